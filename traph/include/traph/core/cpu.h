@@ -0,0 +1,39 @@
+#ifndef TRAPH_CORE_CPU_H_
+#define TRAPH_CORE_CPU_H_
+
+#include <traph/core/type.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TRAPH_ARCH_X86
+#endif
+
+// kernels for wider instruction sets are compiled per function and selected at runtime,
+// so the library itself does not need to be built with -mavx2 / /arch:AVX2
+#if defined(TRAPH_ARCH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TRAPH_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TRAPH_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma")))
+#define TRAPH_TARGET_AVX512_VNNI __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx512vnni,avx2,fma")))
+#else
+#define TRAPH_TARGET_AVX2
+#define TRAPH_TARGET_AVX512
+#define TRAPH_TARGET_AVX512_VNNI
+#endif
+
+namespace traph
+{
+    // instruction set extensions usable by this process (cpu and os support)
+    struct CpuFeatures
+    {
+        bool avx2;
+        bool fma;
+        bool avx512f;
+        bool avx512bw;
+        bool avx512dq;
+        bool avx512vl;
+        bool avx512vnni;
+    };
+
+    const CpuFeatures& cpu_features();
+}
+
+#endif
@@ -29,9 +29,13 @@ namespace traph
 
     public:
         virtual void add_(shared_pointer other) = 0;
+        virtual std::shared_ptr<TensorInterface> bmm(std::shared_ptr<TensorInterface> mat) const = 0;
         virtual shared_pointer clone() const = 0;
         virtual void cos_() = 0;
         virtual std::shared_ptr<TensorBase<f32>> create_grad() = 0;
+        virtual std::shared_ptr<TensorInterface> cummax(idx_type dim) const = 0;
+        virtual std::shared_ptr<TensorInterface> cumprod(idx_type dim) const = 0;
+        virtual std::shared_ptr<TensorInterface> cumsum(idx_type dim) const = 0;
         virtual device_id device() = 0;
         virtual DataType dtype() const = 0;
         virtual bool equal(std::shared_ptr<TensorInterface> other) const = 0;
@@ -81,9 +85,13 @@ namespace traph
     public:
         virtual void add_(TensorInterfacePtr other) = 0;
         virtual void apply_(std::function<T(T)> f) = 0;
+        virtual std::shared_ptr<TensorInterface> bmm(std::shared_ptr<TensorInterface> mat) const = 0;
         virtual TensorInterfacePtr clone() const = 0;
         virtual void cos_() = 0;
         virtual std::shared_ptr<TensorBase<f32>> create_grad() = 0;
+        virtual std::shared_ptr<TensorInterface> cummax(idx_type dim) const = 0;
+        virtual std::shared_ptr<TensorInterface> cumprod(idx_type dim) const = 0;
+        virtual std::shared_ptr<TensorInterface> cumsum(idx_type dim) const = 0;
         virtual T* data_ptr() = 0;
         virtual const T* data_ptr() const = 0;
         virtual device_id device() = 0;
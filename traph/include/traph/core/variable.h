@@ -37,6 +37,8 @@ namespace traph
         virtual void reshape_(const DimVector& dims) = 0;
         virtual void resize_(const DimVector& dims) = 0;
 		virtual DimVector size() const = 0;
+        virtual std::shared_ptr<SparseRows<f32>> sparse_grad() = 0;
+        virtual void sparse_grad_(std::shared_ptr<SparseRows<f32>> g) = 0;
 		virtual DimVector stride() const = 0;
     };
 
@@ -81,6 +83,8 @@ namespace traph
         virtual void reshape_(const DimVector& dims) = 0;
         virtual void resize_(const DimVector& dims) = 0;
 		virtual DimVector size() const = 0;
+        virtual std::shared_ptr<SparseRows<f32>> sparse_grad() = 0;
+        virtual void sparse_grad_(std::shared_ptr<SparseRows<f32>> g) = 0;
         virtual std::shared_ptr<StorageBase<T>> storage() const = 0;
 		virtual DimVector stride() const = 0;
     };
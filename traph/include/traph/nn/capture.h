@@ -0,0 +1,121 @@
+#ifndef TRAPH_NN_CAPTURE_H_
+#define TRAPH_NN_CAPTURE_H_
+
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include <traph/core/variable.h>
+#include <traph/nn/executor.h>
+#include <traph/nn/graph_optimizer.h>
+#include <traph/nn/memory_plan.h>
+#include <traph/nn/operation.h>
+
+namespace traph
+{
+    class Optimizer;
+
+    // one call of a function of function.h, in the order of the calls
+    struct CapturedCall
+    {
+        std::shared_ptr<OpBase> op;
+        std::vector<VariableInterfacePtr> inputs;
+        VariableInterfacePtr result;
+    };
+
+    // Records the function calls of the calling thread for its scope, including the ones
+    // whose result requires no gradient. Captures nest, the innermost one records.
+    class GraphCapture
+    {
+    private:
+        GraphCapture* _previous;
+        std::vector<CapturedCall> _calls;
+    public:
+        GraphCapture();
+        GraphCapture(const GraphCapture&) = delete;
+        GraphCapture& operator= (const GraphCapture&) = delete;
+        ~GraphCapture();
+
+        // the capture of the calling thread or null
+        static GraphCapture* current();
+
+        void record(std::shared_ptr<OpBase> op, std::initializer_list<VariableInterfacePtr> inputs, VariableInterfacePtr result);
+        void record(std::shared_ptr<OpBase> op, const std::vector<VariableInterfacePtr>& inputs, VariableInterfacePtr result);
+
+        std::vector<CapturedCall>& calls() { return _calls; }
+    };
+
+    // A training step of static shapes, recorded once and replayed. The step function makes
+    // the loss of its inputs through the functions of function.h; the first run captures it
+    // with its backward pass and the optimizer step. A later run with inputs of the same
+    // sizes hands their data to the captured input variables and runs the recorded ops
+    // again in place: the variables, the ops, the gradient buffers and the order of the
+    // backward pass are those of the capture, only the kernels make new outputs. Inputs of
+    // other sizes, or that differ in requiring a gradient, capture the step again.
+    // The captured input variables have gradient buffers of their own: they are zeroed
+    // before each backward pass and added to the gradients of the inputs of the run after
+    // it, so inputs that require a gradient accumulate it as in an eager step. Inputs with
+    // sparse gradients are rejected.
+    // The step shall not depend on the values of its inputs; ops replay their captured
+    // settings, except that a dropout draws a new mask for each replay. With a graph
+    // optimizer the recorded calls are rewritten after each capture and run again before
+    // its backward pass.
+    // With memory planning, the default, a replay drops the results of the calls but the
+    // loss and the tensors the ops saved once the backward pass is done with them, so the
+    // storages of a replay are freed within it. The first replay after a capture records
+    // them for a MemoryPlanner and later replays take them from its slabs. Planning needs
+    // the order of the sequential backward pass and is skipped with more backward threads.
+    class CapturedStep
+    {
+    public:
+        using StepFunction = std::function<VariableInterfacePtr(const std::vector<VariableInterfacePtr>&)>;
+    private:
+        StepFunction _step;
+        std::shared_ptr<Optimizer> _optimizer;
+        std::shared_ptr<GraphOptimizer> _graph_optimizer;
+        GraphReport _report;
+        idx_type _captures;
+        // runs since the last capture
+        u64 _replays;
+
+        std::vector<VariableInterfacePtr> _inputs;
+        std::vector<DimVector> _sizes;
+        std::vector<CapturedCall> _calls;
+        // the data of the inputs of each call, filled in again for each replay
+        std::vector<std::vector<TensorInterfacePtr>> _call_data;
+        // the gradients of results, zeroed before each backward pass
+        std::vector<TensorBasePtr<f32>> _result_grads;
+        VariableInterfacePtr _loss;
+        Executor _executor;
+        MemoryPlanner _planner;
+        bool _plan_memory;
+
+        bool same_sizes(const std::vector<VariableInterfacePtr>& inputs) const;
+        void capture(const std::vector<VariableInterfacePtr>& inputs);
+        void forward();
+        void backward(const std::vector<VariableInterfacePtr>& inputs, bool sort);
+        void release();
+    public:
+        // optimizer may be null for a step without an update
+        CapturedStep(StepFunction step, std::shared_ptr<Optimizer> optimizer);
+
+        // one step: zero_grad, forward, backward and the optimizer step; the loss
+        VariableInterfacePtr run(const std::vector<VariableInterfacePtr>& inputs);
+
+        // passes for the calls of later captures, none by default
+        void graph_optimizer_(std::shared_ptr<GraphOptimizer> optimizer) { _graph_optimizer = optimizer; }
+        // of the last capture, empty without a graph optimizer
+        const GraphReport& report() const { return _report; }
+
+        bool plan_memory() const { return _plan_memory; }
+        void plan_memory_(bool enabled);
+        const MemoryPlanner& planner() const { return _planner; }
+
+        // how many times the step was captured
+        idx_type captures() const { return _captures; }
+        const std::vector<CapturedCall>& calls() const { return _calls; }
+    };
+}
+
+#endif
@@ -2,8 +2,6 @@
 #define TRAPH_NN_EXECUTOR_H_
 
 #include <vector>
-#include <list>
-#include <set>
 #include <algorithm>
 #include <iterator>
 #include <cassert>
@@ -12,14 +10,76 @@
 
 namespace traph
 {
+    // Orders the graph behind a variable for the backward pass. Nodes get dense ids in the
+    // order a traversal from the root finds them, through the inputs that require a
+    // gradient, and Kahn's algorithm runs over vectors of those ids, so a sort is linear in
+    // the nodes and edges. The edges of the last graph are kept: a graph of the same
+    // structure, as the one of every iteration of a training loop, reuses its order and
+    // incoming edges. The traversal itself runs for every sort, it is what finds the nodes
+    // of a new graph and compares its edges; replay_backward is the pass without it.
     class Executor
     {
     private:
+        struct BackwardState;
+
+        // the last graph, the inputs of node i are _edges[_offsets[i], _offsets[i + 1])
+        std::vector<idx_type> _offsets;
+        std::vector<idx_type> _edges;
+        std::vector<idx_type> _order;
+        // the edges into node i, by the position of the node they leave in the order and
+        // then by input, which is the order the sequential pass adds their gradients in
+        std::vector<idx_type> _incoming_offsets;
+        std::vector<idx_type> _incoming;
+        bool _cached = false;
+        bool _release_saved = false;
+
+        // buffers of the graph being sorted
+        std::vector<VariableInterface*> _nodes;
+        std::vector<idx_type> _next_offsets;
+        std::vector<idx_type> _next_edges;
+        std::vector<idx_type> _indegrees;
+        std::vector<VariableInterface*> _sorted;
+
+        void backward_sequential();
+        void backward_parallel(int threads);
+        void run_node(idx_type id, BackwardState& state);
     public:
+        // the root first and every node before its inputs
+        const std::vector<VariableInterface*>& sort(VariableInterface* root);
+        // whether the last sort reused the order of the graph before it, after traversing it
+        bool cached() const { return _cached; }
+
+        // Adds the gradients of the graph of root, whose own gradient is set, to the
+        // variables of the graph. With more than one backward thread a node runs as soon as
+        // every node that uses it has, as an OpenMP task, so independent branches run at
+        // the same time and the kernels of each node run on its thread.
+        void backward(VariableInterface* root);
+        // the backward pass of the last sorted graph again, without a sort; its nodes shall
+        // be alive and their inputs unchanged
+        void replay_backward();
+
+        // whether a node drops the tensors its op saved once its backward has run, off by
+        // default; a graph run with it on can not run backward again
+        bool release_saved() const { return _release_saved; }
+        void release_saved_(bool enabled) { _release_saved = enabled; }
+
+        // sort and backward by an executor of the calling thread
         static std::vector<VariableInterface*> topology_sort(VariableInterface* root);
-        static std::set<VariableInterface*> collect_backward_tensors(VariableInterface* root);
+        static void run_backward(VariableInterface* root);
+        // the nodes a traversal from the root finds, in that order
+        static std::vector<VariableInterface*> collect_backward_tensors(VariableInterface* root);
+
+        // threads of the backward pass, 1 for the sequential pass (the default)
+        static int backward_threads();
+        static void backward_threads_(int threads);
+        // With determinism on (the default), a parallel backward pass keeps the gradients
+        // for a node until every user of the node has run and adds them in the order of the
+        // sequential pass, so the results are the same bit for bit. Off, they are added as
+        // they come under a lock of the node.
+        static bool deterministic();
+        static void deterministic_(bool enabled);
     };
 }
 
 
-#endif
\ No newline at end of file
+#endif
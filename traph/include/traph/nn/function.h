@@ -2,35 +2,101 @@
 #define TRAPH_NN_FUNCTION_H_
 
 #include <utility>
+#include <initializer_list>
+#include <memory>
 #include <random>
 #include <cmath>
+#include <string>
+#include <vector>
 
 #include <traph/core/type.h>
 #include <traph/core/index.h>
 #include <traph/core/utils.h>
 #include <traph/core/variable.h>
 #include <traph/nn/variable.h>
+#include <traph/nn/grad_mode.h>
+#include <traph/nn/capture.h>
 #include <traph/core/tensor.h>
 #include <traph/tensor/tensor.h>
 #include <traph/nn/operation.h>
 
 namespace traph
 {
+	// Whether the result of a function of these inputs joins the graph: some input requires
+	// a gradient and no NoGradGuard is active.
+	inline bool needs_grad(std::initializer_list<VariableInterfacePtr> inputs)
+	{
+		if (!GradMode::is_enabled())
+			return false;
+		for (auto& each : inputs)
+			if (each->requires_grad())
+				return true;
+		return false;
+	}
+
+	inline bool needs_grad(const std::vector<VariableInterfacePtr>& inputs)
+	{
+		if (!GradMode::is_enabled())
+			return false;
+		for (auto& each : inputs)
+			if (each->requires_grad())
+				return true;
+		return false;
+	}
+
+	// The op of a function call: shared with the graph when the result requires a gradient
+	// or a GraphCapture records the call, otherwise it lives in the caller's frame and
+	// nothing is allocated for it.
+	template<typename Op>
+	class OpSlot
+	{
+	private:
+		Op _local;
+		Op* _op;
+	public:
+		std::shared_ptr<Op> shared;
+
+		explicit OpSlot(bool requires_grad)
+			:shared(requires_grad || GraphCapture::current() ? std::make_shared<Op>() : nullptr)
+		{
+			_op = shared ? shared.get() : &_local;
+		}
+
+		OpSlot(const OpSlot&) = delete;
+		OpSlot& operator= (const OpSlot&) = delete;
+
+		Op* operator->() { return _op; }
+
+		// the call into the capture of the calling thread, if any
+		void record(std::initializer_list<VariableInterfacePtr> inputs, VariableInterfacePtr result)
+		{
+			if (GraphCapture* capture = GraphCapture::current())
+				capture->record(shared, inputs, result);
+		}
+
+		void record(const std::vector<VariableInterfacePtr>& inputs, VariableInterfacePtr result)
+		{
+			if (GraphCapture* capture = GraphCapture::current())
+				capture->record(shared, inputs, result);
+		}
+	};
 
 #define UNARY_OP(name, op_name)                                                            \
 	VariableInterfacePtr name(VariableInterfacePtr input)                                  \
 	{                                                                                      \
 		DimVector result_dim;                                                              \
-        VariableInterfacePtr result = input->new_empty(result_dim, true);                  \
-		std::shared_ptr<op_name> op(new op_name);                                          \
-		std::vector<VariableInterfacePtr> result_inputs{ input };                          \
+		bool requires_grad = needs_grad({ input });                                        \
+        VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);         \
+		OpSlot<op_name> op(requires_grad);                                                 \
 		result->data_(op->forward({ input->data() }));                                     \
-		if (input->requires_grad())                                                        \
+		op.record({ input }, result);                                                      \
+		if (requires_grad)                                                                 \
 		{                                                                                  \
+			std::vector<VariableInterfacePtr> result_inputs{ input };                      \
 			result->grad_(result->data()->create_grad());                                  \
 			result->grad()->fill_(0);                                                      \
 			result->requires_grad_(true);                                                  \
-			result->grad_fn_(op);                                                          \
+			result->grad_fn_(op.shared);                                                   \
 			result->inputs_(result_inputs);                                                \
 		}                                                                                  \
 		else                                                                               \
@@ -44,16 +110,44 @@ namespace traph
 	VariableInterfacePtr name(VariableInterfacePtr left, VariableInterfacePtr right)       \
 	{                                                                                      \
 		DimVector result_dim;                                                              \
-        VariableInterfacePtr result = left->new_empty(result_dim, true);                   \
-		std::shared_ptr<op_name> op(new op_name);                                          \
+		bool requires_grad = needs_grad({ left, right });                                  \
+        VariableInterfacePtr result = left->new_empty(result_dim, requires_grad);          \
+		OpSlot<op_name> op(requires_grad);                                                 \
 		result->data_(op->forward({ left->data(), right->data() }));                       \
-		if (left->requires_grad() || right->requires_grad())                               \
+		op.record({ left, right }, result);                                                \
+		if (requires_grad)                                                                 \
 		{                                                                                  \
 			std::vector<VariableInterfacePtr> result_inputs{ left, right };                \
 			result->grad_(result->data()->create_grad());                                  \
 			result->grad()->fill_(0);                                                      \
 			result->requires_grad_(true);                                                  \
-			result->grad_fn_(op);                                                          \
+			result->grad_fn_(op.shared);                                                   \
+			result->inputs_(result_inputs);                                                \
+		}                                                                                  \
+		else                                                                               \
+		{                                                                                  \
+			result->requires_grad_(false);                                                 \
+		}                                                                                  \
+		return result;                                                                     \
+	}
+
+#define UNARY_DIM_OP(name, op_name)                                                        \
+	VariableInterfacePtr name(VariableInterfacePtr input, idx_type dim)                    \
+	{                                                                                      \
+		DimVector result_dim;                                                              \
+		bool requires_grad = needs_grad({ input });                                        \
+        VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);         \
+		OpSlot<op_name> op(requires_grad);                                                 \
+		op->set_dim(dim);                                                                  \
+		result->data_(op->forward({ input->data() }));                                     \
+		op.record({ input }, result);                                                      \
+		if (requires_grad)                                                                 \
+		{                                                                                  \
+			std::vector<VariableInterfacePtr> result_inputs{ input };                      \
+			result->grad_(result->data()->create_grad());                                  \
+			result->grad()->fill_(0);                                                      \
+			result->requires_grad_(true);                                                  \
+			result->grad_fn_(op.shared);                                                   \
 			result->inputs_(result_inputs);                                                \
 		}                                                                                  \
 		else                                                                               \
@@ -148,23 +242,322 @@ namespace traph
 
 	BINARY_OP(add, AddOp)
 
+	// average pooling of an [N, C, H, W] input to [N, C, out_h, out_w]
+	VariableInterfacePtr adaptive_avg_pool2d(VariableInterfacePtr input, idx_type out_h, idx_type out_w)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ input });
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<AdaptiveAvgPool2dOp> op(requires_grad);
+		op->set_output_size(out_h, out_w);
+		std::vector<VariableInterfacePtr> result_inputs{ input };
+		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	VariableInterfacePtr avg_pool2d(VariableInterfacePtr input, const Pool2dParams& params)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ input });
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<AvgPool2dOp> op(requires_grad);
+		op->set_params(params);
+		std::vector<VariableInterfacePtr> result_inputs{ input };
+		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	BINARY_OP(bmm, BmmOp)
+
+	// [N, C, H, W] input, [O, C / groups, KH, KW] weight, bias [O] may be null
+	VariableInterfacePtr conv2d(VariableInterfacePtr input, VariableInterfacePtr weight, VariableInterfacePtr bias, const Conv2dParams& params)
+	{
+		DimVector result_dim;
+		std::vector<VariableInterfacePtr> result_inputs{ input, weight };
+		std::vector<TensorInterfacePtr> op_inputs{ input->data(), weight->data() };
+		if (bias)
+		{
+			result_inputs.push_back(bias);
+			op_inputs.push_back(bias->data());
+		}
+		bool requires_grad = needs_grad(result_inputs);
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<Conv2dOp> op(requires_grad);
+		op->set_params(params);
+		result->data_(op->forward(op_inputs));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	UNARY_DIM_OP(cummax, CummaxOp)
+
+	UNARY_DIM_OP(cumprod, CumprodOp)
+
+	UNARY_DIM_OP(cumsum, CumsumOp)
+
+	// Zeroes each element with probability p and scales the others by 1 / (1 - p); the same
+	// seed drops the same elements. The backward pass keeps one bit per element.
+	VariableInterfacePtr dropout(VariableInterfacePtr input, double p, u64 seed)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ input });
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<DropoutOp> op(requires_grad);
+		op->set_p(p);
+		op->set_seed(seed);
+		op->set_requires_grad(requires_grad);
+		std::vector<VariableInterfacePtr> result_inputs{ input };
+		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	// contraction of the inputs by the equation, see einsum_impl
+	VariableInterfacePtr einsum(const EinsumEquation& equation, const std::vector<VariableInterfacePtr>& inputs)
+	{
+		DimVector result_dim;
+		std::vector<TensorInterfacePtr> op_inputs;
+		for (auto& each : inputs)
+			op_inputs.push_back(each->data());
+		bool requires_grad = needs_grad(inputs);
+		VariableInterfacePtr result = inputs.at(0)->new_empty(result_dim, requires_grad);
+		OpSlot<EinsumOp> op(requires_grad);
+		op->set_equation(equation);
+		result->data_(op->forward(op_inputs));
+		op.record(inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	// einsum("ij,jk->ik", { a, b })
+	VariableInterfacePtr einsum(const std::string& spec, const std::vector<VariableInterfacePtr>& inputs)
+	{
+		return einsum(parse_einsum(spec), inputs);
+	}
+
+	// rows of weight at the i64 input; with sparse, weight gets the gradient of the rows read
+	// only, see Variable::sparse_grad_
+	VariableInterfacePtr embedding(VariableInterfacePtr input, VariableInterfacePtr weight, bool sparse = false)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ weight });
+		VariableInterfacePtr result = weight->new_empty(result_dim, requires_grad);
+		OpSlot<EmbeddingOp> op(requires_grad);
+		op->set_sparse(sparse);
+		std::vector<VariableInterfacePtr> result_inputs{ weight, input };
+		result->data_(op->forward({ weight->data(), input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	// sums or means of bags of rows of weight, see embedding_bag_impl; offsets may be null
+	VariableInterfacePtr embedding_bag(VariableInterfacePtr input, VariableInterfacePtr weight, VariableInterfacePtr offsets,
+		EmbeddingBagMode mode = EmbeddingBagMode::MEAN, bool sparse = false)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ weight });
+		VariableInterfacePtr result = weight->new_empty(result_dim, requires_grad);
+		OpSlot<EmbeddingBagOp> op(requires_grad);
+		op->set_mode(mode);
+		op->set_sparse(sparse);
+		std::vector<VariableInterfacePtr> result_inputs{ weight, input };
+		std::vector<TensorInterfacePtr> op_inputs{ weight->data(), input->data() };
+		if (offsets)
+		{
+			result_inputs.push_back(offsets);
+			op_inputs.push_back(offsets->data());
+		}
+		result->data_(op->forward(op_inputs));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	VariableInterfacePtr gelu(VariableInterfacePtr input)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ input });
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<GeluOp> op(requires_grad);
+		op->set_requires_grad(requires_grad);
+		std::vector<VariableInterfacePtr> result_inputs{ input };
+		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	// y = input * weight^T + bias, bias may be null
+	VariableInterfacePtr linear(VariableInterfacePtr input, VariableInterfacePtr weight, VariableInterfacePtr bias)
+	{
+		DimVector result_dim;
+		std::vector<VariableInterfacePtr> result_inputs{ input, weight };
+		std::vector<TensorInterfacePtr> op_inputs{ input->data(), weight->data() };
+		if (bias)
+		{
+			result_inputs.push_back(bias);
+			op_inputs.push_back(bias->data());
+		}
+		bool requires_grad = needs_grad(result_inputs);
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<LinearOp> op(requires_grad);
+		result->data_(op->forward(op_inputs));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
 	BINARY_OP(matmul, MatmulOp)
 
+	VariableInterfacePtr max_pool2d(VariableInterfacePtr input, const Pool2dParams& params)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ input });
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<MaxPool2dOp> op(requires_grad);
+		op->set_params(params);
+		op->set_requires_grad(requires_grad);
+		std::vector<VariableInterfacePtr> result_inputs{ input };
+		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
 	UNARY_OP(mean, MeanOp)
 
 	VariableInterfacePtr pow(VariableInterfacePtr input, float exp)
 	{
 		DimVector result_dim;
-        VariableInterfacePtr result = input->new_empty(result_dim, true);
-		std::shared_ptr<PowOp> op(new PowOp);
+		bool requires_grad = needs_grad({ input });
+        VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<PowOp> op(requires_grad);
 		op->set_exp(exp);
 		result->data_(op->forward({ input->data() }));
-		if (input->requires_grad())
+		op.record({ input }, result);
+		if (requires_grad)
 		{
 			result->grad_(result->data()->create_grad());
 			result->grad()->fill_(0);
 			result->requires_grad_(true);
-			result->grad_fn_(op);
+			result->grad_fn_(op.shared);
 			result->inputs_({ input });
 		}
 		else
@@ -174,23 +567,183 @@ namespace traph
 		return result;
 	}
 
+	// max(x, 0), the backward pass keeps one bit per element instead of the input
+	VariableInterfacePtr relu(VariableInterfacePtr input)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ input });
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<ReluOp> op(requires_grad);
+		op->set_requires_grad(requires_grad);
+		std::vector<VariableInterfacePtr> result_inputs{ input };
+		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	// One recurrent layer over a [T, B, I] input as a single node, see rnn_forward_impl. The
+	// biases and the initial states may be null; c0 and c_n are LSTM only. The states after
+	// the last step are written to h_n and c_n when given, they have no gradient, see
+	// rnn_state for ones that have. node is given the op when there is one, with a gradient
+	// or in a capture, whose states are those of its latest forward, also of a replay.
+	VariableInterfacePtr rnn(RnnMode mode, VariableInterfacePtr input, VariableInterfacePtr w_ih, VariableInterfacePtr w_hh,
+		VariableInterfacePtr b_ih, VariableInterfacePtr b_hh, VariableInterfacePtr h0, VariableInterfacePtr c0,
+		TensorInterfacePtr* h_n = nullptr, TensorInterfacePtr* c_n = nullptr, std::shared_ptr<RnnOp>* node = nullptr)
+	{
+		if ((b_ih == nullptr) != (b_hh == nullptr))
+			throw std::runtime_error("rnn: Both biases or none shall be given.");
+		DimVector result_dim;
+		std::vector<VariableInterfacePtr> result_inputs{ input, w_ih, w_hh };
+		for (auto& each : { b_ih, b_hh, h0, c0 })
+		{
+			if (each)
+				result_inputs.push_back(each);
+		}
+		std::vector<TensorInterfacePtr> op_inputs;
+		for (auto& each : result_inputs)
+			op_inputs.push_back(each->data());
+		bool requires_grad = needs_grad(result_inputs);
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<RnnOp> op(requires_grad);
+		op->set_mode(mode);
+		op->set_inputs(b_ih != nullptr, h0 != nullptr, c0 != nullptr);
+		result->data_(op->forward(op_inputs));
+		op.record(result_inputs, result);
+		if (h_n)
+			*h_n = op->h_n();
+		if (c_n)
+			*c_n = op->c_n();
+		if (node)
+			*node = op.shared;
+
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	// The [B, H] state after the last step of a layer, c_n with cell and h_n otherwise, as a
+	// variable whose gradient goes into the backward pass of the layer. output is the result
+	// of rnn and node the op it gave.
+	VariableInterfacePtr rnn_state(VariableInterfacePtr output, std::shared_ptr<RnnOp> node, bool cell)
+	{
+		if (!node)
+			throw std::runtime_error("rnn_state: The layer shall have an op.");
+		if (cell && node->mode() != RnnMode::LSTM)
+			throw std::runtime_error("rnn_state: Only LSTM layers have a cell state.");
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ output });
+		VariableInterfacePtr result = output->new_empty(result_dim, requires_grad);
+		OpSlot<RnnStateOp> op(requires_grad);
+		op->set_state(node, cell);
+		result->data_(op->forward({ output->data() }));
+		op.record({ output }, result);
+
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_({ output });
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
+	// one GRU layer, see rnn
+	VariableInterfacePtr gru(VariableInterfacePtr input, VariableInterfacePtr w_ih, VariableInterfacePtr w_hh,
+		VariableInterfacePtr b_ih, VariableInterfacePtr b_hh, VariableInterfacePtr h0, TensorInterfacePtr* h_n = nullptr)
+	{
+		return rnn(RnnMode::GRU, input, w_ih, w_hh, b_ih, b_hh, h0, nullptr, h_n, nullptr);
+	}
+
+	// one LSTM layer, see rnn
+	VariableInterfacePtr lstm(VariableInterfacePtr input, VariableInterfacePtr w_ih, VariableInterfacePtr w_hh,
+		VariableInterfacePtr b_ih, VariableInterfacePtr b_hh, VariableInterfacePtr h0, VariableInterfacePtr c0,
+		TensorInterfacePtr* h_n = nullptr, TensorInterfacePtr* c_n = nullptr)
+	{
+		return rnn(RnnMode::LSTM, input, w_ih, w_hh, b_ih, b_hh, h0, c0, h_n, c_n);
+	}
+
+	// softmax(q k^T * scale) v over [B, H, L, D] inputs without the [Lq, Lk] scores, see
+	// scaled_dot_product_attention_impl; key_padding_mask is a [B, Lk] u8 variable or null
+	VariableInterfacePtr scaled_dot_product_attention(VariableInterfacePtr q, VariableInterfacePtr k, VariableInterfacePtr v,
+		VariableInterfacePtr key_padding_mask = nullptr, const AttentionParams& params = AttentionParams())
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ q, k, v });
+		VariableInterfacePtr result = q->new_empty(result_dim, requires_grad);
+		OpSlot<ScaledDotProductAttentionOp> op(requires_grad);
+		op->set_params(params);
+		op->set_requires_grad(requires_grad);
+		std::vector<VariableInterfacePtr> result_inputs{ q, k, v };
+		std::vector<TensorInterfacePtr> op_inputs{ q->data(), k->data(), v->data() };
+		if (key_padding_mask)
+		{
+			result_inputs.push_back(key_padding_mask);
+			op_inputs.push_back(key_padding_mask->data());
+		}
+		result->data_(op->forward(op_inputs));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
 	VariableInterfacePtr select(VariableInterfacePtr input, const SliceVector& slice)
 	{
 		DimVector result_dim;
 
-        VariableInterfacePtr result = input->new_empty(result_dim, true);
-		std::shared_ptr<SelectOp> op(new SelectOp);
+		bool requires_grad = needs_grad({ input });
+        VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<SelectOp> op(requires_grad);
 		op->set_slice(slice);
 
 		std::vector<VariableInterfacePtr> result_inputs{ input };
 		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
 
-		if (input->requires_grad())
+		if (requires_grad)
 		{
 			result->grad_(result->data()->create_grad());
 			result->grad()->fill_(0);
 			result->requires_grad_(true);
-			result->grad_fn_(op);
+			result->grad_fn_(op.shared);
 			result->inputs_(result_inputs);
 		}
 		else
@@ -201,27 +754,61 @@ namespace traph
 		return result;
 	}
 
+	VariableInterfacePtr sigmoid(VariableInterfacePtr input)
+	{
+		DimVector result_dim;
+		bool requires_grad = needs_grad({ input });
+		VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<SigmoidOp> op(requires_grad);
+		op->set_requires_grad(requires_grad);
+		std::vector<VariableInterfacePtr> result_inputs{ input };
+		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
+		if (requires_grad)
+		{
+			result->grad_(result->data()->create_grad());
+			result->grad()->fill_(0);
+			result->requires_grad_(true);
+			result->grad_fn_(op.shared);
+			result->inputs_(result_inputs);
+		}
+		else
+		{
+			result->requires_grad_(false);
+		}
+		return result;
+	}
+
 	UNARY_OP(sin, SinOp)
 
 	BINARY_OP(sub, SubOp)
 
+	// contracts dims_a of left with dims_b of right, see tensordot_impl
+	VariableInterfacePtr tensordot(VariableInterfacePtr left, VariableInterfacePtr right,
+		const std::vector<idx_type>& dims_a, const std::vector<idx_type>& dims_b)
+	{
+		return einsum(tensordot_equation(left->data()->ndimension(), right->data()->ndimension(), dims_a, dims_b), { left, right });
+	}
+
 	VariableInterfacePtr transpose(VariableInterfacePtr input, idx_type dim0, idx_type dim1)
 	{
 		DimVector result_dim;
 
-        VariableInterfacePtr result = input->new_empty(result_dim, true);
-		std::shared_ptr<TransposeOp> op(new TransposeOp);
+		bool requires_grad = needs_grad({ input });
+        VariableInterfacePtr result = input->new_empty(result_dim, requires_grad);
+		OpSlot<TransposeOp> op(requires_grad);
 		op->set_dim(dim0, dim1);
 
 		std::vector<VariableInterfacePtr> result_inputs{ input };
 		result->data_(op->forward({ input->data() }));
+		op.record(result_inputs, result);
 
-		if (input->requires_grad())
+		if (requires_grad)
 		{
 			result->grad_(result->data()->create_grad());
 			result->grad()->fill_(0);
 			result->requires_grad_(true);
-			result->grad_fn_(op);
+			result->grad_fn_(op.shared);
 			result->inputs_(result_inputs);
 		}
 		else
@@ -0,0 +1,43 @@
+#ifndef TRAPH_NN_GRAD_MODE_H_
+#define TRAPH_NN_GRAD_MODE_H_
+
+namespace traph
+{
+    // Whether the functions of the calling thread build the graph: with it off, a result
+    // does not require a gradient, its op is not kept and saves no tensor.
+    class GradMode
+    {
+    public:
+        static bool is_enabled();
+        static void set_enabled(bool enabled);
+    };
+
+    // Turns the graph off on this thread for its scope, as torch.no_grad.
+    class NoGradGuard
+    {
+    private:
+        bool _previous;
+    public:
+        NoGradGuard()
+            :_previous(GradMode::is_enabled())
+        {
+            GradMode::set_enabled(false);
+        }
+
+        NoGradGuard(const NoGradGuard&) = delete;
+        NoGradGuard& operator= (const NoGradGuard&) = delete;
+
+        ~NoGradGuard()
+        {
+            GradMode::set_enabled(_previous);
+        }
+    };
+
+    // The guard of inference and serving code; the functions take the same path as under
+    // NoGradGuard, which already skips everything kept for a backward pass.
+    class InferenceMode: public NoGradGuard
+    {
+    };
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef TRAPH_NN_GRAPH_OPTIMIZER_H_
+#define TRAPH_NN_GRAPH_OPTIMIZER_H_
+
+#include <string>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/core/variable.h>
+
+namespace traph
+{
+    struct CapturedCall;
+
+    struct GraphStats
+    {
+        idx_type nodes = 0;
+        // the bytes the calls read and write, a product a fused matmul keeps included
+        i64 bytes = 0;
+    };
+
+    // what GraphOptimizer::run did, the number of calls each pass removed
+    struct GraphReport
+    {
+        GraphStats before;
+        GraphStats after;
+        idx_type folded = 0;
+        idx_type common = 0;
+        idx_type dead = 0;
+        // calls merged into a matmul and into elementwise chains
+        idx_type fused_matmul = 0;
+        idx_type fused_elementwise = 0;
+        // gradients of matmul inputs that are no longer computed
+        idx_type pruned_grads = 0;
+
+        std::string str() const;
+    };
+
+    // Passes over the calls a GraphCapture recorded, run in this order:
+    // - constant folding, off by default: a call of constants only is removed and its
+    //   result, which keeps the value of the capture, is a constant too. Constants are the
+    //   variables that no call makes, that are not inputs and that require no gradient, so
+    //   a mask or a buffer given new data between steps would keep its captured value.
+    // - common subexpressions: a call of the op and the inputs of an earlier one is removed
+    //   and its result replaced by the earlier result, for ops whose result depends on
+    //   their inputs only.
+    // - dead calls: calls no output depends on are removed.
+    // - matmul fusion: a matmul and the elementwise calls that only read its result, such
+    //   as the add of a bias and an activation, become one FusedMatmulOp. Any matmul with
+    //   an input that requires no gradient becomes one too, which skips that gradient.
+    // - elementwise fusion: chains of two or more elementwise calls, each the only reader
+    //   of the result before it, become one FusedElementwiseOp.
+    // A replaced result is replaced in the calls that read it and in the inputs of their
+    // backward pass, so the rewritten graph runs forward and backward as before.
+    class GraphOptimizer
+    {
+    public:
+        bool fold_constants = false;
+        bool eliminate_common = true;
+        bool eliminate_dead = true;
+        bool fuse_matmul = true;
+        bool fuse_elementwise = true;
+
+        // rewrites calls, which read inputs and make outputs; an output may be replaced
+        GraphReport run(std::vector<CapturedCall>& calls, const std::vector<VariableInterfacePtr>& inputs,
+            std::vector<VariableInterfacePtr>& outputs) const;
+
+        static GraphStats stats(const std::vector<CapturedCall>& calls);
+
+        // whether run writes its report to std::clog, false by default
+        static bool debug();
+        static void debug_(bool enabled);
+    };
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef TRAPH_NN_LAYERS_ACTIVATION
+#define TRAPH_NN_LAYERS_ACTIVATION
+
+
+#include <traph/nn/module.h>
+
+namespace traph
+{
+    // keeps one bit per element for the backward pass
+    class ReLU: public Module
+    {
+    public:
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return relu(input);
+        }
+    };
+
+    class GELU: public Module
+    {
+    public:
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return gelu(input);
+        }
+    };
+
+    class Sigmoid: public Module
+    {
+    public:
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return sigmoid(input);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef TRAPH_NN_LAYERS_CONV
+#define TRAPH_NN_LAYERS_CONV
+
+
+#include <traph/nn/module.h>
+#include <traph/tensor/conv.h>
+
+namespace traph
+{
+    class Conv2d: public Module
+    {
+    private:
+        int _in_channels;
+        int _out_channels;
+        int _kernel_size;
+        Conv2dParams _params;
+        std::shared_ptr<VariableInterface> _weight;
+        std::shared_ptr<VariableInterface> _bias;
+    public:
+        Conv2d(int in_channels, int out_channels, int kernel_size,
+            int stride = 1, int padding = 0, int dilation = 1, int groups = 1, bool bias = true)
+        {
+            if(groups < 1 || in_channels % groups != 0 || out_channels % groups != 0)
+                throw std::runtime_error("Conv2d: Channels shall be divisible by groups.");
+            _in_channels = in_channels;
+            _out_channels = out_channels;
+            _kernel_size = kernel_size;
+            _params.stride_h = _params.stride_w = stride;
+            _params.padding_h = _params.padding_w = padding;
+            _params.dilation_h = _params.dilation_w = dilation;
+            _params.groups = groups;
+            _weight = ones<f32>({out_channels, in_channels / groups, kernel_size, kernel_size}, true);
+            if(bias)
+                _bias = ones<f32>({out_channels}, true);
+
+            register_parameter("weight", _weight);
+            register_parameter("bias", _bias);
+        }
+
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return conv2d(input, _weight, _bias, _params);
+        }
+
+        int in_channels() const { return _in_channels; }
+        int out_channels() const { return _out_channels; }
+        int kernel_size() const { return _kernel_size; }
+        const Conv2dParams& params() const { return _params; }
+        std::shared_ptr<VariableInterface> weight() const { return _weight; }
+        std::shared_ptr<VariableInterface> bias() const { return _bias; }
+    };
+}
+
+#endif // TRAPH_NN_LAYERS_CONV
@@ -0,0 +1,43 @@
+#ifndef TRAPH_NN_LAYERS_DROPOUT
+#define TRAPH_NN_LAYERS_DROPOUT
+
+#include <random>
+#include <stdexcept>
+
+#include <traph/nn/module.h>
+
+namespace traph
+{
+    // Zeroes each element with probability p while training, with a new seed per call drawn
+    // from a generator of its own; the identity in evaluation. The backward pass keeps one
+    // bit per element.
+    class Dropout: public Module
+    {
+    private:
+        double _p;
+        bool _training;
+        std::mt19937_64 _generator;
+    public:
+        Dropout(double p = 0.5)
+            :_p(p), _training(true), _generator(std::random_device()())
+        {
+            if(!(p >= 0 && p <= 1))
+                throw std::runtime_error("Dropout: The probability shall be in [0, 1].");
+        }
+
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            if(!_training || _p == 0)
+                return input;
+            return dropout(input, _p, _generator());
+        }
+
+        // the same masks again from the same seed
+        void seed_(u64 seed) { _generator.seed(seed); }
+        void train_(bool training = true) { _training = training; }
+        bool training() const { return _training; }
+        double p() const { return _p; }
+    };
+}
+
+#endif
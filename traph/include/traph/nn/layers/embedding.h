@@ -0,0 +1,91 @@
+#ifndef TRAPH_NN_LAYERS_EMBEDDING
+#define TRAPH_NN_LAYERS_EMBEDDING
+
+
+#include <traph/nn/module.h>
+#include <traph/tensor/embedding.h>
+
+namespace traph
+{
+    // weight of a table, with a gradient of the rows read only when sparse
+    inline std::shared_ptr<VariableInterface> embedding_weight(const char* name, int num_embeddings, int embedding_dim, bool sparse)
+    {
+        if(num_embeddings < 1 || embedding_dim < 1)
+            throw std::runtime_error(std::string(name) + ": The size of the table shall be positive.");
+        std::shared_ptr<VariableInterface> weight = randn<f32>({num_embeddings, embedding_dim}, !sparse);
+        if(sparse)
+            weight->sparse_grad_(std::make_shared<SparseRows<f32>>(num_embeddings, embedding_dim));
+        return weight;
+    }
+
+    class Embedding: public Module
+    {
+    private:
+        int _num_embeddings;
+        int _embedding_dim;
+        bool _sparse;
+        std::shared_ptr<VariableInterface> _weight;
+    public:
+        Embedding(int num_embeddings, int embedding_dim, bool sparse = false)
+        {
+            _num_embeddings = num_embeddings;
+            _embedding_dim = embedding_dim;
+            _sparse = sparse;
+            _weight = embedding_weight("Embedding", num_embeddings, embedding_dim, sparse);
+
+            register_parameter("weight", _weight);
+        }
+
+        // i64 indices of any shape
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return embedding(input, _weight, _sparse);
+        }
+
+        int num_embeddings() const { return _num_embeddings; }
+        int embedding_dim() const { return _embedding_dim; }
+        bool sparse() const { return _sparse; }
+        std::shared_ptr<VariableInterface> weight() const { return _weight; }
+    };
+
+    class EmbeddingBag: public Module
+    {
+    private:
+        int _num_embeddings;
+        int _embedding_dim;
+        EmbeddingBagMode _mode;
+        bool _sparse;
+        std::shared_ptr<VariableInterface> _weight;
+    public:
+        EmbeddingBag(int num_embeddings, int embedding_dim, EmbeddingBagMode mode = EmbeddingBagMode::MEAN, bool sparse = false)
+        {
+            _num_embeddings = num_embeddings;
+            _embedding_dim = embedding_dim;
+            _mode = mode;
+            _sparse = sparse;
+            _weight = embedding_weight("EmbeddingBag", num_embeddings, embedding_dim, sparse);
+
+            register_parameter("weight", _weight);
+        }
+
+        // [bags, length] i64 indices
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return embedding_bag(input, _weight, nullptr, _mode, _sparse);
+        }
+
+        // 1-D i64 indices and the 1-D offsets where bags start
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input, std::shared_ptr<VariableInterface> offsets)
+        {
+            return embedding_bag(input, _weight, offsets, _mode, _sparse);
+        }
+
+        int num_embeddings() const { return _num_embeddings; }
+        int embedding_dim() const { return _embedding_dim; }
+        EmbeddingBagMode mode() const { return _mode; }
+        bool sparse() const { return _sparse; }
+        std::shared_ptr<VariableInterface> weight() const { return _weight; }
+    };
+}
+
+#endif // TRAPH_NN_LAYERS_EMBEDDING
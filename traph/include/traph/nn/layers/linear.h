@@ -3,6 +3,7 @@
 
 
 #include <traph/nn/module.h>
+#include <traph/nn/quantization.h>
 
 namespace traph
 {
@@ -13,6 +14,11 @@ namespace traph
         int _out_features;
         std::shared_ptr<VariableInterface> _weight;
         std::shared_ptr<VariableInterface> _bias;
+        // set during calibration for post-training quantisation
+        std::shared_ptr<MinMaxObserver> _input_observer;
+        std::shared_ptr<MinMaxObserver> _output_observer;
+        // set by convert, forward then runs in int8
+        std::shared_ptr<QuantizedModule> _quantized;
     public:
         Linear(int in_features, int out_features, bool bias)
         {
@@ -28,14 +34,46 @@ namespace traph
 
         std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
         {
-            std::shared_ptr<VariableInterface> result;
-            if(_bias)
-                result = add(matmul(input, transpose(_weight, 0, 1)), _bias);
-            else
-                result = matmul(input, transpose(_weight, 0, 1));
+            if(_quantized)
+                return _quantized->forward(input);
+
+            std::shared_ptr<VariableInterface> result = linear(input, _weight, _bias);
+
+            if(_input_observer)
+            {
+                _input_observer->observe(*std::dynamic_pointer_cast<TensorBase<f32>>(input->data()));
+                _output_observer->observe(*std::dynamic_pointer_cast<TensorBase<f32>>(result->data()));
+            }
             
             return result;
         }
+
+        int in_features() const { return _in_features; }
+        int out_features() const { return _out_features; }
+        std::shared_ptr<VariableInterface> weight() const { return _weight; }
+        std::shared_ptr<VariableInterface> bias() const { return _bias; }
+
+        // starts recording input and output ranges in forward, see quantize
+        void observe_(bool enable, f32 averaging_constant = 0.f)
+        {
+            if(enable)
+            {
+                _input_observer = std::make_shared<MinMaxObserver>(averaging_constant);
+                _output_observer = std::make_shared<MinMaxObserver>(averaging_constant);
+            }
+            else
+            {
+                _input_observer = nullptr;
+                _output_observer = nullptr;
+            }
+        }
+
+        std::shared_ptr<MinMaxObserver> input_observer() const { return _input_observer; }
+        std::shared_ptr<MinMaxObserver> output_observer() const { return _output_observer; }
+
+        // the int8 layer forward runs through, nullptr to go back to f32
+        void quantized_(std::shared_ptr<QuantizedModule> quantized) { _quantized = quantized; }
+        std::shared_ptr<QuantizedModule> quantized() const { return _quantized; }
     };
 }
 
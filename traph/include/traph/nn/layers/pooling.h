@@ -0,0 +1,88 @@
+#ifndef TRAPH_NN_LAYERS_POOLING
+#define TRAPH_NN_LAYERS_POOLING
+
+
+#include <traph/nn/module.h>
+#include <traph/tensor/pooling.h>
+
+namespace traph
+{
+    // a stride of 0 is the kernel size
+    inline Pool2dParams pool2d_params(int kernel_size, int stride, int padding)
+    {
+        if(kernel_size < 1 || stride < 0)
+            throw std::runtime_error("Pool2d: Kernel size shall be positive and stride not negative.");
+        Pool2dParams params;
+        params.kernel_h = params.kernel_w = kernel_size;
+        params.stride_h = params.stride_w = stride == 0 ? kernel_size : stride;
+        params.padding_h = params.padding_w = padding;
+        return params;
+    }
+
+    class MaxPool2d: public Module
+    {
+    private:
+        Pool2dParams _params;
+    public:
+        MaxPool2d(int kernel_size, int stride = 0, int padding = 0)
+        {
+            _params = pool2d_params(kernel_size, stride, padding);
+        }
+
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return max_pool2d(input, _params);
+        }
+
+        const Pool2dParams& params() const { return _params; }
+    };
+
+    class AvgPool2d: public Module
+    {
+    private:
+        Pool2dParams _params;
+    public:
+        AvgPool2d(int kernel_size, int stride = 0, int padding = 0, bool count_include_pad = true)
+        {
+            _params = pool2d_params(kernel_size, stride, padding);
+            _params.count_include_pad = count_include_pad;
+        }
+
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return avg_pool2d(input, _params);
+        }
+
+        const Pool2dParams& params() const { return _params; }
+    };
+
+    class AdaptiveAvgPool2d: public Module
+    {
+    private:
+        int _out_h;
+        int _out_w;
+    public:
+        AdaptiveAvgPool2d(int out_h, int out_w)
+        {
+            if(out_h < 1 || out_w < 1)
+                throw std::runtime_error("AdaptiveAvgPool2d: The output size shall be positive.");
+            _out_h = out_h;
+            _out_w = out_w;
+        }
+
+        explicit AdaptiveAvgPool2d(int output_size)
+            :AdaptiveAvgPool2d(output_size, output_size)
+        {
+        }
+
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input)
+        {
+            return adaptive_avg_pool2d(input, _out_h, _out_w);
+        }
+
+        int out_h() const { return _out_h; }
+        int out_w() const { return _out_w; }
+    };
+}
+
+#endif // TRAPH_NN_LAYERS_POOLING
@@ -0,0 +1,129 @@
+#ifndef TRAPH_NN_LAYERS_QUANTIZED_LINEAR
+#define TRAPH_NN_LAYERS_QUANTIZED_LINEAR
+
+#include <stdexcept>
+#include <vector>
+
+#include <traph/tensor/qgemm.h>
+#include <traph/nn/module.h>
+#include <traph/nn/quantization.h>
+#include <traph/nn/layers/linear.h>
+
+namespace traph
+{
+    // Inference-only Linear with int8 weights quantised per output channel and u8
+    // activations. forward takes and returns f32 (quantising the input and dequantising the
+    // i32 accumulator with the bias), forward_quantized keeps the activations in u8 with the
+    // bias and requantisation to the output parameters fused into the gemm epilogue, so
+    // consecutive quantised layers run without going through f32.
+    class QuantizedLinear: public Module, public QuantizedModule
+    {
+    private:
+        int _in_features;
+        int _out_features;
+        std::shared_ptr<Tensor<i8>> _weight;
+        std::vector<f32> _weight_scale;
+        std::vector<f32> _bias;
+        QuantParams _input_qparams;
+        QuantParams _output_qparams;
+        // x_scale * w_scale, and the same divided by y_scale with the bias in accumulator units
+        std::vector<f32> _acc_scale;
+        std::vector<f32> _requantize_scale;
+        std::vector<i32> _requantize_bias;
+    public:
+        QuantizedLinear(const Linear& linear, QuantParams input_qparams, QuantParams output_qparams)
+            :_in_features(linear.in_features()), _out_features(linear.out_features()),
+            _input_qparams(input_qparams), _output_qparams(output_qparams)
+        {
+            auto weight = std::dynamic_pointer_cast<Tensor<f32>>(linear.weight()->data());
+            _weight = quantize_per_channel_impl(*weight, _weight_scale);
+
+            if(linear.bias())
+            {
+                auto bias = std::dynamic_pointer_cast<Tensor<f32>>(linear.bias()->data());
+                for(idx_type j = 0; j < _out_features; ++j)
+                    _bias.push_back(bias->data_ptr()[bias->offset() + j * bias->stride(0)]);
+            }
+
+            for(idx_type j = 0; j < _out_features; ++j)
+            {
+                f32 acc_scale = _input_qparams.scale * _weight_scale[j];
+                _acc_scale.push_back(acc_scale);
+                _requantize_scale.push_back(acc_scale / _output_qparams.scale);
+                if(!_bias.empty())
+                    _requantize_bias.push_back(static_cast<i32>(std::nearbyint(_bias[j] / acc_scale)));
+            }
+        }
+
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input) override
+        {
+            auto input_data = std::dynamic_pointer_cast<Tensor<f32>>(input->data());
+            if(!input_data)
+                throw std::runtime_error("QuantizedLinear: The input shall be a f32 tensor.");
+            auto q = quantize_impl(*input_data, _input_qparams.scale, _input_qparams.zero_point);
+            auto result = qlinear_dequantize_impl(*q, _input_qparams.zero_point, *_weight, _bias, _acc_scale);
+            return std::shared_ptr<VariableInterface>(new Variable<f32>(std::shared_ptr<TensorBase<f32>>(result)));
+        }
+
+        // input quantised with input_qparams, output with output_qparams
+        std::shared_ptr<Tensor<u8>> forward_quantized(const Tensor<u8>& input)
+        {
+            return qlinear_impl(input, _input_qparams.zero_point, *_weight, _requantize_bias,
+                _requantize_scale, _output_qparams.zero_point);
+        }
+
+        int in_features() const { return _in_features; }
+        int out_features() const { return _out_features; }
+        std::shared_ptr<Tensor<i8>> weight() const { return _weight; }
+        const std::vector<f32>& weight_scale() const { return _weight_scale; }
+        QuantParams input_qparams() const { return _input_qparams; }
+        QuantParams output_qparams() const { return _output_qparams; }
+    };
+
+    // enables the observers of module and of every Linear below it, calibration batches are
+    // then run through the model's forward
+    inline void prepare_quantization(Module& module, f32 averaging_constant = 0.f)
+    {
+        if(Linear* linear = dynamic_cast<Linear*>(&module))
+            linear->observe_(true, averaging_constant);
+        for(auto& child : module.modules())
+            prepare_quantization(*child, averaging_constant);
+    }
+
+    // converts a calibrated Linear, its observers are switched off and the Linear itself keeps
+    // running in f32
+    inline std::shared_ptr<QuantizedLinear> quantize(Linear& linear)
+    {
+        auto input_observer = linear.input_observer();
+        auto output_observer = linear.output_observer();
+        if(!input_observer || !input_observer->observed())
+            throw std::runtime_error("quantize: The Linear layer has not been calibrated.");
+        std::shared_ptr<QuantizedLinear> result(new QuantizedLinear(linear, input_observer->qparams(), output_observer->qparams()));
+        linear.observe_(false);
+        return result;
+    }
+
+    // Quantizes every calibrated Linear of module and below it, their forward then runs
+    // through the QuantizedLinear so the model's own forward runs in int8, and returns how
+    // many layers were converted. Layers whose observers are off keep running in f32, layers
+    // with observers that saw no batch throw. The float weights stay in the Linear; the int8
+    // weights and the qparams live only in memory, there is no saving or loading them, so a
+    // model is calibrated and converted again each time it is loaded.
+    inline int convert(Module& module)
+    {
+        int converted = 0;
+        if(Linear* linear = dynamic_cast<Linear*>(&module))
+        {
+            if(linear->input_observer())
+            {
+                linear->quantized_(quantize(*linear));
+                ++converted;
+            }
+        }
+        for(auto& child : module.modules())
+            converted += convert(*child);
+        return converted;
+    }
+}
+
+#endif // TRAPH_NN_LAYERS_QUANTIZED_LINEAR
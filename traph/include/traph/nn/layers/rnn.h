@@ -0,0 +1,155 @@
+#ifndef TRAPH_NN_LAYERS_RNN
+#define TRAPH_NN_LAYERS_RNN
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <traph/nn/module.h>
+#include <traph/tensor/rnn.h>
+
+namespace traph
+{
+    // Stacked LSTM or GRU layers over [T, B, I] inputs, one autograd node per layer. The
+    // weights of layer l are weight_ih_l, weight_hh_l, bias_ih_l and bias_hh_l as in torch.nn.
+    class RNNBase: public Module
+    {
+    private:
+        RnnMode _mode;
+        int _input_size;
+        int _hidden_size;
+        int _num_layers;
+        std::vector<std::shared_ptr<VariableInterface>> _w_ih, _w_hh, _b_ih, _b_hh;
+        std::vector<TensorInterfacePtr> _h_n, _c_n;
+        // the op of each layer, if any, which a replay of a captured step runs again
+        std::vector<std::shared_ptr<RnnOp>> _ops;
+        std::vector<std::shared_ptr<VariableInterface>> _outputs;
+
+        std::shared_ptr<VariableInterface> state(int layer, bool cell, const std::vector<TensorInterfacePtr>& states) const
+        {
+            if(layer < 0 || layer >= static_cast<int>(_outputs.size()))
+                throw std::runtime_error("rnn: The layer shall have run forward.");
+            if(_ops[layer])
+                return rnn_state(_outputs[layer], _ops[layer], cell);
+            if(!states[layer])
+                throw std::runtime_error("rnn: Only LSTM layers have a cell state.");
+            std::shared_ptr<VariableInterface> result = _outputs[layer]->new_empty(DimVector(), false);
+            result->data_(states[layer]);
+            return result;
+        }
+
+        // N(0, 1 / hidden_size) values
+        std::shared_ptr<VariableInterface> parameter(std::initializer_list<idx_type> size)
+        {
+            std::shared_ptr<VariableInterface> result = randn<f32>(size, true);
+            std::dynamic_pointer_cast<TensorBase<f32>>(result->data())->mul_(1.f / std::sqrt(static_cast<f32>(_hidden_size)));
+            return result;
+        }
+    public:
+        RNNBase(RnnMode mode, const char* name, int input_size, int hidden_size, int num_layers, bool bias)
+        {
+            if(input_size < 1 || hidden_size < 1 || num_layers < 1)
+                throw std::runtime_error(std::string(name) + ": Sizes and the number of layers shall be positive.");
+            _mode = mode;
+            _input_size = input_size;
+            _hidden_size = hidden_size;
+            _num_layers = num_layers;
+            idx_type width = rnn_gates(mode) * hidden_size;
+            for(int l = 0; l < num_layers; ++l)
+            {
+                std::string suffix = "_l" + std::to_string(l);
+                _w_ih.push_back(parameter({width, l == 0 ? input_size : hidden_size}));
+                _w_hh.push_back(parameter({width, hidden_size}));
+                _b_ih.push_back(bias ? parameter({width}) : nullptr);
+                _b_hh.push_back(bias ? parameter({width}) : nullptr);
+
+                register_parameter("weight_ih" + suffix, _w_ih.back());
+                register_parameter("weight_hh" + suffix, _w_hh.back());
+                register_parameter("bias_ih" + suffix, _b_ih.back());
+                register_parameter("bias_hh" + suffix, _b_hh.back());
+            }
+        }
+
+        // [T, B, I] input to the [T, B, H] output of the last layer. h0 and c0 are empty for
+        // zeros or hold a [B, H] state per layer; c0 is LSTM only.
+        std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input,
+            const std::vector<std::shared_ptr<VariableInterface>>& h0 = {},
+            const std::vector<std::shared_ptr<VariableInterface>>& c0 = {})
+        {
+            if((!h0.empty() && static_cast<int>(h0.size()) != _num_layers) ||
+                (!c0.empty() && static_cast<int>(c0.size()) != _num_layers))
+                throw std::runtime_error("rnn: Initial states shall be given for every layer.");
+            _h_n.assign(_num_layers, nullptr);
+            _c_n.assign(_num_layers, nullptr);
+            _ops.assign(_num_layers, nullptr);
+            _outputs.assign(_num_layers, nullptr);
+            std::shared_ptr<VariableInterface> result = input;
+            for(int l = 0; l < _num_layers; ++l)
+            {
+                result = rnn(_mode, result, _w_ih[l], _w_hh[l], _b_ih[l], _b_hh[l],
+                    h0.empty() ? nullptr : h0[l], c0.empty() ? nullptr : c0[l], &_h_n[l], &_c_n[l], &_ops[l]);
+                _outputs[l] = result;
+            }
+            return result;
+        }
+
+        // [B, H] states of each layer after the last step of the latest forward or replay of
+        // it, without a gradient, see h_state and c_state; c_n is LSTM only
+        std::vector<TensorInterfacePtr> h_n() const
+        {
+            std::vector<TensorInterfacePtr> result = _h_n;
+            for(std::size_t l = 0; l < _ops.size(); ++l)
+            {
+                if(_ops[l])
+                    result[l] = _ops[l]->h_n();
+            }
+            return result;
+        }
+
+        std::vector<TensorInterfacePtr> c_n() const
+        {
+            std::vector<TensorInterfacePtr> result = _c_n;
+            for(std::size_t l = 0; l < _ops.size(); ++l)
+            {
+                if(_ops[l])
+                    result[l] = _ops[l]->c_n();
+            }
+            return result;
+        }
+
+        // the [B, H] state of layer after the last step of the latest forward as a variable
+        // whose gradient goes through the backward pass of the layers, like the output does;
+        // each call is a new node of the graph. c_state is LSTM only.
+        std::shared_ptr<VariableInterface> h_state(int layer) const { return state(layer, false, _h_n); }
+        std::shared_ptr<VariableInterface> c_state(int layer) const { return state(layer, true, _c_n); }
+
+        RnnMode mode() const { return _mode; }
+        int input_size() const { return _input_size; }
+        int hidden_size() const { return _hidden_size; }
+        int num_layers() const { return _num_layers; }
+        std::shared_ptr<VariableInterface> weight_ih(int layer) const { return _w_ih[layer]; }
+        std::shared_ptr<VariableInterface> weight_hh(int layer) const { return _w_hh[layer]; }
+        std::shared_ptr<VariableInterface> bias_ih(int layer) const { return _b_ih[layer]; }
+        std::shared_ptr<VariableInterface> bias_hh(int layer) const { return _b_hh[layer]; }
+    };
+
+    class LSTM: public RNNBase
+    {
+    public:
+        LSTM(int input_size, int hidden_size, int num_layers = 1, bool bias = true)
+            :RNNBase(RnnMode::LSTM, "LSTM", input_size, hidden_size, num_layers, bias)
+        {
+        }
+    };
+
+    class GRU: public RNNBase
+    {
+    public:
+        GRU(int input_size, int hidden_size, int num_layers = 1, bool bias = true)
+            :RNNBase(RnnMode::GRU, "GRU", input_size, hidden_size, num_layers, bias)
+        {
+        }
+    };
+}
+
+#endif // TRAPH_NN_LAYERS_RNN
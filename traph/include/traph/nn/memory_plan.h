@@ -0,0 +1,76 @@
+#ifndef TRAPH_NN_MEMORY_PLAN_H_
+#define TRAPH_NN_MEMORY_PLAN_H_
+
+#include <memory>
+#include <string>
+
+#include <traph/core/type.h>
+
+namespace traph
+{
+    struct MemoryReport
+    {
+        // the storages made and freed within the recorded run, and their bytes
+        idx_type tensors = 0;
+        i64 naive_bytes = 0;
+        // the most bytes of them alive at once
+        i64 live_bytes = 0;
+        // the slabs they are given and the bytes of the slabs
+        idx_type slabs = 0;
+        i64 planned_bytes = 0;
+
+        std::string str() const;
+    };
+
+    class PlannedArena;
+    class StorageArenaGuard;
+
+    // Plans the memory of the storages that a run, such as an iteration of a training loop,
+    // makes on the calling thread. The first run is recorded: a storage lives from the time
+    // it is made to the time it is freed, so an input an op saves for the backward pass
+    // lives until that pass releases it. The storages made and freed within the run are
+    // given slabs by interval colouring, greedily in the order they are made, so that a slab
+    // holds storages whose lives do not overlap and is as large as the largest of them.
+    // Later runs take the storages from the slabs in the order they are made, in one buffer
+    // allocated once. A run that makes a storage of another size, or finds its slab still
+    // in use, takes new[] memory from there on and is recorded again the next time.
+    // Storages a run does not free, such as the loss it returns, use new[] memory.
+    class MemoryPlanner
+    {
+    private:
+        std::shared_ptr<PlannedArena> _arena;
+        std::unique_ptr<StorageArenaGuard> _guard;
+    public:
+        MemoryPlanner();
+        MemoryPlanner(const MemoryPlanner&) = delete;
+        MemoryPlanner& operator= (const MemoryPlanner&) = delete;
+        ~MemoryPlanner();
+
+        // A run on the calling thread, between the two; runs do not nest. A storage of a
+        // planned run that outlives it keeps its slab, and the next run takes new[] memory
+        // where the plan would put a storage there.
+        void begin();
+        void end();
+        // the next run records again
+        void reset();
+
+        // whether the next run takes its storages from the slabs
+        bool planned() const;
+        const MemoryReport& report() const;
+        // storages of the last run that were not where the plan put them
+        idx_type misses() const;
+
+        class Scope
+        {
+        private:
+            MemoryPlanner& _planner;
+        public:
+            explicit Scope(MemoryPlanner& planner);
+            Scope(const Scope&) = delete;
+            Scope& operator= (const Scope&) = delete;
+            ~Scope();
+        };
+    };
+}
+
+#endif
@@ -19,6 +19,8 @@ namespace traph
         std::vector<std::pair<std::string, std::shared_ptr<VariableInterface>>> _parameters;
         std::vector<std::pair<std::string, std::shared_ptr<Module>>> _children;
     public:
+        virtual ~Module() {}
+
         void add_module(const std::string& name, std::shared_ptr<Module> module)
         {
             _children.push_back(std::make_pair(name, module));
@@ -6,12 +6,22 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include <cassert>
+#include <stdexcept>
 
 #include <traph/core/type.h>
 #include <traph/core/index.h>
 #include <traph/core/tensor.h>
 #include <traph/tensor/tensor.h>
+#include <traph/tensor/einsum.h>
+#include <traph/tensor/conv.h>
+#include <traph/tensor/pooling.h>
+#include <traph/tensor/embedding.h>
+#include <traph/tensor/rnn.h>
+#include <traph/tensor/attention.h>
+#include <traph/tensor/activation.h>
+#include <traph/nn/grad_mode.h>
 
 namespace traph
 {
@@ -20,8 +30,11 @@ namespace traph
     private:
         std::vector<TensorInterfacePtr> _saved_tensors;
     public:
+        // nothing is kept under NoGradGuard
         void save(TensorInterfacePtr tensor)
         {
+            if (!GradMode::is_enabled())
+                return;
             _saved_tensors.push_back(tensor);
         }
 
@@ -29,35 +42,774 @@ namespace traph
         {
             return _saved_tensors;
         }
+
+        // before the op runs forward again
+        void clear()
+        {
+            _saved_tensors.clear();
+        }
     };
 
-    class OpBase
-    {
-    public:
-        OpContext context;
-        
-        virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) = 0;
-        virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) = 0;
-    };
+    class OpBase
+    {
+    public:
+        OpContext context;
+        
+        virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) = 0;
+        virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) = 0;
+
+        // The gradient of input i as the rows of a table that were read, for the inputs that
+        // backward returns a null gradient for.
+        virtual std::shared_ptr<SparseRows<f32>> sparse_backward(TensorBasePtr<f32> output_grad, std::size_t i)
+        {
+            return nullptr;
+        }
+
+        // Before a captured step runs the op forward again, replay counting the runs since
+        // the capture from 1. Ops that draw random numbers take new ones for each replay.
+        virtual void replay(u64 replay)
+        {
+        }
+    };
+
+	class AddOp : public OpBase
+	{
+	public:
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 2);
+
+			TensorInterfacePtr left_input = inputs[0];
+			TensorInterfacePtr right_input = inputs[1];
+			TensorInterfacePtr result = left_input->clone();
+            result->add_(right_input);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			return { output_grad, output_grad };
+		}
+	};
+
+	class AdaptiveAvgPool2dOp : public OpBase
+	{
+	private:
+		idx_type _out_h, _out_w;
+		DimVector _input_size;
+	public:
+		void set_output_size(idx_type out_h, idx_type out_w)
+		{
+			_out_h = out_h;
+			_out_w = out_w;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+				result = adaptive_avg_pool2d_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), _out_h, _out_w);
+			else if (input->dtype() == DataType::DOUBLE)
+				result = adaptive_avg_pool2d_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), _out_h, _out_w);
+			else
+				throw std::runtime_error("adaptive_avg_pool2d: Only f32 and f64 tensors are supported.");
+
+			_input_size = input->size();
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			return { adaptive_avg_pool2d_backward_impl(*grad, _input_size) };
+		}
+	};
+
+	class AvgPool2dOp : public OpBase
+	{
+	private:
+		Pool2dParams _params;
+		DimVector _input_size;
+	public:
+		void set_params(const Pool2dParams& params)
+		{
+			_params = params;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+				result = avg_pool2d_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), _params);
+			else if (input->dtype() == DataType::DOUBLE)
+				result = avg_pool2d_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), _params);
+			else
+				throw std::runtime_error("avg_pool2d: Only f32 and f64 tensors are supported.");
+
+			_input_size = input->size();
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			return { avg_pool2d_backward_impl(*grad, _input_size, _params) };
+		}
+	};
+
+	class BmmOp : public OpBase
+	{
+	public:
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 2);
+
+			TensorInterfacePtr left_input = inputs[0];
+			TensorInterfacePtr right_input = inputs[1];
+			TensorInterfacePtr result = left_input->bmm(right_input);
+
+			context.save(left_input);
+			context.save(right_input);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 2);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto left = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto right = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[1]);
+			std::shared_ptr<TensorBase<f32>> left_out = matmul_backward_left_impl(*grad, *right, left->size());
+			std::shared_ptr<TensorBase<f32>> right_out = matmul_backward_right_impl(*grad, *left, right->size());
+			return { left_out, right_out };
+		}
+	};
+
+	class Conv2dOp : public OpBase
+	{
+	private:
+		Conv2dParams _params;
+	public:
+		void set_params(const Conv2dParams& params)
+		{
+			_params = params;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 2 || inputs.size() == 3);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr weight = inputs[1];
+			TensorInterfacePtr bias = inputs.size() == 3 ? inputs[2] : nullptr;
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+			{
+				auto bias_tensor = std::dynamic_pointer_cast<Tensor<f32>>(bias);
+				result = conv2d_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), *std::dynamic_pointer_cast<Tensor<f32>>(weight), bias_tensor.get(), _params);
+			}
+			else if (input->dtype() == DataType::DOUBLE)
+			{
+				auto bias_tensor = std::dynamic_pointer_cast<Tensor<f64>>(bias);
+				result = conv2d_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), *std::dynamic_pointer_cast<Tensor<f64>>(weight), bias_tensor.get(), _params);
+			}
+			else
+			{
+				throw std::runtime_error("conv2d: Only f32 and f64 tensors are supported.");
+			}
+
+			context.save(input);
+			context.save(weight);
+			if (bias)
+				context.save(bias);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 2 || saved_tensors.size() == 3);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto input = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto weight = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[1]);
+			auto grads = conv2d_backward_impl(*grad, *input, *weight, saved_tensors.size() == 3, _params);
+			return std::vector<TensorBasePtr<f32>>(grads.begin(), grads.end());
+		}
+	};
+
+	class CummaxOp : public OpBase
+	{
+	private:
+		idx_type _dim;
+	public:
+		void set_dim(idx_type dim)
+		{
+			_dim = dim;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result = input->cummax(_dim);
+
+			context.save(input);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 1);
+			auto input = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			return { cummax_backward_impl(*grad, *input, _dim) };
+		}
+	};
+
+	class CumprodOp : public OpBase
+	{
+	private:
+		idx_type _dim;
+	public:
+		void set_dim(idx_type dim)
+		{
+			_dim = dim;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result = input->cumprod(_dim);
+
+			context.save(input);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 1);
+			auto input = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			return { cumprod_backward_impl(*grad, *input, _dim) };
+		}
+	};
+
+	class CumsumOp : public OpBase
+	{
+	private:
+		idx_type _dim;
+	public:
+		void set_dim(idx_type dim)
+		{
+			_dim = dim;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result = input->cumsum(_dim);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			// d(cumsum)/dx is a suffix sum of the output gradient
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			return { cumsum_impl(*grad, _dim, true) };
+		}
+	};
+
+	class DropoutOp : public OpBase
+	{
+	private:
+		f64 _p = 0.5;
+		u64 _seed = 0;
+		u64 _captured_seed = 0;
+		bool _requires_grad = true;
+	public:
+		void set_p(f64 p)
+		{
+			_p = p;
+		}
+
+		void set_seed(u64 seed)
+		{
+			_seed = _captured_seed = seed;
+		}
+
+		// splitmix64 of the seed of the call and the replay
+		virtual void replay(u64 replay) override
+		{
+			u64 z = _captured_seed + replay * 0x9E3779B97F4A7C15ull;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			_seed = z ^ (z >> 31);
+		}
+
+		// without a gradient forward saves nothing
+		void set_requires_grad(bool requires_grad)
+		{
+			_requires_grad = requires_grad;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			std::shared_ptr<Tensor<u8>> mask;
+			std::shared_ptr<Tensor<u8>>* wanted = _requires_grad ? &mask : nullptr;
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+				result = dropout_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), _p, _seed, wanted);
+			else if (input->dtype() == DataType::DOUBLE)
+				result = dropout_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), _p, _seed, wanted);
+			else
+				throw std::runtime_error("dropout: Only f32 and f64 tensors are supported.");
+
+			// a bit per element
+			if (mask)
+				context.save(mask);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 1);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto mask = std::dynamic_pointer_cast<Tensor<u8>>(saved_tensors[0]);
+			return { dropout_backward_impl(*grad, *mask, _p) };
+		}
+	};
+
+	class EinsumOp : public OpBase
+	{
+	private:
+		EinsumEquation _equation;
+
+		template<typename T>
+		static std::vector<const Tensor<T>*> operands(const std::vector<TensorInterfacePtr>& inputs)
+		{
+			std::vector<const Tensor<T>*> result;
+			for (auto& each : inputs)
+				result.push_back(std::dynamic_pointer_cast<Tensor<T>>(each).get());
+			return result;
+		}
+	public:
+		void set_equation(const EinsumEquation& equation)
+		{
+			_equation = equation;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(!inputs.empty());
+
+			TensorInterfacePtr result;
+			if (inputs[0]->dtype() == DataType::FLOAT)
+				result = einsum_impl(_equation, operands<f32>(inputs));
+			else if (inputs[0]->dtype() == DataType::DOUBLE)
+				result = einsum_impl(_equation, operands<f64>(inputs));
+			else
+				throw std::runtime_error("einsum: Only f32 and f64 tensors are supported.");
+
+			for (auto& each : inputs)
+				context.save(each);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == _equation.inputs.size());
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto grads = einsum_backward_impl(*grad, _equation, operands<f32>(saved_tensors));
+			return std::vector<TensorBasePtr<f32>>(grads.begin(), grads.end());
+		}
+	};
+
+	class EmbeddingBagOp : public OpBase
+	{
+	private:
+		EmbeddingBagMode _mode;
+		bool _sparse;
+		idx_type _rows;
+	public:
+		EmbeddingBagOp()
+			:_mode(EmbeddingBagMode::MEAN), _sparse(false), _rows(0)
+		{
+		}
+
+		void set_mode(EmbeddingBagMode mode)
+		{
+			_mode = mode;
+		}
+
+		void set_sparse(bool sparse)
+		{
+			_sparse = sparse;
+		}
+
+		// inputs are weight, indices and optionally offsets
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 2 || inputs.size() == 3);
+
+			TensorInterfacePtr weight = inputs[0];
+			if (inputs[1]->dtype() != DataType::LONG || (inputs.size() == 3 && inputs[2]->dtype() != DataType::LONG))
+				throw std::runtime_error("embedding_bag: Indices and offsets shall be i64 tensors.");
+			auto indices = std::dynamic_pointer_cast<Tensor<i64>>(inputs[1]);
+			std::shared_ptr<Tensor<i64>> offsets;
+			if (inputs.size() == 3)
+				offsets = std::dynamic_pointer_cast<Tensor<i64>>(inputs[2]);
+
+			TensorInterfacePtr result;
+			if (weight->dtype() == DataType::FLOAT)
+				result = embedding_bag_impl(*std::dynamic_pointer_cast<Tensor<f32>>(weight), *indices, offsets.get(), _mode);
+			else if (weight->dtype() == DataType::DOUBLE)
+				result = embedding_bag_impl(*std::dynamic_pointer_cast<Tensor<f64>>(weight), *indices, offsets.get(), _mode);
+			else
+				throw std::runtime_error("embedding_bag: Only f32 and f64 weights are supported.");
+
+			_rows = weight->size(0);
+			context.save(indices);
+			if (offsets)
+				context.save(offsets);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			std::vector<TensorBasePtr<f32>> result(saved_tensors.size() + 1);
+			if (!_sparse)
+				result[0] = sparse_rows_to_dense(*sparse_backward(output_grad, 0));
+			return result;
+		}
+
+		virtual std::shared_ptr<SparseRows<f32>> sparse_backward(TensorBasePtr<f32> output_grad, std::size_t i) override
+		{
+			if (i != 0)
+				return nullptr;
+			auto saved_tensors = context.get_saved_tensors();
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto indices = std::dynamic_pointer_cast<Tensor<i64>>(saved_tensors[0]);
+			std::shared_ptr<Tensor<i64>> offsets;
+			if (saved_tensors.size() == 2)
+				offsets = std::dynamic_pointer_cast<Tensor<i64>>(saved_tensors[1]);
+			return embedding_bag_backward_impl(*grad, *indices, offsets.get(), _rows, _mode);
+		}
+	};
+
+	class EmbeddingOp : public OpBase
+	{
+	private:
+		bool _sparse;
+		idx_type _rows;
+	public:
+		EmbeddingOp()
+			:_sparse(false), _rows(0)
+		{
+		}
+
+		void set_sparse(bool sparse)
+		{
+			_sparse = sparse;
+		}
+
+		// inputs are weight and indices
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 2);
+
+			TensorInterfacePtr weight = inputs[0];
+			if (inputs[1]->dtype() != DataType::LONG)
+				throw std::runtime_error("embedding: Indices shall be an i64 tensor.");
+			auto indices = std::dynamic_pointer_cast<Tensor<i64>>(inputs[1]);
+
+			TensorInterfacePtr result;
+			if (weight->dtype() == DataType::FLOAT)
+				result = embedding_impl(*std::dynamic_pointer_cast<Tensor<f32>>(weight), *indices);
+			else if (weight->dtype() == DataType::DOUBLE)
+				result = embedding_impl(*std::dynamic_pointer_cast<Tensor<f64>>(weight), *indices);
+			else
+				throw std::runtime_error("embedding: Only f32 and f64 weights are supported.");
+
+			_rows = weight->size(0);
+			context.save(indices);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			std::vector<TensorBasePtr<f32>> result(2);
+			if (!_sparse)
+				result[0] = sparse_rows_to_dense(*sparse_backward(output_grad, 0));
+			return result;
+		}
+
+		virtual std::shared_ptr<SparseRows<f32>> sparse_backward(TensorBasePtr<f32> output_grad, std::size_t i) override
+		{
+			if (i != 0)
+				return nullptr;
+			auto saved_tensors = context.get_saved_tensors();
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto indices = std::dynamic_pointer_cast<Tensor<i64>>(saved_tensors[0]);
+			return embedding_backward_impl(*grad, *indices, _rows);
+		}
+	};
 
-	class AddOp : public OpBase
+	// An elementwise chain run by one kernel, made by GraphOptimizer from the calls of the ops
+	// it stands for: inputs are the input of the chain and then its sides.
+	class FusedElementwiseOp : public OpBase
 	{
+	private:
+		std::vector<ChainStage> _stages;
+		// whether the gradient of each input is wanted
+		std::vector<bool> _input_grads;
 	public:
+		FusedElementwiseOp(const std::vector<ChainStage>& stages, const std::vector<bool>& input_grads)
+			:_stages(stages), _input_grads(input_grads)
+		{
+		}
+
+		const std::vector<ChainStage>& stages() const
+		{
+			return _stages;
+		}
+
+		// the tensors of inputs from first on
+		template<typename T>
+		static std::vector<const Tensor<T>*> side_tensors(const std::vector<TensorInterfacePtr>& inputs, std::size_t first)
+		{
+			std::vector<const Tensor<T>*> result;
+			for (std::size_t i = first; i < inputs.size(); ++i)
+			{
+				auto side = dynamic_cast<const Tensor<T>*>(inputs[i].get());
+				if (!side)
+					throw std::runtime_error("elementwise_chain: Sides shall have the type of the input.");
+				result.push_back(side);
+			}
+			return result;
+		}
+
 		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
 		{
-			assert(inputs.size() == 2);
+			assert(inputs.size() == _input_grads.size());
 
-			TensorInterfacePtr left_input = inputs[0];
-			TensorInterfacePtr right_input = inputs[1];
-			TensorInterfacePtr result = left_input->clone();
-            result->add_(right_input);
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+				result = elementwise_chain_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), side_tensors<f32>(inputs, 1), _stages);
+			else if (input->dtype() == DataType::DOUBLE)
+				result = elementwise_chain_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), side_tensors<f64>(inputs, 1), _stages);
+			else
+				throw std::runtime_error("elementwise_chain: Only f32 and f64 tensors are supported.");
+
+			for (auto& each : inputs)
+				context.save(each);
 
 			return result;
 		}
 
 		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
 		{
-			return { output_grad, output_grad };
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == _input_grads.size());
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto input = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			std::vector<bool> side_grads(_input_grads.begin() + 1, _input_grads.end());
+			auto grads = elementwise_chain_backward_impl(*grad, *input, side_tensors<f32>(saved_tensors, 1), _stages, side_grads);
+			if (!_input_grads[0])
+				grads[0] = nullptr;
+			return std::vector<TensorBasePtr<f32>>(grads.begin(), grads.end());
+		}
+	};
+
+	// matmul(a, b) and then an elementwise chain over its output, made by GraphOptimizer:
+	// inputs are a, b and then the sides of the chain. The product is kept for the backward
+	// pass instead of the tensors between the stages.
+	class FusedMatmulOp : public OpBase
+	{
+	private:
+		std::vector<ChainStage> _stages;
+		// whether the gradient of each input is wanted
+		std::vector<bool> _input_grads;
+	public:
+		FusedMatmulOp(const std::vector<ChainStage>& stages, const std::vector<bool>& input_grads)
+			:_stages(stages), _input_grads(input_grads)
+		{
+		}
+
+		const std::vector<ChainStage>& stages() const
+		{
+			return _stages;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == _input_grads.size() && inputs.size() >= 2);
+
+			TensorInterfacePtr product = inputs[0]->matmul(inputs[1]);
+			TensorInterfacePtr result = product;
+			if (!_stages.empty())
+			{
+				if (product->dtype() == DataType::FLOAT)
+					result = elementwise_chain_impl(*std::dynamic_pointer_cast<Tensor<f32>>(product), FusedElementwiseOp::side_tensors<f32>(inputs, 2), _stages);
+				else if (product->dtype() == DataType::DOUBLE)
+					result = elementwise_chain_impl(*std::dynamic_pointer_cast<Tensor<f64>>(product), FusedElementwiseOp::side_tensors<f64>(inputs, 2), _stages);
+				else
+					throw std::runtime_error("fused_matmul: Only f32 and f64 tensors are supported.");
+			}
+
+			context.save(inputs[0]);
+			context.save(inputs[1]);
+			context.save(product);
+			for (std::size_t i = 2; i < inputs.size(); ++i)
+				context.save(inputs[i]);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == _input_grads.size() + 1);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto left = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto right = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[1]);
+			auto product = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[2]);
+
+			std::vector<TensorBasePtr<f32>> result(_input_grads.size());
+			if (!_stages.empty())
+			{
+				std::vector<bool> side_grads(_input_grads.begin() + 2, _input_grads.end());
+				auto grads = elementwise_chain_backward_impl(*grad, *product, FusedElementwiseOp::side_tensors<f32>(saved_tensors, 3),
+					_stages, side_grads);
+				grad = grads[0];
+				for (std::size_t i = 1; i < grads.size(); ++i)
+					result[i + 1] = grads[i];
+			}
+			// no product of a gradient that is not read
+			if (_input_grads[0])
+				result[0] = matmul_backward_left_impl(*grad, *right, left->size());
+			if (_input_grads[1])
+				result[1] = matmul_backward_right_impl(*grad, *left, right->size());
+			return result;
+		}
+	};
+
+	class GeluOp : public OpBase
+	{
+	private:
+		bool _requires_grad = true;
+	public:
+		// without a gradient forward saves nothing
+		void set_requires_grad(bool requires_grad)
+		{
+			_requires_grad = requires_grad;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+				result = gelu_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input));
+			else if (input->dtype() == DataType::DOUBLE)
+				result = gelu_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input));
+			else
+				throw std::runtime_error("gelu: Only f32 and f64 tensors are supported.");
+
+			if (_requires_grad)
+				context.save(input);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 1);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto input = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			return { gelu_backward_impl(*grad, *input) };
+		}
+	};
+
+	// y = x * w^T + b with inputs { x, w } or { x, w, b }, the weight is not transposed
+	class LinearOp : public OpBase
+	{
+	public:
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 2 || inputs.size() == 3);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr weight = inputs[1];
+			TensorInterfacePtr bias = inputs.size() == 3 ? inputs[2] : nullptr;
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+			{
+				auto bias_tensor = std::dynamic_pointer_cast<Tensor<f32>>(bias);
+				result = linear_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), *std::dynamic_pointer_cast<Tensor<f32>>(weight), bias_tensor.get());
+			}
+			else if (input->dtype() == DataType::DOUBLE)
+			{
+				auto bias_tensor = std::dynamic_pointer_cast<Tensor<f64>>(bias);
+				result = linear_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), *std::dynamic_pointer_cast<Tensor<f64>>(weight), bias_tensor.get());
+			}
+			else
+			{
+				throw std::runtime_error("linear: Only f32 and f64 tensors are supported.");
+			}
+
+			context.save(input);
+			context.save(weight);
+			if (bias)
+				context.save(bias);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 2 || saved_tensors.size() == 3);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto input = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto weight = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[1]);
+			auto grads = linear_backward_impl(*grad, *input, *weight, saved_tensors.size() == 3);
+			return std::vector<TensorBasePtr<f32>>(grads.begin(), grads.end());
 		}
 	};
 
@@ -82,12 +834,71 @@ namespace traph
 		{
 			auto saved_tensors = context.get_saved_tensors();
 			assert(saved_tensors.size() == 2);
-			std::shared_ptr<TensorBase<f32>> left_out = std::dynamic_pointer_cast<TensorBase<f32>>(output_grad->matmul(saved_tensors[1]->transpose(0, 1)));
-			std::shared_ptr<TensorBase<f32>> right_out = std::dynamic_pointer_cast<TensorBase<f32>>(saved_tensors[0]->transpose(0, 1)->matmul(output_grad));
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto left = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto right = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[1]);
+			// broadcast batch dimensions are summed back to the size of each input
+			std::shared_ptr<TensorBase<f32>> left_out = matmul_backward_left_impl(*grad, *right, left->size());
+			std::shared_ptr<TensorBase<f32>> right_out = matmul_backward_right_impl(*grad, *left, right->size());
 			return { left_out, right_out };
 		}
 	};
 
+	class MaxPool2dOp : public OpBase
+	{
+	private:
+		Pool2dParams _params;
+		bool _requires_grad = true;
+		DimVector _input_size;
+	public:
+		void set_params(const Pool2dParams& params)
+		{
+			_params = params;
+		}
+
+		// without a gradient forward saves nothing
+		void set_requires_grad(bool requires_grad)
+		{
+			_requires_grad = requires_grad;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result;
+			std::shared_ptr<Tensor<u8>> offsets;
+			std::shared_ptr<Tensor<u8>>* wanted = _requires_grad ? &offsets : nullptr;
+			if (input->dtype() == DataType::FLOAT)
+				result = max_pool2d_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), _params, wanted);
+			else if (input->dtype() == DataType::DOUBLE)
+				result = max_pool2d_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), _params, wanted);
+			else
+				throw std::runtime_error("max_pool2d: Only f32 and f64 tensors are supported.");
+
+			// a byte per output for the position of its maximum, or the input to find the
+			// maxima of large windows again
+			_input_size = input->size();
+			if (offsets)
+				context.save(offsets);
+			else if (_requires_grad)
+				context.save(input);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 1);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			if (max_pool2d_has_offsets(_params))
+				return { max_pool2d_backward_impl(*grad, _input_size, *std::dynamic_pointer_cast<Tensor<u8>>(saved_tensors[0]), _params) };
+			return { max_pool2d_backward_impl(*grad, *std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]), _params) };
+		}
+	};
+
 	class MeanOp : public OpBase
 	{
 	public:
@@ -125,6 +936,11 @@ namespace traph
 			_exp = exp;
 		}
 
+		float exp() const
+		{
+			return _exp;
+		}
+
 		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
 		{
 			assert(inputs.size() == 1);
@@ -152,6 +968,287 @@ namespace traph
 		}
 	};
 
+	class ReluOp : public OpBase
+	{
+	private:
+		bool _requires_grad = true;
+	public:
+		// without a gradient forward saves nothing
+		void set_requires_grad(bool requires_grad)
+		{
+			_requires_grad = requires_grad;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			std::shared_ptr<Tensor<u8>> mask;
+			std::shared_ptr<Tensor<u8>>* wanted = _requires_grad ? &mask : nullptr;
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+				result = relu_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input), wanted);
+			else if (input->dtype() == DataType::DOUBLE)
+				result = relu_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input), wanted);
+			else
+				throw std::runtime_error("relu: Only f32 and f64 tensors are supported.");
+
+			// a bit per element
+			if (mask)
+				context.save(mask);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 1);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto mask = std::dynamic_pointer_cast<Tensor<u8>>(saved_tensors[0]);
+			return { relu_backward_impl(*grad, *mask) };
+		}
+	};
+
+	class RnnOp : public OpBase
+	{
+	private:
+		RnnMode _mode;
+		bool _bias, _h0, _c0;
+		TensorInterfacePtr _h_n, _c_n;
+		// the gradients of h_n and c_n, added by the RnnStateOps of this layer before its
+		// backward
+		std::shared_ptr<Tensor<f32>> _grad_h_n, _grad_c_n;
+		std::mutex _state_grad_lock;
+
+		template<typename T>
+		TensorInterfacePtr forward_impl(const std::vector<TensorInterfacePtr>& inputs, RnnState<T>& state)
+		{
+			std::vector<std::shared_ptr<Tensor<T>>> tensors;
+			for (auto& each : inputs)
+				tensors.push_back(std::dynamic_pointer_cast<Tensor<T>>(each));
+			std::size_t next = 3;
+			Tensor<T>* b_ih = _bias ? tensors[next++].get() : nullptr;
+			Tensor<T>* b_hh = _bias ? tensors[next++].get() : nullptr;
+			Tensor<T>* h0 = _h0 ? tensors[next++].get() : nullptr;
+			Tensor<T>* c0 = _c0 ? tensors[next++].get() : nullptr;
+			TensorInterfacePtr result = rnn_forward_impl(_mode, *tensors[0], *tensors[1], *tensors[2], b_ih, b_hh, h0, c0, state);
+			_h_n = state.h_n;
+			_c_n = state.c_n;
+			return result;
+		}
+	public:
+		RnnOp()
+			:_mode(RnnMode::LSTM), _bias(true), _h0(false), _c0(false)
+		{
+		}
+
+		void set_mode(RnnMode mode)
+		{
+			_mode = mode;
+		}
+
+		// which of the optional inputs follow input, w_ih and w_hh: b_ih and b_hh, h0, c0
+		void set_inputs(bool bias, bool h0, bool c0)
+		{
+			_bias = bias;
+			_h0 = h0;
+			_c0 = c0;
+		}
+
+		RnnMode mode() const { return _mode; }
+
+		// [B, H] states after the last step, without a gradient, see RnnStateOp
+		TensorInterfacePtr h_n() const { return _h_n; }
+		TensorInterfacePtr c_n() const { return _c_n; }
+
+		void add_state_grad(bool cell, TensorBasePtr<f32> grad)
+		{
+			std::lock_guard<std::mutex> guard(_state_grad_lock);
+			std::shared_ptr<Tensor<f32>>& sum = cell ? _grad_c_n : _grad_h_n;
+			if (sum)
+				sum->add_(grad);
+			else
+				sum = std::dynamic_pointer_cast<Tensor<f32>>(grad->clone());
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 3 + (_bias ? 2 : 0) + (_h0 ? 1 : 0) + (_c0 ? 1 : 0));
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result;
+			RnnState<f32> state;
+			if (input->dtype() == DataType::FLOAT)
+			{
+				result = forward_impl(inputs, state);
+			}
+			else if (input->dtype() == DataType::DOUBLE)
+			{
+				// backward is f32 only, the state is dropped
+				RnnState<f64> f64_state;
+				result = forward_impl(inputs, f64_state);
+			}
+			else
+			{
+				throw std::runtime_error("rnn: Only f32 and f64 tensors are supported.");
+			}
+
+			context.save(input);
+			context.save(inputs[1]);
+			context.save(inputs[2]);
+			context.save(result);
+			// the buffers of the steps, freed with the other saved tensors
+			context.save(state.gates);
+			context.save(state.candidates);
+			context.save(state.cells);
+			context.save(state.h0);
+			context.save(state.c0);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 9);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto input = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			auto w_ih = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[1]);
+			auto w_hh = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[2]);
+			auto output = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[3]);
+			RnnState<f32> state;
+			state.gates = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[4]);
+			state.candidates = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[5]);
+			state.cells = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[6]);
+			state.h0 = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[7]);
+			state.c0 = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[8]);
+			RnnGrads<f32> grads = rnn_backward_impl(_mode, *grad, *input, *output, *w_ih, *w_hh, state,
+				_grad_h_n.get(), _grad_c_n.get());
+			_grad_h_n = nullptr;
+			_grad_c_n = nullptr;
+
+			std::vector<TensorBasePtr<f32>> result{ grads.input, grads.w_ih, grads.w_hh };
+			if (_bias)
+			{
+				result.push_back(grads.b_ih);
+				result.push_back(grads.b_hh);
+			}
+			if (_h0)
+				result.push_back(grads.h0);
+			if (_c0)
+				result.push_back(grads.c0);
+			return result;
+		}
+	};
+
+	// h_n or c_n of an RnnOp with the output of the layer as input. Its gradient does not go
+	// to the output but is added to the op, whose backward starts from it.
+	class RnnStateOp : public OpBase
+	{
+	private:
+		std::shared_ptr<RnnOp> _node;
+		bool _cell = false;
+	public:
+		void set_state(std::shared_ptr<RnnOp> node, bool cell)
+		{
+			_node = node;
+			_cell = cell;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+			return _cell ? _node->c_n() : _node->h_n();
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			_node->add_state_grad(_cell, output_grad);
+			return { nullptr };
+		}
+	};
+
+	class ScaledDotProductAttentionOp : public OpBase
+	{
+	private:
+		AttentionParams _params;
+		bool _requires_grad = true;
+	public:
+		void set_params(const AttentionParams& params)
+		{
+			_params = params;
+		}
+
+		// without a gradient forward saves nothing
+		void set_requires_grad(bool requires_grad)
+		{
+			_requires_grad = requires_grad;
+		}
+
+		// inputs are q, k, v and an optional u8 key padding mask
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 3 || inputs.size() == 4);
+
+			std::shared_ptr<Tensor<u8>> mask;
+			if (inputs.size() == 4)
+			{
+				if (inputs[3]->dtype() != DataType::BYTE)
+					throw std::runtime_error("scaled_dot_product_attention: The key padding mask shall be a u8 tensor.");
+				mask = std::dynamic_pointer_cast<Tensor<u8>>(inputs[3]);
+			}
+
+			TensorInterfacePtr result;
+			if (inputs[0]->dtype() == DataType::FLOAT)
+			{
+				std::shared_ptr<Tensor<f32>> lse;
+				result = scaled_dot_product_attention_impl(*std::dynamic_pointer_cast<Tensor<f32>>(inputs[0]),
+					*std::dynamic_pointer_cast<Tensor<f32>>(inputs[1]), *std::dynamic_pointer_cast<Tensor<f32>>(inputs[2]),
+					mask.get(), _params, _requires_grad ? &lse : nullptr);
+				if (_requires_grad)
+				{
+					// q, k, v, the output and its log-sum-exp, not the scores
+					for (std::size_t i = 0; i < 3; ++i)
+						context.save(inputs[i]);
+					context.save(result);
+					context.save(lse);
+					if (mask)
+						context.save(mask);
+				}
+			}
+			else if (inputs[0]->dtype() == DataType::DOUBLE)
+			{
+				result = scaled_dot_product_attention_impl(*std::dynamic_pointer_cast<Tensor<f64>>(inputs[0]),
+					*std::dynamic_pointer_cast<Tensor<f64>>(inputs[1]), *std::dynamic_pointer_cast<Tensor<f64>>(inputs[2]),
+					mask.get(), _params);
+			}
+			else
+			{
+				throw std::runtime_error("scaled_dot_product_attention: Only f32 and f64 tensors are supported.");
+			}
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 5 || saved_tensors.size() == 6);
+			std::vector<std::shared_ptr<Tensor<f32>>> saved;
+			for (std::size_t i = 0; i < 5; ++i)
+				saved.push_back(std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[i]));
+			auto mask = saved_tensors.size() == 6 ? std::dynamic_pointer_cast<Tensor<u8>>(saved_tensors[5]) : nullptr;
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto grads = scaled_dot_product_attention_backward_impl(*grad, *saved[0], *saved[1], *saved[2], *saved[3], *saved[4], mask.get(), _params);
+			std::vector<TensorBasePtr<f32>> result(grads.begin(), grads.end());
+			if (mask)
+				result.push_back(nullptr);
+			return result;
+		}
+	};
+
 	class SelectOp : public OpBase
 	{
 	public:
@@ -185,6 +1282,46 @@ namespace traph
 		}
 	};
 
+	class SigmoidOp : public OpBase
+	{
+	private:
+		bool _requires_grad = true;
+	public:
+		// without a gradient forward saves nothing
+		void set_requires_grad(bool requires_grad)
+		{
+			_requires_grad = requires_grad;
+		}
+
+		virtual TensorInterfacePtr forward(std::vector<TensorInterfacePtr> inputs) override
+		{
+			assert(inputs.size() == 1);
+
+			TensorInterfacePtr input = inputs[0];
+			TensorInterfacePtr result;
+			if (input->dtype() == DataType::FLOAT)
+				result = sigmoid_impl(*std::dynamic_pointer_cast<Tensor<f32>>(input));
+			else if (input->dtype() == DataType::DOUBLE)
+				result = sigmoid_impl(*std::dynamic_pointer_cast<Tensor<f64>>(input));
+			else
+				throw std::runtime_error("sigmoid: Only f32 and f64 tensors are supported.");
+
+			if (_requires_grad)
+				context.save(result);
+
+			return result;
+		}
+
+		virtual std::vector<TensorBasePtr<f32>> backward(TensorBasePtr<f32> output_grad) override
+		{
+			auto saved_tensors = context.get_saved_tensors();
+			assert(saved_tensors.size() == 1);
+			auto grad = std::dynamic_pointer_cast<Tensor<f32>>(output_grad);
+			auto output = std::dynamic_pointer_cast<Tensor<f32>>(saved_tensors[0]);
+			return { sigmoid_backward_impl(*grad, *output) };
+		}
+	};
+
 	class SinOp : public OpBase
 	{
 	public:
@@ -26,6 +26,8 @@ namespace traph
             {
 				if(each_param->grad())
 					each_param->grad()->fill_(0);
+				else if(each_param->sparse_grad())
+					each_param->sparse_grad()->clear();
             }
         }
     };
@@ -46,6 +48,13 @@ namespace traph
         {
             for(auto& each:_params)
             {
+                // only the rows that were read change
+                if(auto rows = each->sparse_grad())
+                {
+                    index_add_rows_(*std::dynamic_pointer_cast<Tensor<f32>>(each->data()), *rows, -_lr);
+                    continue;
+                }
+
                 auto d_p = each->grad();
 
                 auto cloned_d_p = std::dynamic_pointer_cast<TensorBase<f32>>(d_p->clone());
@@ -0,0 +1,95 @@
+#ifndef TRAPH_NN_QUANTIZATION_H_
+#define TRAPH_NN_QUANTIZATION_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+#include <traph/core/type.h>
+#include <traph/core/tensor.h>
+#include <traph/core/variable.h>
+
+namespace traph
+{
+    // real = (q - zero_point) * scale
+    struct QuantParams
+    {
+        f32 scale;
+        i32 zero_point;
+    };
+
+    // u8 parameters covering [min, max], the range is widened to contain 0 so that zero
+    // padding and relu outputs are exact
+    inline QuantParams affine_qparams(f32 min, f32 max)
+    {
+        min = std::min(min, 0.f);
+        max = std::max(max, 0.f);
+        if (max == min)
+            return { 1.f, 0 };
+        f32 scale = (max - min) / 255.f;
+        i32 zero_point = static_cast<i32>(std::nearbyint(-min / scale));
+        return { scale, std::min(std::max(zero_point, 0), 255) };
+    }
+
+    // Records the value range of the tensors it sees during calibration. With an averaging
+    // constant of 0 the range is the min/max over all batches, otherwise a moving average of
+    // the per-batch min/max, which is less sensitive to outliers.
+    class MinMaxObserver
+    {
+    private:
+        f32 _averaging_constant;
+        f32 _min;
+        f32 _max;
+        bool _observed;
+    public:
+        MinMaxObserver(f32 averaging_constant = 0.f)
+            :_averaging_constant(averaging_constant), _min(0.f), _max(0.f), _observed(false)
+        {
+        }
+
+        void observe(const TensorBase<f32>& t)
+        {
+            f32 batch_min = t.reduce([](f32 a, f32 b) {return std::min(a, b); });
+            f32 batch_max = t.reduce([](f32 a, f32 b) {return std::max(a, b); });
+            if (!_observed)
+            {
+                _min = batch_min;
+                _max = batch_max;
+                _observed = true;
+            }
+            else if (_averaging_constant > 0.f)
+            {
+                _min += _averaging_constant * (batch_min - _min);
+                _max += _averaging_constant * (batch_max - _max);
+            }
+            else
+            {
+                _min = std::min(_min, batch_min);
+                _max = std::max(_max, batch_max);
+            }
+        }
+
+        bool observed() const { return _observed; }
+        f32 min() const { return _min; }
+        f32 max() const { return _max; }
+        QuantParams qparams() const { return affine_qparams(_min, _max); }
+
+        void reset()
+        {
+            _min = _max = 0.f;
+            _observed = false;
+        }
+    };
+
+    // The int8 layer a float layer runs through once the model is converted, see convert in
+    // layers/quantized_linear.h
+    class QuantizedModule
+    {
+    public:
+        virtual ~QuantizedModule() {}
+        virtual std::shared_ptr<VariableInterface> forward(std::shared_ptr<VariableInterface> input) = 0;
+    };
+}
+
+#endif
@@ -7,6 +7,7 @@
 #include <vector>
 #include <list>
 #include <cassert>
+#include <stdexcept>
 
 #include <traph/core/index.h>
 #include <traph/core/tensor.h>
@@ -27,6 +28,8 @@ namespace traph
     private:
         std::shared_ptr<TensorBase<T>> _data;
         std::shared_ptr<TensorBase<f32>> _grad;
+        // the gradient of a table kept as the rows that were read, instead of _grad
+        std::shared_ptr<SparseRows<f32>> _sparse_grad;
         std::shared_ptr<OpBase> _grad_fn;
         std::vector<VariableInterfacePtr> _inputs;
         // std::vector<std::weak_ptr<VariableInterface>> _outputs;
@@ -64,6 +67,8 @@ namespace traph
         virtual void reshape_(const DimVector& dims) override;
         virtual void resize_(const DimVector& dims) override;
 		virtual DimVector size() const override;
+        virtual std::shared_ptr<SparseRows<f32>> sparse_grad() override;
+        virtual void sparse_grad_(std::shared_ptr<SparseRows<f32>> g) override;
         virtual std::shared_ptr<StorageBase<T>> storage() const override;
 		virtual DimVector stride() const override;
     };
@@ -95,7 +100,7 @@ namespace traph
 	// definition
 	template<typename T>
 	Variable<T>::Variable()
-		:_data(new Tensor<T>), _grad(nullptr),
+		:_data(new Tensor<T>), _grad(nullptr), _sparse_grad(nullptr),
 		_grad_fn(nullptr), _inputs()
 	{
 
@@ -103,21 +108,21 @@ namespace traph
 
 	template<typename T>
 	Variable<T>::Variable(std::shared_ptr<TensorBase<T>> data)
-		:_data(data), _grad(nullptr),
+		:_data(data), _grad(nullptr), _sparse_grad(nullptr),
 		_grad_fn(nullptr), _inputs()
 	{
 	}
 
 	template<typename T>
 	Variable<T>::Variable(const DimVector& dim)
-		:_data(new Tensor<T>(dim)), _grad(nullptr),
+		:_data(new Tensor<T>(dim)), _grad(nullptr), _sparse_grad(nullptr),
 		_grad_fn(nullptr), _inputs()
 	{
 	}
 
 	template<typename T>
 	Variable<T>::Variable(std::initializer_list<idx_type> l)
-		:_data(new Tensor<T>()), _grad(nullptr),
+		:_data(new Tensor<T>()), _grad(nullptr), _sparse_grad(nullptr),
 		_grad_fn(nullptr), _inputs()
 	{
 		DimVector dim;
@@ -142,28 +147,11 @@ namespace traph
 	{
 		_grad->fill_(1);
 
-		std::vector<VariableInterface*> sorted_node = Executor::topology_sort(dynamic_cast<VariableInterface*>(this));
-		for (int i = 0; i < static_cast<int>(sorted_node.size()); ++i)
-		{
-			VariableInterface* cur_node = sorted_node[i];
-			if (cur_node->is_leaf()) continue;
-			std::vector<TensorBasePtr<f32>> back_grad = cur_node->grad_fn()->backward(cur_node->grad());
-
-			assert(back_grad.size() == cur_node->inputs().size());
-			for (int j = 0; j < cur_node->inputs().size(); ++j)
-			{
-				if(cur_node->inputs()[j]->requires_grad())
-					cur_node->inputs()[j]->grad()->add_(back_grad[j]);
-			}
-		}
+		Executor::run_backward(dynamic_cast<VariableInterface*>(this));
 
 		// TODO:retain_graph, retain_all_grad
-		for (int i = static_cast<int>(sorted_node.size()) - 1; i >= 0; --i)
-		{
-			_grad_fn = nullptr;
-			_inputs.clear();
-			// _grad = std::shared_ptr<TensorBase<f32>>(nullptr);
-		}
+		_grad_fn = nullptr;
+		_inputs.clear();
 	}
 
     template<typename T>
@@ -261,12 +249,13 @@ namespace traph
 	template<typename T>
 	bool Variable<T>::requires_grad() const
 	{
-		return bool(_grad);
+		return bool(_grad) || bool(_sparse_grad);
 	}
 
 	template<typename T>
 	void Variable<T>::requires_grad_(bool requires_grad)
 	{
+		_sparse_grad = nullptr;
 		if (requires_grad)
 		{
 			_grad = _data->create_grad();
@@ -296,6 +285,23 @@ namespace traph
 		return _data->size();
 	}
 
+	template<typename T>
+	std::shared_ptr<SparseRows<f32>> Variable<T>::sparse_grad()
+	{
+		return _sparse_grad;
+	}
+
+	// Makes a [rows, dim] variable require a gradient that only holds the rows that were read,
+	// or with null, no gradient.
+	template<typename T>
+	void Variable<T>::sparse_grad_(std::shared_ptr<SparseRows<f32>> g)
+	{
+		if (g && (_data->ndimension() != 2 || g->rows != _data->size(0) || g->dim != _data->size(1)))
+			throw std::runtime_error("sparse_grad_: The gradient shall have the size of the variable.");
+		_sparse_grad = g;
+		_grad = std::shared_ptr<TensorBase<f32>>(nullptr);
+	}
+
 	template<typename T>
 	std::shared_ptr<StorageBase<T>> Variable<T>::storage() const
 	{
@@ -0,0 +1,108 @@
+#ifndef TRAPH_TENSOR_ACTIVATION_H_
+#define TRAPH_TENSOR_ACTIVATION_H_
+
+#include <memory>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	// Elementwise activations and dropout of inputs of any strides into contiguous outputs of
+	// the same size, split between threads on large inputs. ReLU and dropout keep for the
+	// backward pass a mask of one bit per element instead of the input or a float mask: a u8
+	// tensor of mask_bytes(n) bytes where element i is bit i % 8 of byte i / 8, in the row-major
+	// order of the input.
+
+	idx_type mask_bytes(idx_type count);
+
+	// max(x, 0), NaN propagates; with mask, it is set to the bits of x > 0
+	std::shared_ptr<Tensor<f32>> relu_impl(const Tensor<f32>& input, std::shared_ptr<Tensor<u8>>* mask = nullptr);
+
+	std::shared_ptr<Tensor<f64>> relu_impl(const Tensor<f64>& input, std::shared_ptr<Tensor<u8>>* mask = nullptr);
+
+	std::shared_ptr<Tensor<f32>> relu_backward_impl(const Tensor<f32>& grad, const Tensor<u8>& mask);
+
+	std::shared_ptr<Tensor<f64>> relu_backward_impl(const Tensor<f64>& grad, const Tensor<u8>& mask);
+
+	// Zeroes each element with probability p and scales the others by 1 / (1 - p). The bit
+	// of element i comes from a hash of seed and i made in the same pass as the multiply, so
+	// the result does not depend on the number of threads; with mask, it is set to the kept
+	// elements.
+	std::shared_ptr<Tensor<f32>> dropout_impl(const Tensor<f32>& input, f64 p, u64 seed, std::shared_ptr<Tensor<u8>>* mask = nullptr);
+
+	std::shared_ptr<Tensor<f64>> dropout_impl(const Tensor<f64>& input, f64 p, u64 seed, std::shared_ptr<Tensor<u8>>* mask = nullptr);
+
+	std::shared_ptr<Tensor<f32>> dropout_backward_impl(const Tensor<f32>& grad, const Tensor<u8>& mask, f64 p);
+
+	std::shared_ptr<Tensor<f64>> dropout_backward_impl(const Tensor<f64>& grad, const Tensor<u8>& mask, f64 p);
+
+	// x * Phi(x) with the normal distribution function, erf based like torch.nn.GELU
+	std::shared_ptr<Tensor<f32>> gelu_impl(const Tensor<f32>& input);
+
+	std::shared_ptr<Tensor<f64>> gelu_impl(const Tensor<f64>& input);
+
+	std::shared_ptr<Tensor<f32>> gelu_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input);
+
+	std::shared_ptr<Tensor<f64>> gelu_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input);
+
+	std::shared_ptr<Tensor<f32>> sigmoid_impl(const Tensor<f32>& input);
+
+	std::shared_ptr<Tensor<f64>> sigmoid_impl(const Tensor<f64>& input);
+
+	// from the output y of the forward pass, grad * y * (1 - y)
+	std::shared_ptr<Tensor<f32>> sigmoid_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& output);
+
+	std::shared_ptr<Tensor<f64>> sigmoid_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& output);
+
+	// A stage of an elementwise chain, from the value x of the chain so far: x + s, x - s or
+	// s - x for a side tensor s, or an activation of x.
+	enum class ChainKind
+	{
+		ADD,
+		SUB,
+		RSUB,
+		RELU,
+		GELU,
+		SIGMOID,
+		POW
+	};
+
+	struct ChainStage
+	{
+		ChainKind kind;
+		// the index of s in the sides, for ADD, SUB and RSUB
+		idx_type side = -1;
+		// for POW
+		f32 exp = 1;
+	};
+
+	const idx_type max_chain_stages = 16;
+
+	// The stages applied in order to each element of an input of any strides in one pass,
+	// into a contiguous tensor of its size, without a tensor between two stages. A side has
+	// the size of the input or of its trailing dimensions and is broadcast over the leading
+	// ones. A stage computes as the op it stands for does, so the result is that of the ops
+	// run one after another.
+	std::shared_ptr<Tensor<f32>> elementwise_chain_impl(const Tensor<f32>& input, const std::vector<const Tensor<f32>*>& sides,
+		const std::vector<ChainStage>& stages);
+
+	std::shared_ptr<Tensor<f64>> elementwise_chain_impl(const Tensor<f64>& input, const std::vector<const Tensor<f64>*>& sides,
+		const std::vector<ChainStage>& stages);
+
+	// The gradients of the input and then of each side from the gradient of the output; the
+	// values of the stages are computed again from the input instead of being kept. The
+	// gradient of side i is null unless side_grads[i], and a broadcast side gets the sum over
+	// the dimensions it is broadcast along.
+	std::vector<std::shared_ptr<Tensor<f32>>> elementwise_chain_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input,
+		const std::vector<const Tensor<f32>*>& sides, const std::vector<ChainStage>& stages, const std::vector<bool>& side_grads);
+
+	std::vector<std::shared_ptr<Tensor<f64>>> elementwise_chain_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input,
+		const std::vector<const Tensor<f64>*>& sides, const std::vector<ChainStage>& stages, const std::vector<bool>& side_grads);
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <utility>
 #include <cmath>
 #include <memory>
+#include <vector>
 
 #include <traph/core/type.h>
 #include <traph/core/index.h>
@@ -15,38 +16,99 @@ namespace traph
 	template<typename T>
 	class Tensor;
 
+	// a and b are matrices or batches of matrices, the batch dimensions (all but the
+	// last two) are right aligned and broadcast against each other
 	template<class T>
 	void matmul_check(const Tensor<T>& a, const Tensor<T>& b)
 	{
+		idx_type a_dims = a.ndimension(), b_dims = b.ndimension();
 		// check dimension
-		if (a.size().size() > 2 || b.size().size() > 2)
+		if (a_dims < 2 || b_dims < 2)
 		{
-			throw std::runtime_error("matmul: Two parameters shall be matrix (2D).");
+			throw std::runtime_error("matmul: Two parameters shall be matrix (2D) or batch of matrices.");
 		}
-		// check a[1]  and b[0]
-		if (a.size()[1] != b.size()[0])
+		// check a[-1] and b[-2]
+		if (a.size(a_dims - 1) != b.size(b_dims - 2))
 		{
-			throw std::runtime_error("matmul: Dimension 0 of the first matrix shall be equal to dimension 1 of the second matrix.");
+			throw std::runtime_error("matmul: The last dimension of the first matrix shall be equal to the second last dimension of the second matrix.");
 		}
+		// check batch dimensions
+		for (idx_type i = 3; i <= std::min(a_dims, b_dims); ++i)
+		{
+			idx_type a_size = a.size(a_dims - i), b_size = b.size(b_dims - i);
+			if (a_size != b_size && a_size != 1 && b_size != 1)
+			{
+				throw std::runtime_error("matmul: The batch dimensions shall be broadcastable.");
+			}
+		}
+	}
+
+	template<class T>
+	void bmm_check(const Tensor<T>& a, const Tensor<T>& b)
+	{
+		if (a.ndimension() != 3 || b.ndimension() != 3)
+		{
+			throw std::runtime_error("bmm: Two parameters shall be batch of matrices (3D).");
+		}
+		if (a.size(0) != b.size(0))
+		{
+			throw std::runtime_error("bmm: The batch size of two parameters shall be equal.");
+		}
+		matmul_check(a, b);
 	}
 
+	// matmul_impl(a, b) returns a new row-major tensor, matmul_impl(a, b, out, accumulate)
+	// writes out = a * b, or out += a * b when accumulate is set, directly into out; out shall
+	// not share its storage with a or b.
+	// Batches run one gemm per matrix, spread over threads when the matrices are small.
 	std::shared_ptr<Tensor<u8>> matmul_impl(const Tensor<u8>& a, const Tensor<u8>& b);
 
+	void matmul_impl(const Tensor<u8>& a, const Tensor<u8>& b, Tensor<u8>& out, bool accumulate);
+
 	std::shared_ptr<Tensor<i8>> matmul_impl(const Tensor<i8>& a, const Tensor<i8>& b);
 
+	void matmul_impl(const Tensor<i8>& a, const Tensor<i8>& b, Tensor<i8>& out, bool accumulate);
+
 	std::shared_ptr<Tensor<i16>> matmul_impl(const Tensor<i16>& a, const Tensor<i16>& b);
 
+	void matmul_impl(const Tensor<i16>& a, const Tensor<i16>& b, Tensor<i16>& out, bool accumulate);
+
 	std::shared_ptr<Tensor<i32>> matmul_impl(const Tensor<i32>& a, const Tensor<i32>& b);
 
+	void matmul_impl(const Tensor<i32>& a, const Tensor<i32>& b, Tensor<i32>& out, bool accumulate);
+
 	std::shared_ptr<Tensor<i64>> matmul_impl(const Tensor<i64>& a, const Tensor<i64>& b);
 
+	void matmul_impl(const Tensor<i64>& a, const Tensor<i64>& b, Tensor<i64>& out, bool accumulate);
+
 	std::shared_ptr<Tensor<f32>> matmul_impl(const Tensor<f32>& a, const Tensor<f32>& b);
 
+	void matmul_impl(const Tensor<f32>& a, const Tensor<f32>& b, Tensor<f32>& out, bool accumulate);
+
 	std::shared_ptr<Tensor<f64>> matmul_impl(const Tensor<f64>& a, const Tensor<f64>& b);
 
-	std::shared_ptr<Tensor<f32>> inverse_impl(const Tensor<f32>& a);
+	void matmul_impl(const Tensor<f64>& a, const Tensor<f64>& b, Tensor<f64>& out, bool accumulate);
+
+	// gradients of matmul(a, b) with respect to a and b, reduced over broadcast batch dimensions
+	std::shared_ptr<Tensor<f32>> matmul_backward_left_impl(const Tensor<f32>& grad, const Tensor<f32>& b, const DimVector& a_size);
+
+	std::shared_ptr<Tensor<f32>> matmul_backward_right_impl(const Tensor<f32>& grad, const Tensor<f32>& a, const DimVector& b_size);
+
+	std::shared_ptr<Tensor<f64>> matmul_backward_left_impl(const Tensor<f64>& grad, const Tensor<f64>& b, const DimVector& a_size);
+
+	std::shared_ptr<Tensor<f64>> matmul_backward_right_impl(const Tensor<f64>& grad, const Tensor<f64>& a, const DimVector& b_size);
+
+	// y = x * w^T + bias for an input of [..., in], a weight of [out, in] and a bias of [out]
+	// or null. The row-major weight is read in place as the transposed operand: every output
+	// feature is a contiguous row, so thin inputs become dot products (see native_thin_gemm).
+	std::shared_ptr<Tensor<f32>> linear_impl(const Tensor<f32>& input, const Tensor<f32>& weight, const Tensor<f32>* bias);
+
+	std::shared_ptr<Tensor<f64>> linear_impl(const Tensor<f64>& input, const Tensor<f64>& weight, const Tensor<f64>* bias);
+
+	// gradients of linear with respect to the input, the weight and, with with_bias, the bias
+	std::vector<std::shared_ptr<Tensor<f32>>> linear_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, const Tensor<f32>& weight, bool with_bias);
 
-	std::shared_ptr<Tensor<f64>> inverse_impl(const Tensor<f64>& a);
+	std::vector<std::shared_ptr<Tensor<f64>>> linear_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, const Tensor<f64>& weight, bool with_bias);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef TRAPH_TENSOR_ATTENTION_H_
+#define TRAPH_TENSOR_ATTENTION_H_
+
+#include <memory>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	template<typename T>
+	class KVCacheLayer;
+
+	struct AttentionParams
+	{
+		// query i sees the keys j <= i + Lk - Lq, so that the last query is aligned with the
+		// last key as when the queries continue a cached prefix
+		bool causal = false;
+		// 0 for 1 / sqrt(D)
+		double scale = 0;
+	};
+
+	// softmax(q k^T * scale) v for q [B, H, Lq, D], k [B, H, Lk, D] and v [B, H, Lk, Dv] of any
+	// strides, into a contiguous [B, H, Lq, Dv] output. key_padding_mask is a [B, Lk] u8
+	// tensor or null, the keys where it is nonzero are ignored. Queries that see no key get
+	// a zero output.
+	// Blocks of queries run over blocks of keys with an online softmax: the scores of one pair
+	// of blocks are a gemm into a small buffer, and the running maximum and sum of every query
+	// rescale its output, so no [Lq, Lk] matrix is made. Heads and query blocks are split
+	// between threads. With lse, it is set to the [B, H, Lq] log-sum-exp of the scaled scores
+	// of each query, -inf when it sees no key, which is all the backward pass keeps.
+	std::shared_ptr<Tensor<f32>> scaled_dot_product_attention_impl(const Tensor<f32>& q, const Tensor<f32>& k, const Tensor<f32>& v,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params, std::shared_ptr<Tensor<f32>>* lse = nullptr);
+
+	std::shared_ptr<Tensor<f64>> scaled_dot_product_attention_impl(const Tensor<f64>& q, const Tensor<f64>& k, const Tensor<f64>& v,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params, std::shared_ptr<Tensor<f64>>* lse = nullptr);
+
+	// Gradients of q, k and v from the gradient of the output, the output and the lse of the
+	// forward pass. The probabilities of each pair of blocks are computed again from the
+	// scores and lse instead of being stored; heads are split between threads.
+	std::vector<std::shared_ptr<Tensor<f32>>> scaled_dot_product_attention_backward_impl(const Tensor<f32>& grad,
+		const Tensor<f32>& q, const Tensor<f32>& k, const Tensor<f32>& v, const Tensor<f32>& output, const Tensor<f32>& lse,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params);
+
+	std::vector<std::shared_ptr<Tensor<f64>>> scaled_dot_product_attention_backward_impl(const Tensor<f64>& grad,
+		const Tensor<f64>& q, const Tensor<f64>& k, const Tensor<f64>& v, const Tensor<f64>& output, const Tensor<f64>& lse,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params);
+
+	// Attention of q [B, H, Lq, D] over the keys and values one layer of a KVCache holds for
+	// each of B sequences, of any lengths, into a contiguous [B, H, Lq, D] output. With a
+	// causal mask the queries are the last Lq tokens of their sequence. The blocks of each
+	// sequence are read in place with the kernel of scaled_dot_product_attention_impl, so one
+	// step of decoding costs the length of the sequence.
+	std::shared_ptr<Tensor<f32>> paged_attention_impl(const Tensor<f32>& q, const KVCacheLayer<f32>& cache,
+		const std::vector<idx_type>& sequences, const AttentionParams& params);
+
+	std::shared_ptr<Tensor<f64>> paged_attention_impl(const Tensor<f64>& q, const KVCacheLayer<f64>& cache,
+		const std::vector<idx_type>& sequences, const AttentionParams& params);
+}
+
+#endif
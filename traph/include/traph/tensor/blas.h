@@ -0,0 +1,94 @@
+#ifndef TRAPH_TENSOR_BLAS_H_
+#define TRAPH_TENSOR_BLAS_H_
+
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <traph/core/type.h>
+
+namespace traph
+{
+	// C = alpha * A * B + beta * C with the strided layout of native_gemm. A backend returns
+	// false when it can not address the given strides, the native gemm is used instead.
+	using SgemmFunction = bool(*)(idx_type m, idx_type n, idx_type k, f32 alpha,
+		const f32* a, idx_type a_rs, idx_type a_cs,
+		const f32* b, idx_type b_rs, idx_type b_cs,
+		f32 beta, f32* c, idx_type c_rs, idx_type c_cs);
+
+	using DgemmFunction = bool(*)(idx_type m, idx_type n, idx_type k, f64 alpha,
+		const f64* a, idx_type a_rs, idx_type a_cs,
+		const f64* b, idx_type b_rs, idx_type b_cs,
+		f64 beta, f64* c, idx_type c_rs, idx_type c_cs);
+
+	// Gemm backends available at runtime ("native", "eigen", and "mkl" or "openblas" when
+	// compiled in). Shapes are grouped into buckets by the power of two of m, n and k, the
+	// data type and whether A and B are transposed; on first use of a bucket every backend is
+	// timed on that shape and the fastest one is used from then on. Decisions are appended
+	// to a cache file and read back on start when one is given, by TRAPH_BLAS_CACHE or
+	// cache_path_; there is none by default.
+	class BlasRegistry
+	{
+	private:
+		struct Backend
+		{
+			std::string name;
+			SgemmFunction sgemm;
+			DgemmFunction dgemm;
+		};
+		// dtype, trans_a, trans_b, m, n, k buckets
+		using BucketKey = std::tuple<int, bool, bool, int, int, int>;
+
+		mutable std::shared_mutex _mutex;
+		std::vector<Backend> _backends;
+		std::map<BucketKey, std::string> _choices;
+		std::string _forced;
+		bool _autotune;
+		std::string _cache_path;
+
+		BlasRegistry();
+		void load_cache();
+		void store_choice(const BucketKey& key, const std::string& name);
+		std::size_t find_backend(const std::string& name) const;
+		std::size_t tune(const BucketKey& key, DataType dtype, idx_type m, idx_type n, idx_type k, bool trans_a, bool trans_b);
+		std::size_t choose(DataType dtype, idx_type m, idx_type n, idx_type k, bool trans_a, bool trans_b);
+	public:
+		BlasRegistry(const BlasRegistry&) = delete;
+		BlasRegistry& operator=(const BlasRegistry&) = delete;
+
+		static BlasRegistry& get();
+
+		// a backend registered again under the same name replaces the old one
+		void register_backend(const std::string& name, SgemmFunction sgemm, DgemmFunction dgemm);
+		std::vector<std::string> backends() const;
+
+		// run every gemm on one backend, an empty name returns to per-bucket selection
+		void backend_(const std::string& name);
+		std::string backend() const;
+		void autotune_(bool enable);
+		bool autotune() const;
+		// empty path disables the cache file, the current choices are kept
+		void cache_path_(const std::string& path);
+		std::string cache_path() const;
+		// forgets all bucket decisions (not the cache file)
+		void clear_choices();
+
+		// name of the backend gemms of this shape run on, tunes the bucket if needed
+		std::string select(DataType dtype, idx_type m, idx_type n, idx_type k, bool trans_a, bool trans_b);
+
+		void gemm(idx_type m, idx_type n, idx_type k, f32 alpha,
+			const f32* a, idx_type a_rs, idx_type a_cs,
+			const f32* b, idx_type b_rs, idx_type b_cs,
+			f32 beta, f32* c, idx_type c_rs, idx_type c_cs);
+
+		void gemm(idx_type m, idx_type n, idx_type k, f64 alpha,
+			const f64* a, idx_type a_rs, idx_type a_cs,
+			const f64* b, idx_type b_rs, idx_type b_cs,
+			f64 beta, f64* c, idx_type c_rs, idx_type c_cs);
+	};
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef TRAPH_TENSOR_CONV_H_
+#define TRAPH_TENSOR_CONV_H_
+
+#include <memory>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	struct Conv2dParams
+	{
+		idx_type stride_h = 1, stride_w = 1;
+		idx_type padding_h = 0, padding_w = 0;
+		idx_type dilation_h = 1, dilation_w = 1;
+		idx_type groups = 1;
+	};
+
+	enum class ConvAlgorithm
+	{
+		// the cheapest algorithm by a cost model, or the fastest one measured on the first call
+		// for each shape with conv2d_benchmark_(true)
+		AUTO,
+		IM2COL,
+		// direct kernels for every f32 3x3 and 1x1 kernel without groups
+		DIRECT,
+		// Winograd F(2x2, 3x3) and F(4x4, 3x3) for 3x3 kernels with unit stride and dilation
+		WINOGRAD_2X2,
+		WINOGRAD_4X4,
+		// products of the spectra of the zero padded input and kernel, for unit stride and
+		// dilation; the cost does not grow with the kernel size
+		FFT
+	};
+
+	// output size of one spatial dimension
+	idx_type conv_output_size(idx_type input, idx_type kernel, idx_type stride, idx_type padding, idx_type dilation);
+
+	// y = conv2d(x, w) + bias for an [N, C, H, W] input, an [O, C / groups, KH, KW] weight and
+	// a bias of [O] or null, the result is [N, O, OH, OW]. Every image and group is one gemm of
+	// the weight with the im2col matrix of the image, 1x1 kernels with unit stride multiply the
+	// input in place. Other algorithms may run instead, see ConvAlgorithm: the direct kernels
+	// for f32 3x3 kernels without groups (native_direct_conv2d), Winograd and FFT for unit
+	// stride and dilation. The gradients always use im2col.
+	std::shared_ptr<Tensor<f32>> conv2d_impl(const Tensor<f32>& input, const Tensor<f32>& weight, const Tensor<f32>* bias, const Conv2dParams& params);
+
+	std::shared_ptr<Tensor<f64>> conv2d_impl(const Tensor<f64>& input, const Tensor<f64>& weight, const Tensor<f64>* bias, const Conv2dParams& params);
+
+	// gradients with respect to the input, the weight and, with with_bias, the bias
+	std::vector<std::shared_ptr<Tensor<f32>>> conv2d_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, const Tensor<f32>& weight, bool with_bias, const Conv2dParams& params);
+
+	std::vector<std::shared_ptr<Tensor<f64>>> conv2d_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, const Tensor<f64>& weight, bool with_bias, const Conv2dParams& params);
+
+	// Blocking of the direct convolution kernels of this cpu: weights are blocked by `lanes`
+	// output channels, inputs by up to `channel_block` input channels, and rows are computed
+	// in tiles of `tile_width` output pixels.
+	struct DirectConvLayout
+	{
+		idx_type lanes, channel_block, tile_width;
+	};
+
+	DirectConvLayout native_direct_conv2d_layout();
+
+	// Direct convolution of one image with groups == 1. The input is padded and channel
+	// blocked, [C / cb][HP][WP][cb] for a cb up to layout.channel_block, and followed by
+	// tile_width * stride_w * cb readable floats: the last tile of a row may read past it. The
+	// weight is [O / lanes][C / cb][KH][KW][cb][lanes], zero past C and O. The output
+	// [O, OH, OW] is contiguous. Rows of output channel blocks are split between threads.
+	void native_direct_conv2d(idx_type channel_blocks, idx_type channel_block, idx_type padded_h, idx_type padded_w,
+		const f32* input, idx_type out_channels, idx_type kernel_h, idx_type kernel_w, const f32* weight, const f32* bias,
+		const Conv2dParams& params, idx_type out_h, idx_type out_w, f32* output);
+
+	// the algorithm conv2d_impl uses, AUTO by default; a forced algorithm that does not apply
+	// to a shape falls back to IM2COL
+	ConvAlgorithm conv2d_algorithm();
+
+	void conv2d_algorithm_(ConvAlgorithm algorithm);
+
+	// whether the algorithm can compute a convolution of these shapes and dtype
+	bool conv2d_algorithm_applies(ConvAlgorithm algorithm, DataType dtype, const DimVector& input, const DimVector& weight, const Conv2dParams& params);
+
+	// the algorithm conv2d_impl runs for these tensors, benchmarking the candidates when
+	// conv2d_benchmark() is on and the shape is not cached yet
+	ConvAlgorithm conv2d_find_algorithm(const Tensor<f32>& input, const Tensor<f32>& weight, const Conv2dParams& params);
+
+	ConvAlgorithm conv2d_find_algorithm(const Tensor<f64>& input, const Tensor<f64>& weight, const Conv2dParams& params);
+
+	// With benchmarking on, AUTO times every applicable algorithm on the first convolution of
+	// each dtype, shape, parameters and thread count and keeps the fastest, like the algorithm
+	// finder of cuDNN. Off by default: the first call of each shape then costs several.
+	bool conv2d_benchmark();
+
+	void conv2d_benchmark_(bool enabled);
+
+	idx_type conv2d_algorithm_cache_size();
+
+	void conv2d_clear_algorithm_cache();
+
+	// number of times a thread grew its scratch memory, repeated convolutions of the same
+	// shapes reuse it
+	idx_type conv_workspace_allocations();
+}
+
+#endif
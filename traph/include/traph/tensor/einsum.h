@@ -0,0 +1,66 @@
+#ifndef TRAPH_TENSOR_EINSUM_H_
+#define TRAPH_TENSOR_EINSUM_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/core/index.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	// Labels of every dimension of the operands and of the result. A label repeated inside one
+	// operand takes the diagonal, labels missing from the output are summed over.
+	struct EinsumEquation
+	{
+		std::vector<std::vector<int>> inputs;
+		std::vector<int> output;
+	};
+
+	// Parses "ij,jk->ik" (letters only). Without "->" the output holds the labels that occur
+	// exactly once, in alphabetical order.
+	EinsumEquation parse_einsum(const std::string& spec);
+
+	// Contraction order for operands of the given shapes, as pairs of positions in the list of
+	// pending operands: both are removed and their product is appended, like numpy's
+	// einsum_path. Small contractions get the order with the fewest flops (ties go to smaller
+	// intermediates), larger ones contract the cheapest pair first. Plans are cached per
+	// equation and shapes.
+	std::vector<std::pair<idx_type, idx_type>> einsum_path(const EinsumEquation& equation, const std::vector<DimVector>& shapes);
+
+	idx_type einsum_plan_cache_size();
+
+	void einsum_clear_plan_cache();
+
+	// Every pairwise step runs as a batched gemm on strided views of its operands, an operand
+	// is only copied when its dimensions can not be grouped into the matrix rows and columns.
+	std::shared_ptr<Tensor<f32>> einsum_impl(const EinsumEquation& equation, const std::vector<const Tensor<f32>*>& operands);
+
+	std::shared_ptr<Tensor<f64>> einsum_impl(const EinsumEquation& equation, const std::vector<const Tensor<f64>*>& operands);
+
+	std::shared_ptr<Tensor<f32>> einsum_impl(const std::string& spec, const std::vector<const Tensor<f32>*>& operands);
+
+	std::shared_ptr<Tensor<f64>> einsum_impl(const std::string& spec, const std::vector<const Tensor<f64>*>& operands);
+
+	// gradient of einsum with respect to every operand, as einsums of the gradient and the
+	// other operands. Operands with a repeated label are not supported.
+	std::vector<std::shared_ptr<Tensor<f32>>> einsum_backward_impl(const Tensor<f32>& grad, const EinsumEquation& equation, const std::vector<const Tensor<f32>*>& operands);
+
+	std::vector<std::shared_ptr<Tensor<f64>>> einsum_backward_impl(const Tensor<f64>& grad, const EinsumEquation& equation, const std::vector<const Tensor<f64>*>& operands);
+
+	// equation of tensordot: dims_a[i] of a is contracted with dims_b[i] of b, the result holds
+	// the other dimensions of a followed by the other dimensions of b
+	EinsumEquation tensordot_equation(idx_type a_dims, idx_type b_dims, const std::vector<idx_type>& dims_a, const std::vector<idx_type>& dims_b);
+
+	std::shared_ptr<Tensor<f32>> tensordot_impl(const Tensor<f32>& a, const Tensor<f32>& b, const std::vector<idx_type>& dims_a, const std::vector<idx_type>& dims_b);
+
+	std::shared_ptr<Tensor<f64>> tensordot_impl(const Tensor<f64>& a, const Tensor<f64>& b, const std::vector<idx_type>& dims_a, const std::vector<idx_type>& dims_b);
+}
+
+#endif
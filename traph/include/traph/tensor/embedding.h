@@ -0,0 +1,90 @@
+#ifndef TRAPH_TENSOR_EMBEDDING_H_
+#define TRAPH_TENSOR_EMBEDDING_H_
+
+#include <memory>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	// A [rows, dim] table of which only some rows are nonzero, the gradient of a table that was
+	// only partly read. values[i] is the row indices[i]; indices are sorted and unique, and
+	// values is a contiguous [indices.size(), dim] tensor, or null when no row is set.
+	template<typename T>
+	struct SparseRows
+	{
+		idx_type rows = 0, dim = 0;
+		std::vector<idx_type> indices;
+		std::shared_ptr<Tensor<T>> values;
+
+		SparseRows() = default;
+
+		SparseRows(idx_type table_rows, idx_type table_dim)
+			:rows(table_rows), dim(table_dim)
+		{
+		}
+
+		idx_type nnz() const { return static_cast<idx_type>(indices.size()); }
+
+		void clear()
+		{
+			indices.clear();
+			values = nullptr;
+		}
+	};
+
+	enum class EmbeddingBagMode
+	{
+		SUM,
+		MEAN
+	};
+
+	// Lookups in a [rows, dim] table of any strides. The indices are i64 of any shape and strides
+	// and are checked against the table; outputs are contiguous. Output rows are gathered in
+	// parallel, and gradients are coalesced into the rows that were read, each summed over its
+	// lookups in order, so that they do not depend on the number of threads.
+
+	// [*indices.size(), dim] rows of weight
+	std::shared_ptr<Tensor<f32>> embedding_impl(const Tensor<f32>& weight, const Tensor<i64>& indices);
+
+	std::shared_ptr<Tensor<f64>> embedding_impl(const Tensor<f64>& weight, const Tensor<i64>& indices);
+
+	// gradient of a table of rows rows from the [*indices.size(), dim] gradient of the output
+	std::shared_ptr<SparseRows<f32>> embedding_backward_impl(const Tensor<f32>& grad, const Tensor<i64>& indices, idx_type rows);
+
+	std::shared_ptr<SparseRows<f64>> embedding_backward_impl(const Tensor<f64>& grad, const Tensor<i64>& indices, idx_type rows);
+
+	// [bags, dim] sums or means of bags of rows. With offsets, indices is 1-D and bag b is
+	// indices[offsets[b], offsets[b + 1]) with the last bag running to the end; offsets start at
+	// 0 and do not decrease. Without, indices is [bags, length]. Empty bags are 0.
+	std::shared_ptr<Tensor<f32>> embedding_bag_impl(const Tensor<f32>& weight, const Tensor<i64>& indices, const Tensor<i64>* offsets, EmbeddingBagMode mode);
+
+	std::shared_ptr<Tensor<f64>> embedding_bag_impl(const Tensor<f64>& weight, const Tensor<i64>& indices, const Tensor<i64>* offsets, EmbeddingBagMode mode);
+
+	std::shared_ptr<SparseRows<f32>> embedding_bag_backward_impl(const Tensor<f32>& grad, const Tensor<i64>& indices, const Tensor<i64>* offsets, idx_type rows, EmbeddingBagMode mode);
+
+	std::shared_ptr<SparseRows<f64>> embedding_bag_backward_impl(const Tensor<f64>& grad, const Tensor<i64>& indices, const Tensor<i64>* offsets, idx_type rows, EmbeddingBagMode mode);
+
+	// lhs += rhs, merging their rows
+	void sparse_rows_add_(SparseRows<f32>& lhs, const SparseRows<f32>& rhs);
+
+	void sparse_rows_add_(SparseRows<f64>& lhs, const SparseRows<f64>& rhs);
+
+	// contiguous [rows, dim] tensor of the table
+	std::shared_ptr<Tensor<f32>> sparse_rows_to_dense(const SparseRows<f32>& rows);
+
+	std::shared_ptr<Tensor<f64>> sparse_rows_to_dense(const SparseRows<f64>& rows);
+
+	// table[indices[i]] += alpha * values[i] for a [rows, dim] table of any strides, touching
+	// only those rows
+	void index_add_rows_(Tensor<f32>& table, const SparseRows<f32>& rows, f32 alpha);
+
+	void index_add_rows_(Tensor<f64>& table, const SparseRows<f64>& rows, f64 alpha);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef TRAPH_TENSOR_GEMM_H_
+#define TRAPH_TENSOR_GEMM_H_
+
+#include <traph/core/type.h>
+
+namespace traph
+{
+	enum class GemmIsa
+	{
+		GENERIC,
+		AVX2,
+		AVX512
+	};
+
+	// C = alpha * A * B + beta * C
+	// A is m x k, B is k x n and C is m x n, every matrix is given by its row and column
+	// stride, so transposed and sliced views are packed straight from their storage.
+	// When beta is zero C is not read.
+	void native_gemm(idx_type m, idx_type n, idx_type k, f32 alpha,
+		const f32* a, idx_type a_rs, idx_type a_cs,
+		const f32* b, idx_type b_rs, idx_type b_cs,
+		f32 beta, f32* c, idx_type c_rs, idx_type c_cs);
+
+	void native_gemm(idx_type m, idx_type n, idx_type k, f64 alpha,
+		const f64* a, idx_type a_rs, idx_type a_cs,
+		const f64* b, idx_type b_rs, idx_type b_cs,
+		f64 beta, f64* c, idx_type c_rs, idx_type c_cs);
+
+	// C = alpha * A * B + beta * C for C with at most 4 rows, without packing. Handles rows of
+	// A and columns of B with unit stride (dot products) or rows of B with unit stride (scaled
+	// rows of B), returns false for other layouts. native_gemm tries it first for C with few
+	// rows or, transposed, few columns.
+	bool native_thin_gemm(idx_type m, idx_type n, idx_type k, f32 alpha,
+		const f32* a, idx_type a_rs, idx_type a_cs,
+		const f32* b, idx_type b_rs, idx_type b_cs,
+		f32 beta, f32* c, idx_type c_rs, idx_type c_cs);
+
+	bool native_thin_gemm(idx_type m, idx_type n, idx_type k, f64 alpha,
+		const f64* a, idx_type a_rs, idx_type a_cs,
+		const f64* b, idx_type b_rs, idx_type b_cs,
+		f64 beta, f64* c, idx_type c_rs, idx_type c_cs);
+
+	// micro-kernel instruction set, picked from cpu_features() on first use
+	GemmIsa native_gemm_isa();
+	// force a micro-kernel, sets wider than the cpu supports are clamped
+	void native_gemm_isa_(GemmIsa isa);
+}
+
+#endif
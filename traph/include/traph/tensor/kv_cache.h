@@ -0,0 +1,97 @@
+#ifndef TRAPH_TENSOR_KV_CACHE_H_
+#define TRAPH_TENSOR_KV_CACHE_H_
+
+#include <memory>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	template<typename T>
+	class KVCacheLayer;
+
+	// Keys and values of the tokens seen so far by a set of sequences, for every layer of a
+	// decoder. Memory is a pool of blocks allocated once; a block holds block_size tokens of
+	// every head in every layer, and each sequence has a table of the blocks it uses in order,
+	// so sequences of different lengths grow one block at a time without moving what is
+	// stored and return their blocks to the pool when removed. Within a layer a block of one
+	// head is a contiguous [block_size, head_dim] matrix.
+	template<typename T>
+	class KVCache
+	{
+	private:
+		struct Sequence
+		{
+			bool active = false;
+			idx_type length = 0;
+			std::vector<idx_type> blocks;
+		};
+
+		idx_type _layers, _heads, _head_dim, _block_size, _num_blocks;
+		// [layers, blocks, heads, block_size, head_dim]
+		std::vector<T> _keys, _values;
+		std::vector<idx_type> _free_blocks;
+		std::vector<Sequence> _sequences;
+
+		const Sequence& sequence(idx_type id) const;
+		std::size_t block_offset(idx_type layer, idx_type block, idx_type head) const;
+	public:
+		KVCache(idx_type layers, idx_type heads, idx_type head_dim, idx_type block_size, idx_type num_blocks);
+
+		// a new empty sequence; ids of removed sequences are used again
+		idx_type add_sequence();
+		void remove_sequence(idx_type id);
+
+		// Makes room for count more tokens at the end of each sequence, for all layers; the
+		// layers then write them with KVCacheLayer::write. Throws, changing nothing, when the
+		// pool has too few free blocks.
+		void append(const std::vector<idx_type>& sequences, idx_type count);
+
+		idx_type length(idx_type id) const;
+		const std::vector<idx_type>& blocks(idx_type id) const;
+
+		KVCacheLayer<T> layer(idx_type index);
+
+		idx_type layers() const { return _layers; }
+		idx_type heads() const { return _heads; }
+		idx_type head_dim() const { return _head_dim; }
+		idx_type block_size() const { return _block_size; }
+		idx_type num_blocks() const { return _num_blocks; }
+		idx_type free_blocks() const { return static_cast<idx_type>(_free_blocks.size()); }
+
+		// [block_size, head_dim] keys and values of one head in one block
+		T* keys(idx_type layer, idx_type block, idx_type head);
+		const T* keys(idx_type layer, idx_type block, idx_type head) const;
+		T* values(idx_type layer, idx_type block, idx_type head);
+		const T* values(idx_type layer, idx_type block, idx_type head) const;
+	};
+
+	// One layer of a KVCache, which shall outlive it.
+	template<typename T>
+	class KVCacheLayer
+	{
+	private:
+		KVCache<T>* _cache;
+		idx_type _index;
+	public:
+		KVCacheLayer(KVCache<T>& cache, idx_type index);
+
+		// [B, H, n, D] keys and values of any strides into the last n tokens of each of the B
+		// sequences, after KVCache::append
+		void write(const std::vector<idx_type>& sequences, const Tensor<T>& keys, const Tensor<T>& values);
+
+		// [H, length, D] copies of what a sequence has stored
+		std::shared_ptr<Tensor<T>> keys(idx_type id) const;
+		std::shared_ptr<Tensor<T>> values(idx_type id) const;
+
+		KVCache<T>& cache() const { return *_cache; }
+		idx_type index() const { return _index; }
+	};
+}
+
+#endif
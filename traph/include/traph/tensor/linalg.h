@@ -0,0 +1,69 @@
+#ifndef TRAPH_TENSOR_LINALG_H_
+#define TRAPH_TENSOR_LINALG_H_
+
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	// Every routine takes matrices or batches of matrices: the last two dimensions hold the
+	// matrix, the leading ones the batch. Batches are factorised one matrix per thread. The
+	// factorisations are Eigen's blocked ones, which call LAPACK when the build links MKL or
+	// OpenBLAS. Prefer solve, lu_solve or cholesky_solve to multiplying by an explicit
+	// inverse: they are cheaper and more accurate.
+
+	// LU factorisation with partial pivoting, a[pivots[i]] is row i of L * U. The first
+	// tensor holds L (unit diagonal, not stored) below the diagonal and U on and above it.
+	std::pair<std::shared_ptr<Tensor<f32>>, std::shared_ptr<Tensor<i32>>> lu_impl(const Tensor<f32>& a);
+
+	std::pair<std::shared_ptr<Tensor<f64>>, std::shared_ptr<Tensor<i32>>> lu_impl(const Tensor<f64>& a);
+
+	// x with a * x = b for the factors of lu_impl. b is [..., n, k] with batch dimensions
+	// broadcast against the ones of lu, or a vector of n values.
+	std::shared_ptr<Tensor<f32>> lu_solve_impl(const Tensor<f32>& lu, const Tensor<i32>& pivots, const Tensor<f32>& b);
+
+	std::shared_ptr<Tensor<f64>> lu_solve_impl(const Tensor<f64>& lu, const Tensor<i32>& pivots, const Tensor<f64>& b);
+
+	// x with a * x = b, every matrix of a is factorised once however often b broadcasts it.
+	// Throws when a matrix is singular.
+	std::shared_ptr<Tensor<f32>> solve_impl(const Tensor<f32>& a, const Tensor<f32>& b);
+
+	std::shared_ptr<Tensor<f64>> solve_impl(const Tensor<f64>& a, const Tensor<f64>& b);
+
+	// L with a = L * L^T for a symmetric positive definite a (only its lower triangle is read),
+	// or U = L^T with upper set. Throws when a is not positive definite.
+	std::shared_ptr<Tensor<f32>> cholesky_impl(const Tensor<f32>& a, bool upper);
+
+	std::shared_ptr<Tensor<f64>> cholesky_impl(const Tensor<f64>& a, bool upper);
+
+	// x with a * x = b for the factor of cholesky_impl, b as in lu_solve_impl
+	std::shared_ptr<Tensor<f32>> cholesky_solve_impl(const Tensor<f32>& factor, const Tensor<f32>& b, bool upper);
+
+	std::shared_ptr<Tensor<f64>> cholesky_solve_impl(const Tensor<f64>& factor, const Tensor<f64>& b, bool upper);
+
+	// reduced QR of an m x n matrix, Q is m x min(m, n) with orthonormal columns and R is
+	// min(m, n) x n upper triangular
+	std::pair<std::shared_ptr<Tensor<f32>>, std::shared_ptr<Tensor<f32>>> qr_impl(const Tensor<f32>& a);
+
+	std::pair<std::shared_ptr<Tensor<f64>>, std::shared_ptr<Tensor<f64>>> qr_impl(const Tensor<f64>& a);
+
+	// inverse of every matrix, through the LU factorisation. Throws when a matrix is singular.
+	std::shared_ptr<Tensor<f32>> inverse_impl(const Tensor<f32>& a);
+
+	std::shared_ptr<Tensor<f64>> inverse_impl(const Tensor<f64>& a);
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> inverse_impl(const Tensor<T>& a)
+	{
+		throw std::runtime_error("inverse: Only float and double tensors can be inverted.");
+	}
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef TRAPH_TENSOR_POOLING_H_
+#define TRAPH_TENSOR_POOLING_H_
+
+#include <memory>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	struct Pool2dParams
+	{
+		idx_type kernel_h = 1, kernel_w = 1;
+		idx_type stride_h = 1, stride_w = 1;
+		idx_type padding_h = 0, padding_w = 0;
+		// whether avg_pool2d divides by the whole window or only by the pixels inside the input
+		bool count_include_pad = true;
+	};
+
+	// Pooling of [N, C, H, W] inputs of any strides into contiguous [N, C, OH, OW] outputs.
+	// Blocks of channels of one image are read channels last, an input that already is is read
+	// in place, and pooled for a vector of channels at a time. Images and channel blocks are
+	// split between threads. The padding is at most half of the kernel, so every window has a
+	// pixel of the input.
+
+	// Max pooling, padded pixels are ignored and NaN propagates. With offsets, and when
+	// max_pool2d_has_offsets, offsets is set to the [N, C, OH, OW] index of the maximum inside
+	// its window, kh * kernel_w + kw; one byte per output instead of an index into the input.
+	std::shared_ptr<Tensor<f32>> max_pool2d_impl(const Tensor<f32>& input, const Pool2dParams& params, std::shared_ptr<Tensor<u8>>* offsets = nullptr);
+
+	std::shared_ptr<Tensor<f64>> max_pool2d_impl(const Tensor<f64>& input, const Pool2dParams& params, std::shared_ptr<Tensor<u8>>* offsets = nullptr);
+
+	// whether windows are small enough for the offsets of max_pool2d_impl
+	bool max_pool2d_has_offsets(const Pool2dParams& params);
+
+	// gradient with respect to an input of input_size from the offsets of the forward pass
+	std::shared_ptr<Tensor<f32>> max_pool2d_backward_impl(const Tensor<f32>& grad, const DimVector& input_size, const Tensor<u8>& offsets, const Pool2dParams& params);
+
+	std::shared_ptr<Tensor<f64>> max_pool2d_backward_impl(const Tensor<f64>& grad, const DimVector& input_size, const Tensor<u8>& offsets, const Pool2dParams& params);
+
+	// gradient with respect to the input, finding the maxima again
+	std::shared_ptr<Tensor<f32>> max_pool2d_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, const Pool2dParams& params);
+
+	std::shared_ptr<Tensor<f64>> max_pool2d_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, const Pool2dParams& params);
+
+	std::shared_ptr<Tensor<f32>> avg_pool2d_impl(const Tensor<f32>& input, const Pool2dParams& params);
+
+	std::shared_ptr<Tensor<f64>> avg_pool2d_impl(const Tensor<f64>& input, const Pool2dParams& params);
+
+	std::shared_ptr<Tensor<f32>> avg_pool2d_backward_impl(const Tensor<f32>& grad, const DimVector& input_size, const Pool2dParams& params);
+
+	std::shared_ptr<Tensor<f64>> avg_pool2d_backward_impl(const Tensor<f64>& grad, const DimVector& input_size, const Pool2dParams& params);
+
+	// Average pooling to [N, C, out_h, out_w]: output row i averages input rows
+	// [floor(i * H / out_h), ceil((i + 1) * H / out_h)), and the same for columns.
+	std::shared_ptr<Tensor<f32>> adaptive_avg_pool2d_impl(const Tensor<f32>& input, idx_type out_h, idx_type out_w);
+
+	std::shared_ptr<Tensor<f64>> adaptive_avg_pool2d_impl(const Tensor<f64>& input, idx_type out_h, idx_type out_w);
+
+	std::shared_ptr<Tensor<f32>> adaptive_avg_pool2d_backward_impl(const Tensor<f32>& grad, const DimVector& input_size);
+
+	std::shared_ptr<Tensor<f64>> adaptive_avg_pool2d_backward_impl(const Tensor<f64>& grad, const DimVector& input_size);
+}
+
+#endif
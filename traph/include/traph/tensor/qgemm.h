@@ -0,0 +1,65 @@
+#ifndef TRAPH_TENSOR_QGEMM_H_
+#define TRAPH_TENSOR_QGEMM_H_
+
+#include <memory>
+#include <vector>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	// C = (A - a_zero) * (B - b_zero), products are accumulated exactly in i32.
+	// A is m x k with u8 or i8 elements, B is k x n with i8 elements and C is m x n, every
+	// matrix is given by its row and column stride like in native_gemm. b_zero holds one zero
+	// point per column of B (per output channel) when b_zero_num == n, or one for all columns
+	// when b_zero_num == 1. Kernels use AVX-512 VNNI (vpdpbusd) or AVX2 (vpmaddubsw) when the
+	// cpu has them, see native_gemm_isa.
+	void qgemm(idx_type m, idx_type n, idx_type k,
+		const u8* a, idx_type a_rs, idx_type a_cs, i32 a_zero,
+		const i8* b, idx_type b_rs, idx_type b_cs, const i32* b_zero, idx_type b_zero_num,
+		i32* c, idx_type c_rs, idx_type c_cs);
+
+	void qgemm(idx_type m, idx_type n, idx_type k,
+		const i8* a, idx_type a_rs, idx_type a_cs, i32 a_zero,
+		const i8* b, idx_type b_rs, idx_type b_cs, const i32* b_zero, idx_type b_zero_num,
+		i32* c, idx_type c_rs, idx_type c_cs);
+
+	// out = saturate(round((acc + bias) * scale) + out_zero), bias is null or holds one value
+	// per column, scale holds one value per column when scale_num == n or a single one
+	void requantize(idx_type m, idx_type n, const i32* acc, idx_type acc_rs, idx_type acc_cs,
+		const i32* bias, const f32* scale, idx_type scale_num, i32 out_zero,
+		i8* out, idx_type out_rs, idx_type out_cs);
+
+	void requantize(idx_type m, idx_type n, const i32* acc, idx_type acc_rs, idx_type acc_cs,
+		const i32* bias, const f32* scale, idx_type scale_num, i32 out_zero,
+		u8* out, idx_type out_rs, idx_type out_cs);
+
+	// matrix versions of qgemm and requantize, b_zero and scale hold 1 or n values
+	std::shared_ptr<Tensor<i32>> qmatmul_impl(const Tensor<u8>& a, i32 a_zero, const Tensor<i8>& b, const std::vector<i32>& b_zero);
+
+	std::shared_ptr<Tensor<i32>> qmatmul_impl(const Tensor<i8>& a, i32 a_zero, const Tensor<i8>& b, const std::vector<i32>& b_zero);
+
+	std::shared_ptr<Tensor<i8>> requantize_impl(const Tensor<i32>& acc, const std::vector<f32>& scale, i32 out_zero);
+
+	// q = saturate(round(x / scale) + zero), contiguous result of the same size
+	std::shared_ptr<Tensor<u8>> quantize_impl(const Tensor<f32>& x, f32 scale, i32 zero);
+
+	std::shared_ptr<Tensor<f32>> dequantize_impl(const Tensor<u8>& q, f32 scale, i32 zero);
+
+	// symmetric int8 quantisation of every row of an [out, in] weight, one scale per output
+	// channel is written to scale
+	std::shared_ptr<Tensor<i8>> quantize_per_channel_impl(const Tensor<f32>& w, std::vector<f32>& scale);
+
+	// y = x * w^T for a [..., in] input and an [out, in] weight quantised per channel with zero
+	// point 0. qlinear_impl requantises to u8 with acc_scale[j] = x_scale * w_scale[j] / y_scale
+	// and a bias in accumulator units, qlinear_dequantize_impl returns f32 with
+	// acc_scale[j] = x_scale * w_scale[j] and a float bias. The bias is empty or has out values.
+	std::shared_ptr<Tensor<u8>> qlinear_impl(const Tensor<u8>& x, i32 x_zero, const Tensor<i8>& w,
+		const std::vector<i32>& bias, const std::vector<f32>& acc_scale, i32 y_zero);
+
+	std::shared_ptr<Tensor<f32>> qlinear_dequantize_impl(const Tensor<u8>& x, i32 x_zero, const Tensor<i8>& w,
+		const std::vector<f32>& bias, const std::vector<f32>& acc_scale);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef TRAPH_TENSOR_RNN_H_
+#define TRAPH_TENSOR_RNN_H_
+
+#include <memory>
+
+#include <traph/core/type.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	// LSTM gates are input, forget, cell and output, GRU gates are reset, update and new.
+	enum class RnnMode
+	{
+		LSTM,
+		GRU
+	};
+
+	// gates per hidden unit
+	idx_type rnn_gates(RnnMode mode);
+
+	// What rnn_forward_impl keeps for the backward pass and the final states.
+	template<typename T>
+	struct RnnState
+	{
+		// [T, B, G * H] gate activations
+		std::shared_ptr<Tensor<T>> gates;
+		// GRU only, [T, B, H] hidden part of the new gate, W_hn h + b_hn
+		std::shared_ptr<Tensor<T>> candidates;
+		// LSTM only, [T, B, H] cell states
+		std::shared_ptr<Tensor<T>> cells;
+		// [B, H] initial and final states; c0 and c_n are LSTM only
+		std::shared_ptr<Tensor<T>> h0, c0, h_n, c_n;
+	};
+
+	template<typename T>
+	struct RnnGrads
+	{
+		std::shared_ptr<Tensor<T>> input, w_ih, w_hh, b_ih, b_hh, h0, c0;
+	};
+
+	// One layer over a [T, B, I] sequence, returning the [T, B, H] hidden states. w_ih is
+	// [G * H, I] and w_hh [G * H, H] with the gates in the order above, like torch.nn.LSTM and
+	// GRU. Biases are [G * H] and h0, c0 are [B, H], each of them may be null for zeros.
+	// The input projection of all steps is one gemm; each step is one gemm of the hidden state
+	// followed by a fused update of the gates and states.
+	std::shared_ptr<Tensor<f32>> rnn_forward_impl(RnnMode mode, const Tensor<f32>& input,
+		const Tensor<f32>& w_ih, const Tensor<f32>& w_hh, const Tensor<f32>* b_ih, const Tensor<f32>* b_hh,
+		const Tensor<f32>* h0, const Tensor<f32>* c0, RnnState<f32>& state);
+
+	std::shared_ptr<Tensor<f64>> rnn_forward_impl(RnnMode mode, const Tensor<f64>& input,
+		const Tensor<f64>& w_ih, const Tensor<f64>& w_hh, const Tensor<f64>* b_ih, const Tensor<f64>* b_hh,
+		const Tensor<f64>* h0, const Tensor<f64>* c0, RnnState<f64>& state);
+
+	// Backpropagation through time from the [T, B, H] gradient of the output, in one pass over
+	// the steps in reverse; the gradients of the weights and the input are gemms over all
+	// steps at the end. grad_h_n and grad_c_n are the [B, H] gradients of the final states,
+	// null for none. Every gradient is returned, b_ih and b_hh are the same for LSTM.
+	RnnGrads<f32> rnn_backward_impl(RnnMode mode, const Tensor<f32>& grad, const Tensor<f32>& input,
+		const Tensor<f32>& output, const Tensor<f32>& w_ih, const Tensor<f32>& w_hh, const RnnState<f32>& state,
+		const Tensor<f32>* grad_h_n = nullptr, const Tensor<f32>* grad_c_n = nullptr);
+
+	RnnGrads<f64> rnn_backward_impl(RnnMode mode, const Tensor<f64>& grad, const Tensor<f64>& input,
+		const Tensor<f64>& output, const Tensor<f64>& w_ih, const Tensor<f64>& w_hh, const RnnState<f64>& state,
+		const Tensor<f64>* grad_h_n = nullptr, const Tensor<f64>* grad_c_n = nullptr);
+}
+
+#endif
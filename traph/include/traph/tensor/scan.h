@@ -0,0 +1,34 @@
+#ifndef TRAPH_TENSOR_SCAN_H_
+#define TRAPH_TENSOR_SCAN_H_
+
+#include <memory>
+
+#include <traph/core/type.h>
+#include <traph/core/index.h>
+
+namespace traph
+{
+	template<typename T>
+	class Tensor;
+
+	// inclusive prefix scans along one dimension
+	// the result is always a new contiguous tensor with the shape of the input
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cumsum_impl(const Tensor<T>& a, idx_type dim, bool reverse = false);
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cumprod_impl(const Tensor<T>& a, idx_type dim, bool reverse = false);
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cummax_impl(const Tensor<T>& a, idx_type dim, bool reverse = false);
+
+	// gradient of cumprod w.r.t. input, handles zeros in input
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cumprod_backward_impl(const Tensor<T>& grad, const Tensor<T>& input, idx_type dim);
+
+	// gradient of cummax w.r.t. input, the running argmax is recomputed from input
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cummax_backward_impl(const Tensor<T>& grad, const Tensor<T>& input, idx_type dim);
+}
+
+#endif
@@ -18,6 +18,8 @@
 
 #include<traph/tensor/tensor_storage.h>
 #include<traph/tensor/arithmetic.h>
+#include<traph/tensor/linalg.h>
+#include<traph/tensor/scan.h>
 
 namespace traph
 {
@@ -62,9 +64,13 @@ namespace traph
 
         virtual void add_(TensorInterfacePtr other) override;
         virtual void apply_(std::function<T(T)> f) override;
+        virtual std::shared_ptr<TensorInterface> bmm(std::shared_ptr<TensorInterface> mat) const override;
         virtual TensorInterfacePtr clone() const override;
         virtual void cos_() override;
         virtual std::shared_ptr<TensorBase<f32>> create_grad() override;
+        virtual std::shared_ptr<TensorInterface> cummax(idx_type dim) const override;
+        virtual std::shared_ptr<TensorInterface> cumprod(idx_type dim) const override;
+        virtual std::shared_ptr<TensorInterface> cumsum(idx_type dim) const override;
         virtual T* data_ptr() override;
         virtual const T* data_ptr() const override;
         virtual device_id device() override;
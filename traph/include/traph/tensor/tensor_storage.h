@@ -1,11 +1,76 @@
 #ifndef TRAPH_TENSOR_TENSOR_STORAGE_H_
 #define TRAPH_TENSOR_TENSOR_STORAGE_H_
 
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
 #include<traph/core/type.h>
 #include<traph/core/tensor_storage.h>
 
 namespace traph
 {
+    // Memory for the storages made on a thread while it is the current arena of the thread,
+    // see StorageArenaGuard. Storages keep their arena alive and hand their memory back to
+    // it, from any thread.
+    class StorageArena
+    {
+    public:
+        virtual ~StorageArena() {}
+
+        // memory for a storage of bytes, or null for new[]
+        virtual void* allocate(std::size_t bytes) = 0;
+        // memory of allocate that is no longer used
+        virtual void release(void* data) = 0;
+
+        // the arena of the calling thread or null
+        static std::shared_ptr<StorageArena> current();
+    };
+
+    class StorageArenaGuard
+    {
+    private:
+        std::shared_ptr<StorageArena> _previous;
+    public:
+        explicit StorageArenaGuard(std::shared_ptr<StorageArena> arena);
+        StorageArenaGuard(const StorageArenaGuard&) = delete;
+        StorageArenaGuard& operator= (const StorageArenaGuard&) = delete;
+        ~StorageArenaGuard();
+    };
+
+    template<typename T>
+    struct StorageDeleter
+    {
+        // null for memory of new[]
+        std::shared_ptr<StorageArena> arena;
+
+        void operator()(T* data) const
+        {
+            if (arena)
+                arena->release(data);
+            else
+                delete[] data;
+        }
+    };
+
+    template<typename T>
+    using StoragePointer = std::unique_ptr<T[], StorageDeleter<T>>;
+
+    // uninitialized memory for len elements, from the arena of the calling thread if any
+    template<typename T>
+    StoragePointer<T> allocate_storage(idx_type len)
+    {
+        static_assert(std::is_trivial<T>::value, "Storages of an arena hold trivial types only.");
+        std::shared_ptr<StorageArena> arena = StorageArena::current();
+        if (arena && len > 0)
+        {
+            if (void* data = arena->allocate(static_cast<std::size_t>(len) * sizeof(T)))
+                return StoragePointer<T>(static_cast<T*>(data), StorageDeleter<T>{ arena });
+        }
+        return StoragePointer<T>(new T[len], StorageDeleter<T>());
+    }
+
     // The real representation of all tensors.
     template<typename T>
     class TensorStorage: public ContiguousStorageBase<T>
@@ -22,7 +87,7 @@ namespace traph
         using const_reference = const self_type&;
 
     public:
-        std::unique_ptr<T[]> data;
+        StoragePointer<T> data;
         idx_type len;
         TensorStorage()
             :data(nullptr), len(0)
@@ -30,7 +95,7 @@ namespace traph
         }
 
         TensorStorage(const TensorStorage& other)
-            :data(new T[other.len]), len(other.len)
+            :data(allocate_storage<T>(other.len)), len(other.len)
         {
             std::memcpy(data.get(), other.data.get(), other.len * sizeof(T));
         }
@@ -42,7 +107,7 @@ namespace traph
 
         TensorStorage& operator=(const TensorStorage& other)
         {
-            data = std::make_unique(new T[other.len]);
+            data = allocate_storage<T>(other.len);
             std::memcpy(data.get(), other.data.get(), other.len * sizeof(T));
             len = other.len;
 
@@ -60,7 +125,7 @@ namespace traph
         virtual std::shared_ptr<StorageBase<T>> clone() const override
         {
             std::shared_ptr<TensorStorage<T>> cloned_storage(new TensorStorage<T>);
-            cloned_storage->data = std::unique_ptr<T[]>(new T[len]);
+            cloned_storage->data = allocate_storage<T>(len);
             std::memcpy(cloned_storage->data.get(), data.get(), len * sizeof(T));
             cloned_storage->len = len;
 
@@ -76,7 +141,7 @@ namespace traph
             if(size < 0 || size == len)
                 return;
             idx_type move_size = (size > len ? len: size);
-            std::unique_ptr<T[]> temp(new T[size]);
+            StoragePointer<T> temp = allocate_storage<T>(size);
             std::memcpy(temp.get(), data.get(), move_size * sizeof(T));
             data = std::move(temp);
 
@@ -0,0 +1,202 @@
+#ifndef TRAPH_TEST_ACTIVATION_H_
+#define TRAPH_TEST_ACTIVATION_H_
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <omp.h>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/layers/activation.h>
+#include <traph/nn/layers/dropout.h>
+#include <traph/tensor/activation.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> activation_input(const traph::DimVector& size, int seed)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(size));
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<T>((i * 13 + seed * 7) % 41) / 8 - 2.5;
+        return result;
+    }
+
+    inline bool mask_bit(const traph::Tensor<traph::u8>& mask, int i)
+    {
+        return (mask.data_ptr()[i / 8] >> (i % 8)) & 1;
+    }
+
+    // values and gradients of an activation against f and its derivative df
+    template<typename T, typename F, typename DF>
+    void check_activation(const traph::Tensor<T>& result, const traph::Tensor<T>& dx,
+        const traph::Tensor<T>& input, const traph::Tensor<T>& grad, F f, DF df, double eps)
+    {
+        int count = input.size().flat_size();
+        REQUIRE(result.size() == input.size());
+        REQUIRE(dx.size() == input.size());
+        for (int i = 0; i < count; ++i)
+        {
+            double x = input.data_ptr()[i];
+            REQUIRE(std::abs(result.data_ptr()[i] - f(x)) < eps);
+            REQUIRE(std::abs(dx.data_ptr()[i] - grad.data_ptr()[i] * df(x)) < eps);
+        }
+    }
+}
+
+TEST_CASE( "activation test", "[activation]" )
+{
+    SECTION("relu")
+    {
+        // a count that is not a multiple of 8
+        auto x = traph_test::activation_input<double>(traph::DimVector({ 7, 13 }), 1);
+        auto grad = traph_test::activation_input<double>(traph::DimVector({ 7, 13 }), 2);
+        std::shared_ptr<traph::Tensor<traph::u8>> mask;
+        auto y = traph::relu_impl(*x, &mask);
+        REQUIRE(mask->size() == traph::DimVector({ traph::mask_bytes(91) }));
+        REQUIRE(mask->size(0) == 12);
+        auto dx = traph::relu_backward_impl(*grad, *mask);
+        traph_test::check_activation(*y, *dx, *x, *grad,
+            [](double v) { return v > 0 ? v : 0.0; }, [](double v) { return v > 0 ? 1.0 : 0.0; }, 1e-12);
+        for (int i = 0; i < 91; ++i)
+            REQUIRE(traph_test::mask_bit(*mask, i) == (x->data_ptr()[i] > 0));
+
+        // a strided input has the mask of its row-major order
+        auto t = std::dynamic_pointer_cast<traph::Tensor<double>>(x->transpose(0, 1));
+        std::shared_ptr<traph::Tensor<traph::u8>> t_mask;
+        auto ty = traph::relu_impl(*t, &t_mask);
+        for (int i = 0; i < 13; ++i)
+            for (int j = 0; j < 7; ++j)
+            {
+                REQUIRE(ty->data_ptr()[i * 7 + j] == y->data_ptr()[j * 13 + i]);
+                REQUIRE(traph_test::mask_bit(*t_mask, i * 7 + j) == traph_test::mask_bit(*mask, j * 13 + i));
+            }
+
+        auto nan = traph_test::activation_input<float>(traph::DimVector({ 3 }), 3);
+        nan->data_ptr()[1] = std::nan("");
+        REQUIRE(std::isnan(traph::relu_impl(*nan)->data_ptr()[1]));
+    }
+
+    SECTION("gelu and sigmoid")
+    {
+        auto x = traph_test::activation_input<double>(traph::DimVector({ 5, 9 }), 4);
+        auto grad = traph_test::activation_input<double>(traph::DimVector({ 5, 9 }), 5);
+        auto cdf = [](double v) { return 0.5 * (1 + std::erf(v / std::sqrt(2.0))); };
+        auto y = traph::gelu_impl(*x);
+        traph_test::check_activation(*y, *traph::gelu_backward_impl(*grad, *x), *x, *grad,
+            [&](double v) { return v * cdf(v); },
+            [&](double v) { return cdf(v) + v * std::exp(-v * v / 2) / std::sqrt(2 * 3.14159265358979323846); }, 1e-12);
+
+        auto sig = [](double v) { return 1 / (1 + std::exp(-v)); };
+        auto s = traph::sigmoid_impl(*x);
+        traph_test::check_activation(*s, *traph::sigmoid_backward_impl(*grad, *s), *x, *grad,
+            sig, [&](double v) { return sig(v) * (1 - sig(v)); }, 1e-12);
+    }
+
+    SECTION("dropout")
+    {
+        int count = 1 << 18;
+        auto x = traph_test::activation_input<float>(traph::DimVector({ count }), 6);
+        auto grad = traph_test::activation_input<float>(traph::DimVector({ count }), 7);
+        std::shared_ptr<traph::Tensor<traph::u8>> mask;
+        auto y = traph::dropout_impl(*x, 0.25, 42, &mask);
+        // a bit instead of a float of mask per element
+        REQUIRE(mask->size(0) * 32 == count * static_cast<int>(sizeof(float)));
+        auto dx = traph::dropout_backward_impl(*grad, *mask, 0.25);
+        int kept = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            bool bit = traph_test::mask_bit(*mask, i);
+            kept += bit;
+            REQUIRE(y->data_ptr()[i] == (bit ? x->data_ptr()[i] * (1 / 0.75f) : 0.f));
+            REQUIRE(dx->data_ptr()[i] == (bit ? grad->data_ptr()[i] * (1 / 0.75f) : 0.f));
+        }
+        REQUIRE(std::abs(kept / static_cast<double>(count) - 0.75) < 0.01);
+
+        // the same seed drops the same elements on any number of threads, another seed others
+        int threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+        std::shared_ptr<traph::Tensor<traph::u8>> serial;
+        traph::dropout_impl(*x, 0.25, 42, &serial);
+        omp_set_num_threads(4);
+        std::shared_ptr<traph::Tensor<traph::u8>> parallel, other;
+        traph::dropout_impl(*x, 0.25, 42, &parallel);
+        traph::dropout_impl(*x, 0.25, 43, &other);
+        omp_set_num_threads(threads);
+        int same = 0;
+        for (int i = 0; i < mask->size(0); ++i)
+        {
+            REQUIRE(serial->data_ptr()[i] == mask->data_ptr()[i]);
+            REQUIRE(parallel->data_ptr()[i] == mask->data_ptr()[i]);
+            same += other->data_ptr()[i] == mask->data_ptr()[i];
+        }
+        REQUIRE(same < mask->size(0) / 2);
+
+        auto none = traph::dropout_impl(*x, 0.0, 1);
+        auto all = traph::dropout_impl(*x, 1.0, 1);
+        for (int i = 0; i < count; ++i)
+        {
+            REQUIRE(none->data_ptr()[i] == x->data_ptr()[i]);
+            REQUIRE(all->data_ptr()[i] == 0.f);
+        }
+    }
+
+    SECTION("layers")
+    {
+        auto x = traph::randn<float>({ 6, 11 }, true);
+        traph::ReLU relu;
+        traph::sum(relu.forward(x))->backward();
+        auto data = std::dynamic_pointer_cast<traph::Tensor<float>>(x->data());
+        for (int i = 0; i < 66; ++i)
+            REQUIRE(x->grad()->data_ptr()[i] == (data->data_ptr()[i] > 0 ? 1.f : 0.f));
+
+        auto z = traph::randn<float>({ 4, 5 }, true);
+        traph::Sigmoid sigmoid;
+        traph::GELU gelu;
+        traph::sum(sigmoid.forward(z))->backward();
+        traph::sum(gelu.forward(z))->backward();
+        auto z_data = std::dynamic_pointer_cast<traph::Tensor<float>>(z->data());
+        for (int i = 0; i < 20; ++i)
+        {
+            double v = z_data->data_ptr()[i];
+            double s = 1 / (1 + std::exp(-v));
+            double cdf = 0.5 * (1 + std::erf(v / std::sqrt(2.0)));
+            double expected = s * (1 - s) + cdf + v * std::exp(-v * v / 2) / std::sqrt(2 * 3.14159265358979323846);
+            REQUIRE(std::abs(z->grad()->data_ptr()[i] - expected) < 1e-5);
+        }
+
+        auto w = traph::randn<float>({ 64, 32 }, true);
+        traph::Dropout dropout(0.5);
+        dropout.seed_(7);
+        auto y = dropout.forward(w);
+        traph::sum(y)->backward();
+        auto y_data = std::dynamic_pointer_cast<traph::Tensor<float>>(y->data());
+        for (int i = 0; i < 64 * 32; ++i)
+            REQUIRE(w->grad()->data_ptr()[i] == (y_data->data_ptr()[i] != 0 ? 2.f : 0.f));
+        // a new mask per call, none in evaluation
+        auto again = std::dynamic_pointer_cast<traph::Tensor<float>>(dropout.forward(w)->data());
+        int differ = 0;
+        for (int i = 0; i < 64 * 32; ++i)
+            differ += (again->data_ptr()[i] == 0) != (y_data->data_ptr()[i] == 0);
+        REQUIRE(differ > 0);
+        dropout.train_(false);
+        REQUIRE(dropout.forward(w) == w);
+
+        // no mask without a gradient
+        auto frozen = traph::randn<float>({ 3 }, false);
+        REQUIRE_FALSE(traph::relu(frozen)->requires_grad());
+    }
+
+    auto x = traph_test::activation_input<float>(traph::DimVector({ 10 }), 1);
+    std::shared_ptr<traph::Tensor<traph::u8>> mask;
+    traph::relu_impl(*x, &mask);
+    REQUIRE_THROWS_AS(traph::relu_backward_impl(*traph_test::activation_input<float>(traph::DimVector({ 17 }), 1), *mask), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::dropout_impl(*x, 1.5, 1), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::sigmoid_backward_impl(*x, *traph_test::activation_input<float>(traph::DimVector({ 2, 5 }), 1)), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::Dropout(-0.1), std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef TRAPH_TEST_ATTENTION_H_
+#define TRAPH_TEST_ATTENTION_H_
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/function.h>
+#include <traph/tensor/attention.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> attention_tensor(const traph::DimVector& size, int seed)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(size));
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<T>((i * 13 + seed * 7) % 29) / 14 - 1;
+        return result;
+    }
+
+    // [B, Lk] mask padding the last pad[b] keys of each batch
+    inline std::shared_ptr<traph::Tensor<traph::u8>> padding_mask(int lk, const std::vector<int>& pad)
+    {
+        int batch = static_cast<int>(pad.size());
+        std::shared_ptr<traph::Tensor<traph::u8>> result(new traph::Tensor<traph::u8>(traph::DimVector({ batch, lk })));
+        for (int b = 0; b < batch; ++b)
+            for (int j = 0; j < lk; ++j)
+                result->data_ptr()[b * lk + j] = j >= lk - pad[b];
+        return result;
+    }
+
+    // attention of contiguous inputs with the [Lq, Lk] probabilities, and its gradients
+    template<typename T>
+    struct AttentionReference
+    {
+        std::vector<double> output, lse, dq, dk, dv;
+
+        AttentionReference(const traph::Tensor<T>& q, const traph::Tensor<T>& k, const traph::Tensor<T>& v,
+            const traph::Tensor<traph::u8>* mask, const traph::AttentionParams& params, const traph::Tensor<T>& grad)
+        {
+            int batch = q.size(0), heads = q.size(1), lq = q.size(2), d = q.size(3), lk = k.size(2), dvs = v.size(3);
+            double scale = params.scale > 0 ? params.scale : 1 / std::sqrt(static_cast<double>(d));
+            output.assign(batch * heads * lq * dvs, 0.0);
+            lse.assign(batch * heads * lq, -std::numeric_limits<double>::infinity());
+            dq.assign(q.size().flat_size(), 0.0);
+            dk.assign(k.size().flat_size(), 0.0);
+            dv.assign(v.size().flat_size(), 0.0);
+            for (int b = 0; b < batch; ++b)
+            for (int h = 0; h < heads; ++h)
+            {
+                int head = b * heads + h;
+                const T* qh = q.data_ptr() + head * lq * d;
+                const T* kh = k.data_ptr() + head * lk * d;
+                const T* vh = v.data_ptr() + head * lk * dvs;
+                const T* gh = grad.data_ptr() + head * lq * dvs;
+                for (int i = 0; i < lq; ++i)
+                {
+                    std::vector<double> p(lk, 0.0);
+                    std::vector<bool> seen(lk, false);
+                    double mx = -std::numeric_limits<double>::infinity();
+                    for (int j = 0; j < lk; ++j)
+                    {
+                        seen[j] = (!params.causal || j <= i + lk - lq) && !(mask && mask->data_ptr()[b * lk + j]);
+                        if (!seen[j])
+                            continue;
+                        for (int c = 0; c < d; ++c)
+                            p[j] += static_cast<double>(qh[i * d + c]) * kh[j * d + c];
+                        p[j] *= scale;
+                        mx = std::max(mx, p[j]);
+                    }
+                    double sum = 0;
+                    for (int j = 0; j < lk; ++j)
+                    {
+                        p[j] = seen[j] ? std::exp(p[j] - mx) : 0.0;
+                        sum += p[j];
+                    }
+                    if (sum == 0)
+                        continue;
+                    lse[head * lq + i] = mx + std::log(sum);
+                    std::vector<double> dp(lk, 0.0);
+                    double dot = 0;
+                    for (int j = 0; j < lk; ++j)
+                    {
+                        p[j] /= sum;
+                        for (int c = 0; c < dvs; ++c)
+                        {
+                            output[(head * lq + i) * dvs + c] += p[j] * vh[j * dvs + c];
+                            dv[(head * lk + j) * dvs + c] += p[j] * gh[i * dvs + c];
+                            dp[j] += static_cast<double>(gh[i * dvs + c]) * vh[j * dvs + c];
+                        }
+                        dot += p[j] * dp[j];
+                    }
+                    for (int j = 0; j < lk; ++j)
+                    {
+                        double ds = p[j] * (dp[j] - dot) * scale;
+                        for (int c = 0; c < d; ++c)
+                        {
+                            dq[(head * lq + i) * d + c] += ds * kh[j * d + c];
+                            dk[(head * lk + j) * d + c] += ds * qh[i * d + c];
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    template<typename T>
+    void require_near(const traph::Tensor<T>& result, const std::vector<double>& expected, double eps)
+    {
+        REQUIRE(result.size().flat_size() == static_cast<int>(expected.size()));
+        for (std::size_t i = 0; i < expected.size(); ++i)
+        {
+            if (std::isinf(expected[i]))
+                REQUIRE(result.data_ptr()[i] == expected[i]);
+            else
+                REQUIRE(std::abs(result.data_ptr()[i] - expected[i]) < eps);
+        }
+    }
+
+    template<typename T>
+    void check_attention(int batch, int heads, int lq, int lk, int d, int dv, bool causal, const std::vector<int>& pad, double eps)
+    {
+        auto q = attention_tensor<T>(traph::DimVector({ batch, heads, lq, d }), 1);
+        auto k = attention_tensor<T>(traph::DimVector({ batch, heads, lk, d }), 2);
+        auto v = attention_tensor<T>(traph::DimVector({ batch, heads, lk, dv }), 3);
+        auto grad = attention_tensor<T>(traph::DimVector({ batch, heads, lq, dv }), 4);
+        auto mask = pad.empty() ? nullptr : padding_mask(lk, pad);
+        traph::AttentionParams params;
+        params.causal = causal;
+        AttentionReference<T> expected(*q, *k, *v, mask.get(), params, *grad);
+
+        std::shared_ptr<traph::Tensor<T>> lse;
+        auto output = traph::scaled_dot_product_attention_impl(*q, *k, *v, mask.get(), params, &lse);
+        require_near(*output, expected.output, eps);
+        require_near(*lse, expected.lse, eps);
+        auto grads = traph::scaled_dot_product_attention_backward_impl(*grad, *q, *k, *v, *output, *lse, mask.get(), params);
+        require_near(*grads[0], expected.dq, eps);
+        require_near(*grads[1], expected.dk, eps);
+        require_near(*grads[2], expected.dv, eps);
+    }
+}
+
+TEST_CASE( "attention test", "[attention]" )
+{
+    SECTION("forward and backward")
+    {
+        traph_test::check_attention<double>(2, 3, 5, 7, 4, 3, false, {}, 1e-12);
+        traph_test::check_attention<double>(1, 2, 1, 9, 8, 8, true, {}, 1e-12);
+        // several blocks of queries and keys, the causal diagonal and the padding inside them
+        traph_test::check_attention<double>(2, 2, 70, 130, 16, 12, false, { 0, 40 }, 1e-12);
+        traph_test::check_attention<double>(2, 2, 70, 130, 16, 12, true, { 3, 75 }, 1e-12);
+        traph_test::check_attention<double>(1, 1, 150, 150, 8, 8, true, {}, 1e-12);
+        traph_test::check_attention<float>(2, 4, 100, 100, 32, 32, true, { 0, 10 }, 1e-4);
+    }
+
+    SECTION("queries that see no key")
+    {
+        // more queries than keys, and a batch whose keys are all padded
+        traph_test::check_attention<double>(1, 1, 6, 3, 4, 4, true, {}, 1e-12);
+        traph_test::check_attention<double>(2, 1, 4, 5, 4, 4, false, { 0, 5 }, 1e-12);
+        auto q = traph_test::attention_tensor<double>(traph::DimVector({ 2, 1, 4, 4 }), 1);
+        auto output = traph::scaled_dot_product_attention_impl(*q, *q, *q, traph_test::padding_mask(4, { 0, 4 }).get(), traph::AttentionParams());
+        for (int i = 16; i < 32; ++i)
+            REQUIRE(output->data_ptr()[i] == 0.0);
+    }
+
+    SECTION("strided inputs")
+    {
+        // [B, L, H, D] storage seen as [B, H, L, D]
+        auto q = traph_test::attention_tensor<double>(traph::DimVector({ 2, 3, 70, 8 }), 1);
+        auto k = traph_test::attention_tensor<double>(traph::DimVector({ 2, 3, 90, 8 }), 2);
+        auto grad = traph_test::attention_tensor<double>(traph::DimVector({ 2, 3, 70, 8 }), 4);
+        auto q_view = std::dynamic_pointer_cast<traph::Tensor<double>>(
+            std::dynamic_pointer_cast<traph::Tensor<double>>(q->transpose(1, 2)->clone())->transpose(1, 2));
+        auto k_view = std::dynamic_pointer_cast<traph::Tensor<double>>(
+            std::dynamic_pointer_cast<traph::Tensor<double>>(k->transpose(1, 2)->clone())->transpose(1, 2));
+        traph::AttentionParams params;
+        params.causal = true;
+        params.scale = 0.25;
+        std::shared_ptr<traph::Tensor<double>> lse, view_lse;
+        auto expected = traph::scaled_dot_product_attention_impl(*q, *k, *k, nullptr, params, &lse);
+        auto result = traph::scaled_dot_product_attention_impl(*q_view, *k_view, *k_view, nullptr, params, &view_lse);
+        for (int i = 0; i < expected->size().flat_size(); ++i)
+            REQUIRE(std::abs(result->data_ptr()[i] - expected->data_ptr()[i]) < 1e-12);
+        auto grads = traph::scaled_dot_product_attention_backward_impl(*grad, *q, *k, *k, *expected, *lse, nullptr, params);
+        auto view_grads = traph::scaled_dot_product_attention_backward_impl(*grad, *q_view, *k_view, *k_view, *result, *view_lse, nullptr, params);
+        for (int g = 0; g < 3; ++g)
+            for (int i = 0; i < grads[g]->size().flat_size(); ++i)
+                REQUIRE(std::abs(view_grads[g]->data_ptr()[i] - grads[g]->data_ptr()[i]) < 1e-12);
+    }
+
+    SECTION("variables")
+    {
+        auto q = traph::randn<float>({ 2, 2, 33, 8 }, true);
+        auto k = traph::randn<float>({ 2, 2, 47, 8 }, true);
+        auto v = traph::randn<float>({ 2, 2, 47, 4 }, true);
+        auto mask = traph::zeros<traph::u8>({ 2, 47 });
+        std::dynamic_pointer_cast<traph::Tensor<traph::u8>>(mask->data())->data_ptr()[47 + 46] = 1;
+        traph::AttentionParams params;
+        params.causal = true;
+        auto output = traph::scaled_dot_product_attention(q, k, v, mask, params);
+        REQUIRE(output->size() == traph::DimVector({ 2, 2, 33, 4 }));
+        traph::sum(output)->backward();
+
+        auto data = [](const traph::VariableInterfacePtr& x) { return std::dynamic_pointer_cast<traph::Tensor<float>>(x->data()); };
+        auto grad = std::make_shared<traph::Tensor<float>>(traph::DimVector({ 2, 2, 33, 4 }));
+        grad->fill_(1.f);
+        traph_test::AttentionReference<float> expected(*data(q), *data(k), *data(v),
+            std::dynamic_pointer_cast<traph::Tensor<traph::u8>>(mask->data()).get(), params, *grad);
+        traph_test::require_near(*data(output), expected.output, 1e-4);
+        traph_test::require_near(*std::dynamic_pointer_cast<traph::Tensor<float>>(q->grad()), expected.dq, 1e-4);
+        traph_test::require_near(*std::dynamic_pointer_cast<traph::Tensor<float>>(k->grad()), expected.dk, 1e-4);
+        traph_test::require_near(*std::dynamic_pointer_cast<traph::Tensor<float>>(v->grad()), expected.dv, 1e-4);
+    }
+
+    auto q = traph_test::attention_tensor<float>(traph::DimVector({ 1, 2, 3, 4 }), 1);
+    auto k = traph_test::attention_tensor<float>(traph::DimVector({ 1, 2, 5, 4 }), 2);
+    auto v = traph_test::attention_tensor<float>(traph::DimVector({ 1, 2, 6, 4 }), 3);
+    traph::AttentionParams params;
+    REQUIRE_THROWS_AS(traph::scaled_dot_product_attention_impl(*q, *k, *v, nullptr, params), std::runtime_error);
+    auto narrow = traph_test::attention_tensor<float>(traph::DimVector({ 1, 2, 5, 3 }), 4);
+    REQUIRE_THROWS_AS(traph::scaled_dot_product_attention_impl(*q, *narrow, *k, nullptr, params), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::scaled_dot_product_attention_impl(*q, *k, *k, traph_test::padding_mask(4, { 0 }).get(), params), std::runtime_error);
+    params.scale = -1;
+    REQUIRE_THROWS_AS(traph::scaled_dot_product_attention_impl(*q, *k, *k, nullptr, params), std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef TRAPH_TEST_CAPTURE_H_
+#define TRAPH_TEST_CAPTURE_H_
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/capture.h>
+#include <traph/nn/function.h>
+#include <traph/nn/grad_mode.h>
+#include <traph/nn/layers/activation.h>
+#include <traph/nn/layers/linear.h>
+#include <traph/nn/layers/rnn.h>
+#include <traph/nn/optim.h>
+
+namespace traph_test
+{
+    // two linear layers with the same weights for every seed
+    struct CaptureModel
+    {
+        traph::Linear first{ 12, 24, true };
+        traph::Linear second{ 24, 3, true };
+        std::shared_ptr<traph::SGD> optimizer;
+
+        explicit CaptureModel(int seed)
+        {
+            std::vector<traph::VariableInterfacePtr> params = parameters();
+            for (std::size_t p = 0; p < params.size(); ++p)
+            {
+                auto data = std::dynamic_pointer_cast<traph::Tensor<float>>(params[p]->data());
+                for (int i = 0; i < params[p]->size().flat_size(); ++i)
+                    data->data_ptr()[i] = static_cast<float>((i * 13 + (seed + static_cast<int>(p)) * 7) % 29) / 28 - 0.5f;
+            }
+            optimizer = std::make_shared<traph::SGD>(params, 0.05f);
+        }
+
+        std::vector<traph::VariableInterfacePtr> parameters()
+        {
+            std::vector<traph::VariableInterfacePtr> result = first.parameters();
+            for (auto& each : second.parameters())
+                result.push_back(each);
+            return result;
+        }
+
+        // the input goes through an op that requires no gradient first
+        traph::VariableInterfacePtr loss(const std::vector<traph::VariableInterfacePtr>& inputs)
+        {
+            traph::ReLU relu;
+            traph::Sigmoid sigmoid;
+            auto hidden = sigmoid.forward(first.forward(relu.forward(inputs[0])));
+            return traph::mean(traph::pow(traph::sub(second.forward(hidden), inputs[1]), 2));
+        }
+    };
+
+    inline traph::VariableInterfacePtr capture_input(int rows, int cols, int seed)
+    {
+        auto result = traph::zeros<float>({ rows, cols });
+        auto data = std::dynamic_pointer_cast<traph::Tensor<float>>(result->data());
+        for (int i = 0; i < rows * cols; ++i)
+            data->data_ptr()[i] = static_cast<float>((i * 5 + seed * 11) % 23) / 11 - 1;
+        return result;
+    }
+}
+
+TEST_CASE( "capture test", "[capture]" )
+{
+    SECTION("replay matches eager steps")
+    {
+        traph_test::CaptureModel eager(1), captured(1);
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return captured.loss(inputs); },
+            captured.optimizer);
+
+        for (int iteration = 0; iteration < 6; ++iteration)
+        {
+            // a batch of another size in the middle captures again
+            int rows = iteration == 3 ? 5 : 8;
+            std::vector<traph::VariableInterfacePtr> inputs{ traph_test::capture_input(rows, 12, iteration),
+                traph_test::capture_input(rows, 3, iteration + 100) };
+
+            eager.optimizer->zero_grad();
+            auto expected = eager.loss(inputs);
+            expected->backward();
+            eager.optimizer->step();
+
+            auto loss = step.run(inputs);
+            REQUIRE(std::dynamic_pointer_cast<traph::Tensor<float>>(loss->data())->item()
+                == std::dynamic_pointer_cast<traph::Tensor<float>>(expected->data())->item());
+            auto eager_params = eager.parameters();
+            auto captured_params = captured.parameters();
+            for (std::size_t p = 0; p < eager_params.size(); ++p)
+                for (int i = 0; i < eager_params[p]->size().flat_size(); ++i)
+                    REQUIRE(std::dynamic_pointer_cast<traph::Tensor<float>>(captured_params[p]->data())->data_ptr()[i]
+                        == std::dynamic_pointer_cast<traph::Tensor<float>>(eager_params[p]->data())->data_ptr()[i]);
+
+            // the backward pass releases the tensors the ops saved
+            for (auto& call : step.calls())
+                REQUIRE(call.op->context.get_saved_tensors().empty());
+        }
+        REQUIRE(step.captures() == 3);
+        // relu, linear, sigmoid, linear, sub, pow and mean
+        REQUIRE(step.calls().size() == 7);
+    }
+
+    SECTION("dropout masks per replay")
+    {
+        auto w = traph::zeros<float>({ 1, 64 }, true);
+        auto optimizer = std::make_shared<traph::SGD>(std::vector<traph::VariableInterfacePtr>{ w }, 0.f);
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) {
+            return traph::mean(traph::dropout(traph::add(inputs[0], w), 0.5, 7));
+        }, optimizer);
+
+        // the gradient of w is the mask of the run
+        std::vector<std::vector<float>> masks;
+        for (int iteration = 0; iteration < 3; ++iteration)
+        {
+            step.run({ traph_test::capture_input(1, 64, 1) });
+            auto grad = std::dynamic_pointer_cast<traph::Tensor<float>>(w->grad());
+            masks.emplace_back(grad->data_ptr(), grad->data_ptr() + 64);
+        }
+        REQUIRE(step.captures() == 1);
+        REQUIRE(masks[0] != masks[1]);
+        REQUIRE(masks[1] != masks[2]);
+    }
+
+    SECTION("rnn states after a replay")
+    {
+        traph::LSTM eager(3, 4, 2), captured(3, 4, 2);
+        auto eager_params = eager.parameters();
+        auto captured_params = captured.parameters();
+        for (std::size_t p = 0; p < eager_params.size(); ++p)
+            captured_params[p]->data_(eager_params[p]->data()->clone());
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) {
+            return traph::mean(captured.forward(inputs[0]));
+        }, nullptr);
+
+        for (int iteration = 0; iteration < 3; ++iteration)
+        {
+            auto input = traph::zeros<float>({ 5, 2, 3 }, false);
+            for (int i = 0; i < 5 * 2 * 3; ++i)
+                std::dynamic_pointer_cast<traph::Tensor<float>>(input->data())->data_ptr()[i] = static_cast<float>((i + iteration * 7) % 11) / 5 - 1;
+            eager.forward(input);
+            step.run({ input });
+            for (int l = 0; l < 2; ++l)
+            {
+                auto expected_h = std::dynamic_pointer_cast<traph::Tensor<float>>(eager.h_n()[l]);
+                auto expected_c = std::dynamic_pointer_cast<traph::Tensor<float>>(eager.c_n()[l]);
+                auto h = std::dynamic_pointer_cast<traph::Tensor<float>>(captured.h_n()[l]);
+                auto c = std::dynamic_pointer_cast<traph::Tensor<float>>(captured.c_n()[l]);
+                for (int i = 0; i < 2 * 4; ++i)
+                {
+                    REQUIRE(h->data_ptr()[i] == expected_h->data_ptr()[i]);
+                    REQUIRE(c->data_ptr()[i] == expected_c->data_ptr()[i]);
+                }
+            }
+            // the gate and cell buffers are released with the other saved tensors
+            for (auto& call : step.calls())
+                REQUIRE(call.op->context.get_saved_tensors().empty());
+        }
+        REQUIRE(step.captures() == 1);
+    }
+
+    SECTION("gradients of inputs")
+    {
+        traph_test::CaptureModel eager(4), captured(4);
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return captured.loss(inputs); },
+            captured.optimizer);
+
+        std::vector<traph::VariableInterfacePtr> eager_inputs, captured_inputs;
+        for (int iteration = 0; iteration < 5; ++iteration)
+        {
+            // the last run reuses the inputs of the one before, whose gradients then accumulate
+            if (iteration < 4)
+            {
+                eager_inputs = { traph_test::capture_input(8, 12, iteration), traph_test::capture_input(8, 3, iteration + 100) };
+                captured_inputs = { traph_test::capture_input(8, 12, iteration), traph_test::capture_input(8, 3, iteration + 100) };
+                eager_inputs[0]->requires_grad_(true);
+                captured_inputs[0]->requires_grad_(true);
+            }
+
+            eager.optimizer->zero_grad();
+            eager.loss(eager_inputs)->backward();
+            eager.optimizer->step();
+            step.run(captured_inputs);
+
+            REQUIRE(!captured_inputs[1]->grad());
+            auto expected = eager_inputs[0]->grad();
+            auto grad = captured_inputs[0]->grad();
+            bool nonzero = false;
+            for (int i = 0; i < 8 * 12; ++i)
+            {
+                REQUIRE(grad->data_ptr()[i] == expected->data_ptr()[i]);
+                nonzero = nonzero || grad->data_ptr()[i] != 0.f;
+            }
+            REQUIRE(nonzero);
+        }
+        REQUIRE(step.captures() == 1);
+
+        // an input that stops requiring a gradient captures again
+        step.run({ traph_test::capture_input(8, 12, 9), traph_test::capture_input(8, 3, 9) });
+        REQUIRE(step.captures() == 2);
+    }
+
+    SECTION("errors")
+    {
+        traph::CapturedStep constant([](const std::vector<traph::VariableInterfacePtr>& inputs) { return traph::relu(inputs[0]); }, nullptr);
+        REQUIRE_THROWS_AS(constant.run({ traph_test::capture_input(2, 2, 1) }), std::runtime_error);
+
+        traph_test::CaptureModel model(2);
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return model.loss(inputs); }, nullptr);
+        auto table = traph::zeros<float>({ 4, 3 });
+        table->sparse_grad_(std::make_shared<traph::SparseRows<float>>(4, 3));
+        REQUIRE_THROWS_AS(step.run({ traph_test::capture_input(2, 12, 1), table }), std::runtime_error);
+        traph::NoGradGuard guard;
+        REQUIRE_THROWS_AS(step.run({ traph_test::capture_input(2, 12, 1), traph_test::capture_input(2, 3, 1) }), std::runtime_error);
+    }
+}
+
+#endif
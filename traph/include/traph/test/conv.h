@@ -0,0 +1,271 @@
+#ifndef TRAPH_TEST_CONV_H_
+#define TRAPH_TEST_CONV_H_
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/tensor/conv.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> conv_tensor(const traph::DimVector& size, int seed)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(size));
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<T>((i * 7 + seed * 5) % 13) / 4 - 1;
+        return result;
+    }
+
+    // input [N, C, H, W] and weight [O, C / groups, KH, KW] in row-major order
+    struct NaiveConv
+    {
+        int batch, channels, height, width, out_channels, kernel_h, kernel_w;
+        traph::Conv2dParams params;
+        int out_h, out_w;
+
+        NaiveConv(int n, int c, int h, int w, int o, int kh, int kw, const traph::Conv2dParams& p)
+            : batch(n), channels(c), height(h), width(w), out_channels(o), kernel_h(kh), kernel_w(kw), params(p)
+        {
+            out_h = traph::conv_output_size(h, kh, p.stride_h, p.padding_h, p.dilation_h);
+            out_w = traph::conv_output_size(w, kw, p.stride_w, p.padding_w, p.dilation_w);
+        }
+
+        // calls f(input index, weight index, output index) for every multiply-add
+        template<typename F>
+        void visit(F f) const
+        {
+            int cg = channels / params.groups, og = out_channels / params.groups;
+            for (int n = 0; n < batch; ++n)
+                for (int o = 0; o < out_channels; ++o)
+                    for (int oh = 0; oh < out_h; ++oh)
+                        for (int ow = 0; ow < out_w; ++ow)
+                            for (int c = 0; c < cg; ++c)
+                                for (int kh = 0; kh < kernel_h; ++kh)
+                                    for (int kw = 0; kw < kernel_w; ++kw)
+                                    {
+                                        int ih = oh * params.stride_h - params.padding_h + kh * params.dilation_h;
+                                        int iw = ow * params.stride_w - params.padding_w + kw * params.dilation_w;
+                                        if (ih < 0 || ih >= height || iw < 0 || iw >= width)
+                                            continue;
+                                        int ic = o / og * cg + c;
+                                        f(((n * channels + ic) * height + ih) * width + iw,
+                                            ((o * cg + c) * kernel_h + kh) * kernel_w + kw,
+                                            ((n * out_channels + o) * out_h + oh) * out_w + ow);
+                                    }
+        }
+
+        template<typename T>
+        std::vector<double> forward(const T* x, const T* w, const T* b) const
+        {
+            std::vector<double> y(batch * out_channels * out_h * out_w, 0.0);
+            visit([&](int xi, int wi, int yi) { y[yi] += static_cast<double>(x[xi]) * w[wi]; });
+            if (b)
+                for (int i = 0; i < static_cast<int>(y.size()); ++i)
+                    y[i] += b[i / (out_h * out_w) % out_channels];
+            return y;
+        }
+    };
+
+    template<typename T>
+    void check_conv(int n, int c, int h, int w, int o, int k, const traph::Conv2dParams& params, double tolerance)
+    {
+        auto input = conv_tensor<T>({ n, c, h, w }, 1);
+        auto weight = conv_tensor<T>({ o, c / params.groups, k, k }, 2);
+        auto bias = conv_tensor<T>({ o }, 3);
+        NaiveConv naive(n, c, h, w, o, k, k, params);
+        std::vector<double> expected = naive.forward(input->data_ptr(), weight->data_ptr(), bias->data_ptr());
+
+        auto result = traph::conv2d_impl(*input, *weight, bias.get(), params);
+        REQUIRE(result->size() == traph::DimVector({ n, o, naive.out_h, naive.out_w }));
+        for (int i = 0; i < static_cast<int>(expected.size()); ++i)
+            REQUIRE(std::abs(result->data_ptr()[i] - expected[i]) < tolerance);
+    }
+
+    template<typename T>
+    void check_conv_algorithms(int n, int c, int h, int w, int o, int k, const traph::Conv2dParams& params, double tolerance)
+    {
+        // algorithms that do not apply to a shape fall back to im2col
+        for (traph::ConvAlgorithm algorithm : { traph::ConvAlgorithm::IM2COL, traph::ConvAlgorithm::DIRECT,
+            traph::ConvAlgorithm::WINOGRAD_2X2, traph::ConvAlgorithm::WINOGRAD_4X4, traph::ConvAlgorithm::FFT, traph::ConvAlgorithm::AUTO })
+        {
+            traph::conv2d_algorithm_(algorithm);
+            check_conv<T>(n, c, h, w, o, k, params, tolerance);
+        }
+    }
+
+    template<typename T>
+    traph::ConvAlgorithm model_algorithm(int n, int c, int h, int w, int o, int k, const traph::Conv2dParams& params)
+    {
+        auto input = conv_tensor<T>({ n, c, h, w }, 1);
+        auto weight = conv_tensor<T>({ o, c / params.groups, k, k }, 2);
+        return traph::conv2d_find_algorithm(*input, *weight, params);
+    }
+
+    inline traph::Conv2dParams conv_params(int stride, int padding, int dilation, int groups)
+    {
+        traph::Conv2dParams params;
+        params.stride_h = params.stride_w = stride;
+        params.padding_h = params.padding_w = padding;
+        params.dilation_h = params.dilation_w = dilation;
+        params.groups = groups;
+        return params;
+    }
+}
+
+TEST_CASE( "conv test", "[conv]" )
+{
+    SECTION("forward")
+    {
+        traph::Conv2dParams asymmetric = traph_test::conv_params(1, 1, 1, 1);
+        asymmetric.stride_w = 2;
+        asymmetric.padding_h = 0;
+        asymmetric.dilation_h = 2;
+        const traph::Conv2dParams configs[] = {
+            traph_test::conv_params(1, 0, 1, 1),
+            traph_test::conv_params(1, 1, 1, 1),
+            traph_test::conv_params(2, 1, 1, 1),
+            traph_test::conv_params(1, 2, 2, 1),
+            traph_test::conv_params(2, 0, 1, 2),
+            asymmetric
+        };
+        for (const traph::Conv2dParams& params : configs)
+            for (int k : { 1, 3, 5 })
+            {
+                traph_test::check_conv_algorithms<float>(2, 4, 9, 11, 6, k, params, 1e-4);
+                traph_test::check_conv_algorithms<double>(2, 4, 9, 11, 6, k, params, 1e-10);
+            }
+        // more channels than one block of the direct kernels, rows wider than a tile
+        traph_test::check_conv_algorithms<float>(3, 20, 12, 30, 37, 3, traph_test::conv_params(1, 1, 1, 1), 1e-3);
+        traph_test::check_conv_algorithms<float>(1, 35, 8, 29, 20, 1, traph_test::conv_params(2, 1, 1, 1), 1e-3);
+        // depthwise
+        traph_test::check_conv<float>(2, 6, 7, 7, 6, 3, traph_test::conv_params(1, 1, 1, 6), 1e-4);
+        traph_test::check_conv_algorithms<double>(2, 6, 7, 7, 6, 3, traph_test::conv_params(1, 1, 1, 6), 1e-10);
+        // partial Winograd tiles, fft sizes past the padded input
+        traph_test::check_conv_algorithms<double>(3, 5, 13, 6, 7, 3, traph_test::conv_params(1, 2, 1, 1), 1e-10);
+        traph_test::check_conv_algorithms<double>(2, 3, 17, 9, 4, 7, traph_test::conv_params(1, 3, 1, 1), 1e-10);
+        traph::conv2d_algorithm_(traph::ConvAlgorithm::AUTO);
+    }
+
+    SECTION("strided input and no bias")
+    {
+        auto input = traph_test::conv_tensor<double>({ 2, 3, 6, 5 }, 4);
+        auto weight = traph_test::conv_tensor<double>({ 4, 3, 3, 3 }, 5);
+        traph::Conv2dParams params = traph_test::conv_params(1, 1, 1, 1);
+        auto view = std::dynamic_pointer_cast<traph::Tensor<double>>(input->transpose(2, 3));
+        auto result = traph::conv2d_impl(*view, *weight, nullptr, params);
+        REQUIRE(result->size() == traph::DimVector({ 2, 4, 5, 6 }));
+
+        traph::Tensor<double> copy(traph::DimVector({ 2, 3, 5, 6 }));
+        for (int i = 0; i < 2 * 3; ++i)
+            for (int h = 0; h < 5; ++h)
+                for (int w = 0; w < 6; ++w)
+                    copy.data_ptr()[(i * 5 + h) * 6 + w] = input->data_ptr()[(i * 6 + w) * 5 + h];
+        traph_test::NaiveConv naive(2, 3, 5, 6, 4, 3, 3, params);
+        std::vector<double> expected = naive.forward<double>(copy.data_ptr(), weight->data_ptr(), nullptr);
+        for (int i = 0; i < static_cast<int>(expected.size()); ++i)
+            REQUIRE(std::abs(result->data_ptr()[i] - expected[i]) < 1e-10);
+    }
+
+    SECTION("backward")
+    {
+        const traph::Conv2dParams configs[] = {
+            traph_test::conv_params(1, 1, 1, 1),
+            traph_test::conv_params(2, 1, 2, 2),
+            traph_test::conv_params(1, 0, 1, 1)
+        };
+        for (const traph::Conv2dParams& params : configs)
+            for (int k : { 1, 3 })
+            {
+                const int n = 3, c = 4, h = 7, w = 8, o = 6;
+                auto input = traph_test::conv_tensor<double>({ n, c, h, w }, 6);
+                auto weight = traph_test::conv_tensor<double>({ o, c / params.groups, k, k }, 7);
+                traph_test::NaiveConv naive(n, c, h, w, o, k, k, params);
+                auto grad = traph_test::conv_tensor<double>({ n, o, naive.out_h, naive.out_w }, 8);
+
+                std::vector<double> dx(n * c * h * w, 0.0), dw(weight->size().flat_size(), 0.0), db(o, 0.0);
+                const double* x = input->data_ptr();
+                const double* wt = weight->data_ptr();
+                const double* dy = grad->data_ptr();
+                naive.visit([&](int xi, int wi, int yi) {
+                    dx[xi] += wt[wi] * dy[yi];
+                    dw[wi] += x[xi] * dy[yi];
+                });
+                for (int i = 0; i < grad->size().flat_size(); ++i)
+                    db[i / (naive.out_h * naive.out_w) % o] += dy[i];
+
+                auto grads = traph::conv2d_backward_impl(*grad, *input, *weight, true, params);
+                REQUIRE(grads.size() == 3);
+                REQUIRE(grads[0]->size() == input->size());
+                REQUIRE(grads[1]->size() == weight->size());
+                for (int i = 0; i < static_cast<int>(dx.size()); ++i)
+                    REQUIRE(std::abs(grads[0]->data_ptr()[i] - dx[i]) < 1e-10);
+                for (int i = 0; i < static_cast<int>(dw.size()); ++i)
+                    REQUIRE(std::abs(grads[1]->data_ptr()[i] - dw[i]) < 1e-10);
+                for (int i = 0; i < o; ++i)
+                    REQUIRE(std::abs(grads[2]->data_ptr()[i] - db[i]) < 1e-10);
+                REQUIRE(traph::conv2d_backward_impl(*grad, *input, *weight, false, params).size() == 2);
+            }
+    }
+
+    SECTION("algorithm selection")
+    {
+        traph::Conv2dParams same = traph_test::conv_params(1, 1, 1, 1);
+        traph::Conv2dParams strided = traph_test::conv_params(2, 1, 1, 1);
+        REQUIRE(traph::conv2d_algorithm_applies(traph::ConvAlgorithm::WINOGRAD_4X4, traph::DataType::DOUBLE, { 1, 4, 8, 8 }, { 4, 4, 3, 3 }, same));
+        REQUIRE_FALSE(traph::conv2d_algorithm_applies(traph::ConvAlgorithm::WINOGRAD_2X2, traph::DataType::FLOAT, { 1, 4, 8, 8 }, { 4, 4, 5, 5 }, same));
+        REQUIRE_FALSE(traph::conv2d_algorithm_applies(traph::ConvAlgorithm::FFT, traph::DataType::FLOAT, { 1, 4, 8, 8 }, { 4, 4, 3, 3 }, strided));
+        REQUIRE_FALSE(traph::conv2d_algorithm_applies(traph::ConvAlgorithm::DIRECT, traph::DataType::DOUBLE, { 1, 4, 8, 8 }, { 4, 4, 3, 3 }, same));
+
+        // the cost model
+        REQUIRE(traph_test::model_algorithm<double>(1, 64, 56, 56, 64, 3, same) == traph::ConvAlgorithm::WINOGRAD_4X4);
+        REQUIRE(traph_test::model_algorithm<double>(1, 64, 56, 56, 64, 3, strided) == traph::ConvAlgorithm::IM2COL);
+        REQUIRE(traph_test::model_algorithm<float>(1, 256, 14, 14, 256, 3, same) == traph::ConvAlgorithm::IM2COL);
+        REQUIRE(traph_test::model_algorithm<double>(1, 16, 64, 64, 16, 31, traph_test::conv_params(1, 15, 1, 1)) == traph::ConvAlgorithm::FFT);
+        REQUIRE(traph_test::model_algorithm<double>(4, 32, 16, 16, 64, 1, traph_test::conv_params(1, 0, 1, 1)) == traph::ConvAlgorithm::IM2COL);
+
+        // the benchmark runs once per shape
+        traph::conv2d_clear_algorithm_cache();
+        traph::conv2d_benchmark_(true);
+        traph_test::check_conv<float>(2, 8, 12, 12, 8, 3, same, 1e-3);
+        traph_test::check_conv<double>(2, 8, 12, 12, 8, 3, same, 1e-10);
+        REQUIRE(traph::conv2d_algorithm_cache_size() == 2);
+        traph_test::check_conv<float>(2, 8, 12, 12, 8, 3, same, 1e-3);
+        REQUIRE(traph_test::model_algorithm<float>(2, 8, 12, 12, 8, 3, same) != traph::ConvAlgorithm::AUTO);
+        REQUIRE(traph::conv2d_algorithm_cache_size() == 2);
+        traph::conv2d_benchmark_(false);
+        traph::conv2d_clear_algorithm_cache();
+        REQUIRE(traph::conv2d_algorithm_cache_size() == 0);
+    }
+
+    SECTION("workspace reuse")
+    {
+        auto input = traph_test::conv_tensor<float>({ 2, 8, 20, 20 }, 9);
+        auto weight = traph_test::conv_tensor<float>({ 16, 8, 3, 3 }, 10);
+        traph::Conv2dParams params = traph_test::conv_params(1, 1, 1, 1);
+        for (traph::ConvAlgorithm algorithm : { traph::ConvAlgorithm::IM2COL, traph::ConvAlgorithm::DIRECT,
+            traph::ConvAlgorithm::WINOGRAD_2X2, traph::ConvAlgorithm::WINOGRAD_4X4, traph::ConvAlgorithm::FFT })
+        {
+            traph::conv2d_algorithm_(algorithm);
+            traph::conv2d_impl(*input, *weight, nullptr, params);
+            traph::idx_type allocations = traph::conv_workspace_allocations();
+            for (int i = 0; i < 3; ++i)
+                traph::conv2d_impl(*input, *weight, nullptr, params);
+            REQUIRE(traph::conv_workspace_allocations() == allocations);
+        }
+        traph::conv2d_algorithm_(traph::ConvAlgorithm::AUTO);
+    }
+
+    auto input = traph_test::conv_tensor<float>({ 1, 4, 5, 5 }, 11);
+    auto weight = traph_test::conv_tensor<float>({ 2, 3, 3, 3 }, 12);
+    REQUIRE_THROWS_AS(traph::conv2d_impl(*input, *weight, nullptr, traph::Conv2dParams()), std::runtime_error);
+    auto large = traph_test::conv_tensor<float>({ 2, 4, 7, 7 }, 13);
+    REQUIRE_THROWS_AS(traph::conv2d_impl(*input, *large, nullptr, traph::Conv2dParams()), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::conv2d_impl(*input, *input, nullptr, traph_test::conv_params(1, 0, 1, 3)), std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef TRAPH_TEST_EINSUM_H_
+#define TRAPH_TEST_EINSUM_H_
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/tensor/einsum.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    inline std::shared_ptr<traph::Tensor<double>> pattern_tensor(const traph::DimVector& size, int seed)
+    {
+        std::shared_ptr<traph::Tensor<double>> result(new traph::Tensor<double>(size));
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<double>((i * 7 + seed * 3) % 11) - 5;
+        return result;
+    }
+
+    // element of t at the given index, t may be a strided view
+    inline double element(const traph::Tensor<double>& t, const std::vector<int>& index)
+    {
+        const double* p = t.data_ptr() + t.offset();
+        for (int d = 0; d < static_cast<int>(index.size()); ++d)
+            p += index[d] * t.stride(d);
+        return *p;
+    }
+
+    // einsum by visiting every combination of label values
+    inline std::vector<double> naive_einsum(const std::string& spec, const std::vector<const traph::Tensor<double>*>& operands)
+    {
+        traph::EinsumEquation equation = traph::parse_einsum(spec);
+        std::map<int, int> sizes;
+        for (int i = 0; i < static_cast<int>(operands.size()); ++i)
+            for (int d = 0; d < static_cast<int>(equation.inputs[i].size()); ++d)
+                sizes[equation.inputs[i][d]] = static_cast<int>(operands[i]->size(d));
+        std::vector<int> labels;
+        for (auto& each : sizes)
+            labels.push_back(each.first);
+
+        int out_count = 1;
+        for (int label : equation.output)
+            out_count *= sizes[label];
+        std::vector<double> result(out_count, 0.0);
+        std::map<int, int> value;
+        for (int label : labels)
+            value[label] = 0;
+        while (true)
+        {
+            double product = 1.0;
+            for (int i = 0; i < static_cast<int>(operands.size()); ++i)
+            {
+                std::vector<int> index;
+                for (int label : equation.inputs[i])
+                    index.push_back(value[label]);
+                product *= element(*operands[i], index);
+            }
+            int out = 0;
+            for (int label : equation.output)
+                out = out * sizes[label] + value[label];
+            result[out] += product;
+
+            int l = static_cast<int>(labels.size()) - 1;
+            for (; l >= 0; --l)
+            {
+                if (++value[labels[l]] < sizes[labels[l]])
+                    break;
+                value[labels[l]] = 0;
+            }
+            if (l < 0)
+                break;
+        }
+        return result;
+    }
+
+    inline void check_einsum(const std::string& spec, const std::vector<const traph::Tensor<double>*>& operands)
+    {
+        auto result = traph::einsum_impl(spec, operands);
+        std::vector<double> expected = naive_einsum(spec, operands);
+        REQUIRE(result->size().flat_size() == static_cast<traph::idx_type>(expected.size()));
+        for (int i = 0; i < static_cast<int>(expected.size()); ++i)
+            REQUIRE(result->data_ptr()[i] == Approx(expected[i]));
+    }
+}
+
+TEST_CASE( "einsum test", "[einsum]" )
+{
+    auto a = traph_test::pattern_tensor({ 4, 5 }, 1);
+    auto b = traph_test::pattern_tensor({ 5, 6 }, 2);
+    auto c = traph_test::pattern_tensor({ 6, 3 }, 3);
+    auto square = traph_test::pattern_tensor({ 5, 5 }, 4);
+    auto batch_a = traph_test::pattern_tensor({ 3, 4, 5 }, 5);
+    auto batch_b = traph_test::pattern_tensor({ 3, 5, 2 }, 6);
+    auto cube = traph_test::pattern_tensor({ 2, 3, 4 }, 7);
+
+    SECTION("single and pairwise contractions")
+    {
+        traph_test::check_einsum("ij,jk->ik", { a.get(), b.get() });
+        traph_test::check_einsum("ij,jk", { a.get(), b.get() });
+        traph_test::check_einsum("ij,jk->ki", { a.get(), b.get() });
+        traph_test::check_einsum("bij,bjk->bik", { batch_a.get(), batch_b.get() });
+        traph_test::check_einsum("bij,bjk->ikb", { batch_a.get(), batch_b.get() });
+        traph_test::check_einsum("bij,bjk->ik", { batch_a.get(), batch_b.get() });
+        traph_test::check_einsum("bij,bij->bi", { batch_a.get(), batch_a.get() });
+        traph_test::check_einsum("ij,kl->ijkl", { a.get(), c.get() });
+        traph_test::check_einsum("ii->", { square.get() });
+        traph_test::check_einsum("ii->i", { square.get() });
+        traph_test::check_einsum("ij->", { a.get() });
+        traph_test::check_einsum("ijk->kji", { cube.get() });
+        traph_test::check_einsum("ijk,ij->k", { cube.get(), traph_test::pattern_tensor({ 2, 3 }, 8).get() });
+        traph_test::check_einsum("ij,ij,ij->j", { a.get(), a.get(), a.get() });
+    }
+
+    SECTION("strided views")
+    {
+        auto a_t = std::dynamic_pointer_cast<traph::Tensor<double>>(a->transpose(0, 1));
+        auto b_t = std::dynamic_pointer_cast<traph::Tensor<double>>(b->transpose(0, 1));
+        traph_test::check_einsum("ji,kj->ik", { a_t.get(), b_t.get() });
+        auto cube_p = std::dynamic_pointer_cast<traph::Tensor<double>>(cube->permute({ 2, 0, 1 }));
+        traph_test::check_einsum("kij,jl->ikl", { cube_p.get(), traph_test::pattern_tensor({ 3, 2 }, 9).get() });
+    }
+
+    SECTION("contraction order and plan cache")
+    {
+        traph::einsum_clear_plan_cache();
+        auto x = traph_test::pattern_tensor({ 40, 2 }, 10);
+        auto y = traph_test::pattern_tensor({ 2, 40 }, 11);
+        auto z = traph_test::pattern_tensor({ 40, 2 }, 12);
+        // y * z is 2 x 2, x * y would be 40 x 40
+        traph::EinsumEquation equation = traph::parse_einsum("ij,jk,kl->il");
+        auto path = traph::einsum_path(equation, { x->size(), y->size(), z->size() });
+        REQUIRE(path.size() == 2);
+        REQUIRE(path[0] == std::make_pair<traph::idx_type, traph::idx_type>(1, 2));
+        REQUIRE(path[1] == std::make_pair<traph::idx_type, traph::idx_type>(0, 1));
+        REQUIRE(traph::einsum_plan_cache_size() == 1);
+
+        traph_test::check_einsum("ij,jk,kl->il", { x.get(), y.get(), z.get() });
+        traph_test::check_einsum("ij,jk,kl->il", { x.get(), y.get(), z.get() });
+        REQUIRE(traph::einsum_plan_cache_size() == 1);
+        traph_test::check_einsum("ij,jk,kl->il", { a.get(), b.get(), c.get() });
+        REQUIRE(traph::einsum_plan_cache_size() == 2);
+    }
+
+    SECTION("tensordot")
+    {
+        auto d = traph_test::pattern_tensor({ 4, 3, 2 }, 13);
+        auto result = traph::tensordot_impl(*cube, *d, { 1, 2 }, { 1, 0 });
+        REQUIRE(result->size() == traph::DimVector({ 2, 2 }));
+        std::vector<double> expected = traph_test::naive_einsum("ijk,kjl->il", { cube.get(), d.get() });
+        for (int i = 0; i < 4; ++i)
+            REQUIRE(result->data_ptr()[i] == Approx(expected[i]));
+        REQUIRE_THROWS(traph::tensordot_impl(*cube, *d, { 2 }, { 2 }));
+    }
+
+    SECTION("gradients")
+    {
+        auto grad = traph_test::pattern_tensor({ 4, 6 }, 14);
+        traph::EinsumEquation equation = traph::parse_einsum("ij,jk->ik");
+        auto grads = traph::einsum_backward_impl(*grad, equation, { a.get(), b.get() });
+        std::vector<double> expected_a = traph_test::naive_einsum("ik,kj->ij", { grad.get(), std::dynamic_pointer_cast<traph::Tensor<double>>(b->transpose(0, 1)).get() });
+        std::vector<double> expected_b = traph_test::naive_einsum("ji,jk->ik", { a.get(), grad.get() });
+        REQUIRE(grads[0]->size() == a->size());
+        REQUIRE(grads[1]->size() == b->size());
+        for (int i = 0; i < 20; ++i)
+            REQUIRE(grads[0]->data_ptr()[i] == Approx(expected_a[i]));
+        for (int i = 0; i < 30; ++i)
+            REQUIRE(grads[1]->data_ptr()[i] == Approx(expected_b[i]));
+
+        // a label only the first operand has is broadcast back
+        auto sum_grad = traph_test::pattern_tensor({ 6 }, 15);
+        auto sum_grads = traph::einsum_backward_impl(*sum_grad, traph::parse_einsum("ij,jk->k"), { a.get(), b.get() });
+        REQUIRE(sum_grads[0]->size() == a->size());
+        for (int j = 0; j < 5; ++j)
+        {
+            double expected = 0.0;
+            for (int k = 0; k < 6; ++k)
+                expected += b->data_ptr()[j * 6 + k] * sum_grad->data_ptr()[k];
+            REQUIRE(sum_grads[0]->data_ptr()[j] == Approx(expected));
+            REQUIRE(sum_grads[0]->data_ptr()[3 * 5 + j] == Approx(expected));
+        }
+    }
+
+    using Operands = std::vector<const traph::Tensor<double>*>;
+    REQUIRE_THROWS(traph::einsum_impl("ij,jk->ik", Operands{ a.get(), a.get() }));
+    REQUIRE_THROWS(traph::einsum_impl("ij->ijk", Operands{ a.get() }));
+    REQUIRE_THROWS(traph::einsum_impl("...ij->ij", Operands{ a.get() }));
+}
+
+#endif
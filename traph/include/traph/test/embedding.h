@@ -0,0 +1,295 @@
+#ifndef TRAPH_TEST_EMBEDDING_H_
+#define TRAPH_TEST_EMBEDDING_H_
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <omp.h>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/layers/embedding.h>
+#include <traph/nn/optim.h>
+#include <traph/tensor/embedding.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> embedding_table(int rows, int dim, int seed)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(traph::DimVector({ rows, dim })));
+        for (int i = 0; i < rows * dim; ++i)
+            result->data_ptr()[i] = static_cast<T>((i * 7 + seed * 5) % 17) / 4 - 2;
+        return result;
+    }
+
+    // count indices in [0, rows), with repeats
+    inline std::shared_ptr<traph::Tensor<traph::i64>> embedding_indices(const traph::DimVector& size, int rows, int seed)
+    {
+        std::shared_ptr<traph::Tensor<traph::i64>> result(new traph::Tensor<traph::i64>(size));
+        unsigned state = static_cast<unsigned>(seed);
+        for (int i = 0; i < size.flat_size(); ++i)
+        {
+            state = state * 1103515245u + 12345u;
+            result->data_ptr()[i] = static_cast<traph::i64>((state >> 8) % static_cast<unsigned>(rows));
+        }
+        return result;
+    }
+
+    inline std::shared_ptr<traph::Tensor<traph::i64>> long_tensor(const std::vector<traph::i64>& values)
+    {
+        std::shared_ptr<traph::Tensor<traph::i64>> result(new traph::Tensor<traph::i64>(traph::DimVector({ static_cast<int>(values.size()) })));
+        for (std::size_t i = 0; i < values.size(); ++i)
+            result->data_ptr()[i] = values[i];
+        return result;
+    }
+
+    // the [rows, dim] dense table of sparse rows, checking the rows are sorted and unique
+    template<typename T>
+    std::vector<double> dense_rows(const traph::SparseRows<T>& rows)
+    {
+        std::vector<double> result(static_cast<std::size_t>(rows.rows) * rows.dim, 0.0);
+        for (int s = 0; s < rows.nnz(); ++s)
+        {
+            if (s > 0)
+                REQUIRE(rows.indices[s - 1] < rows.indices[s]);
+            for (int j = 0; j < rows.dim; ++j)
+                result[static_cast<std::size_t>(rows.indices[s]) * rows.dim + j] = rows.values->data_ptr()[s * rows.dim + j];
+        }
+        return result;
+    }
+
+    // bags of 1-D indices from offsets, checked against a direct sum and its gradient
+    template<typename T>
+    void check_embedding_bag(int rows, int dim, const std::vector<traph::i64>& offsets, int count,
+        traph::EmbeddingBagMode mode, double eps)
+    {
+        auto weight = embedding_table<T>(rows, dim, 1);
+        auto indices = embedding_indices(traph::DimVector({ count }), rows, 2);
+        auto offset_tensor = long_tensor(offsets);
+        auto result = traph::embedding_bag_impl(*weight, *indices, offset_tensor.get(), mode);
+        int bags = static_cast<int>(offsets.size());
+        REQUIRE(result->size() == traph::DimVector({ bags, dim }));
+
+        auto grad = embedding_table<T>(bags, dim, 3);
+        std::vector<double> dw(static_cast<std::size_t>(rows) * dim, 0.0);
+        for (int b = 0; b < bags; ++b)
+        {
+            int begin = static_cast<int>(offsets[b]);
+            int end = b + 1 < bags ? static_cast<int>(offsets[b + 1]) : count;
+            double scale = mode == traph::EmbeddingBagMode::MEAN && end > begin ? 1.0 / (end - begin) : 1.0;
+            for (int j = 0; j < dim; ++j)
+            {
+                double sum = 0.0;
+                for (int k = begin; k < end; ++k)
+                {
+                    int row = static_cast<int>(indices->data_ptr()[k]);
+                    sum += weight->data_ptr()[row * dim + j];
+                    dw[row * dim + j] += scale * grad->data_ptr()[b * dim + j];
+                }
+                REQUIRE(std::abs(result->data_ptr()[b * dim + j] - sum * scale) < eps);
+            }
+        }
+
+        auto rows_grad = traph::embedding_bag_backward_impl(*grad, *indices, offset_tensor.get(), rows, mode);
+        std::vector<double> dense = dense_rows(*rows_grad);
+        for (std::size_t i = 0; i < dw.size(); ++i)
+            REQUIRE(std::abs(dense[i] - dw[i]) < eps);
+    }
+}
+
+TEST_CASE( "embedding test", "[embedding]" )
+{
+    SECTION("embedding")
+    {
+        auto weight = traph_test::embedding_table<float>(50, 7, 1);
+        auto indices = traph_test::embedding_indices(traph::DimVector({ 3, 4, 5 }), 50, 2);
+        auto result = traph::embedding_impl(*weight, *indices);
+        REQUIRE(result->size() == traph::DimVector({ 3, 4, 5, 7 }));
+        for (int i = 0; i < 60; ++i)
+            for (int j = 0; j < 7; ++j)
+                REQUIRE(result->data_ptr()[i * 7 + j] == weight->data_ptr()[indices->data_ptr()[i] * 7 + j]);
+
+        // a transposed table and transposed indices
+        auto memory = traph_test::embedding_table<double>(9, 40, 3);
+        auto transposed = std::dynamic_pointer_cast<traph::Tensor<double>>(memory->transpose(0, 1));
+        auto index_memory = traph_test::embedding_indices(traph::DimVector({ 6, 4 }), 40, 4);
+        auto index_view = std::dynamic_pointer_cast<traph::Tensor<traph::i64>>(index_memory->transpose(0, 1));
+        auto strided = traph::embedding_impl(*transposed, *index_view);
+        REQUIRE(strided->size() == traph::DimVector({ 4, 6, 9 }));
+        for (int a = 0; a < 4; ++a)
+            for (int b = 0; b < 6; ++b)
+                for (int j = 0; j < 9; ++j)
+                    REQUIRE(strided->data_ptr()[(a * 6 + b) * 9 + j] == memory->data_ptr()[j * 40 + index_memory->data_ptr()[b * 4 + a]]);
+    }
+
+    SECTION("embedding backward")
+    {
+        auto indices = traph_test::embedding_indices(traph::DimVector({ 30, 11 }), 40, 5);
+        auto grad = traph_test::embedding_table<float>(330, 6, 6);
+        grad->resize_({ 30, 11, 6 });
+        auto rows = traph::embedding_backward_impl(*grad, *indices, 40);
+        REQUIRE(rows->rows == 40);
+        REQUIRE(rows->dim == 6);
+        REQUIRE(rows->nnz() <= 40);
+        std::vector<double> dw(40 * 6, 0.0);
+        for (int i = 0; i < 330; ++i)
+            for (int j = 0; j < 6; ++j)
+                dw[indices->data_ptr()[i] * 6 + j] += grad->data_ptr()[i * 6 + j];
+        std::vector<double> dense = traph_test::dense_rows(*rows);
+        for (int i = 0; i < 40 * 6; ++i)
+            REQUIRE(std::abs(dense[i] - dw[i]) < 1e-4);
+        auto to_dense = traph::sparse_rows_to_dense(*rows);
+        for (int i = 0; i < 40 * 6; ++i)
+            REQUIRE(to_dense->data_ptr()[i] == static_cast<float>(dense[i]));
+
+        // a table of 2^24 rows needs three digits and only keeps the rows read
+        auto sparse = traph_test::embedding_indices(traph::DimVector({ 1000 }), 1 << 24, 7);
+        auto sparse_grad = traph_test::embedding_table<double>(1000, 3, 8);
+        sparse->data_ptr()[999] = sparse->data_ptr()[0];
+        auto large = traph::embedding_backward_impl(*sparse_grad, *sparse, 1 << 24);
+        REQUIRE(large->nnz() < 1000);
+        for (int s = 0; s < large->nnz(); ++s)
+        {
+            if (s > 0)
+                REQUIRE(large->indices[s - 1] < large->indices[s]);
+            for (int j = 0; j < 3; ++j)
+            {
+                double sum = 0.0;
+                for (int i = 0; i < 1000; ++i)
+                    if (sparse->data_ptr()[i] == large->indices[s])
+                        sum += sparse_grad->data_ptr()[i * 3 + j];
+                REQUIRE(std::abs(large->values->data_ptr()[s * 3 + j] - sum) < 1e-12);
+            }
+        }
+    }
+
+    SECTION("embedding bag")
+    {
+        for (traph::EmbeddingBagMode mode : { traph::EmbeddingBagMode::SUM, traph::EmbeddingBagMode::MEAN })
+        {
+            // with empty bags in the middle and at the end
+            traph_test::check_embedding_bag<float>(30, 5, { 0, 3, 3, 10, 11, 20 }, 20, mode, 1e-5);
+            traph_test::check_embedding_bag<double>(100, 70, { 0, 0, 40, 41 }, 90, mode, 1e-12);
+        }
+
+        // [bags, length] indices without offsets
+        auto weight = traph_test::embedding_table<float>(25, 4, 9);
+        auto indices = traph_test::embedding_indices(traph::DimVector({ 6, 3 }), 25, 10);
+        auto result = traph::embedding_bag_impl(*weight, *indices, nullptr, traph::EmbeddingBagMode::MEAN);
+        auto flat = traph::Tensor<traph::i64>(traph::DimVector({ 18 }));
+        for (int i = 0; i < 18; ++i)
+            flat.data_ptr()[i] = indices->data_ptr()[i];
+        auto offsets = traph_test::long_tensor({ 0, 3, 6, 9, 12, 15 });
+        auto expected = traph::embedding_bag_impl(*weight, flat, offsets.get(), traph::EmbeddingBagMode::MEAN);
+        for (int i = 0; i < 24; ++i)
+            REQUIRE(result->data_ptr()[i] == expected->data_ptr()[i]);
+    }
+
+    SECTION("backward does not depend on threads")
+    {
+        auto indices = traph_test::embedding_indices(traph::DimVector({ 4096 }), 300, 11);
+        auto grad = traph_test::embedding_table<float>(4096, 64, 12);
+        int threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+        auto serial = traph::embedding_backward_impl(*grad, *indices, 300);
+        omp_set_num_threads(4);
+        auto parallel = traph::embedding_backward_impl(*grad, *indices, 300);
+        omp_set_num_threads(threads);
+        REQUIRE(serial->indices == parallel->indices);
+        for (int i = 0; i < serial->nnz() * 64; ++i)
+            REQUIRE(serial->values->data_ptr()[i] == parallel->values->data_ptr()[i]);
+    }
+
+    SECTION("sparse rows")
+    {
+        auto lhs = traph::embedding_backward_impl(*traph_test::embedding_table<float>(4, 3, 13), *traph_test::long_tensor({ 5, 1, 5, 8 }), 10);
+        auto rhs = traph::embedding_backward_impl(*traph_test::embedding_table<float>(3, 3, 14), *traph_test::long_tensor({ 8, 2, 9 }), 10);
+        std::vector<double> expected = traph_test::dense_rows(*lhs);
+        std::vector<double> rhs_dense = traph_test::dense_rows(*rhs);
+        for (std::size_t i = 0; i < expected.size(); ++i)
+            expected[i] += rhs_dense[i];
+        traph::sparse_rows_add_(*lhs, *rhs);
+        REQUIRE(lhs->indices == std::vector<traph::idx_type>({ 1, 2, 5, 8, 9 }));
+        std::vector<double> sum = traph_test::dense_rows(*lhs);
+        for (std::size_t i = 0; i < sum.size(); ++i)
+            REQUIRE(std::abs(sum[i] - expected[i]) < 1e-6);
+
+        // only the rows of a transposed table that are set change
+        auto memory = traph_test::embedding_table<float>(3, 10, 15);
+        auto table = std::dynamic_pointer_cast<traph::Tensor<float>>(memory->transpose(0, 1));
+        auto before = traph_test::embedding_table<float>(3, 10, 15);
+        traph::index_add_rows_(*table, *lhs, -0.5f);
+        for (int row = 0; row < 10; ++row)
+            for (int j = 0; j < 3; ++j)
+                REQUIRE(std::abs(memory->data_ptr()[j * 10 + row] - (before->data_ptr()[j * 10 + row] - 0.5 * sum[row * 3 + j])) < 1e-6);
+
+        traph::SparseRows<float> empty(10, 3);
+        traph::sparse_rows_add_(empty, *lhs);
+        REQUIRE(empty.indices == lhs->indices);
+        REQUIRE(empty.values != lhs->values);
+        traph::SparseRows<float> other(11, 3);
+        REQUIRE_THROWS_AS(traph::sparse_rows_add_(other, *lhs), std::runtime_error);
+    }
+
+    SECTION("sparse gradients of the layers")
+    {
+        auto ids = traph::zeros<traph::i64>({ 2, 3 });
+        traph::i64 values[] = { 4, 7, 4, 900, 7, 4 };
+        for (int i = 0; i < 6; ++i)
+            std::dynamic_pointer_cast<traph::Tensor<traph::i64>>(ids->data())->data_ptr()[i] = values[i];
+
+        traph::Embedding sparse(1000, 8, true);
+        traph::Embedding dense(1000, 8, false);
+        REQUIRE(sparse.weight()->requires_grad());
+        REQUIRE_FALSE(sparse.weight()->grad());
+        auto weight = std::dynamic_pointer_cast<traph::Tensor<float>>(sparse.weight()->data());
+        auto before = std::dynamic_pointer_cast<traph::Tensor<float>>(weight->clone());
+        std::dynamic_pointer_cast<traph::Tensor<float>>(dense.weight()->data())->apply_([](float) { return 0.f; });
+        dense.weight()->data()->add_(weight);
+
+        traph::sum(sparse.forward(ids))->backward();
+        traph::sum(dense.forward(ids))->backward();
+        auto rows = sparse.weight()->sparse_grad();
+        REQUIRE(rows->indices == std::vector<traph::idx_type>({ 4, 7, 900 }));
+        std::vector<double> grad = traph_test::dense_rows(*rows);
+        for (int i = 0; i < 1000 * 8; ++i)
+            REQUIRE(grad[i] == dense.weight()->grad()->data_ptr()[i]);
+        REQUIRE(grad[4 * 8] == 3.0);
+
+        // the optimizer moves the rows read only, and zero_grad drops them
+        traph::SGD optimizer(sparse.parameters(), 0.5f);
+        optimizer.step();
+        for (int row = 0; row < 1000; ++row)
+            for (int j = 0; j < 8; ++j)
+                REQUIRE(weight->data_ptr()[row * 8 + j] == before->data_ptr()[row * 8 + j] - 0.5f * static_cast<float>(grad[row * 8 + j]));
+        optimizer.zero_grad();
+        REQUIRE(sparse.weight()->sparse_grad()->nnz() == 0);
+
+        // gradients of several lookups accumulate
+        traph::EmbeddingBag bag(1000, 8, traph::EmbeddingBagMode::SUM, true);
+        auto flat = traph::zeros<traph::i64>({ 6 });
+        auto offsets = traph::zeros<traph::i64>({ 2 });
+        for (int i = 0; i < 6; ++i)
+            std::dynamic_pointer_cast<traph::Tensor<traph::i64>>(flat->data())->data_ptr()[i] = values[i];
+        std::dynamic_pointer_cast<traph::Tensor<traph::i64>>(offsets->data())->data_ptr()[1] = 2;
+        traph::sum(bag.forward(flat, offsets))->backward();
+        traph::sum(bag.forward(ids))->backward();
+        auto bag_rows = bag.weight()->sparse_grad();
+        REQUIRE(bag_rows->indices == std::vector<traph::idx_type>({ 4, 7, 900 }));
+        REQUIRE(bag_rows->values->data_ptr()[0] == 6.f);
+    }
+
+    auto weight = traph_test::embedding_table<float>(10, 3, 16);
+    REQUIRE_THROWS_AS(traph::embedding_impl(*weight, *traph_test::long_tensor({ 3, 10 })), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::embedding_impl(*weight, *traph_test::long_tensor({ -1 })), std::runtime_error);
+    auto indices = traph_test::long_tensor({ 1, 2, 3 });
+    REQUIRE_THROWS_AS(traph::embedding_bag_impl(*weight, *indices, traph_test::long_tensor({ 1, 2 }).get(), traph::EmbeddingBagMode::SUM), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::embedding_bag_impl(*weight, *indices, traph_test::long_tensor({ 0, 2, 1 }).get(), traph::EmbeddingBagMode::SUM), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::embedding_bag_impl(*weight, *indices, nullptr, traph::EmbeddingBagMode::SUM), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::embedding_backward_impl(*weight, *indices, 10), std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef TRAPH_TEST_EXECUTOR_H_
+#define TRAPH_TEST_EXECUTOR_H_
+
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/executor.h>
+#include <traph/nn/function.h>
+#include <traph/nn/variable.h>
+
+namespace traph_test
+{
+    // a residual chain y_{i+1} = y_i + sigmoid(y_i) of the given length from x
+    inline traph::VariableInterfacePtr residual_chain(traph::VariableInterfacePtr x, int length)
+    {
+        traph::VariableInterfacePtr y = x;
+        for (int i = 0; i < length; ++i)
+            y = traph::add(y, traph::sigmoid(y));
+        return y;
+    }
+
+    inline traph::VariableInterfacePtr patterned(traph::VariableInterfacePtr v, int seed)
+    {
+        auto data = std::dynamic_pointer_cast<traph::Tensor<float>>(v->data());
+        for (int i = 0; i < v->size().flat_size(); ++i)
+            data->data_ptr()[i] = static_cast<float>((i * 13 + seed * 7) % 41) / 40 - 0.5f;
+        return v;
+    }
+
+    // heads of two linear layers over x added into a loss, with the gradients of x, of the
+    // weights and of a sparse table after a backward pass
+    inline std::vector<std::vector<float>> multi_head_gradients(int heads)
+    {
+        auto x = patterned(traph::randn<float>({ 8, 16 }, true), 1);
+        auto table = patterned(traph::randn<float>({ 50, 16 }, false), 2);
+        table->sparse_grad_(std::make_shared<traph::SparseRows<float>>(50, 16));
+        auto ids = traph::zeros<traph::i64>({ 8 });
+        for (int i = 0; i < 8; ++i)
+            std::dynamic_pointer_cast<traph::Tensor<traph::i64>>(ids->data())->data_ptr()[i] = (i * 7) % 5;
+        auto input = traph::add(x, traph::embedding(ids, table, true));
+
+        std::vector<traph::VariableInterfacePtr> weights;
+        traph::VariableInterfacePtr loss;
+        for (int h = 0; h < heads; ++h)
+        {
+            auto w = patterned(traph::randn<float>({ 32, 16 }, true), 3 + 2 * h);
+            auto v = patterned(traph::randn<float>({ 4, 32 }, true), 4 + 2 * h);
+            weights.push_back(w);
+            weights.push_back(v);
+            auto y = traph::linear(traph::gelu(traph::linear(input, w, nullptr)), v, nullptr);
+            loss = loss ? traph::add(loss, y) : y;
+        }
+        traph::sum(traph::add(loss, loss))->backward();
+
+        std::vector<std::vector<float>> result;
+        result.emplace_back(x->grad()->data_ptr(), x->grad()->data_ptr() + 8 * 16);
+        for (auto& w : weights)
+            result.emplace_back(w->grad()->data_ptr(), w->grad()->data_ptr() + w->size().flat_size());
+        auto rows = table->sparse_grad();
+        result.emplace_back(rows->values->data_ptr(), rows->values->data_ptr() + rows->nnz() * 16);
+        return result;
+    }
+
+    // every node comes before the inputs that require a gradient, each once
+    inline void check_order(const std::vector<traph::VariableInterface*>& order, traph::VariableInterface* root)
+    {
+        std::unordered_map<traph::VariableInterface*, int> position;
+        for (int i = 0; i < static_cast<int>(order.size()); ++i)
+            REQUIRE(position.emplace(order[i], i).second);
+        REQUIRE(order[0] == root);
+        for (auto node : order)
+            for (auto& input : node->inputs())
+                if (input->requires_grad())
+                    REQUIRE(position.at(node) < position.at(input.get()));
+    }
+}
+
+TEST_CASE( "executor test", "[executor]" )
+{
+    SECTION("order")
+    {
+        // shared inputs and an input given twice
+        auto x = traph::ones<float>({ 3 }, true);
+        auto w = traph::ones<float>({ 3 }, false);
+        auto a = traph::sigmoid(x);
+        auto b = traph::add(a, a);
+        auto c = traph::add(traph::add(b, x), w);
+        auto nodes = traph::Executor::collect_backward_tensors(c.get());
+        REQUIRE(nodes.size() == 5);
+        REQUIRE(nodes[0] == c.get());
+        traph_test::check_order(traph::Executor::topology_sort(c.get()), c.get());
+
+        traph::sum(c)->backward();
+        // d/dx (2 s(x) + x) = 2 s(x) (1 - s(x)) + 1
+        double s = 1 / (1 + std::exp(-1.0));
+        for (int i = 0; i < 3; ++i)
+            REQUIRE(std::abs(x->grad()->data_ptr()[i] - (2 * s * (1 - s) + 1)) < 1e-6);
+        REQUIRE_FALSE(w->requires_grad());
+    }
+
+    SECTION("long graphs")
+    {
+        auto x = traph::ones<float>({ 2 }, true);
+        auto y = traph_test::residual_chain(x, 20000);
+        traph::Executor executor;
+        auto& order = executor.sort(y.get());
+        REQUIRE(order.size() == 40001);
+        traph_test::check_order(order, y.get());
+        REQUIRE_FALSE(executor.cached());
+
+        // the graph of the next iteration has the same structure and another does not
+        auto next = traph_test::residual_chain(x, 20000);
+        traph_test::check_order(executor.sort(next.get()), next.get());
+        REQUIRE(executor.cached());
+        auto other = traph_test::residual_chain(x, 19999);
+        traph_test::check_order(executor.sort(other.get()), other.get());
+        REQUIRE_FALSE(executor.cached());
+        auto wider = traph::add(traph_test::residual_chain(x, 19999), x);
+        traph_test::check_order(executor.sort(wider.get()), wider.get());
+        REQUIRE_FALSE(executor.cached());
+    }
+
+    SECTION("parallel backward")
+    {
+        auto run = [&](int threads, bool deterministic) {
+            traph::Executor::backward_threads_(threads);
+            traph::Executor::deterministic_(deterministic);
+            auto result = traph_test::multi_head_gradients(12);
+            traph::Executor::backward_threads_(1);
+            traph::Executor::deterministic_(true);
+            return result;
+        };
+        auto sequential = run(1, true);
+        // the same bits from the deterministic pass every time
+        for (int repeat = 0; repeat < 3; ++repeat)
+            REQUIRE(run(4, true) == sequential);
+        auto unordered = run(4, false);
+        REQUIRE(unordered.size() == sequential.size());
+        for (std::size_t i = 0; i < sequential.size(); ++i)
+        {
+            REQUIRE(unordered[i].size() == sequential[i].size());
+            for (std::size_t j = 0; j < sequential[i].size(); ++j)
+                REQUIRE(std::abs(unordered[i][j] - sequential[i][j]) < 1e-3 * (1 + std::abs(sequential[i][j])));
+        }
+        REQUIRE_THROWS_AS(traph::Executor::backward_threads_(0), std::runtime_error);
+    }
+}
+
+#endif
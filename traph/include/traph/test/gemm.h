@@ -0,0 +1,489 @@
+#ifndef TRAPH_TEST_GEMM_H_
+#define TRAPH_TEST_GEMM_H_
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/tensor/blas.h>
+#include <traph/tensor/gemm.h>
+#include <traph/tensor/qgemm.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    // c = alpha * a * b + beta * c in double precision
+    template<typename T>
+    void reference_gemm(int m, int n, int k, T alpha,
+        const T* a, int a_rs, int a_cs, const T* b, int b_rs, int b_cs,
+        T beta, T* c, int c_rs, int c_cs)
+    {
+        for (int i = 0; i < m; ++i)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                double acc = 0.0;
+                for (int p = 0; p < k; ++p)
+                    acc += static_cast<double>(a[i * a_rs + p * a_cs]) * b[p * b_rs + j * b_cs];
+                T& c_value = c[i * c_rs + j * c_cs];
+                c_value = static_cast<T>(alpha * acc + (beta == T(0) ? 0.0 : beta * static_cast<double>(c_value)));
+            }
+        }
+    }
+
+    template<typename T>
+    void check_gemm(int m, int n, int k, bool trans_a, bool trans_b, bool trans_c, T beta)
+    {
+        std::vector<T> a(m * k), b(k * n), c(m * n), expected(m * n);
+        for (int i = 0; i < m * k; ++i)
+            a[i] = static_cast<T>((i * 7 % 13) - 6) / 4;
+        for (int i = 0; i < k * n; ++i)
+            b[i] = static_cast<T>((i * 5 % 11) - 5) / 4;
+        for (int i = 0; i < m * n; ++i)
+            c[i] = expected[i] = static_cast<T>(i % 3);
+
+        int a_rs = trans_a ? 1 : k, a_cs = trans_a ? m : 1;
+        int b_rs = trans_b ? 1 : n, b_cs = trans_b ? k : 1;
+        int c_rs = trans_c ? 1 : n, c_cs = trans_c ? m : 1;
+        traph::native_gemm(m, n, k, T(1.5), a.data(), a_rs, a_cs, b.data(), b_rs, b_cs, beta, c.data(), c_rs, c_cs);
+        reference_gemm(m, n, k, T(1.5), a.data(), a_rs, a_cs, b.data(), b_rs, b_cs, beta, expected.data(), c_rs, c_cs);
+
+        for (int i = 0; i < m * n; ++i)
+            REQUIRE(std::abs(c[i] - expected[i]) <= 1e-3 * (1 + std::abs(expected[i])));
+    }
+}
+
+TEST_CASE( "gemm test", "[gemm]" )
+{
+    traph::GemmIsa detected = traph::native_gemm_isa();
+    traph::GemmIsa isas[] = { traph::GemmIsa::GENERIC, traph::GemmIsa::AVX2, traph::GemmIsa::AVX512 };
+
+    for (traph::GemmIsa isa : isas)
+    {
+        traph::native_gemm_isa_(isa);
+
+        // f32 edge tiles and transposed operands
+        traph_test::check_gemm<float>(1, 1, 1, false, false, false, 0.f);
+        traph_test::check_gemm<float>(13, 37, 5, false, false, false, 0.f);
+        traph_test::check_gemm<float>(29, 17, 300, true, false, false, 0.5f);
+        traph_test::check_gemm<float>(7, 70, 19, false, true, true, 1.f);
+
+        // f64 blocked sizes
+        traph_test::check_gemm<double>(100, 45, 270, false, false, false, 0.f);
+        traph_test::check_gemm<double>(150, 33, 17, true, true, false, 2.0);
+        traph_test::check_gemm<double>(31, 9, 600, false, false, true, 0.0);
+
+        // thin products: dot form (transposed B), axpy form and few columns
+        traph_test::check_gemm<float>(1, 300, 77, false, true, false, 0.f);
+        traph_test::check_gemm<float>(3, 101, 40, false, true, true, 1.f);
+        traph_test::check_gemm<float>(4, 157, 33, true, false, false, 0.5f);
+        traph_test::check_gemm<float>(90, 2, 65, false, false, false, 0.f);
+        traph_test::check_gemm<double>(2, 75, 21, false, true, false, 2.0);
+        traph_test::check_gemm<double>(1, 83, 300, false, false, true, 0.0);
+        traph_test::check_gemm<double>(50, 1, 31, true, true, false, 1.0);
+    }
+
+    traph::native_gemm_isa_(detected);
+}
+
+namespace traph_test
+{
+    template<typename AT>
+    void check_qgemm(int m, int n, int k, bool trans_b, int a_zero, bool per_channel)
+    {
+        std::vector<AT> a(m * k);
+        std::vector<traph::i8> b(k * n);
+        std::vector<traph::i32> b_zero(per_channel ? n : 1), c(m * n);
+        for (int i = 0; i < m * k; ++i)
+            a[i] = static_cast<AT>(i * 37 + 11);
+        for (int i = 0; i < k * n; ++i)
+            b[i] = static_cast<traph::i8>(i * 53 + 7);
+        for (int j = 0; j < static_cast<int>(b_zero.size()); ++j)
+            b_zero[j] = j % 5 - 2;
+
+        int b_rs = trans_b ? 1 : n, b_cs = trans_b ? k : 1;
+        traph::qgemm(m, n, k, a.data(), k, 1, a_zero, b.data(), b_rs, b_cs, b_zero.data(), static_cast<int>(b_zero.size()), c.data(), n, 1);
+
+        for (int i = 0; i < m; ++i)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                long long expected = 0;
+                int zb = b_zero[per_channel ? j : 0];
+                for (int p = 0; p < k; ++p)
+                    expected += static_cast<long long>(a[i * k + p] - a_zero) * (b[p * b_rs + j * b_cs] - zb);
+                REQUIRE(c[i * n + j] == expected);
+            }
+        }
+    }
+}
+
+TEST_CASE( "qgemm test", "[gemm]" )
+{
+    traph::GemmIsa detected = traph::native_gemm_isa();
+    traph::GemmIsa isas[] = { traph::GemmIsa::GENERIC, traph::GemmIsa::AVX2, traph::GemmIsa::AVX512 };
+
+    for (traph::GemmIsa isa : isas)
+    {
+        traph::native_gemm_isa_(isa);
+        // extreme values of both operands, edge tiles and k not a multiple of 4
+        traph_test::check_qgemm<traph::u8>(1, 1, 1, false, 0, false);
+        traph_test::check_qgemm<traph::u8>(13, 37, 29, false, 128, true);
+        traph_test::check_qgemm<traph::u8>(70, 45, 1100, true, 3, false);
+        traph_test::check_qgemm<traph::i8>(9, 70, 7, false, -5, true);
+        traph_test::check_qgemm<traph::i8>(100, 20, 300, true, 0, false);
+    }
+    traph::native_gemm_isa_(detected);
+
+    SECTION("requantize saturates and rounds per channel")
+    {
+        traph::i32 acc[] = { 100, -100, 1000, 7 };
+        traph::i32 bias[] = { 0, 10 };
+        float scale[] = { 0.5f, 0.25f };
+        traph::i8 out[4];
+        traph::requantize(2, 2, acc, 2, 1, bias, scale, 2, 1, out, 2, 1);
+        REQUIRE(out[0] == 51);
+        REQUIRE(out[1] == -21);
+        REQUIRE(out[2] == 127);
+        REQUIRE(out[3] == 5);
+    }
+}
+
+TEST_CASE( "blas registry test", "[gemm]" )
+{
+    traph::BlasRegistry& registry = traph::BlasRegistry::get();
+    std::string saved_path = registry.cache_path();
+    // no cache file unless one is asked for
+    if (!std::getenv("TRAPH_BLAS_CACHE"))
+        REQUIRE(saved_path.empty());
+    const char* cache_file = "traph_blas_cache_test.txt";
+    std::remove(cache_file);
+    registry.cache_path_(cache_file);
+    registry.clear_choices();
+
+    SECTION("every backend computes the same product")
+    {
+        for (const std::string& name : registry.backends())
+        {
+            registry.backend_(name);
+            REQUIRE(registry.select(traph::DataType::FLOAT, 8, 8, 8, false, false) == name);
+
+            std::vector<float> a(6 * 5), b(5 * 7), c(6 * 7, 1.f), expected(6 * 7, 1.f);
+            for (int i = 0; i < 30; ++i)
+                a[i] = static_cast<float>(i % 4) - 1;
+            for (int i = 0; i < 35; ++i)
+                b[i] = static_cast<float>(i % 3) - 1;
+            // transposed A and a column-major C
+            registry.gemm(6, 7, 5, 2.f, a.data(), 1, 6, b.data(), 7, 1, 1.f, c.data(), 1, 6);
+            traph_test::reference_gemm(6, 7, 5, 2.f, a.data(), 1, 6, b.data(), 7, 1, 1.f, expected.data(), 1, 6);
+            for (int i = 0; i < 42; ++i)
+                REQUIRE(c[i] == expected[i]);
+        }
+        REQUIRE_THROWS(registry.backend_("no such backend"));
+        registry.backend_("");
+    }
+
+    SECTION("tuned buckets are written to the cache")
+    {
+        std::string chosen = registry.select(traph::DataType::DOUBLE, 3, 300, 40, false, true);
+        std::ifstream file(cache_file);
+        std::string dtype, name;
+        int trans_a, trans_b, m, n, k;
+        REQUIRE(file >> dtype >> trans_a >> trans_b >> m >> n >> k >> name);
+        REQUIRE(dtype == "f64");
+        REQUIRE(trans_a == 0);
+        REQUIRE(trans_b == 1);
+        REQUIRE(name == chosen);
+
+        // decisions are read back instead of tuned again
+        registry.clear_choices();
+        registry.cache_path_(cache_file);
+        REQUIRE(registry.select(traph::DataType::DOUBLE, 4, 260, 33, false, true) == chosen);
+    }
+
+    registry.cache_path_(saved_path);
+    std::remove(cache_file);
+}
+
+#if defined TRAPH_BUILD_MKL || defined TRAPH_BUILD_OPENBLAS
+namespace traph_test
+{
+    // matmul of two views against reference_gemm over their strides, into out when given;
+    // a is [m, k] or [B, m, k], b is [k, n] or has the batch of a
+    inline void check_matmul_view(const traph::FloatTensor& a, const traph::FloatTensor& b,
+        std::shared_ptr<traph::FloatTensor> out = nullptr)
+    {
+        int a_dims = a.ndimension(), b_dims = b.ndimension();
+        int batch = a_dims == 3 ? a.size(0) : 1;
+        int m = a.size(a_dims - 2), k = a.size(a_dims - 1), n = b.size(b_dims - 1);
+        std::vector<float> expected(batch * m * n, 0.f);
+        if (out)
+        {
+            for (int i = 0; i < batch * m * n; ++i)
+                expected[i] = out->data_ptr()[out->offset() + (a_dims == 3 ? i / (m * n) * out->stride(0) : 0) +
+                    i % (m * n) / n * out->stride(a_dims - 2) + i % n * out->stride(a_dims - 1)];
+            traph::matmul_impl(a, b, *out, true);
+        }
+        else
+        {
+            out = traph::matmul_impl(a, b);
+        }
+
+        for (int p = 0; p < batch; ++p)
+        {
+            const float* a_ptr = a.data_ptr() + a.offset() + (a_dims == 3 ? p * a.stride(0) : 0);
+            const float* b_ptr = b.data_ptr() + b.offset() + (b_dims == 3 ? p * b.stride(0) : 0);
+            reference_gemm(m, n, k, 1.f, a_ptr, a.stride(a_dims - 2), a.stride(a_dims - 1),
+                b_ptr, b.stride(b_dims - 2), b.stride(b_dims - 1), 1.f, expected.data() + p * m * n, n, 1);
+        }
+        for (int i = 0; i < batch * m * n; ++i)
+        {
+            float value = out->data_ptr()[out->offset() + (a_dims == 3 ? i / (m * n) * out->stride(0) : 0) +
+                i % (m * n) / n * out->stride(a_dims - 2) + i % n * out->stride(a_dims - 1)];
+            REQUIRE(std::abs(value - expected[i]) <= 1e-4f * (1 + std::abs(expected[i])));
+        }
+    }
+
+    inline std::shared_ptr<traph::FloatTensor> view_operand(const traph::DimVector& size, int seed)
+    {
+        auto result = std::make_shared<traph::FloatTensor>(size);
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<float>((i * 7 + seed * 3) % 13) / 4 - 1.5f;
+        return result;
+    }
+}
+
+TEST_CASE( "cblas layouts test", "[gemm]" )
+{
+    using traph_test::view_operand;
+    traph::BlasRegistry& registry = traph::BlasRegistry::get();
+    // the cblas backend is registered last
+    std::string cblas = registry.backends().back();
+    REQUIRE((cblas == "mkl" || cblas == "openblas"));
+    registry.backend_(cblas);
+
+    auto transposed = [](std::shared_ptr<traph::FloatTensor> t) {
+        return std::dynamic_pointer_cast<traph::FloatTensor>(t->transpose(0, 1));
+    };
+    auto permuted = [](std::shared_ptr<traph::FloatTensor> t, const traph::DimVector& dims) {
+        return std::dynamic_pointer_cast<traph::FloatTensor>(t->permute(dims));
+    };
+
+    SECTION("transposed operands become transpose flags")
+    {
+        auto a = view_operand({ 6, 5 }, 1), b = view_operand({ 5, 7 }, 2);
+        auto a_t = transposed(view_operand({ 5, 6 }, 3)), b_t = transposed(view_operand({ 7, 5 }, 4));
+        traph_test::check_matmul_view(*a_t, *b);
+        traph_test::check_matmul_view(*a, *b_t);
+        traph_test::check_matmul_view(*a_t, *b_t);
+        // a column-major output is a call in column-major order
+        traph_test::check_matmul_view(*a_t, *b, transposed(view_operand({ 7, 6 }, 5)));
+        traph_test::check_matmul_view(*a, *b_t, transposed(view_operand({ 7, 6 }, 6)));
+        // a single output row or column goes to gemv
+        traph_test::check_matmul_view(*transposed(view_operand({ 5, 1 }, 7)), *b_t);
+        traph_test::check_matmul_view(*a_t, *transposed(view_operand({ 1, 5 }, 8)));
+    }
+
+    SECTION("permuted batches keep their leading dimensions")
+    {
+        // [m, B, k] and [k, B, n] storages seen as [B, m, k] and [B, k, n], the rows of each
+        // matrix are B * k and B * n apart
+        auto a = permuted(view_operand({ 6, 3, 5 }, 9), { 1, 0, 2 });
+        auto b = permuted(view_operand({ 5, 3, 4 }, 10), { 1, 0, 2 });
+        traph_test::check_matmul_view(*a, *b);
+        // [B, k, m] seen as [B, m, k] is a transposed matrix per batch
+        traph_test::check_matmul_view(*permuted(view_operand({ 3, 5, 6 }, 11), { 0, 2, 1 }), *b);
+        traph_test::check_matmul_view(*a, *b, permuted(view_operand({ 6, 3, 4 }, 12), { 1, 0, 2 }));
+    }
+
+    SECTION("layouts cblas can not describe fall back")
+    {
+        // [2, 6] matrices with strides 30 and 5, no unit stride
+        auto a = permuted(view_operand({ 2, 6, 5 }, 13), { 2, 0, 1 });
+        traph_test::check_matmul_view(*a, *view_operand({ 5, 6, 3 }, 14));
+    }
+
+    registry.backend_("");
+}
+#endif
+
+TEST_CASE( "batched matmul test", "[gemm]" )
+{
+    // a: 2 x 1 x 3 x 4, b: 5 x 4 x 2, result 2 x 5 x 3 x 2
+    auto a = std::make_shared<traph::FloatTensor>(traph::DimVector({ 2, 1, 3, 4 }));
+    auto b = std::make_shared<traph::FloatTensor>(traph::DimVector({ 5, 4, 2 }));
+    for (int i = 0; i < 24; ++i)
+        a->data_ptr()[i] = static_cast<float>(i % 7) - 3;
+    for (int i = 0; i < 40; ++i)
+        b->data_ptr()[i] = static_cast<float>(i % 5) - 2;
+
+    auto c = traph::matmul_impl(*a, *b);
+    REQUIRE(c->size() == traph::DimVector({ 2, 5, 3, 2 }));
+
+    for (int n = 0; n < 2; ++n)
+        for (int m = 0; m < 5; ++m)
+        {
+            std::vector<float> expected(6);
+            traph_test::reference_gemm(3, 2, 4, 1.f, a->data_ptr() + n * 12, 4, 1, b->data_ptr() + m * 8, 2, 1, 0.f, expected.data(), 2, 1);
+            for (int i = 0; i < 6; ++i)
+                REQUIRE(c->data_ptr()[(n * 5 + m) * 6 + i] == expected[i]);
+        }
+
+    SECTION("gradients are summed over broadcast dimensions")
+    {
+        auto grad = std::make_shared<traph::FloatTensor>(c->size());
+        grad->fill_(1.f);
+        auto grad_a = traph::matmul_backward_left_impl(*grad, *b, a->size());
+        auto grad_b = traph::matmul_backward_right_impl(*grad, *a, b->size());
+        REQUIRE(grad_a->size() == a->size());
+        REQUIRE(grad_b->size() == b->size());
+
+        // d/da[n,0,i,k] = sum over m, j of b[m,k,j]
+        for (int k = 0; k < 4; ++k)
+        {
+            float expected = 0.f;
+            for (int m = 0; m < 5; ++m)
+                expected += b->data_ptr()[m * 8 + k * 2] + b->data_ptr()[m * 8 + k * 2 + 1];
+            REQUIRE(grad_a->data_ptr()[k] == expected);
+            REQUIRE(grad_a->data_ptr()[12 + 2 * 4 + k] == expected);
+        }
+        // d/db[m,k,j] = sum over n, i of a[n,0,i,k]
+        for (int k = 0; k < 4; ++k)
+        {
+            float expected = 0.f;
+            for (int n = 0; n < 2; ++n)
+                for (int i = 0; i < 3; ++i)
+                    expected += a->data_ptr()[n * 12 + i * 4 + k];
+            REQUIRE(grad_b->data_ptr()[k * 2] == expected);
+            REQUIRE(grad_b->data_ptr()[4 * 8 + k * 2 + 1] == expected);
+        }
+    }
+
+    SECTION("accumulating into an output")
+    {
+        auto out = std::make_shared<traph::FloatTensor>(c->size());
+        std::vector<float> filled(60);
+        for (int i = 0; i < 60; ++i)
+            out->data_ptr()[i] = filled[i] = static_cast<float>(i % 4) - 1.5f;
+        traph::matmul_impl(*a, *b, *out, true);
+        for (int i = 0; i < 60; ++i)
+            REQUIRE(out->data_ptr()[i] == filled[i] + c->data_ptr()[i]);
+        traph::matmul_impl(*a, *b, *out, false);
+        for (int i = 0; i < 60; ++i)
+            REQUIRE(out->data_ptr()[i] == c->data_ptr()[i]);
+
+        // a column-major output, the transpose of a [2, 3] tensor, and an integer product
+        auto x = std::make_shared<traph::IntTensor>(traph::DimVector({ 3, 4 }));
+        auto y = std::make_shared<traph::IntTensor>(traph::DimVector({ 4, 2 }));
+        auto stored = std::make_shared<traph::IntTensor>(traph::DimVector({ 2, 3 }));
+        for (int i = 0; i < 12; ++i)
+            x->data_ptr()[i] = i % 5 - 2;
+        for (int i = 0; i < 8; ++i)
+            y->data_ptr()[i] = i % 3 - 1;
+        for (int i = 0; i < 6; ++i)
+            stored->data_ptr()[i] = 10 * i;
+        auto column_major = std::dynamic_pointer_cast<traph::IntTensor>(stored->transpose(0, 1));
+        traph::matmul_impl(*x, *y, *column_major, true);
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 2; ++j)
+            {
+                int expected = 10 * (j * 3 + i);
+                for (int p = 0; p < 4; ++p)
+                    expected += x->data_ptr()[i * 4 + p] * y->data_ptr()[p * 2 + j];
+                REQUIRE(stored->data_ptr()[j * 3 + i] == expected);
+            }
+
+        // the output can not be an operand or a view of one
+        auto square = std::make_shared<traph::FloatTensor>(traph::DimVector({ 4, 4 }));
+        square->fill_(1.f);
+        auto other = std::make_shared<traph::FloatTensor>(traph::DimVector({ 4, 4 }));
+        other->fill_(1.f);
+        REQUIRE_THROWS_AS(traph::matmul_impl(*square, *other, *square, true), std::runtime_error);
+        auto view = std::dynamic_pointer_cast<traph::FloatTensor>(other->transpose(0, 1));
+        REQUIRE_THROWS_AS(traph::matmul_impl(*square, *other, *view, false), std::runtime_error);
+    }
+
+    SECTION("bmm requires equal batch sizes")
+    {
+        REQUIRE_THROWS(a->bmm(b));
+        auto d = std::make_shared<traph::FloatTensor>(traph::DimVector({ 5, 2, 4 }));
+        d->fill_(1.f);
+        auto e = std::dynamic_pointer_cast<traph::FloatTensor>(d->bmm(b));
+        REQUIRE(e->size() == traph::DimVector({ 5, 2, 2 }));
+    }
+}
+
+TEST_CASE( "linear test", "[gemm]" )
+{
+    // x: 2 x 3 x 5 (batch of rows), w: 4 x 5, bias: 4
+    auto x = std::make_shared<traph::FloatTensor>(traph::DimVector({ 2, 3, 5 }));
+    auto w = std::make_shared<traph::FloatTensor>(traph::DimVector({ 4, 5 }));
+    auto bias = std::make_shared<traph::FloatTensor>(traph::DimVector({ 4 }));
+    for (int i = 0; i < 30; ++i)
+        x->data_ptr()[i] = static_cast<float>(i % 7) - 3;
+    for (int i = 0; i < 20; ++i)
+        w->data_ptr()[i] = static_cast<float>(i % 5) - 2;
+    for (int i = 0; i < 4; ++i)
+        bias->data_ptr()[i] = static_cast<float>(i);
+
+    auto y = traph::linear_impl(*x, *w, bias.get());
+    REQUIRE(y->size() == traph::DimVector({ 2, 3, 4 }));
+    std::vector<float> expected(6 * 4);
+    traph_test::reference_gemm(6, 4, 5, 1.f, x->data_ptr(), 5, 1, w->data_ptr(), 1, 5, 0.f, expected.data(), 4, 1);
+    for (int i = 0; i < 24; ++i)
+        REQUIRE(y->data_ptr()[i] == expected[i] + i % 4);
+
+    SECTION("a vector and a strided batch give the same rows")
+    {
+        auto row = std::make_shared<traph::FloatTensor>(traph::DimVector({ 5 }));
+        for (int k = 0; k < 5; ++k)
+            row->data_ptr()[k] = x->data_ptr()[5 * 5 + k];
+        auto y_row = traph::linear_impl(*row, *w, bias.get());
+        REQUIRE(y_row->size() == traph::DimVector({ 4 }));
+        for (int j = 0; j < 4; ++j)
+            REQUIRE(y_row->data_ptr()[j] == y->data_ptr()[5 * 4 + j]);
+
+        auto x_t = std::dynamic_pointer_cast<traph::FloatTensor>(x->transpose(0, 1));
+        auto y_t = traph::linear_impl(*x_t, *w, nullptr);
+        REQUIRE(y_t->size() == traph::DimVector({ 3, 2, 4 }));
+        for (int j = 0; j < 4; ++j)
+            REQUIRE(y_t->data_ptr()[(2 * 2 + 1) * 4 + j] == expected[5 * 4 + j]);
+    }
+
+    SECTION("gradients")
+    {
+        auto grad = std::make_shared<traph::FloatTensor>(y->size());
+        grad->fill_(1.f);
+        auto grads = traph::linear_backward_impl(*grad, *x, *w, true);
+        REQUIRE(grads.size() == 3);
+        // d/dx[r, k] = sum over j of w[j, k]
+        for (int k = 0; k < 5; ++k)
+        {
+            float column_sum = 0.f;
+            for (int j = 0; j < 4; ++j)
+                column_sum += w->data_ptr()[j * 5 + k];
+            REQUIRE(grads[0]->data_ptr()[k] == column_sum);
+            REQUIRE(grads[0]->data_ptr()[29 - 4 + k] == column_sum);
+        }
+        // d/dw[j, k] = sum over rows of x[r, k], d/db[j] = number of rows
+        for (int k = 0; k < 5; ++k)
+        {
+            float row_sum = 0.f;
+            for (int r = 0; r < 6; ++r)
+                row_sum += x->data_ptr()[r * 5 + k];
+            REQUIRE(grads[1]->data_ptr()[k] == row_sum);
+            REQUIRE(grads[1]->data_ptr()[3 * 5 + k] == row_sum);
+        }
+        for (int j = 0; j < 4; ++j)
+            REQUIRE(grads[2]->data_ptr()[j] == 6.f);
+    }
+
+    REQUIRE_THROWS(traph::linear_impl(*w, *x, nullptr));
+}
+
+#endif
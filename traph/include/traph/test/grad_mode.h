@@ -0,0 +1,81 @@
+#ifndef TRAPH_TEST_GRAD_MODE_H_
+#define TRAPH_TEST_GRAD_MODE_H_
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/function.h>
+#include <traph/nn/grad_mode.h>
+#include <traph/nn/layers/activation.h>
+#include <traph/nn/layers/linear.h>
+
+namespace traph_test
+{
+    inline traph::VariableInterfacePtr two_layers(traph::Linear& first, traph::Linear& second, traph::VariableInterfacePtr x)
+    {
+        traph::ReLU relu;
+        return traph::sum(second.forward(relu.forward(first.forward(x))));
+    }
+}
+
+TEST_CASE( "grad mode test", "[grad_mode]" )
+{
+    traph::Linear first(16, 32, true);
+    traph::Linear second(32, 8, true);
+    // fixed values, random ones can leave every unit of the relu off and the gradients zero
+    auto x = traph::zeros<float>({ 4, 16 }, false);
+    auto x_data = std::dynamic_pointer_cast<traph::Tensor<float>>(x->data());
+    for (int i = 0; i < 4 * 16; ++i)
+        x_data->data_ptr()[i] = static_cast<float>(i * 7 % 11) / 10 - 0.4f;
+
+    SECTION("no graph under the guard")
+    {
+        auto expected = traph_test::two_layers(first, second, x);
+        REQUIRE(expected->requires_grad());
+        REQUIRE(expected->grad_fn());
+        {
+            traph::NoGradGuard guard;
+            REQUIRE_FALSE(traph::GradMode::is_enabled());
+            auto y = traph_test::two_layers(first, second, x);
+            REQUIRE_FALSE(y->requires_grad());
+            REQUIRE_FALSE(y->grad_fn());
+            REQUIRE(y->inputs().empty());
+            REQUIRE(std::dynamic_pointer_cast<traph::Tensor<float>>(y->data())->item()
+                == std::dynamic_pointer_cast<traph::Tensor<float>>(expected->data())->item());
+
+            // ops keep no tensor
+            traph::LinearOp op;
+            op.forward({ x->data(), first.parameters()[0]->data() });
+            REQUIRE(op.context.get_saved_tensors().empty());
+        }
+        REQUIRE(traph::GradMode::is_enabled());
+
+        expected->backward();
+        REQUIRE(first.parameters()[0]->grad()->data_ptr()[0] != 0);
+    }
+
+    SECTION("nesting and threads")
+    {
+        {
+            traph::InferenceMode outer;
+            {
+                traph::NoGradGuard inner;
+                REQUIRE_FALSE(traph::GradMode::is_enabled());
+            }
+            REQUIRE_FALSE(traph::GradMode::is_enabled());
+
+            // the mode is the calling thread's
+            bool other = false;
+            std::thread thread([&]() { other = traph::GradMode::is_enabled(); });
+            thread.join();
+            REQUIRE(other);
+            REQUIRE_FALSE(traph_test::two_layers(first, second, x)->requires_grad());
+        }
+        REQUIRE(traph::GradMode::is_enabled());
+        REQUIRE(traph_test::two_layers(first, second, x)->requires_grad());
+    }
+}
+
+#endif
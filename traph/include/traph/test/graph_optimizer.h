@@ -0,0 +1,198 @@
+#ifndef TRAPH_TEST_GRAPH_OPTIMIZER_H_
+#define TRAPH_TEST_GRAPH_OPTIMIZER_H_
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/capture.h>
+#include <traph/nn/function.h>
+#include <traph/nn/graph_optimizer.h>
+#include <traph/nn/optim.h>
+#include <traph/tensor/activation.h>
+
+namespace traph_test
+{
+    inline std::shared_ptr<traph::Tensor<float>> float_data(const traph::VariableInterfacePtr& v)
+    {
+        return std::dynamic_pointer_cast<traph::Tensor<float>>(v->data());
+    }
+
+    inline traph::VariableInterfacePtr graph_tensor(int rows, int cols, int seed, bool requires_grad)
+    {
+        auto result = traph::zeros<float>({ rows, cols }, requires_grad);
+        for (int i = 0; i < rows * cols; ++i)
+            float_data(result)->data_ptr()[i] = static_cast<float>((i * 7 + seed * 13) % 19) / 9 - 1;
+        return result;
+    }
+
+    // a step with a constant, a repeated call, an unused call, a matmul with a bias and
+    // activations, and a chain of elementwise calls
+    struct GraphModel
+    {
+        traph::VariableInterfacePtr w = graph_tensor(6, 5, 1, true);
+        traph::VariableInterfacePtr b = graph_tensor(8, 5, 2, true);
+        traph::VariableInterfacePtr v = graph_tensor(8, 5, 3, true);
+        traph::VariableInterfacePtr c = graph_tensor(8, 5, 4, false);
+        std::shared_ptr<traph::SGD> optimizer = std::make_shared<traph::SGD>(std::vector<traph::VariableInterfacePtr>{ w, b, v }, 0.1f);
+
+        traph::VariableInterfacePtr loss(const std::vector<traph::VariableInterfacePtr>& inputs)
+        {
+            auto h = traph::relu(inputs[0]);
+            auto k = traph::pow(c, 2);
+            auto y = traph::pow(traph::relu(traph::sub(traph::sigmoid(traph::add(traph::matmul(h, w), b)), k)), 2);
+            auto u = traph::sigmoid(v);
+            auto e = traph::relu(traph::gelu(traph::add(u, traph::sigmoid(v))));
+            auto unused = traph::gelu(w);
+            return traph::mean(traph::add(y, e));
+        }
+    };
+}
+
+TEST_CASE( "graph optimizer test", "[graph_optimizer]" )
+{
+    SECTION("passes")
+    {
+        traph_test::GraphModel plain, optimized;
+        traph::CapturedStep plain_step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return plain.loss(inputs); },
+            plain.optimizer);
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return optimized.loss(inputs); },
+            optimized.optimizer);
+        auto passes = std::make_shared<traph::GraphOptimizer>();
+        passes->fold_constants = true;
+        step.graph_optimizer_(passes);
+
+        for (int iteration = 0; iteration < 4; ++iteration)
+        {
+            std::vector<traph::VariableInterfacePtr> inputs{ traph_test::graph_tensor(8, 6, iteration + 5, false) };
+            auto expected = plain_step.run(inputs);
+            auto loss = step.run(inputs);
+            REQUIRE(std::abs(traph_test::float_data(loss)->item() - traph_test::float_data(expected)->item()) < 1e-5);
+            std::vector<traph::VariableInterfacePtr> params{ optimized.w, optimized.b, optimized.v };
+            std::vector<traph::VariableInterfacePtr> plain_params{ plain.w, plain.b, plain.v };
+            for (std::size_t p = 0; p < params.size(); ++p)
+                for (int i = 0; i < params[p]->size().flat_size(); ++i)
+                    REQUIRE(std::abs(traph_test::float_data(params[p])->data_ptr()[i] - traph_test::float_data(plain_params[p])->data_ptr()[i]) < 1e-5);
+        }
+        REQUIRE(step.captures() == 1);
+
+        const traph::GraphReport& report = step.report();
+        REQUIRE(report.before.nodes == 16);
+        REQUIRE(report.folded == 1);
+        REQUIRE(report.common == 1);
+        REQUIRE(report.dead == 1);
+        REQUIRE(report.fused_matmul == 6);
+        REQUIRE(report.fused_elementwise == 3);
+        REQUIRE(report.pruned_grads == 1);
+        // relu of the input, the fused matmul, the sigmoid read twice, the chain and the mean
+        REQUIRE(report.after.nodes == 5);
+        REQUIRE(step.calls().size() == 5);
+        REQUIRE(report.after.bytes < report.before.bytes);
+        REQUIRE(plain_step.report().before.nodes == 0);
+    }
+
+    SECTION("buffer updated between steps")
+    {
+        // c is not folded by default and its new data is read by later replays
+        traph_test::GraphModel plain, optimized;
+        traph::CapturedStep plain_step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return plain.loss(inputs); },
+            plain.optimizer);
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return optimized.loss(inputs); },
+            optimized.optimizer);
+        step.graph_optimizer_(std::make_shared<traph::GraphOptimizer>());
+        for (int iteration = 0; iteration < 3; ++iteration)
+        {
+            if (iteration == 2)
+            {
+                plain.c->data_(traph_test::graph_tensor(8, 5, 9, false)->data());
+                optimized.c->data_(traph_test::graph_tensor(8, 5, 9, false)->data());
+            }
+            std::vector<traph::VariableInterfacePtr> inputs{ traph_test::graph_tensor(8, 6, iteration + 5, false) };
+            auto expected = plain_step.run(inputs);
+            auto loss = step.run(inputs);
+            REQUIRE(std::abs(traph_test::float_data(loss)->item() - traph_test::float_data(expected)->item()) < 1e-5);
+        }
+        REQUIRE(step.report().folded == 0);
+    }
+
+    SECTION("fused loss")
+    {
+        // the loss is the result of an elementwise chain and of a fused matmul
+        auto w = traph_test::graph_tensor(6, 1, 1, true);
+        auto b = traph_test::graph_tensor(1, 1, 2, true);
+        std::vector<traph::CapturedStep::StepFunction> losses{
+            [&](const std::vector<traph::VariableInterfacePtr>& inputs) {
+                return traph::relu(traph::sigmoid(traph::mean(traph::matmul(inputs[0], w))));
+            },
+            [&](const std::vector<traph::VariableInterfacePtr>& inputs) {
+                return traph::sigmoid(traph::add(traph::matmul(inputs[0], w), b));
+            } };
+        for (auto& loss : losses)
+        {
+            traph::CapturedStep plain_step(loss, nullptr), step(loss, nullptr);
+            step.graph_optimizer_(std::make_shared<traph::GraphOptimizer>());
+            for (int iteration = 0; iteration < 2; ++iteration)
+            {
+                std::vector<traph::VariableInterfacePtr> inputs{ traph_test::graph_tensor(1, 6, iteration, false) };
+                float expected = traph_test::float_data(plain_step.run(inputs))->item();
+                REQUIRE(std::abs(traph_test::float_data(step.run(inputs))->item() - expected) < 1e-6);
+            }
+            REQUIRE(step.report().fused_matmul + step.report().fused_elementwise > 0);
+        }
+    }
+
+    SECTION("passes off")
+    {
+        traph_test::GraphModel model;
+        auto passes = std::make_shared<traph::GraphOptimizer>();
+        passes->fold_constants = passes->eliminate_common = passes->eliminate_dead = false;
+        passes->fuse_matmul = passes->fuse_elementwise = false;
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return model.loss(inputs); }, nullptr);
+        step.graph_optimizer_(passes);
+        step.run({ traph_test::graph_tensor(8, 6, 1, false) });
+        REQUIRE(step.report().after.nodes == 16);
+        REQUIRE(step.report().after.bytes == step.report().before.bytes);
+    }
+
+    SECTION("broadcast side")
+    {
+        // sigmoid(x + s) - t for a bias s of [5] and a t of [8, 5]
+        auto x = traph_test::float_data(traph_test::graph_tensor(8, 5, 1, false));
+        std::shared_ptr<traph::Tensor<float>> s(new traph::Tensor<float>(traph::DimVector({ 5 })));
+        auto t = traph_test::float_data(traph_test::graph_tensor(8, 5, 3, false));
+        for (int j = 0; j < 5; ++j)
+            s->data_ptr()[j] = 0.25f * j - 0.5f;
+        std::vector<traph::ChainStage> stages(3);
+        stages[0].kind = traph::ChainKind::ADD;
+        stages[0].side = 0;
+        stages[1].kind = traph::ChainKind::SIGMOID;
+        stages[2].kind = traph::ChainKind::SUB;
+        stages[2].side = 1;
+        auto y = traph::elementwise_chain_impl(*x, { s.get(), t.get() }, stages);
+        auto grad = traph_test::float_data(traph_test::graph_tensor(8, 5, 4, false));
+        auto grads = traph::elementwise_chain_backward_impl(*grad, *x, { s.get(), t.get() }, stages, { true, false });
+        REQUIRE(grads.size() == 3);
+        REQUIRE(!grads[2]);
+        std::vector<double> ds(5, 0);
+        for (int i = 0; i < 40; ++i)
+        {
+            double sigmoid = 1 / (1 + std::exp(-(x->data_ptr()[i] + s->data_ptr()[i % 5])));
+            REQUIRE(std::abs(y->data_ptr()[i] - (sigmoid - t->data_ptr()[i])) < 1e-6);
+            double dx = grad->data_ptr()[i] * sigmoid * (1 - sigmoid);
+            REQUIRE(std::abs(grads[0]->data_ptr()[i] - dx) < 1e-6);
+            ds[i % 5] += dx;
+        }
+        for (int j = 0; j < 5; ++j)
+            REQUIRE(std::abs(grads[1]->data_ptr()[j] - ds[j]) < 1e-5);
+
+        stages[2].side = 2;
+        REQUIRE_THROWS_AS(traph::elementwise_chain_impl(*x, { s.get(), t.get() }, stages), std::runtime_error);
+        stages[2].side = 1;
+        REQUIRE_THROWS_AS(traph::elementwise_chain_impl(*x, { x.get(), traph_test::float_data(traph_test::graph_tensor(8, 4, 1, false)).get() },
+            stages), std::runtime_error);
+    }
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef TRAPH_TEST_KV_CACHE_H_
+#define TRAPH_TEST_KV_CACHE_H_
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/tensor/attention.h>
+#include <traph/tensor/kv_cache.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> cache_tensor(const traph::DimVector& size, int seed)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(size));
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<T>((i * 11 + seed * 17) % 31) / 15 - 1;
+        return result;
+    }
+
+    // the [H, L, D] tensor of a sequence as [1, H, L, D]
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> one_batch(const traph::Tensor<T>& x)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(traph::DimVector({ 1, x.size(0), x.size(1), x.size(2) })));
+        std::copy(x.data_ptr(), x.data_ptr() + x.size().flat_size(), result->data_ptr());
+        return result;
+    }
+
+    // paged attention of [B, H, Lq, D] queries against attention over the stored tokens of
+    // each sequence on its own
+    template<typename T>
+    void check_paged_attention(traph::KVCacheLayer<T> layer, const std::vector<traph::idx_type>& sequences, int lq, bool causal, double eps)
+    {
+        int heads = layer.cache().heads(), dim = layer.cache().head_dim();
+        int batch = static_cast<int>(sequences.size());
+        auto q = cache_tensor<T>(traph::DimVector({ batch, heads, lq, dim }), 5);
+        traph::AttentionParams params;
+        params.causal = causal;
+        auto result = traph::paged_attention_impl(*q, layer, sequences, params);
+        REQUIRE(result->size() == q->size());
+        for (int b = 0; b < batch; ++b)
+        {
+            std::shared_ptr<traph::Tensor<T>> one(new traph::Tensor<T>(traph::DimVector({ 1, heads, lq, dim })));
+            std::copy(q->data_ptr() + b * heads * lq * dim, q->data_ptr() + (b + 1) * heads * lq * dim, one->data_ptr());
+            auto expected = traph::scaled_dot_product_attention_impl(*one, *one_batch(*layer.keys(sequences[b])),
+                *one_batch(*layer.values(sequences[b])), nullptr, params);
+            for (int i = 0; i < heads * lq * dim; ++i)
+                REQUIRE(std::abs(result->data_ptr()[b * heads * lq * dim + i] - expected->data_ptr()[i]) < eps);
+        }
+    }
+}
+
+TEST_CASE( "kv cache test", "[kv_cache]" )
+{
+    SECTION("blocks")
+    {
+        traph::KVCache<float> cache(2, 2, 4, 5, 6);
+        auto a = cache.add_sequence();
+        auto b = cache.add_sequence();
+        cache.append({ a, b }, 7);
+        REQUIRE(cache.length(a) == 7);
+        REQUIRE(cache.blocks(a) == std::vector<traph::idx_type>({ 0, 1 }));
+        REQUIRE(cache.blocks(b) == std::vector<traph::idx_type>({ 2, 3 }));
+        cache.append({ b }, 3);
+        REQUIRE(cache.blocks(b).size() == 2);
+        REQUIRE(cache.free_blocks() == 2);
+
+        // all or nothing when the pool runs out
+        REQUIRE_THROWS_AS(cache.append({ a, b }, 6), std::runtime_error);
+        REQUIRE(cache.length(a) == 7);
+        REQUIRE(cache.free_blocks() == 2);
+        REQUIRE_THROWS_AS(cache.append({ a, a }, 1), std::runtime_error);
+
+        // removed blocks and ids are used again
+        cache.remove_sequence(a);
+        REQUIRE(cache.free_blocks() == 4);
+        REQUIRE_THROWS_AS(cache.length(a), std::runtime_error);
+        REQUIRE(cache.add_sequence() == a);
+        cache.append({ a }, 1);
+        REQUIRE(cache.blocks(a) == std::vector<traph::idx_type>({ 0 }));
+    }
+
+    SECTION("write and read back")
+    {
+        traph::KVCache<double> cache(2, 3, 4, 5, 20);
+        auto a = cache.add_sequence();
+        auto b = cache.add_sequence();
+        cache.append({ a, b }, 7);
+        auto keys = traph_test::cache_tensor<double>(traph::DimVector({ 2, 3, 7, 4 }), 1);
+        auto values = traph_test::cache_tensor<double>(traph::DimVector({ 2, 3, 7, 4 }), 2);
+        cache.layer(1).write({ a, b }, *keys, *values);
+        // one more token for b only, from a strided [1, H, 1, D] view
+        cache.append({ b }, 1);
+        auto token = traph_test::cache_tensor<double>(traph::DimVector({ 1, 4, 1, 3 }), 3);
+        auto token_view = std::dynamic_pointer_cast<traph::Tensor<double>>(token->transpose(1, 3));
+        cache.layer(1).write({ b }, *token_view, *token_view);
+
+        auto stored = cache.layer(1).keys(b);
+        REQUIRE(stored->size() == traph::DimVector({ 3, 8, 4 }));
+        for (int h = 0; h < 3; ++h)
+        {
+            for (int t = 0; t < 7; ++t)
+                for (int j = 0; j < 4; ++j)
+                    REQUIRE(stored->data_ptr()[(h * 8 + t) * 4 + j] == keys->data_ptr()[((3 + h) * 7 + t) * 4 + j]);
+            for (int j = 0; j < 4; ++j)
+                REQUIRE(stored->data_ptr()[(h * 8 + 7) * 4 + j] == token->data_ptr()[j * 3 + h]);
+        }
+        auto stored_values = cache.layer(1).values(a);
+        for (int i = 0; i < 3 * 7 * 4; ++i)
+            REQUIRE(stored_values->data_ptr()[i] == values->data_ptr()[i]);
+        REQUIRE_THROWS_AS(cache.layer(0).write({ a }, *traph_test::cache_tensor<double>(traph::DimVector({ 1, 3, 9, 4 }), 1),
+            *traph_test::cache_tensor<double>(traph::DimVector({ 1, 3, 9, 4 }), 1)), std::runtime_error);
+        REQUIRE_THROWS_AS(cache.layer(2), std::runtime_error);
+    }
+
+    SECTION("paged attention")
+    {
+        // sequences of different lengths over blocks smaller and larger than a key block
+        for (int block_size : { 5, 100 })
+        {
+            traph::KVCache<double> cache(1, 2, 8, block_size, 40);
+            std::vector<traph::idx_type> sequences{ cache.add_sequence(), cache.add_sequence(), cache.add_sequence() };
+            std::vector<int> prefill{ 7, 150, 1 };
+            for (int s = 0; s < 3; ++s)
+            {
+                cache.append({ sequences[s] }, prefill[s]);
+                auto keys = traph_test::cache_tensor<double>(traph::DimVector({ 1, 2, prefill[s], 8 }), s + 1);
+                auto values = traph_test::cache_tensor<double>(traph::DimVector({ 1, 2, prefill[s], 8 }), s + 4);
+                cache.layer(0).write({ sequences[s] }, *keys, *values);
+            }
+            // prefill of the first sequence, then decoding steps of all of them
+            traph_test::check_paged_attention(cache.layer(0), { sequences[0] }, 7, true, 1e-12);
+            for (int step = 0; step < 3; ++step)
+            {
+                cache.append(sequences, 1);
+                auto keys = traph_test::cache_tensor<double>(traph::DimVector({ 3, 2, 1, 8 }), step + 7);
+                cache.layer(0).write(sequences, *keys, *keys);
+                traph_test::check_paged_attention(cache.layer(0), sequences, 1, true, 1e-12);
+            }
+            traph_test::check_paged_attention(cache.layer(0), sequences, 2, false, 1e-12);
+        }
+
+        traph::KVCache<float> cache(1, 2, 8, 16, 4);
+        auto id = cache.add_sequence();
+        cache.append({ id }, 3);
+        auto q = traph_test::cache_tensor<float>(traph::DimVector({ 1, 2, 1, 4 }), 1);
+        REQUIRE_THROWS_AS(traph::paged_attention_impl(*q, cache.layer(0), { id }, traph::AttentionParams()), std::runtime_error);
+        REQUIRE_THROWS_AS(traph::paged_attention_impl(*q, cache.layer(0), { id, id }, traph::AttentionParams()), std::runtime_error);
+    }
+
+    REQUIRE_THROWS_AS(traph::KVCache<float>(1, 0, 8, 16, 4), std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef TRAPH_TEST_LINALG_H_
+#define TRAPH_TEST_LINALG_H_
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+#include <catch2/catch.hpp>
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/linalg.h>
+
+namespace traph_test
+{
+    // a batch of well conditioned matrices (diagonally dominant), symmetric when spd is set
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> test_matrices(int batch, int n, int seed, bool spd)
+    {
+        std::shared_ptr<traph::Tensor<T>> a(new traph::Tensor<T>(traph::DimVector({ batch, n, n })));
+        T* p = a->data_ptr();
+        int state = seed;
+        for (int i = 0; i < batch * n * n; ++i)
+        {
+            state = (state * 1103515245 + 12345) & 0x7fffffff;
+            p[i] = static_cast<T>(state % 2001) / 1000 - 1;
+        }
+        for (int b = 0; b < batch; ++b)
+        {
+            T* m = p + b * n * n;
+            for (int i = 0; i < n; ++i)
+            {
+                if (spd)
+                    for (int j = 0; j < i; ++j)
+                        m[i * n + j] = m[j * n + i];
+                m[i * n + i] += static_cast<T>(n);
+            }
+        }
+        return a;
+    }
+
+    // largest |a * x - b| over a batch, x and b are [batch, n, k] (or [n] without batch)
+    template<typename T>
+    T residual(const traph::Tensor<T>& a, const traph::Tensor<T>& x, const traph::Tensor<T>& b, int batch, int n, int k)
+    {
+        T result = 0;
+        for (int s = 0; s < batch; ++s)
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < k; ++j)
+                {
+                    T sum = 0;
+                    for (int l = 0; l < n; ++l)
+                        sum += a.data_ptr()[s * n * n + i * n + l] * x.data_ptr()[s * n * k + l * k + j];
+                    result = std::max(result, std::abs(sum - b.data_ptr()[s * n * k + i * k + j]));
+                }
+        return result;
+    }
+}
+
+TEST_CASE( "linalg test", "[linalg]" )
+{
+    const int batch = 5, n = 7, k = 3;
+    auto a = traph_test::test_matrices<double>(batch, n, 1, false);
+    traph::Tensor<double> b(traph::DimVector({ batch, n, k }));
+    for (int i = 0; i < batch * n * k; ++i)
+        b.data_ptr()[i] = i % 5 - 2.0;
+
+    SECTION("solve, lu and lu_solve")
+    {
+        auto x = traph::solve_impl(*a, b);
+        REQUIRE(x->size() == b.size());
+        REQUIRE(traph_test::residual(*a, *x, b, batch, n, k) < 1e-12);
+
+        auto factors = traph::lu_impl(*a);
+        REQUIRE(factors.second->size() == traph::DimVector({ batch, n }));
+        auto y = traph::lu_solve_impl(*factors.first, *factors.second, b);
+        for (int i = 0; i < batch * n * k; ++i)
+            REQUIRE(std::abs(y->data_ptr()[i] - x->data_ptr()[i]) < 1e-12);
+
+        // P * a = L * U
+        const double* lu = factors.first->data_ptr();
+        const int* pivots = factors.second->data_ptr();
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+            {
+                double sum = 0;
+                for (int l = 0; l <= std::min(i, j); ++l)
+                    sum += (l == i ? 1.0 : lu[i * n + l]) * lu[l * n + j];
+                REQUIRE(std::abs(sum - a->data_ptr()[pivots[i] * n + j]) < 1e-12);
+            }
+    }
+
+    SECTION("one matrix against a batch and a vector")
+    {
+        auto a2 = traph_test::test_matrices<float>(1, n, 2, false);
+        a2->resize_({ n, n });
+        traph::Tensor<float> rhs(traph::DimVector({ batch, n, k }));
+        for (int i = 0; i < batch * n * k; ++i)
+            rhs.data_ptr()[i] = static_cast<float>(i % 7) - 3.f;
+        auto x = traph::solve_impl(*a2, rhs);
+        REQUIRE(x->size() == rhs.size());
+        for (int s = 0; s < batch; ++s)
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < k; ++j)
+                {
+                    float sum = 0;
+                    for (int l = 0; l < n; ++l)
+                        sum += a2->data_ptr()[i * n + l] * x->data_ptr()[s * n * k + l * k + j];
+                    REQUIRE(std::abs(sum - rhs.data_ptr()[s * n * k + i * k + j]) < 1e-4f);
+                }
+
+        traph::Tensor<float> v(traph::DimVector({ n }));
+        for (int i = 0; i < n; ++i)
+            v.data_ptr()[i] = static_cast<float>(i);
+        auto xv = traph::solve_impl(*a2, v);
+        REQUIRE(xv->size() == traph::DimVector({ n }));
+        REQUIRE(traph_test::residual(*a2, *xv, v, 1, n, 1) < 1e-4f);
+    }
+
+    SECTION("cholesky and cholesky_solve")
+    {
+        auto spd = traph_test::test_matrices<double>(batch, n, 3, true);
+        auto lower = traph::cholesky_impl(*spd, false);
+        auto upper = traph::cholesky_impl(*spd, true);
+        for (int s = 0; s < batch; ++s)
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < n; ++j)
+                {
+                    const double* l = lower->data_ptr() + s * n * n;
+                    REQUIRE(upper->data_ptr()[s * n * n + j * n + i] == l[i * n + j]);
+                    if (j > i)
+                        REQUIRE(l[i * n + j] == 0.0);
+                    double sum = 0;
+                    for (int m = 0; m < n; ++m)
+                        sum += l[i * n + m] * l[j * n + m];
+                    REQUIRE(std::abs(sum - spd->data_ptr()[s * n * n + i * n + j]) < 1e-12);
+                }
+
+        auto x = traph::cholesky_solve_impl(*lower, b, false);
+        REQUIRE(traph_test::residual(*spd, *x, b, batch, n, k) < 1e-12);
+        auto y = traph::cholesky_solve_impl(*upper, b, true);
+        REQUIRE(traph_test::residual(*spd, *y, b, batch, n, k) < 1e-12);
+
+        auto not_spd = traph_test::test_matrices<double>(1, n, 4, true);
+        not_spd->data_ptr()[0] = -1.0;
+        REQUIRE_THROWS_AS(traph::cholesky_impl(*not_spd, false), std::runtime_error);
+    }
+
+    SECTION("qr")
+    {
+        const int m = 6, cols = 4;
+        traph::Tensor<double> tall(traph::DimVector({ 2, m, cols }));
+        for (int i = 0; i < 2 * m * cols; ++i)
+            tall.data_ptr()[i] = std::sin(i * 0.7) + (i % 3);
+        for (int transposed = 0; transposed < 2; ++transposed)
+        {
+            // the wide case runs on a transposed view
+            std::shared_ptr<traph::Tensor<double>> input(new traph::Tensor<double>(tall.size()));
+            std::copy(tall.data_ptr(), tall.data_ptr() + 2 * m * cols, input->data_ptr());
+            if (transposed)
+                input->transpose_(1, 2);
+            int rows = transposed ? cols : m, columns = transposed ? m : cols, r = std::min(rows, columns);
+            auto result = traph::qr_impl(*input);
+            REQUIRE(result.first->size() == traph::DimVector({ 2, rows, r }));
+            REQUIRE(result.second->size() == traph::DimVector({ 2, r, columns }));
+            for (int s = 0; s < 2; ++s)
+            {
+                const double* q = result.first->data_ptr() + s * rows * r;
+                const double* upper = result.second->data_ptr() + s * r * columns;
+                for (int i = 0; i < r; ++i)
+                    for (int j = 0; j < r; ++j)
+                    {
+                        double dot = 0;
+                        for (int l = 0; l < rows; ++l)
+                            dot += q[l * r + i] * q[l * r + j];
+                        REQUIRE(std::abs(dot - (i == j ? 1.0 : 0.0)) < 1e-12);
+                    }
+                for (int i = 0; i < rows; ++i)
+                    for (int j = 0; j < columns; ++j)
+                    {
+                        double sum = 0;
+                        for (int l = 0; l < r; ++l)
+                            sum += q[i * r + l] * upper[l * columns + j];
+                        double expected = transposed ? tall.data_ptr()[s * m * cols + j * cols + i] : tall.data_ptr()[s * m * cols + i * cols + j];
+                        REQUIRE(std::abs(sum - expected) < 1e-12);
+                        if (i < r && j < i)
+                            REQUIRE(upper[i * columns + j] == 0.0);
+                    }
+            }
+        }
+    }
+
+    SECTION("inverse")
+    {
+        auto inv = std::dynamic_pointer_cast<traph::Tensor<double>>(a->inverse());
+        REQUIRE(inv);
+        for (int s = 0; s < batch; ++s)
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < n; ++j)
+                {
+                    double sum = 0;
+                    for (int l = 0; l < n; ++l)
+                        sum += a->data_ptr()[s * n * n + i * n + l] * inv->data_ptr()[s * n * n + l * n + j];
+                    REQUIRE(std::abs(sum - (i == j ? 1.0 : 0.0)) < 1e-12);
+                }
+
+        traph::Tensor<double> singular(traph::DimVector({ 2, 2 }));
+        singular.fill_(1.0);
+        REQUIRE_THROWS_AS(singular.inverse(), std::runtime_error);
+        traph::Tensor<double> rhs(traph::DimVector({ 2 }));
+        rhs.fill_(1.0);
+        REQUIRE_THROWS_AS(traph::solve_impl(singular, rhs), std::runtime_error);
+        REQUIRE_THROWS_AS(traph::Tensor<int>(traph::DimVector({ 2, 2 })).inverse(), std::runtime_error);
+    }
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef TRAPH_TEST_MEMORY_PLAN_H_
+#define TRAPH_TEST_MEMORY_PLAN_H_
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/capture.h>
+#include <traph/nn/executor.h>
+#include <traph/nn/function.h>
+#include <traph/nn/layers/activation.h>
+#include <traph/nn/layers/linear.h>
+#include <traph/nn/memory_plan.h>
+#include <traph/nn/optim.h>
+
+namespace traph_test
+{
+    // three linear layers with the same weights for every model
+    struct PlanModel
+    {
+        traph::Linear first{ 10, 32, true };
+        traph::Linear second{ 32, 32, true };
+        traph::Linear third{ 32, 2, true };
+        std::shared_ptr<traph::SGD> optimizer;
+
+        PlanModel()
+        {
+            std::vector<traph::VariableInterfacePtr> params = parameters();
+            for (std::size_t p = 0; p < params.size(); ++p)
+            {
+                auto data = std::dynamic_pointer_cast<traph::Tensor<float>>(params[p]->data());
+                for (int i = 0; i < params[p]->size().flat_size(); ++i)
+                    data->data_ptr()[i] = static_cast<float>((i * 11 + static_cast<int>(p) * 5) % 31) / 30 - 0.5f;
+            }
+            optimizer = std::make_shared<traph::SGD>(params, 0.05f);
+        }
+
+        std::vector<traph::VariableInterfacePtr> parameters()
+        {
+            std::vector<traph::VariableInterfacePtr> result;
+            for (traph::Linear* layer : { &first, &second, &third })
+                for (auto& each : layer->parameters())
+                    result.push_back(each);
+            return result;
+        }
+
+        traph::VariableInterfacePtr loss(const std::vector<traph::VariableInterfacePtr>& inputs)
+        {
+            auto h = traph::relu(first.forward(inputs[0]));
+            h = traph::sigmoid(second.forward(h));
+            return traph::mean(traph::pow(traph::sub(third.forward(h), inputs[1]), 2));
+        }
+
+        float step(const std::vector<traph::VariableInterfacePtr>& inputs)
+        {
+            optimizer->zero_grad();
+            auto result = loss(inputs);
+            result->backward();
+            optimizer->step();
+            return std::dynamic_pointer_cast<traph::Tensor<float>>(result->data())->item();
+        }
+    };
+
+    inline std::vector<traph::VariableInterfacePtr> plan_inputs(int rows, int seed)
+    {
+        std::vector<traph::VariableInterfacePtr> result{ traph::zeros<float>({ rows, 10 }, false), traph::zeros<float>({ rows, 2 }, false) };
+        for (auto& each : result)
+        {
+            auto data = std::dynamic_pointer_cast<traph::Tensor<float>>(each->data());
+            for (int i = 0; i < each->size().flat_size(); ++i)
+                data->data_ptr()[i] = static_cast<float>((i * 7 + seed * 3) % 17) / 8 - 1;
+        }
+        return result;
+    }
+
+    inline void require_same_parameters(PlanModel& a, PlanModel& b)
+    {
+        auto a_params = a.parameters();
+        auto b_params = b.parameters();
+        for (std::size_t p = 0; p < a_params.size(); ++p)
+            for (int i = 0; i < a_params[p]->size().flat_size(); ++i)
+                REQUIRE(std::dynamic_pointer_cast<traph::Tensor<float>>(a_params[p]->data())->data_ptr()[i]
+                    == std::dynamic_pointer_cast<traph::Tensor<float>>(b_params[p]->data())->data_ptr()[i]);
+    }
+}
+
+TEST_CASE( "memory plan test", "[memory_plan]" )
+{
+    SECTION("eager steps")
+    {
+        traph_test::PlanModel plain, planned;
+        traph::MemoryPlanner planner;
+        for (int iteration = 0; iteration < 6; ++iteration)
+        {
+            // a batch of another size misses the plan and is recorded again after
+            int rows = iteration == 3 ? 6 : 16;
+            auto inputs = traph_test::plan_inputs(rows, iteration);
+            float expected = plain.step(inputs);
+            float loss;
+            {
+                traph::MemoryPlanner::Scope scope(planner);
+                loss = planned.step(inputs);
+            }
+            REQUIRE(loss == expected);
+            traph_test::require_same_parameters(plain, planned);
+
+            if (iteration == 3)
+            {
+                REQUIRE(planner.misses() > 0);
+                REQUIRE(!planner.planned());
+            }
+            else
+            {
+                REQUIRE(planner.planned());
+                if (iteration > 0 && iteration != 4)
+                    REQUIRE(planner.misses() == 0);
+            }
+        }
+
+        const traph::MemoryReport& report = planner.report();
+        REQUIRE(report.tensors > 0);
+        REQUIRE(report.live_bytes <= report.planned_bytes);
+        REQUIRE(report.planned_bytes < report.naive_bytes);
+    }
+
+    SECTION("captured step")
+    {
+        traph_test::PlanModel plain, captured;
+        traph::CapturedStep step([&](const std::vector<traph::VariableInterfacePtr>& inputs) { return captured.loss(inputs); },
+            captured.optimizer);
+        for (int iteration = 0; iteration < 5; ++iteration)
+        {
+            auto inputs = traph_test::plan_inputs(16, iteration);
+            float expected = plain.step(inputs);
+            auto loss = step.run(inputs);
+            REQUIRE(std::dynamic_pointer_cast<traph::Tensor<float>>(loss->data())->item() == expected);
+            traph_test::require_same_parameters(plain, captured);
+            // the capture, then the replay that is recorded
+            REQUIRE(step.planner().planned() == (iteration > 0));
+            if (iteration > 1)
+                REQUIRE(step.planner().misses() == 0);
+        }
+        REQUIRE(step.captures() == 1);
+        REQUIRE(step.planner().report().planned_bytes < step.planner().report().naive_bytes);
+
+        step.plan_memory_(false);
+        step.run(traph_test::plan_inputs(16, 7));
+        REQUIRE(!step.planner().planned());
+        // results are kept without planning
+        REQUIRE(step.calls().front().result->data());
+    }
+
+    SECTION("errors")
+    {
+        traph::MemoryPlanner planner;
+        traph::MemoryPlanner::Scope scope(planner);
+        REQUIRE_THROWS_AS(planner.begin(), std::runtime_error);
+    }
+}
+
+#endif
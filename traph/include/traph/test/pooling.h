@@ -0,0 +1,314 @@
+#ifndef TRAPH_TEST_POOLING_H_
+#define TRAPH_TEST_POOLING_H_
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/tensor/gemm.h>
+#include <traph/tensor/pooling.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> pool_tensor(const traph::DimVector& size, int seed)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(size));
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<T>((i * 7 + seed * 5) % 13) / 4 - 1;
+        return result;
+    }
+
+    inline traph::Pool2dParams pool_params(int kernel, int stride, int padding, bool count_include_pad = true)
+    {
+        traph::Pool2dParams params;
+        params.kernel_h = params.kernel_w = kernel;
+        params.stride_h = params.stride_w = stride;
+        params.padding_h = params.padding_w = padding;
+        params.count_include_pad = count_include_pad;
+        return params;
+    }
+
+    // [N, C, H, W] in row-major order; rows and cols are the [begin, end) of every window and
+    // the divisor of its average
+    struct NaivePool
+    {
+        int batch, channels, height, width, out_h, out_w;
+        std::vector<int> row_begin, row_end, row_count, col_begin, col_end, col_count;
+
+        NaivePool(int n, int c, int h, int w, const traph::Pool2dParams& p)
+            : batch(n), channels(c), height(h), width(w)
+        {
+            out_h = (h + 2 * p.padding_h - p.kernel_h) / p.stride_h + 1;
+            out_w = (w + 2 * p.padding_w - p.kernel_w) / p.stride_w + 1;
+            windows(h, out_h, p.kernel_h, p.stride_h, p.padding_h, p.count_include_pad, row_begin, row_end, row_count);
+            windows(w, out_w, p.kernel_w, p.stride_w, p.padding_w, p.count_include_pad, col_begin, col_end, col_count);
+        }
+
+        NaivePool(int n, int c, int h, int w, int oh, int ow)
+            : batch(n), channels(c), height(h), width(w), out_h(oh), out_w(ow)
+        {
+            for (int i = 0; i < oh; ++i)
+            {
+                row_begin.push_back(i * h / oh);
+                row_end.push_back(((i + 1) * h + oh - 1) / oh);
+                row_count.push_back(row_end.back() - row_begin.back());
+            }
+            for (int i = 0; i < ow; ++i)
+            {
+                col_begin.push_back(i * w / ow);
+                col_end.push_back(((i + 1) * w + ow - 1) / ow);
+                col_count.push_back(col_end.back() - col_begin.back());
+            }
+        }
+
+        static void windows(int size, int out, int kernel, int stride, int padding, bool include_pad,
+            std::vector<int>& begin, std::vector<int>& end, std::vector<int>& count)
+        {
+            for (int i = 0; i < out; ++i)
+            {
+                int start = i * stride - padding;
+                begin.push_back(std::max(start, 0));
+                end.push_back(std::min(start + kernel, size));
+                count.push_back(include_pad ? std::min(start + kernel, size + padding) - start : end.back() - begin.back());
+            }
+        }
+
+        // calls f(output index, input index, divisor) for every pixel of every window
+        template<typename F>
+        void visit(F f) const
+        {
+            for (int p = 0; p < batch * channels; ++p)
+                for (int oh = 0; oh < out_h; ++oh)
+                    for (int ow = 0; ow < out_w; ++ow)
+                        for (int ih = row_begin[oh]; ih < row_end[oh]; ++ih)
+                            for (int iw = col_begin[ow]; iw < col_end[ow]; ++iw)
+                                f((p * out_h + oh) * out_w + ow, (p * height + ih) * width + iw, row_count[oh] * col_count[ow]);
+        }
+
+        int outputs() const { return batch * channels * out_h * out_w; }
+
+        // the first maximum of every window in row-major order
+        template<typename T>
+        std::vector<int> argmax(const T* x) const
+        {
+            std::vector<int> result(outputs(), -1);
+            visit([&](int yi, int xi, int) {
+                int& best = result[yi];
+                if (best < 0 || (!std::isnan(x[best]) && (x[xi] > x[best] || std::isnan(x[xi]))))
+                    best = xi;
+            });
+            return result;
+        }
+
+        template<typename T>
+        std::vector<double> average(const T* x) const
+        {
+            std::vector<double> result(outputs(), 0.0);
+            visit([&](int yi, int xi, int count) { result[yi] += static_cast<double>(x[xi]) / count; });
+            return result;
+        }
+    };
+
+    template<typename T>
+    void check_max_pool(int n, int c, int h, int w, const traph::Pool2dParams& params)
+    {
+        auto input = pool_tensor<T>({ n, c, h, w }, 1);
+        NaivePool naive(n, c, h, w, params);
+        std::vector<int> argmax = naive.argmax(input->data_ptr());
+
+        std::shared_ptr<traph::Tensor<traph::u8>> offsets;
+        auto result = traph::max_pool2d_impl(*input, params, &offsets);
+        REQUIRE(result->size() == traph::DimVector({ n, c, naive.out_h, naive.out_w }));
+        REQUIRE(offsets);
+        REQUIRE(offsets->size() == result->size());
+        for (int i = 0; i < naive.outputs(); ++i)
+        {
+            REQUIRE(result->data_ptr()[i] == input->data_ptr()[argmax[i]]);
+            int oh = i / naive.out_w % naive.out_h, ow = i % naive.out_w;
+            int ih = argmax[i] / w % h, iw = argmax[i] % w;
+            int tap = (ih - oh * params.stride_h + params.padding_h) * params.kernel_w + iw - ow * params.stride_w + params.padding_w;
+            REQUIRE(offsets->data_ptr()[i] == tap);
+        }
+        REQUIRE(traph::max_pool2d_impl(*input, params)->size() == result->size());
+
+        // both backward passes scatter to the first maximum
+        auto grad = pool_tensor<T>({ n, c, naive.out_h, naive.out_w }, 2);
+        std::vector<double> dx(n * c * h * w, 0.0);
+        for (int i = 0; i < naive.outputs(); ++i)
+            dx[argmax[i]] += grad->data_ptr()[i];
+        auto from_offsets = traph::max_pool2d_backward_impl(*grad, input->size(), *offsets, params);
+        auto recomputed = traph::max_pool2d_backward_impl(*grad, *input, params);
+        REQUIRE(from_offsets->size() == input->size());
+        REQUIRE(recomputed->size() == input->size());
+        for (int i = 0; i < static_cast<int>(dx.size()); ++i)
+        {
+            REQUIRE(std::abs(from_offsets->data_ptr()[i] - dx[i]) < 1e-5);
+            REQUIRE(std::abs(recomputed->data_ptr()[i] - dx[i]) < 1e-5);
+        }
+    }
+
+    template<typename T>
+    void check_avg_pool(int n, int c, int h, int w, const traph::Pool2dParams& params, double tolerance)
+    {
+        auto input = pool_tensor<T>({ n, c, h, w }, 3);
+        NaivePool naive(n, c, h, w, params);
+        std::vector<double> expected = naive.average(input->data_ptr());
+        auto result = traph::avg_pool2d_impl(*input, params);
+        REQUIRE(result->size() == traph::DimVector({ n, c, naive.out_h, naive.out_w }));
+        for (int i = 0; i < naive.outputs(); ++i)
+            REQUIRE(std::abs(result->data_ptr()[i] - expected[i]) < tolerance);
+
+        auto grad = pool_tensor<T>({ n, c, naive.out_h, naive.out_w }, 4);
+        std::vector<double> dx(n * c * h * w, 0.0);
+        naive.visit([&](int yi, int xi, int count) { dx[xi] += static_cast<double>(grad->data_ptr()[yi]) / count; });
+        auto input_grad = traph::avg_pool2d_backward_impl(*grad, input->size(), params);
+        REQUIRE(input_grad->size() == input->size());
+        for (int i = 0; i < static_cast<int>(dx.size()); ++i)
+            REQUIRE(std::abs(input_grad->data_ptr()[i] - dx[i]) < tolerance);
+    }
+
+    template<typename T>
+    void check_adaptive_avg_pool(int n, int c, int h, int w, int out_h, int out_w, double tolerance)
+    {
+        auto input = pool_tensor<T>({ n, c, h, w }, 5);
+        NaivePool naive(n, c, h, w, out_h, out_w);
+        std::vector<double> expected = naive.average(input->data_ptr());
+        auto result = traph::adaptive_avg_pool2d_impl(*input, out_h, out_w);
+        REQUIRE(result->size() == traph::DimVector({ n, c, out_h, out_w }));
+        for (int i = 0; i < naive.outputs(); ++i)
+            REQUIRE(std::abs(result->data_ptr()[i] - expected[i]) < tolerance);
+
+        auto grad = pool_tensor<T>({ n, c, out_h, out_w }, 6);
+        std::vector<double> dx(n * c * h * w, 0.0);
+        naive.visit([&](int yi, int xi, int count) { dx[xi] += static_cast<double>(grad->data_ptr()[yi]) / count; });
+        auto input_grad = traph::adaptive_avg_pool2d_backward_impl(*grad, input->size());
+        REQUIRE(input_grad->size() == input->size());
+        for (int i = 0; i < static_cast<int>(dx.size()); ++i)
+            REQUIRE(std::abs(input_grad->data_ptr()[i] - dx[i]) < tolerance);
+    }
+}
+
+TEST_CASE( "pooling test", "[pooling]" )
+{
+    const traph::Pool2dParams configs[] = {
+        traph_test::pool_params(2, 2, 0),
+        traph_test::pool_params(3, 2, 1),
+        traph_test::pool_params(3, 1, 1, false),
+        traph_test::pool_params(3, 3, 0),
+        traph_test::pool_params(5, 2, 2, false)
+    };
+
+    SECTION("max pool")
+    {
+        // every copy of the block kernels
+        traph::GemmIsa detected = traph::native_gemm_isa();
+        for (traph::GemmIsa isa : { traph::GemmIsa::GENERIC, traph::GemmIsa::AVX2, traph::GemmIsa::AVX512 })
+        {
+            traph::native_gemm_isa_(isa);
+            for (const traph::Pool2dParams& params : configs)
+                for (int c : { 3, 16, 37 })
+                {
+                    traph_test::check_max_pool<float>(2, c, 9, 11, params);
+                    traph_test::check_max_pool<double>(1, c, 12, 7, params);
+                }
+        }
+        traph::native_gemm_isa_(detected);
+        traph::Pool2dParams asymmetric = traph_test::pool_params(3, 2, 1);
+        asymmetric.kernel_w = 2;
+        asymmetric.stride_h = 1;
+        asymmetric.padding_w = 0;
+        traph_test::check_max_pool<float>(3, 18, 8, 10, asymmetric);
+    }
+
+    SECTION("max pool of large windows and NaN")
+    {
+        // 17 x 17 taps do not fit in a byte, backward finds the maxima again
+        traph::Pool2dParams large = traph_test::pool_params(17, 4, 8);
+        REQUIRE_FALSE(traph::max_pool2d_has_offsets(large));
+        auto input = traph_test::pool_tensor<float>({ 2, 5, 20, 23 }, 7);
+        std::shared_ptr<traph::Tensor<traph::u8>> offsets;
+        auto result = traph::max_pool2d_impl(*input, large, &offsets);
+        REQUIRE_FALSE(offsets);
+        traph_test::NaivePool naive(2, 5, 20, 23, large);
+        std::vector<int> argmax = naive.argmax(input->data_ptr());
+        auto grad = traph_test::pool_tensor<float>(result->size(), 8);
+        std::vector<double> dx(input->size().flat_size(), 0.0);
+        for (int i = 0; i < naive.outputs(); ++i)
+        {
+            REQUIRE(result->data_ptr()[i] == input->data_ptr()[argmax[i]]);
+            dx[argmax[i]] += grad->data_ptr()[i];
+        }
+        auto input_grad = traph::max_pool2d_backward_impl(*grad, *input, large);
+        for (int i = 0; i < static_cast<int>(dx.size()); ++i)
+            REQUIRE(std::abs(input_grad->data_ptr()[i] - dx[i]) < 1e-5);
+
+        auto nan = traph_test::pool_tensor<double>({ 1, 2, 4, 4 }, 9);
+        nan->data_ptr()[5] = std::numeric_limits<double>::quiet_NaN();
+        auto pooled = traph::max_pool2d_impl(*nan, traph_test::pool_params(2, 2, 0), &offsets);
+        REQUIRE(std::isnan(pooled->data_ptr()[0]));
+        REQUIRE(offsets->data_ptr()[0] == 3);
+        REQUIRE_FALSE(std::isnan(pooled->data_ptr()[1]));
+    }
+
+    SECTION("avg pool")
+    {
+        traph::GemmIsa detected = traph::native_gemm_isa();
+        for (traph::GemmIsa isa : { traph::GemmIsa::GENERIC, traph::GemmIsa::AVX2, traph::GemmIsa::AVX512 })
+        {
+            traph::native_gemm_isa_(isa);
+            for (const traph::Pool2dParams& params : configs)
+                for (int c : { 3, 16, 37 })
+                {
+                    traph_test::check_avg_pool<float>(2, c, 9, 11, params, 1e-5);
+                    traph_test::check_avg_pool<double>(1, c, 12, 7, params, 1e-12);
+                }
+        }
+        traph::native_gemm_isa_(detected);
+        traph_test::check_adaptive_avg_pool<float>(2, 20, 7, 7, 1, 1, 1e-5);
+        traph_test::check_adaptive_avg_pool<float>(1, 5, 10, 13, 3, 4, 1e-5);
+        traph_test::check_adaptive_avg_pool<double>(2, 17, 5, 6, 7, 8, 1e-12);
+    }
+
+    SECTION("strided and channels last inputs")
+    {
+        // [N, H, W, C] memory seen as [N, C, H, W], with full and partial channel blocks
+        for (int c : { 32, 20 })
+        {
+            auto memory = traph_test::pool_tensor<float>({ 2, 9, 8, c }, 10);
+            auto input = std::dynamic_pointer_cast<traph::Tensor<float>>(memory->permute({ 0, 3, 1, 2 }));
+            traph::Tensor<float> copy(traph::DimVector({ 2, c, 9, 8 }));
+            for (int n = 0; n < 2; ++n)
+                for (int ch = 0; ch < c; ++ch)
+                    for (int p = 0; p < 9 * 8; ++p)
+                        copy.data_ptr()[(n * c + ch) * 9 * 8 + p] = memory->data_ptr()[(n * 9 * 8 + p) * c + ch];
+            traph::Pool2dParams params = traph_test::pool_params(3, 2, 1);
+            auto expected = traph::max_pool2d_impl(copy, params);
+            auto result = traph::max_pool2d_impl(*input, params);
+            auto expected_avg = traph::avg_pool2d_impl(copy, params);
+            auto result_avg = traph::avg_pool2d_impl(*input, params);
+            auto expected_grad = traph::max_pool2d_backward_impl(*expected_avg, copy, params);
+            auto result_grad = traph::max_pool2d_backward_impl(*result_avg, *input, params);
+            for (int i = 0; i < expected->size().flat_size(); ++i)
+            {
+                REQUIRE(result->data_ptr()[i] == expected->data_ptr()[i]);
+                REQUIRE(std::abs(result_avg->data_ptr()[i] - expected_avg->data_ptr()[i]) < 1e-6);
+            }
+            for (int i = 0; i < copy.size().flat_size(); ++i)
+                REQUIRE(std::abs(result_grad->data_ptr()[i] - expected_grad->data_ptr()[i]) < 1e-6);
+        }
+    }
+
+    auto input = traph_test::pool_tensor<float>({ 1, 2, 5, 5 }, 11);
+    REQUIRE_THROWS_AS(traph::max_pool2d_impl(*input, traph_test::pool_params(3, 1, 2)), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::avg_pool2d_impl(*input, traph_test::pool_params(7, 1, 0)), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::adaptive_avg_pool2d_impl(*input, 0, 2), std::runtime_error);
+    auto grad = traph_test::pool_tensor<float>({ 1, 2, 3, 3 }, 12);
+    REQUIRE_THROWS_AS(traph::avg_pool2d_backward_impl(*grad, input->size(), traph_test::pool_params(2, 2, 0)), std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef TRAPH_TEST_QUANTIZATION_H_
+#define TRAPH_TEST_QUANTIZATION_H_
+
+#include <cmath>
+#include <memory>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/function.h>
+#include <traph/nn/layers/linear.h>
+#include <traph/nn/layers/quantized_linear.h>
+#include <traph/tensor/qgemm.h>
+
+namespace traph_test
+{
+    // deterministic values in [-range, range)
+    inline void fill_pattern(traph::VariableInterfacePtr v, int seed, float range)
+    {
+        auto t = std::dynamic_pointer_cast<traph::TensorBase<float>>(v->data());
+        int i = seed;
+        t->apply_([&i, range](float) {
+            i = (i * 1103515245 + 12345) & 0x7fffffff;
+            return (static_cast<float>(i % 2001) / 1000.f - 1.f) * range;
+        });
+    }
+
+    // a model holding its layers as children, calibrated and converted as a whole
+    struct QuantModel: public traph::Module
+    {
+        std::shared_ptr<traph::Linear> fc1 = std::make_shared<traph::Linear>(64, 32, true);
+        std::shared_ptr<traph::Linear> fc2 = std::make_shared<traph::Linear>(32, 8, true);
+
+        QuantModel()
+        {
+            add_module("fc1", fc1);
+            add_module("fc2", fc2);
+            fill_pattern(fc1->weight(), 2, 0.2f);
+            fill_pattern(fc1->bias(), 3, 0.5f);
+            fill_pattern(fc2->weight(), 4, 0.3f);
+            fill_pattern(fc2->bias(), 5, 0.5f);
+        }
+
+        traph::VariableInterfacePtr forward(traph::VariableInterfacePtr input)
+        {
+            return fc2->forward(traph::relu(fc1->forward(input)));
+        }
+    };
+}
+
+TEST_CASE( "quantization test", "[quantization]" )
+{
+    SECTION("quantize and dequantize round trip")
+    {
+        auto x = traph::zeros<float>({ 3, 5 });
+        traph_test::fill_pattern(x, 1, 2.f);
+        auto x_data = std::dynamic_pointer_cast<traph::Tensor<float>>(x->data());
+        traph::QuantParams qparams = traph::affine_qparams(-2.f, 2.f);
+        auto q = traph::quantize_impl(*x_data, qparams.scale, qparams.zero_point);
+        auto back = traph::dequantize_impl(*q, qparams.scale, qparams.zero_point);
+        for (int i = 0; i < 15; ++i)
+            REQUIRE(std::abs(back->data_ptr()[i] - x_data->data_ptr()[i]) <= qparams.scale / 2 + 1e-6f);
+    }
+
+    SECTION("calibrated linear layers run in int8")
+    {
+        traph::Linear linear1(64, 32, true), linear2(32, 8, true);
+        traph_test::fill_pattern(linear1.weight(), 2, 0.2f);
+        traph_test::fill_pattern(linear1.bias(), 3, 0.5f);
+        traph_test::fill_pattern(linear2.weight(), 4, 0.3f);
+        traph_test::fill_pattern(linear2.bias(), 5, 0.5f);
+
+        traph::prepare_quantization(linear1);
+        traph::prepare_quantization(linear2);
+        for (int batch = 0; batch < 4; ++batch)
+        {
+            auto x = traph::zeros<float>({ 16, 64 });
+            traph_test::fill_pattern(x, 10 + batch, 1.f);
+            linear2.forward(linear1.forward(x));
+        }
+        auto q1 = traph::quantize(linear1);
+        auto q2 = traph::quantize(linear2);
+        REQUIRE(q1->weight()->size(0) == 32);
+        REQUIRE(!linear1.input_observer());
+
+        auto x = traph::zeros<float>({ 5, 64 });
+        traph_test::fill_pattern(x, 99, 1.f);
+        auto expected = std::dynamic_pointer_cast<traph::Tensor<float>>(linear2.forward(linear1.forward(x))->data());
+        auto hidden = std::dynamic_pointer_cast<traph::Tensor<float>>(linear1.forward(x)->data());
+
+        // f32 in and out, per layer
+        auto y1 = std::dynamic_pointer_cast<traph::Tensor<float>>(q1->forward(x)->data());
+        float range1 = 0.f;
+        for (int i = 0; i < 5 * 32; ++i)
+            range1 = std::max(range1, std::abs(hidden->data_ptr()[i]));
+        for (int i = 0; i < 5 * 32; ++i)
+            REQUIRE(std::abs(y1->data_ptr()[i] - hidden->data_ptr()[i]) <= 0.02f * range1);
+
+        // a single row takes the dot product path and gives the same result
+        auto row = traph::zeros<float>({ 1, 64 });
+        auto row_data = std::dynamic_pointer_cast<traph::Tensor<float>>(row->data());
+        auto x_rows = std::dynamic_pointer_cast<traph::Tensor<float>>(x->data());
+        for (int i = 0; i < 64; ++i)
+            row_data->data_ptr()[i] = x_rows->data_ptr()[2 * 64 + i];
+        auto y_row = std::dynamic_pointer_cast<traph::Tensor<float>>(q1->forward(row)->data());
+        for (int j = 0; j < 32; ++j)
+            REQUIRE(y_row->data_ptr()[j] == y1->data_ptr()[2 * 32 + j]);
+
+        // u8 activations between the layers
+        traph::QuantParams in = q1->input_qparams();
+        traph::QuantParams out = q2->output_qparams();
+        auto x_data = std::dynamic_pointer_cast<traph::Tensor<float>>(x->data());
+        auto q = q2->forward_quantized(*q1->forward_quantized(*traph::quantize_impl(*x_data, in.scale, in.zero_point)));
+        auto y = traph::dequantize_impl(*q, out.scale, out.zero_point);
+        float range2 = 0.f;
+        for (int i = 0; i < 5 * 8; ++i)
+            range2 = std::max(range2, std::abs(expected->data_ptr()[i]));
+        for (int i = 0; i < 5 * 8; ++i)
+            REQUIRE(std::abs(y->data_ptr()[i] - expected->data_ptr()[i]) <= 0.06f * range2);
+    }
+
+    SECTION("whole models are converted")
+    {
+        traph_test::QuantModel model;
+        traph::prepare_quantization(model);
+        for (int batch = 0; batch < 4; ++batch)
+        {
+            auto x = traph::zeros<float>({ 16, 64 });
+            traph_test::fill_pattern(x, 10 + batch, 1.f);
+            model.forward(x);
+        }
+
+        auto x = traph::zeros<float>({ 5, 64 });
+        traph_test::fill_pattern(x, 99, 1.f);
+        auto expected = std::dynamic_pointer_cast<traph::Tensor<float>>(model.forward(x)->data());
+        REQUIRE(traph::convert(model) == 2);
+        REQUIRE(model.fc1->quantized());
+        REQUIRE(model.fc2->quantized());
+        REQUIRE(!model.fc1->input_observer());
+
+        // the model's own forward now runs both layers in int8
+        auto y = std::dynamic_pointer_cast<traph::Tensor<float>>(model.forward(x)->data());
+        float range = 0.f, error = 0.f;
+        for (int i = 0; i < 5 * 8; ++i)
+        {
+            range = std::max(range, std::abs(expected->data_ptr()[i]));
+            error = std::max(error, std::abs(y->data_ptr()[i] - expected->data_ptr()[i]));
+        }
+        REQUIRE(error > 0.f);
+        REQUIRE(error <= 0.05f * range);
+
+        // converted layers are not converted again, and can go back to f32
+        REQUIRE(traph::convert(model) == 0);
+        model.fc1->quantized_(nullptr);
+        model.fc2->quantized_(nullptr);
+        auto back = std::dynamic_pointer_cast<traph::Tensor<float>>(model.forward(x)->data());
+        for (int i = 0; i < 5 * 8; ++i)
+            REQUIRE(back->data_ptr()[i] == expected->data_ptr()[i]);
+    }
+
+    SECTION("uncalibrated layers are rejected")
+    {
+        traph::Linear linear(4, 4, false);
+        REQUIRE_THROWS(traph::quantize(linear));
+
+        // observers that saw no batch
+        traph_test::QuantModel model;
+        traph::prepare_quantization(model);
+        REQUIRE_THROWS(traph::convert(model));
+    }
+}
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef TRAPH_TEST_RNN_H_
+#define TRAPH_TEST_RNN_H_
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <traph/nn/function.h>
+#include <traph/nn/grad_mode.h>
+#include <traph/nn/layers/rnn.h>
+#include <traph/tensor/rnn.h>
+#include <traph/tensor/tensor.h>
+
+namespace traph_test
+{
+    template<typename T>
+    std::shared_ptr<traph::Tensor<T>> rnn_tensor(const traph::DimVector& size, int seed)
+    {
+        std::shared_ptr<traph::Tensor<T>> result(new traph::Tensor<T>(size));
+        for (int i = 0; i < size.flat_size(); ++i)
+            result->data_ptr()[i] = static_cast<T>((i * 7 + seed * 11) % 23) / 22 - static_cast<T>(0.5);
+        return result;
+    }
+
+    inline double rnn_sigmoid(double x)
+    {
+        return 1.0 / (1.0 + std::exp(-x));
+    }
+
+    // inputs of one layer; biases and initial states are null when not used
+    template<typename T>
+    struct RnnInputs
+    {
+        traph::RnnMode mode;
+        std::shared_ptr<traph::Tensor<T>> input, w_ih, w_hh, b_ih, b_hh, h0, c0;
+
+        RnnInputs(traph::RnnMode mode, int steps, int batch, int input_size, int hidden, bool bias, bool states)
+            :mode(mode)
+        {
+            int width = traph::rnn_gates(mode) * hidden;
+            input = rnn_tensor<T>(traph::DimVector({ steps, batch, input_size }), 1);
+            w_ih = rnn_tensor<T>(traph::DimVector({ width, input_size }), 2);
+            w_hh = rnn_tensor<T>(traph::DimVector({ width, hidden }), 3);
+            if (bias)
+            {
+                b_ih = rnn_tensor<T>(traph::DimVector({ width }), 4);
+                b_hh = rnn_tensor<T>(traph::DimVector({ width }), 5);
+            }
+            if (states)
+            {
+                h0 = rnn_tensor<T>(traph::DimVector({ batch, hidden }), 6);
+                if (mode == traph::RnnMode::LSTM)
+                    c0 = rnn_tensor<T>(traph::DimVector({ batch, hidden }), 7);
+            }
+        }
+
+        std::shared_ptr<traph::Tensor<T>> forward(traph::RnnState<T>& state) const
+        {
+            return traph::rnn_forward_impl(mode, *input, *w_ih, *w_hh, b_ih.get(), b_hh.get(), h0.get(), c0.get(), state);
+        }
+    };
+
+    // step by step in double, returning [T, B, H] outputs followed by the final cell states
+    template<typename T>
+    std::vector<double> rnn_reference(const RnnInputs<T>& in)
+    {
+        int steps = in.input->size(0), batch = in.input->size(1), input_size = in.input->size(2);
+        int hidden = in.w_hh->size(1), gates = traph::rnn_gates(in.mode);
+        auto at = [](const std::shared_ptr<traph::Tensor<T>>& t, int i) { return t ? static_cast<double>(t->data_ptr()[i]) : 0.0; };
+        std::vector<double> h(batch * hidden), c(batch * hidden), result;
+        for (int i = 0; i < batch * hidden; ++i)
+        {
+            h[i] = at(in.h0, i);
+            c[i] = at(in.c0, i);
+        }
+        for (int t = 0; t < steps; ++t)
+        {
+            std::vector<double> h_next(h.size()), c_next(c.size());
+            for (int b = 0; b < batch; ++b)
+            {
+                std::vector<double> xg(gates * hidden), hg(gates * hidden);
+                for (int g = 0; g < gates * hidden; ++g)
+                {
+                    xg[g] = at(in.b_ih, g);
+                    hg[g] = at(in.b_hh, g);
+                    for (int k = 0; k < input_size; ++k)
+                        xg[g] += at(in.w_ih, g * input_size + k) * at(in.input, (t * batch + b) * input_size + k);
+                    for (int k = 0; k < hidden; ++k)
+                        hg[g] += at(in.w_hh, g * hidden + k) * h[b * hidden + k];
+                }
+                for (int j = 0; j < hidden; ++j)
+                {
+                    int s = b * hidden + j;
+                    if (in.mode == traph::RnnMode::LSTM)
+                    {
+                        double i = rnn_sigmoid(xg[j] + hg[j]);
+                        double f = rnn_sigmoid(xg[hidden + j] + hg[hidden + j]);
+                        double n = std::tanh(xg[2 * hidden + j] + hg[2 * hidden + j]);
+                        double o = rnn_sigmoid(xg[3 * hidden + j] + hg[3 * hidden + j]);
+                        c_next[s] = f * c[s] + i * n;
+                        h_next[s] = o * std::tanh(c_next[s]);
+                    }
+                    else
+                    {
+                        double r = rnn_sigmoid(xg[j] + hg[j]);
+                        double z = rnn_sigmoid(xg[hidden + j] + hg[hidden + j]);
+                        double n = std::tanh(xg[2 * hidden + j] + r * hg[2 * hidden + j]);
+                        h_next[s] = (1 - z) * n + z * h[s];
+                    }
+                }
+            }
+            h = h_next;
+            c = c_next;
+            result.insert(result.end(), h.begin(), h.end());
+        }
+        if (in.mode == traph::RnnMode::LSTM)
+            result.insert(result.end(), c.begin(), c.end());
+        return result;
+    }
+
+    template<typename T>
+    void check_rnn_forward(const RnnInputs<T>& in, double eps)
+    {
+        traph::RnnState<T> state;
+        auto result = in.forward(state);
+        std::vector<double> expected = rnn_reference(in);
+        int count = result->size().flat_size();
+        int last = count - state.h_n->size().flat_size();
+        for (int i = 0; i < count; ++i)
+            REQUIRE(std::abs(result->data_ptr()[i] - expected[i]) < eps);
+        for (int i = 0; i < state.h_n->size().flat_size(); ++i)
+            REQUIRE(state.h_n->data_ptr()[i] == result->data_ptr()[last + i]);
+        if (in.mode == traph::RnnMode::LSTM)
+        {
+            for (int i = 0; i < state.c_n->size().flat_size(); ++i)
+                REQUIRE(std::abs(state.c_n->data_ptr()[i] - expected[count + i]) < eps);
+        }
+    }
+
+    // every gradient against central differences of sum(grad * output), plus the same of
+    // the final states with final_grads
+    inline void check_rnn_backward(const RnnInputs<double>& in, bool final_grads = false)
+    {
+        traph::RnnState<double> state;
+        auto output = in.forward(state);
+        auto grad = rnn_tensor<double>(output->size(), 8);
+        std::shared_ptr<traph::Tensor<double>> grad_h_n, grad_c_n;
+        if (final_grads)
+        {
+            grad_h_n = rnn_tensor<double>(state.h_n->size(), 9);
+            if (state.c_n)
+                grad_c_n = rnn_tensor<double>(state.c_n->size(), 10);
+        }
+        traph::RnnGrads<double> grads = traph::rnn_backward_impl(in.mode, *grad, *in.input, *output, *in.w_ih, *in.w_hh, state,
+            grad_h_n.get(), grad_c_n.get());
+
+        auto dot = [](const std::shared_ptr<traph::Tensor<double>>& a, const std::shared_ptr<traph::Tensor<double>>& b) {
+            double result = 0;
+            for (int i = 0; a && i < a->size().flat_size(); ++i)
+                result += a->data_ptr()[i] * b->data_ptr()[i];
+            return result;
+        };
+        auto loss = [&]() {
+            traph::RnnState<double> s;
+            auto y = in.forward(s);
+            return dot(y, grad) + dot(grad_h_n, s.h_n) + dot(grad_c_n, s.c_n);
+        };
+        std::vector<std::pair<std::shared_ptr<traph::Tensor<double>>, std::shared_ptr<traph::Tensor<double>>>> checked{
+            { in.input, grads.input }, { in.w_ih, grads.w_ih }, { in.w_hh, grads.w_hh },
+            { in.b_ih, grads.b_ih }, { in.b_hh, grads.b_hh }, { in.h0, grads.h0 }, { in.c0, grads.c0 } };
+        for (auto& each : checked)
+        {
+            if (!each.first)
+                continue;
+            REQUIRE(each.second->size() == each.first->size());
+            for (int i = 0; i < each.first->size().flat_size(); ++i)
+            {
+                double& x = each.first->data_ptr()[i];
+                double saved = x;
+                x = saved + 1e-6;
+                double up = loss();
+                x = saved - 1e-6;
+                double down = loss();
+                x = saved;
+                REQUIRE(std::abs(each.second->data_ptr()[i] - (up - down) / 2e-6) < 1e-6);
+            }
+        }
+    }
+}
+
+TEST_CASE( "rnn test", "[rnn]" )
+{
+    using traph::RnnMode;
+
+    SECTION("forward")
+    {
+        for (RnnMode mode : { RnnMode::LSTM, RnnMode::GRU })
+        {
+            traph_test::check_rnn_forward(traph_test::RnnInputs<double>(mode, 5, 3, 4, 6, true, true), 1e-12);
+            traph_test::check_rnn_forward(traph_test::RnnInputs<double>(mode, 1, 1, 2, 3, false, false), 1e-12);
+            traph_test::check_rnn_forward(traph_test::RnnInputs<float>(mode, 7, 2, 5, 8, true, true), 1e-5);
+        }
+    }
+
+    SECTION("backward through time")
+    {
+        for (RnnMode mode : { RnnMode::LSTM, RnnMode::GRU })
+        {
+            traph_test::check_rnn_backward(traph_test::RnnInputs<double>(mode, 4, 3, 5, 4, true, true));
+            traph_test::check_rnn_backward(traph_test::RnnInputs<double>(mode, 1, 2, 3, 2, false, false));
+            traph_test::check_rnn_backward(traph_test::RnnInputs<double>(mode, 4, 3, 5, 4, true, true), true);
+        }
+    }
+
+    SECTION("strided input")
+    {
+        for (RnnMode mode : { RnnMode::LSTM, RnnMode::GRU })
+        {
+            traph_test::RnnInputs<double> in(mode, 4, 3, 5, 4, true, true);
+            traph::RnnState<double> state;
+            auto expected = in.forward(state);
+            auto grad = traph_test::rnn_tensor<double>(expected->size(), 9);
+            auto grads = traph::rnn_backward_impl(mode, *grad, *in.input, *expected, *in.w_ih, *in.w_hh, state);
+
+            // [B, T, I] storage seen as [T, B, I]
+            auto batch_first = std::dynamic_pointer_cast<traph::Tensor<double>>(in.input->transpose(0, 1)->clone());
+            in.input = std::dynamic_pointer_cast<traph::Tensor<double>>(batch_first->transpose(0, 1));
+            auto result = in.forward(state);
+            auto strided = traph::rnn_backward_impl(mode, *grad, *in.input, *result, *in.w_ih, *in.w_hh, state);
+            for (int i = 0; i < expected->size().flat_size(); ++i)
+                REQUIRE(result->data_ptr()[i] == expected->data_ptr()[i]);
+            for (int i = 0; i < grads.w_ih->size().flat_size(); ++i)
+                REQUIRE(std::abs(strided.w_ih->data_ptr()[i] - grads.w_ih->data_ptr()[i]) < 1e-12);
+            for (int i = 0; i < grads.input->size().flat_size(); ++i)
+                REQUIRE(strided.input->data_ptr()[i] == grads.input->data_ptr()[i]);
+        }
+    }
+
+    SECTION("stacked layers")
+    {
+        traph::LSTM lstm(3, 4, 2);
+        REQUIRE(lstm.parameters().size() == 8);
+        auto input = traph::zeros<float>({ 5, 2, 3 }, true);
+        auto input_data = std::dynamic_pointer_cast<traph::Tensor<float>>(input->data());
+        for (int i = 0; i < 5 * 2 * 3; ++i)
+            input_data->data_ptr()[i] = static_cast<float>(i % 7) / 7;
+        auto output = lstm.forward(input);
+        REQUIRE(output->size() == traph::DimVector({ 5, 2, 4 }));
+        REQUIRE(lstm.h_n().size() == 2);
+        REQUIRE(lstm.c_n()[1]->size() == traph::DimVector({ 2, 4 }));
+
+        // the second layer reads the output of the first
+        traph::RnnState<float> state;
+        traph::RnnState<float> second;
+        auto first = traph::rnn_forward_impl(RnnMode::LSTM, *input_data,
+            *std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.weight_ih(0)->data()), *std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.weight_hh(0)->data()),
+            std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.bias_ih(0)->data()).get(), std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.bias_hh(0)->data()).get(),
+            nullptr, nullptr, state);
+        auto top = traph::rnn_forward_impl(RnnMode::LSTM, *first,
+            *std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.weight_ih(1)->data()), *std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.weight_hh(1)->data()),
+            std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.bias_ih(1)->data()).get(), std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.bias_hh(1)->data()).get(),
+            nullptr, nullptr, second);
+        auto output_data = std::dynamic_pointer_cast<traph::Tensor<float>>(output->data());
+        for (int i = 0; i < 5 * 2 * 4; ++i)
+            REQUIRE(output_data->data_ptr()[i] == top->data_ptr()[i]);
+
+        traph::sum(output)->backward();
+        for (auto& each : lstm.parameters())
+            REQUIRE(each->grad()->size() == each->data()->size());
+        REQUIRE(input->grad()->size() == traph::DimVector({ 5, 2, 3 }));
+
+        traph::GRU gru(3, 4, 1, false);
+        REQUIRE(gru.parameters().size() == 2);
+        auto h0 = traph::zeros<float>({ 2, 4 }, true);
+        traph::sum(gru.forward(input, { h0 }))->backward();
+        REQUIRE(h0->grad()->size() == traph::DimVector({ 2, 4 }));
+        REQUIRE(gru.c_n()[0] == nullptr);
+        REQUIRE_THROWS_AS(gru.forward(input, { h0, h0 }), std::runtime_error);
+    }
+
+    SECTION("gradients of the final states")
+    {
+        traph::LSTM lstm(3, 4, 2);
+        auto input = traph::zeros<float>({ 5, 2, 3 }, true);
+        auto input_data = std::dynamic_pointer_cast<traph::Tensor<float>>(input->data());
+        for (int i = 0; i < 5 * 2 * 3; ++i)
+            input_data->data_ptr()[i] = static_cast<float>(i % 7) / 7 - 0.4f;
+
+        // a loss of the final states of both layers only, the output is not used
+        auto loss = [&]() {
+            auto output = lstm.forward(input);
+            auto h = lstm.h_state(1), c = lstm.c_state(0);
+            return traph::add(traph::sum(traph::pow(h, 2)), traph::sum(c));
+        };
+        auto result = loss();
+        REQUIRE(result->requires_grad());
+        REQUIRE(lstm.h_state(1)->size() == traph::DimVector({ 2, 4 }));
+        auto h_data = std::dynamic_pointer_cast<traph::Tensor<float>>(lstm.h_state(1)->data());
+        REQUIRE(h_data == lstm.h_n()[1]);
+        result->backward();
+
+        auto value = [&]() {
+            traph::NoGradGuard guard;
+            return std::dynamic_pointer_cast<traph::Tensor<float>>(loss()->data())->item();
+        };
+        for (auto& param : { lstm.weight_hh(0), lstm.weight_ih(1), lstm.bias_ih(0) })
+        {
+            auto data = std::dynamic_pointer_cast<traph::Tensor<float>>(param->data());
+            bool nonzero = false;
+            for (int i = 0; i < param->size().flat_size(); i += 5)
+            {
+                float saved = data->data_ptr()[i];
+                data->data_ptr()[i] = saved + 1e-2f;
+                float up = value();
+                data->data_ptr()[i] = saved - 1e-2f;
+                float down = value();
+                data->data_ptr()[i] = saved;
+                float g = param->grad()->data_ptr()[i];
+                REQUIRE(std::abs(g - (up - down) / 2e-2f) < 2e-3f + 1e-2f * std::abs(g));
+                nonzero = nonzero || g != 0.f;
+            }
+            REQUIRE(nonzero);
+        }
+        REQUIRE(input->grad()->size() == traph::DimVector({ 5, 2, 3 }));
+
+        traph::GRU gru(3, 4);
+        gru.forward(input);
+        REQUIRE_THROWS_AS(gru.c_state(0), std::runtime_error);
+        REQUIRE_THROWS_AS(gru.h_state(1), std::runtime_error);
+        {
+            // without a gradient the states are plain variables
+            traph::NoGradGuard guard;
+            gru.forward(input);
+            REQUIRE(!gru.h_state(0)->requires_grad());
+            REQUIRE(gru.h_state(0)->data() == gru.h_n()[0]);
+        }
+    }
+
+    traph_test::RnnInputs<float> in(RnnMode::LSTM, 3, 2, 4, 5, true, true);
+    traph::RnnState<float> state;
+    REQUIRE_THROWS_AS(traph::rnn_forward_impl(RnnMode::GRU, *in.input, *in.w_ih, *in.w_hh, nullptr, nullptr, nullptr, nullptr, state), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::rnn_forward_impl(RnnMode::LSTM, *in.w_ih, *in.w_ih, *in.w_hh, nullptr, nullptr, nullptr, nullptr, state), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::rnn_forward_impl(RnnMode::LSTM, *in.input, *in.w_ih, *in.w_hh, in.h0.get(), nullptr, nullptr, nullptr, state), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::rnn_forward_impl(RnnMode::LSTM, *in.input, *in.w_ih, *in.w_hh, nullptr, nullptr, in.b_ih.get(), nullptr, state), std::runtime_error);
+    auto output = in.forward(state);
+    traph::RnnState<float> empty;
+    REQUIRE_THROWS_AS(traph::rnn_backward_impl(RnnMode::LSTM, *output, *in.input, *output, *in.w_ih, *in.w_hh, empty), std::runtime_error);
+    REQUIRE_THROWS_AS(traph::rnn_backward_impl(RnnMode::LSTM, *in.input, *in.input, *output, *in.w_ih, *in.w_hh, state), std::runtime_error);
+}
+
+#endif
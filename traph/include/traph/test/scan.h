@@ -0,0 +1,82 @@
+#ifndef TRAPH_TEST_SCAN_H_
+#define TRAPH_TEST_SCAN_H_
+
+#include <catch2/catch.hpp>
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/scan.h>
+
+TEST_CASE( "scan test", "[scan]" )
+{
+    auto a = std::make_shared<traph::FloatTensor>(traph::DimVector({ 2, 3 }));
+    float* a_ptr = a->data_ptr();
+    float values[] = { 1, 3, 2, 4, 0, 5 };
+    std::copy(values, values + 6, a_ptr);
+
+    SECTION("cumsum along inner dimension")
+    {
+        auto c = traph::cumsum_impl(*a, 1);
+        float expected[] = { 1, 4, 6, 4, 4, 9 };
+        for (int i = 0; i < 6; ++i)
+            REQUIRE(c->data_ptr()[i] == expected[i]);
+    }
+
+    SECTION("cumsum along outer dimension")
+    {
+        auto c = traph::cumsum_impl(*a, 0);
+        float expected[] = { 1, 3, 2, 5, 3, 7 };
+        for (int i = 0; i < 6; ++i)
+            REQUIRE(c->data_ptr()[i] == expected[i]);
+    }
+
+    SECTION("reverse cumsum of transposed view")
+    {
+        auto t = std::dynamic_pointer_cast<traph::FloatTensor>(a->transpose(0, 1));
+        auto c = traph::cumsum_impl(*t, 1, true);
+        float expected[] = { 5, 4, 3, 0, 7, 5 };
+        for (int i = 0; i < 6; ++i)
+            REQUIRE(c->data_ptr()[i] == expected[i]);
+    }
+
+    SECTION("cummax and cumprod")
+    {
+        auto m = traph::cummax_impl(*a, 1);
+        auto p = traph::cumprod_impl(*a, 1);
+        float expected_max[] = { 1, 3, 3, 4, 4, 5 };
+        float expected_prod[] = { 1, 3, 6, 4, 0, 0 };
+        for (int i = 0; i < 6; ++i)
+        {
+            REQUIRE(m->data_ptr()[i] == expected_max[i]);
+            REQUIRE(p->data_ptr()[i] == expected_prod[i]);
+        }
+    }
+
+    SECTION("gradients")
+    {
+        auto g = std::make_shared<traph::FloatTensor>(traph::DimVector({ 2, 3 }));
+        g->fill_(1);
+        auto dp = traph::cumprod_backward_impl(*g, *a, 1);
+        auto dm = traph::cummax_backward_impl(*g, *a, 1);
+        // row 0: y = {1, 3, 6}, row 1 contains a zero in the middle
+        float expected_prod[] = { 1 + 3 + 6, 1 + 2, 3, 1, 4 + 20, 0 };
+        float expected_max[] = { 1, 2, 0, 2, 0, 1 };
+        for (int i = 0; i < 6; ++i)
+        {
+            REQUIRE(dp->data_ptr()[i] == Approx(expected_prod[i]));
+            REQUIRE(dm->data_ptr()[i] == expected_max[i]);
+        }
+    }
+
+    SECTION("long axis blocked scan")
+    {
+        traph::idx_type n = 1 << 20;
+        auto l = std::make_shared<traph::IntTensor>(traph::DimVector({ n }));
+        l->fill_(1);
+        auto c = traph::cumsum_impl(*l, 0);
+        bool ok = true;
+        for (traph::idx_type i = 0; i < n; ++i)
+            ok = ok && c->data_ptr()[i] == i + 1;
+        REQUIRE(ok);
+    }
+}
+
+#endif
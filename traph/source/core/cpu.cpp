@@ -0,0 +1,81 @@
+#include <traph/core/cpu.h>
+
+#if defined(TRAPH_ARCH_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace traph
+{
+    namespace
+    {
+#if defined(TRAPH_ARCH_X86)
+        void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+        {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+            for (int i = 0; i < 4; ++i)
+                regs[i] = static_cast<unsigned>(info[i]);
+#else
+            __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        }
+
+        u64 xgetbv0()
+        {
+#if defined(_MSC_VER)
+            return _xgetbv(0);
+#else
+            unsigned eax, edx;
+            __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            return (static_cast<u64>(edx) << 32) | eax;
+#endif
+        }
+#endif
+
+        CpuFeatures detect_cpu_features()
+        {
+            CpuFeatures features{};
+#if defined(TRAPH_ARCH_X86)
+            unsigned regs[4];
+            cpuid(0, 0, regs);
+            unsigned max_leaf = regs[0];
+            if (max_leaf < 7)
+                return features;
+
+            cpuid(1, 0, regs);
+            bool osxsave = (regs[2] >> 27) & 1;
+            bool avx = (regs[2] >> 28) & 1;
+            bool fma = (regs[2] >> 12) & 1;
+            if (!osxsave || !avx)
+                return features;
+
+            // the os has to save ymm (and zmm) state on context switches
+            u64 xcr0 = xgetbv0();
+            bool ymm_state = (xcr0 & 0x6) == 0x6;
+            bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+
+            cpuid(7, 0, regs);
+            features.avx2 = ymm_state && ((regs[1] >> 5) & 1);
+            features.fma = ymm_state && fma;
+            features.avx512f = zmm_state && ((regs[1] >> 16) & 1);
+            features.avx512dq = features.avx512f && ((regs[1] >> 17) & 1);
+            features.avx512bw = features.avx512f && ((regs[1] >> 30) & 1);
+            features.avx512vl = features.avx512f && ((regs[1] >> 31) & 1);
+            features.avx512vnni = features.avx512f && ((regs[2] >> 11) & 1);
+#endif
+            return features;
+        }
+    }
+
+    const CpuFeatures& cpu_features()
+    {
+        static const CpuFeatures features = detect_cpu_features();
+        return features;
+    }
+}
@@ -0,0 +1,196 @@
+#include <traph/nn/capture.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include <traph/nn/grad_mode.h>
+#include <traph/nn/optim.h>
+
+namespace traph
+{
+    namespace
+    {
+        thread_local GraphCapture* current_capture = nullptr;
+
+        void capture_error(const std::string& message)
+        {
+            throw std::runtime_error("CapturedStep: " + message + ".");
+        }
+    }
+
+    GraphCapture::GraphCapture()
+        :_previous(current_capture)
+    {
+        current_capture = this;
+    }
+
+    GraphCapture::~GraphCapture()
+    {
+        current_capture = _previous;
+    }
+
+    GraphCapture* GraphCapture::current()
+    {
+        return current_capture;
+    }
+
+    void GraphCapture::record(std::shared_ptr<OpBase> op, std::initializer_list<VariableInterfacePtr> inputs, VariableInterfacePtr result)
+    {
+        _calls.push_back(CapturedCall{ op, std::vector<VariableInterfacePtr>(inputs), result });
+    }
+
+    void GraphCapture::record(std::shared_ptr<OpBase> op, const std::vector<VariableInterfacePtr>& inputs, VariableInterfacePtr result)
+    {
+        _calls.push_back(CapturedCall{ op, inputs, result });
+    }
+
+    CapturedStep::CapturedStep(StepFunction step, std::shared_ptr<Optimizer> optimizer)
+        :_step(step), _optimizer(optimizer), _captures(0), _replays(0), _plan_memory(true)
+    {
+        _executor.release_saved_(_plan_memory);
+    }
+
+    void CapturedStep::plan_memory_(bool enabled)
+    {
+        _plan_memory = enabled;
+        _executor.release_saved_(enabled);
+        _planner.reset();
+    }
+
+    bool CapturedStep::same_sizes(const std::vector<VariableInterfacePtr>& inputs) const
+    {
+        if (_captures == 0 || inputs.size() != _sizes.size())
+            return false;
+        for (std::size_t i = 0; i < inputs.size(); ++i)
+            if (inputs[i]->size() != _sizes[i] || inputs[i]->data()->dtype() != _inputs[i]->data()->dtype() ||
+                inputs[i]->requires_grad() != _inputs[i]->requires_grad())
+                return false;
+        return true;
+    }
+
+    VariableInterfacePtr CapturedStep::run(const std::vector<VariableInterfacePtr>& inputs)
+    {
+        if (!GradMode::is_enabled())
+            capture_error("A training step can not run under NoGradGuard");
+        if (_optimizer)
+            _optimizer->zero_grad();
+        if (same_sizes(inputs))
+        {
+            for (std::size_t i = 0; i < inputs.size(); ++i)
+                _inputs[i]->data_(inputs[i]->data());
+            ++_replays;
+            std::optional<MemoryPlanner::Scope> scope;
+            if (_plan_memory && Executor::backward_threads() == 1)
+                scope.emplace(_planner);
+            forward();
+            backward(inputs, false);
+            release();
+        }
+        else
+        {
+            capture(inputs);
+            release();
+            _planner.reset();
+        }
+        if (_optimizer)
+            _optimizer->step();
+        return _loss;
+    }
+
+    void CapturedStep::capture(const std::vector<VariableInterfacePtr>& inputs)
+    {
+        // variables of the step's own, that later runs hand new data to
+        _inputs.clear();
+        _sizes.clear();
+        for (auto& each : inputs)
+        {
+            if (each->sparse_grad())
+                capture_error("An input can not take a sparse gradient");
+            VariableInterfacePtr input = each->new_empty(DimVector(), false);
+            input->data_(each->data());
+            if (each->requires_grad())
+                input->requires_grad_(true);
+            _inputs.push_back(input);
+            _sizes.push_back(each->size());
+        }
+
+        {
+            GraphCapture capture;
+            _loss = _step(_inputs);
+            _calls.swap(capture.calls());
+        }
+        if (!_loss || !_loss->requires_grad())
+            capture_error("The step shall return a loss that requires a gradient");
+        _report = GraphReport();
+        if (_graph_optimizer)
+        {
+            std::vector<VariableInterfacePtr> outputs{ _loss };
+            _report = _graph_optimizer->run(_calls, _inputs, outputs);
+            _loss = outputs[0];
+        }
+
+        _call_data.assign(_calls.size(), std::vector<TensorInterfacePtr>());
+        _result_grads.clear();
+        for (std::size_t i = 0; i < _calls.size(); ++i)
+        {
+            _call_data[i].resize(_calls[i].inputs.size());
+            if (TensorBasePtr<f32> grad = _calls[i].result->grad())
+                _result_grads.push_back(grad);
+        }
+        ++_captures;
+        _replays = 0;
+
+        // rewritten calls have not run yet
+        if (_graph_optimizer)
+            forward();
+        backward(inputs, true);
+    }
+
+    void CapturedStep::forward()
+    {
+        for (std::size_t i = 0; i < _calls.size(); ++i)
+        {
+            CapturedCall& call = _calls[i];
+            std::vector<TensorInterfacePtr>& data = _call_data[i];
+            for (std::size_t j = 0; j < call.inputs.size(); ++j)
+                data[j] = call.inputs[j]->data();
+            call.op->context.clear();
+            if (_replays > 0)
+                call.op->replay(_replays);
+            call.result->data_(call.op->forward(data));
+        }
+    }
+
+    void CapturedStep::backward(const std::vector<VariableInterfacePtr>& inputs, bool sort)
+    {
+        for (auto& grad : _result_grads)
+            grad->fill_(0);
+        for (auto& input : _inputs)
+            if (input->grad())
+                input->grad()->fill_(0);
+        _loss->grad()->fill_(1);
+        if (sort)
+            _executor.backward(_loss.get());
+        else
+            _executor.replay_backward();
+
+        // the gradients of this run go to the caller's inputs, added like eager backward does
+        for (std::size_t i = 0; i < inputs.size(); ++i)
+            if (_inputs[i]->grad())
+                inputs[i]->grad()->add_(_inputs[i]->grad());
+    }
+
+    void CapturedStep::release()
+    {
+        if (!_plan_memory)
+            return;
+        for (std::size_t i = 0; i < _calls.size(); ++i)
+        {
+            for (auto& data : _call_data[i])
+                data.reset();
+            if (_calls[i].result != _loss)
+                _calls[i].result->data_(nullptr);
+        }
+    }
+}
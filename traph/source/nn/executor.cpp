@@ -1,73 +1,311 @@
 #include <traph/nn/executor.h>
 
-#include <map>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <omp.h>
+
+#include <traph/tensor/embedding.h>
+#include <traph/tensor/tensor.h>
 
 namespace traph
 {
-    std::vector<VariableInterface*> Executor::topology_sort(VariableInterface* root)
+    namespace
     {
-        std::set<VariableInterface*> all_nodes = collect_backward_tensors(root);
-		// std::set<VariableInterface*> visited_nodes;
-        std::vector<VariableInterface*> sort_result;
-		std::map<VariableInterface*, int> indegrees;
-        std::size_t all_size = all_nodes.size();
-
-		for (std::set<VariableInterface*>::iterator it = all_nodes.begin(); it != all_nodes.end(); ++it)
-			indegrees[*it] = 0;
-
-		for (std::set<VariableInterface*>::iterator it = all_nodes.begin(); it != all_nodes.end(); ++it)
-		{
-			std::vector<VariableInterfacePtr>& cur_inputs = (*it)->inputs();
-			for (auto &each : cur_inputs)
-				if(indegrees.find(each.get()) != indegrees.end())
-					indegrees[each.get()]++;
-		}
-
-        for(int i = 0; i<all_size; ++i)
+        std::atomic<int> threads_of_backward(1);
+        std::atomic<bool> deterministic_backward(true);
+
+        Executor& thread_executor()
         {
-            for(std::set<VariableInterface*>::iterator it = all_nodes.begin(); it != all_nodes.end(); ++it)
+            thread_local Executor executor;
+            return executor;
+        }
+
+        // ids in the order nodes are found, the inputs of a node are added to the edges when
+        // it is reached
+        void traverse(VariableInterface* root, std::vector<VariableInterface*>& nodes,
+            std::vector<idx_type>& offsets, std::vector<idx_type>& edges)
+        {
+            std::unordered_map<VariableInterface*, idx_type> ids;
+            ids.reserve(nodes.capacity());
+            nodes.clear();
+            offsets.clear();
+            edges.clear();
+
+            nodes.push_back(root);
+            ids.emplace(root, 0);
+            offsets.push_back(0);
+            for (std::size_t i = 0; i < nodes.size(); ++i)
             {
-                std::vector<VariableInterfacePtr> cur_inputs = (*it)->inputs();
-				if (indegrees[*it] == 0)
-				{
-					sort_result.push_back(*it);
-					all_nodes.erase(it);
-					for (auto& each:cur_inputs)
-					{
-						if (indegrees.find(each.get()) != indegrees.end())
-							indegrees[each.get()]--;
-					}
-					break;
-				}
+                std::vector<VariableInterfacePtr>& cur_inputs = nodes[i]->inputs();
+                for (auto& each : cur_inputs)
+                {
+                    if (!each->requires_grad())
+                        continue;
+                    auto found = ids.emplace(each.get(), static_cast<idx_type>(nodes.size()));
+                    if (found.second)
+                        nodes.push_back(each.get());
+                    edges.push_back(found.first->second);
+                }
+                offsets.push_back(static_cast<idx_type>(edges.size()));
             }
         }
 
-		return sort_result;
+        // the gradient a node passes to one of its inputs, dense or as rows
+        struct Contribution
+        {
+            TensorBasePtr<f32> dense;
+            std::shared_ptr<SparseRows<f32>> rows;
+        };
+
+        Contribution contribution(VariableInterface* node, const std::vector<TensorBasePtr<f32>>& back_grad, std::size_t j)
+        {
+            Contribution result;
+            result.dense = back_grad[j];
+            if (!result.dense)
+                result.rows = node->grad_fn()->sparse_backward(node->grad(), j);
+            return result;
+        }
+
+        void accumulate(VariableInterface* input, const Contribution& c)
+        {
+            if (c.dense)
+            {
+                if (!input->grad())
+                    throw std::runtime_error("backward: A dense gradient can not be added to a sparse one.");
+                input->grad()->add_(c.dense);
+                return;
+            }
+
+            if (!c.rows)
+                return;
+            if (input->grad())
+                index_add_rows_(*std::dynamic_pointer_cast<Tensor<f32>>(input->grad()), *c.rows, 1.f);
+            else
+                sparse_rows_add_(*input->sparse_grad(), *c.rows);
+        }
     }
 
-    std::set<VariableInterface*> Executor::collect_backward_tensors(VariableInterface* root)
+    struct Executor::BackwardState
     {
-        // bfs
-        std::set<VariableInterface*> result_set;
-        std::list<VariableInterface*> variable_queue;
-        variable_queue.push_back(root);
-        while(!variable_queue.empty())
+        bool ordered;
+        // the gradients of the edges when ordered, a lock of each node when not
+        std::vector<Contribution> slots;
+        std::vector<std::mutex> locks;
+        std::vector<std::atomic<idx_type>> pending;
+        std::atomic<bool> failed;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        BackwardState(bool ordered, idx_type nodes, idx_type edges)
+            :ordered(ordered), slots(ordered ? edges : 0), locks(ordered ? 0 : nodes), pending(nodes), failed(false)
         {
-            // get first
-            VariableInterface* cur = variable_queue.front();
-            variable_queue.pop_front();
-            // save
-            result_set.insert(cur);
-
-            // get inputs and insert into queue then continue
-            std::vector<VariableInterfacePtr>& cur_inputs(cur->inputs());
-            for(int i = 0; i<cur_inputs.size(); ++i)
+        }
+    };
+
+    const std::vector<VariableInterface*>& Executor::sort(VariableInterface* root)
+    {
+        traverse(root, _nodes, _next_offsets, _next_edges);
+        idx_type count = static_cast<idx_type>(_nodes.size());
+        _cached = _next_offsets == _offsets && _next_edges == _edges;
+        if (!_cached)
+        {
+            _offsets.swap(_next_offsets);
+            _edges.swap(_next_edges);
+
+            // an edge of each use, a node listed twice as an input is released twice
+            _indegrees.assign(count, 0);
+            for (idx_type e : _edges)
+                ++_indegrees[e];
+            _incoming_offsets.assign(count + 1, 0);
+            for (idx_type i = 0; i < count; ++i)
+                _incoming_offsets[i + 1] = _incoming_offsets[i] + _indegrees[i];
+
+            _order.clear();
+            _order.reserve(count);
+            for (idx_type i = 0; i < count; ++i)
+                if (_indegrees[i] == 0)
+                    _order.push_back(i);
+            for (std::size_t head = 0; head < _order.size(); ++head)
             {
-                if(cur_inputs[i]->requires_grad())
-                    variable_queue.push_back(cur_inputs[i].get());
+                idx_type cur = _order[head];
+                for (idx_type e = _offsets[cur]; e < _offsets[cur + 1]; ++e)
+                    if (--_indegrees[_edges[e]] == 0)
+                        _order.push_back(_edges[e]);
             }
+            assert(static_cast<idx_type>(_order.size()) == count);
+
+            // the indegrees are spent, they count the edges filled in instead
+            _incoming.resize(_edges.size());
+            for (idx_type cur : _order)
+                for (idx_type e = _offsets[cur]; e < _offsets[cur + 1]; ++e)
+                {
+                    idx_type target = _edges[e];
+                    _incoming[_incoming_offsets[target] + _indegrees[target]++] = e;
+                }
         }
 
-        return result_set;
+        _sorted.resize(count);
+        for (idx_type i = 0; i < count; ++i)
+            _sorted[i] = _nodes[_order[i]];
+        return _sorted;
+    }
+
+    void Executor::backward(VariableInterface* root)
+    {
+        sort(root);
+        replay_backward();
+    }
+
+    void Executor::replay_backward()
+    {
+        int threads = backward_threads();
+        if (threads > 1 && _nodes.size() > 1 && !omp_in_parallel())
+            backward_parallel(threads);
+        else
+            backward_sequential();
+    }
+
+    void Executor::backward_sequential()
+    {
+        for (VariableInterface* cur_node : _sorted)
+        {
+            if (cur_node->is_leaf()) continue;
+            std::vector<TensorBasePtr<f32>> back_grad = cur_node->grad_fn()->backward(cur_node->grad());
+
+            assert(back_grad.size() == cur_node->inputs().size());
+            for (std::size_t j = 0; j < cur_node->inputs().size(); ++j)
+            {
+                VariableInterfacePtr& input = cur_node->inputs()[j];
+                if (!input->requires_grad())
+                    continue;
+                accumulate(input.get(), contribution(cur_node, back_grad, j));
+            }
+            if (_release_saved)
+                cur_node->grad_fn()->context.clear();
+        }
+    }
+
+    void Executor::backward_parallel(int threads)
+    {
+        idx_type count = static_cast<idx_type>(_nodes.size());
+        BackwardState state(deterministic(), count, static_cast<idx_type>(_edges.size()));
+        for (idx_type i = 0; i < count; ++i)
+            state.pending[i].store(_incoming_offsets[i + 1] - _incoming_offsets[i], std::memory_order_relaxed);
+
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+        run_node(0, state);
+
+        if (state.error)
+            std::rethrow_exception(state.error);
+    }
+
+    // the gradient of the node is complete: run its function, then release its inputs
+    void Executor::run_node(idx_type id, BackwardState& state)
+    {
+        VariableInterface* cur_node = _nodes[id];
+        try
+        {
+            if (state.ordered)
+            {
+                for (idx_type k = _incoming_offsets[id]; k < _incoming_offsets[id + 1]; ++k)
+                {
+                    Contribution& c = state.slots[_incoming[k]];
+                    accumulate(cur_node, c);
+                    c = Contribution();
+                }
+            }
+
+            if (!cur_node->is_leaf() && !state.failed.load())
+            {
+                std::vector<TensorBasePtr<f32>> back_grad = cur_node->grad_fn()->backward(cur_node->grad());
+
+                assert(back_grad.size() == cur_node->inputs().size());
+                idx_type e = _offsets[id];
+                for (std::size_t j = 0; j < cur_node->inputs().size(); ++j)
+                {
+                    VariableInterfacePtr& input = cur_node->inputs()[j];
+                    if (!input->requires_grad())
+                        continue;
+                    Contribution c = contribution(cur_node, back_grad, j);
+                    if (state.ordered)
+                    {
+                        state.slots[e] = c;
+                    }
+                    else
+                    {
+                        std::lock_guard<std::mutex> lock(state.locks[_edges[e]]);
+                        accumulate(input.get(), c);
+                    }
+                    ++e;
+                }
+                if (_release_saved)
+                    cur_node->grad_fn()->context.clear();
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(state.error_mutex);
+            if (!state.error)
+                state.error = std::current_exception();
+            state.failed.store(true);
+        }
+        if (state.failed.load())
+            return;
+
+        for (idx_type e = _offsets[id]; e < _offsets[id + 1]; ++e)
+        {
+            idx_type target = _edges[e];
+            if (state.pending[target].fetch_sub(1) == 1)
+            {
+#pragma omp task firstprivate(target) shared(state)
+                run_node(target, state);
+            }
+        }
+    }
+
+    std::vector<VariableInterface*> Executor::topology_sort(VariableInterface* root)
+    {
+        return thread_executor().sort(root);
+    }
+
+    void Executor::run_backward(VariableInterface* root)
+    {
+        thread_executor().backward(root);
+    }
+
+    std::vector<VariableInterface*> Executor::collect_backward_tensors(VariableInterface* root)
+    {
+        std::vector<VariableInterface*> nodes;
+        std::vector<idx_type> offsets, edges;
+        traverse(root, nodes, offsets, edges);
+        return nodes;
+    }
+
+    int Executor::backward_threads()
+    {
+        return threads_of_backward.load();
+    }
+
+    void Executor::backward_threads_(int threads)
+    {
+        if (threads < 1)
+            throw std::runtime_error("Executor: The number of backward threads shall be positive.");
+        threads_of_backward.store(threads);
+    }
+
+    bool Executor::deterministic()
+    {
+        return deterministic_backward.load();
+    }
+
+    void Executor::deterministic_(bool enabled)
+    {
+        deterministic_backward.store(enabled);
     }
-}
\ No newline at end of file
+}
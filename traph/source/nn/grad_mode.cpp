@@ -0,0 +1,19 @@
+#include <traph/nn/grad_mode.h>
+
+namespace traph
+{
+    namespace
+    {
+        thread_local bool grad_enabled = true;
+    }
+
+    bool GradMode::is_enabled()
+    {
+        return grad_enabled;
+    }
+
+    void GradMode::set_enabled(bool enabled)
+    {
+        grad_enabled = enabled;
+    }
+}
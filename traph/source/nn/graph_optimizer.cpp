@@ -0,0 +1,431 @@
+#include <traph/nn/graph_optimizer.h>
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <traph/nn/capture.h>
+#include <traph/nn/operation.h>
+
+namespace traph
+{
+    namespace
+    {
+        std::atomic<bool> debug_enabled(false);
+
+        using CallList = std::vector<CapturedCall>;
+
+        i64 element_bytes(DataType dtype)
+        {
+            switch (dtype)
+            {
+            case DataType::BYTE:
+            case DataType::CHAR:
+                return 1;
+            case DataType::SHORT:
+                return 2;
+            case DataType::INT:
+            case DataType::FLOAT:
+                return 4;
+            default:
+                return 8;
+            }
+        }
+
+        i64 variable_bytes(const VariableInterfacePtr& v)
+        {
+            TensorInterfacePtr data = v->data();
+            return data ? static_cast<i64>(data->size().flat_size()) * element_bytes(data->dtype()) : 0;
+        }
+
+        void replace(std::vector<VariableInterfacePtr>& list, VariableInterface* from, const VariableInterfacePtr& to)
+        {
+            for (auto& each : list)
+                if (each.get() == from)
+                    each = to;
+        }
+
+        // the calls from first on and the outputs read to instead of from
+        void replace_uses(CallList& calls, std::size_t first, VariableInterface* from, const VariableInterfacePtr& to,
+            std::vector<VariableInterfacePtr>& outputs)
+        {
+            for (std::size_t i = first; i < calls.size(); ++i)
+            {
+                replace(calls[i].inputs, from, to);
+                replace(calls[i].result->inputs(), from, to);
+            }
+            replace(outputs, from, to);
+        }
+
+        // the calls that are not removed, in order
+        void compact(CallList& calls, const std::vector<bool>& removed)
+        {
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < calls.size(); ++i)
+                if (!removed[i])
+                    calls[kept++] = calls[i];
+            calls.resize(kept);
+        }
+
+        idx_type fold_pass(CallList& calls, const std::vector<VariableInterfacePtr>& inputs)
+        {
+            std::unordered_set<VariableInterface*> made, given, constant;
+            for (auto& call : calls)
+                made.insert(call.result.get());
+            for (auto& each : inputs)
+                given.insert(each.get());
+            auto is_constant = [&](const VariableInterfacePtr& v) {
+                return constant.count(v.get()) || (!made.count(v.get()) && !given.count(v.get()) && !v->requires_grad());
+            };
+
+            std::vector<bool> removed(calls.size(), false);
+            idx_type count = 0;
+            for (std::size_t i = 0; i < calls.size(); ++i)
+            {
+                bool all = !calls[i].inputs.empty() && !calls[i].result->requires_grad();
+                for (std::size_t j = 0; all && j < calls[i].inputs.size(); ++j)
+                    all = is_constant(calls[i].inputs[j]);
+                if (!all)
+                    continue;
+                constant.insert(calls[i].result.get());
+                removed[i] = true;
+                ++count;
+            }
+            compact(calls, removed);
+            return count;
+        }
+
+        // ops whose result depends on their inputs only
+        bool pure(const OpBase& op)
+        {
+            const std::type_info& type = typeid(op);
+            return type == typeid(AddOp) || type == typeid(SubOp) || type == typeid(MatmulOp) || type == typeid(LinearOp)
+                || type == typeid(MeanOp) || type == typeid(SumOp) || type == typeid(PowOp) || type == typeid(ReluOp)
+                || type == typeid(GeluOp) || type == typeid(SigmoidOp) || type == typeid(SinOp);
+        }
+
+        bool same_call(const CapturedCall& a, const CapturedCall& b)
+        {
+            if (typeid(*a.op) != typeid(*b.op) || a.inputs.size() != b.inputs.size())
+                return false;
+            for (std::size_t i = 0; i < a.inputs.size(); ++i)
+                if (a.inputs[i] != b.inputs[i])
+                    return false;
+            auto pow = dynamic_cast<const PowOp*>(a.op.get());
+            return !pow || pow->exp() == dynamic_cast<const PowOp*>(b.op.get())->exp();
+        }
+
+        idx_type common_pass(CallList& calls, std::vector<VariableInterfacePtr>& outputs)
+        {
+            // earlier pure calls by their first input
+            std::unordered_multimap<VariableInterface*, std::size_t> earlier;
+            std::vector<bool> removed(calls.size(), false);
+            idx_type count = 0;
+            for (std::size_t i = 0; i < calls.size(); ++i)
+            {
+                if (!pure(*calls[i].op) || calls[i].inputs.empty())
+                    continue;
+                VariableInterface* first = calls[i].inputs[0].get();
+                auto range = earlier.equal_range(first);
+                auto found = range.first;
+                while (found != range.second && !same_call(calls[found->second], calls[i]))
+                    ++found;
+                if (found == range.second)
+                {
+                    earlier.emplace(first, i);
+                    continue;
+                }
+                replace_uses(calls, i + 1, calls[i].result.get(), calls[found->second].result, outputs);
+                removed[i] = true;
+                ++count;
+            }
+            compact(calls, removed);
+            return count;
+        }
+
+        idx_type dead_pass(CallList& calls, const std::vector<VariableInterfacePtr>& outputs)
+        {
+            std::unordered_set<VariableInterface*> live;
+            for (auto& each : outputs)
+                live.insert(each.get());
+            std::vector<bool> removed(calls.size(), false);
+            idx_type count = 0;
+            for (std::size_t i = calls.size(); i-- > 0;)
+            {
+                if (!live.count(calls[i].result.get()))
+                {
+                    removed[i] = true;
+                    ++count;
+                    continue;
+                }
+                for (auto& each : calls[i].inputs)
+                    live.insert(each.get());
+            }
+            compact(calls, removed);
+            return count;
+        }
+
+        // whether size ends with the dimensions of side
+        bool trailing(const DimVector& size, const DimVector& side)
+        {
+            if (side.size() > size.size())
+                return false;
+            for (idx_type d = 0; d < static_cast<idx_type>(side.size()); ++d)
+                if (side[d] != size[size.size() - side.size() + d])
+                    return false;
+            return true;
+        }
+
+        bool chainable(const VariableInterfacePtr& v)
+        {
+            TensorInterfacePtr data = v->data();
+            return data && (data->dtype() == DataType::FLOAT || data->dtype() == DataType::DOUBLE);
+        }
+
+        bool same_type(const VariableInterfacePtr& a, const VariableInterfacePtr& b)
+        {
+            return chainable(a) && chainable(b) && a->data()->dtype() == b->data()->dtype();
+        }
+
+        // The stage call adds to a chain whose value is x, with side set to the tensor it
+        // reads besides x if any; false unless call is elementwise and keeps the size of x.
+        bool chain_stage(const CapturedCall& call, const VariableInterfacePtr& x, ChainStage& stage, VariableInterfacePtr& side)
+        {
+            if (!same_type(call.result, x) || call.result->size() != x->size())
+                return false;
+            const OpBase* op = call.op.get();
+            side = nullptr;
+            if (typeid(*op) == typeid(ReluOp))
+                stage.kind = ChainKind::RELU;
+            else if (typeid(*op) == typeid(GeluOp))
+                stage.kind = ChainKind::GELU;
+            else if (typeid(*op) == typeid(SigmoidOp))
+                stage.kind = ChainKind::SIGMOID;
+            else if (typeid(*op) == typeid(PowOp))
+            {
+                stage.kind = ChainKind::POW;
+                stage.exp = static_cast<const PowOp*>(op)->exp();
+            }
+            else if (typeid(*op) == typeid(AddOp) || typeid(*op) == typeid(SubOp))
+            {
+                bool add = typeid(*op) == typeid(AddOp);
+                if (call.inputs[0] == x)
+                {
+                    side = call.inputs[1];
+                    stage.kind = add ? ChainKind::ADD : ChainKind::SUB;
+                }
+                else
+                {
+                    side = call.inputs[0];
+                    stage.kind = add ? ChainKind::ADD : ChainKind::RSUB;
+                }
+                return same_type(side, x) && trailing(x->size(), side->size());
+            }
+            else
+            {
+                return false;
+            }
+            return call.inputs.size() == 1 && call.inputs[0] == x;
+        }
+
+        struct Chain
+        {
+            std::vector<ChainStage> stages;
+            std::vector<VariableInterfacePtr> sides;
+            // the calls of the stages
+            std::vector<std::size_t> calls;
+        };
+
+        // how many times calls and outputs read each variable, and the last call that does
+        struct Readers
+        {
+            std::unordered_map<VariableInterface*, idx_type> count;
+            std::unordered_map<VariableInterface*, std::size_t> last;
+
+            Readers(const CallList& calls, const std::vector<VariableInterfacePtr>& outputs)
+            {
+                for (std::size_t i = 0; i < calls.size(); ++i)
+                {
+                    for (auto& each : calls[i].inputs)
+                    {
+                        ++count[each.get()];
+                        last[each.get()] = i;
+                    }
+                }
+                for (auto& each : outputs)
+                    ++count[each.get()];
+            }
+        };
+
+        // adds the stage of call to chain
+        bool add_stage(Chain& chain, const CapturedCall& call, const VariableInterfacePtr& x, std::size_t index)
+        {
+            if (static_cast<idx_type>(chain.stages.size()) >= max_chain_stages)
+                return false;
+            ChainStage stage;
+            VariableInterfacePtr side;
+            if (!chain_stage(call, x, stage, side))
+                return false;
+            if (side)
+            {
+                stage.side = static_cast<idx_type>(chain.sides.size());
+                chain.sides.push_back(side);
+            }
+            chain.stages.push_back(stage);
+            chain.calls.push_back(index);
+            return true;
+        }
+
+        // the stages of the calls that are each the only reader of the value before, from
+        // the result x of a call on; the result of the chain
+        VariableInterfacePtr extend(Chain& chain, const CallList& calls, const Readers& readers, const std::vector<bool>& fused,
+            VariableInterfacePtr x)
+        {
+            while (true)
+            {
+                // an output is read by no call
+                auto count = readers.count.find(x.get());
+                auto reader = readers.last.find(x.get());
+                if (count == readers.count.end() || count->second != 1 || reader == readers.last.end())
+                    return x;
+                std::size_t next = reader->second;
+                if (fused[next] || !add_stage(chain, calls[next], x, next))
+                    return x;
+                x = calls[next].result;
+            }
+        }
+
+        // the call at the place of the last call of the chain, which makes result
+        template<typename Op>
+        void replace_chain(CallList& calls, std::vector<bool>& fused, std::size_t first, const Chain& chain,
+            std::vector<VariableInterfacePtr> inputs, const VariableInterfacePtr& result)
+        {
+            inputs.insert(inputs.end(), chain.sides.begin(), chain.sides.end());
+            std::vector<bool> input_grads;
+            for (auto& each : inputs)
+                input_grads.push_back(each->requires_grad());
+            auto op = std::make_shared<Op>(chain.stages, input_grads);
+            fused[first] = true;
+            for (std::size_t each : chain.calls)
+                fused[each] = true;
+            std::size_t last = chain.calls.empty() ? first : chain.calls.back();
+            calls[last] = CapturedCall{ op, inputs, result };
+            fused[last] = false;
+            if (result->requires_grad())
+            {
+                result->grad_fn_(op);
+                result->inputs_(inputs);
+            }
+        }
+
+        void matmul_pass(CallList& calls, const std::vector<VariableInterfacePtr>& outputs, GraphReport& report)
+        {
+            Readers readers(calls, outputs);
+            std::vector<bool> fused(calls.size(), false);
+            for (std::size_t i = 0; i < calls.size(); ++i)
+            {
+                const CapturedCall& call = calls[i];
+                if (fused[i] || typeid(*call.op) != typeid(MatmulOp))
+                    continue;
+                Chain chain;
+                VariableInterfacePtr result = call.result;
+                if (chainable(result))
+                    result = extend(chain, calls, readers, fused, result);
+                idx_type pruned = 0;
+                if (result->requires_grad())
+                    pruned = !call.inputs[0]->requires_grad() + !call.inputs[1]->requires_grad();
+                if (chain.stages.empty() && pruned == 0)
+                    continue;
+                report.fused_matmul += static_cast<idx_type>(chain.calls.size());
+                report.pruned_grads += pruned;
+                replace_chain<FusedMatmulOp>(calls, fused, i, chain, call.inputs, result);
+            }
+            compact(calls, fused);
+        }
+
+        void elementwise_pass(CallList& calls, const std::vector<VariableInterfacePtr>& outputs, GraphReport& report)
+        {
+            Readers readers(calls, outputs);
+            std::vector<bool> fused(calls.size(), false);
+            for (std::size_t i = 0; i < calls.size(); ++i)
+            {
+                if (fused[i] || calls[i].inputs.empty())
+                    continue;
+                VariableInterfacePtr input = calls[i].inputs[0];
+                if (!chainable(input))
+                    continue;
+                Chain chain;
+                if (!add_stage(chain, calls[i], input, i))
+                    continue;
+                VariableInterfacePtr result = extend(chain, calls, readers, fused, calls[i].result);
+                if (chain.stages.size() < 2)
+                    continue;
+                report.fused_elementwise += static_cast<idx_type>(chain.calls.size());
+                replace_chain<FusedElementwiseOp>(calls, fused, i, chain, { input }, result);
+            }
+            compact(calls, fused);
+        }
+    }
+
+    std::string GraphReport::str() const
+    {
+        std::ostringstream out;
+        out << "graph: " << before.nodes << " nodes, " << before.bytes << " bytes -> " << after.nodes << " nodes, "
+            << after.bytes << " bytes (folded " << folded << ", common " << common << ", dead " << dead
+            << ", fused into matmul " << fused_matmul << ", fused elementwise " << fused_elementwise
+            << ", pruned gradients " << pruned_grads << ")";
+        return out.str();
+    }
+
+    GraphReport GraphOptimizer::run(std::vector<CapturedCall>& calls, const std::vector<VariableInterfacePtr>& inputs,
+        std::vector<VariableInterfacePtr>& outputs) const
+    {
+        GraphReport report;
+        report.before = stats(calls);
+        if (fold_constants)
+            report.folded = fold_pass(calls, inputs);
+        if (eliminate_common)
+            report.common = common_pass(calls, outputs);
+        if (eliminate_dead)
+            report.dead = dead_pass(calls, outputs);
+        if (fuse_matmul)
+            matmul_pass(calls, outputs, report);
+        if (fuse_elementwise)
+            elementwise_pass(calls, outputs, report);
+        report.after = stats(calls);
+        if (debug())
+            std::clog << report.str() << std::endl;
+        return report;
+    }
+
+    GraphStats GraphOptimizer::stats(const std::vector<CapturedCall>& calls)
+    {
+        GraphStats result;
+        result.nodes = static_cast<idx_type>(calls.size());
+        for (auto& call : calls)
+        {
+            for (auto& each : call.inputs)
+                result.bytes += variable_bytes(each);
+            result.bytes += variable_bytes(call.result);
+            // the product is written and read again by the chain
+            auto matmul = dynamic_cast<const FusedMatmulOp*>(call.op.get());
+            if (matmul && !matmul->stages().empty())
+                result.bytes += 2 * variable_bytes(call.result);
+        }
+        return result;
+    }
+
+    bool GraphOptimizer::debug()
+    {
+        return debug_enabled;
+    }
+
+    void GraphOptimizer::debug_(bool enabled)
+    {
+        debug_enabled = enabled;
+    }
+}
@@ -0,0 +1,297 @@
+#include <traph/nn/memory_plan.h>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <traph/tensor/tensor_storage.h>
+
+namespace traph
+{
+    namespace
+    {
+        const std::size_t slab_alignment = 64;
+
+        void plan_error(const std::string& message)
+        {
+            throw std::runtime_error("MemoryPlanner: " + message + ".");
+        }
+
+        // the memory of the slabs of one plan, freed when no storage is left in it
+        struct SlabBuffer
+        {
+            char* data;
+
+            explicit SlabBuffer(std::size_t bytes)
+                :data(static_cast<char*>(::operator new(std::max<std::size_t>(bytes, 1), std::align_val_t(slab_alignment))))
+            {
+            }
+
+            SlabBuffer(const SlabBuffer&) = delete;
+            SlabBuffer& operator= (const SlabBuffer&) = delete;
+
+            ~SlabBuffer()
+            {
+                ::operator delete(data, std::align_val_t(slab_alignment));
+            }
+        };
+    }
+
+    class PlannedArena : public StorageArena
+    {
+    public:
+        struct Interval
+        {
+            std::size_t bytes;
+            i64 begin;
+            // -1 while the storage is alive
+            i64 end;
+            idx_type slab;
+        };
+
+        struct Recorded
+        {
+            std::size_t interval;
+            idx_type generation;
+        };
+
+        struct Occupant
+        {
+            std::shared_ptr<SlabBuffer> buffer;
+            idx_type slab;
+        };
+
+        // storages are freed from any thread
+        std::mutex mutex;
+        bool running = false;
+        bool recording = false;
+        bool planned = false;
+
+        // the recorded run, with its storages that are alive by their memory
+        std::vector<Interval> intervals;
+        std::unordered_map<void*, Recorded> recorded;
+        idx_type generation = 0;
+        i64 clock = 0;
+
+        std::shared_ptr<SlabBuffer> buffer;
+        std::vector<std::size_t> offsets;
+        std::vector<bool> busy;
+        std::unordered_map<void*, Occupant> occupied;
+        std::size_t next = 0;
+        bool diverged = false;
+        idx_type misses = 0;
+
+        MemoryReport report;
+
+        virtual void* allocate(std::size_t bytes) override
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+                return nullptr;
+            if (recording)
+            {
+                void* data = ::operator new(bytes);
+                recorded[data] = Recorded{ intervals.size(), generation };
+                intervals.push_back(Interval{ bytes, clock++, -1, -1 });
+                return data;
+            }
+
+            std::size_t k = next++;
+            if (!diverged && (k >= intervals.size() || intervals[k].bytes != bytes))
+                diverged = true;
+            if (diverged || (intervals[k].slab >= 0 && busy[intervals[k].slab]))
+            {
+                ++misses;
+                return nullptr;
+            }
+            idx_type slab = intervals[k].slab;
+            if (slab < 0)
+                return nullptr;
+            busy[slab] = true;
+            char* data = buffer->data + offsets[slab];
+            occupied[data] = Occupant{ buffer, slab };
+            return data;
+        }
+
+        virtual void release(void* data) override
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto occupant = occupied.find(data);
+            if (occupant != occupied.end())
+            {
+                if (occupant->second.buffer == buffer)
+                    busy[occupant->second.slab] = false;
+                occupied.erase(occupant);
+                return;
+            }
+            auto found = recorded.find(data);
+            if (found != recorded.end())
+            {
+                if (running && recording && found->second.generation == generation)
+                    intervals[found->second.interval].end = clock++;
+                recorded.erase(found);
+            }
+            ::operator delete(data);
+        }
+
+        // slabs for the intervals that ended, greedily in the order they begin: the
+        // smallest free slab that is large enough, else the largest free one grown, else a
+        // new one
+        void plan()
+        {
+            std::vector<std::size_t> sizes;
+            std::multimap<std::size_t, idx_type> free_slabs;
+            using Busy = std::pair<i64, idx_type>;
+            std::priority_queue<Busy, std::vector<Busy>, std::greater<Busy>> busy_until;
+            std::vector<i64> delta(static_cast<std::size_t>(clock) + 1, 0);
+            report = MemoryReport();
+            for (Interval& interval : intervals)
+            {
+                if (interval.end < 0)
+                    continue;
+                while (!busy_until.empty() && busy_until.top().first < interval.begin)
+                {
+                    idx_type slab = busy_until.top().second;
+                    free_slabs.emplace(sizes[slab], slab);
+                    busy_until.pop();
+                }
+                auto found = free_slabs.lower_bound(interval.bytes);
+                if (found == free_slabs.end() && !free_slabs.empty())
+                    found = std::prev(free_slabs.end());
+                if (found == free_slabs.end())
+                {
+                    interval.slab = static_cast<idx_type>(sizes.size());
+                    sizes.push_back(interval.bytes);
+                }
+                else
+                {
+                    interval.slab = found->second;
+                    sizes[interval.slab] = std::max(sizes[interval.slab], interval.bytes);
+                    free_slabs.erase(found);
+                }
+                busy_until.emplace(interval.end, interval.slab);
+
+                ++report.tensors;
+                report.naive_bytes += static_cast<i64>(interval.bytes);
+                delta[interval.begin] += static_cast<i64>(interval.bytes);
+                delta[interval.end] -= static_cast<i64>(interval.bytes);
+            }
+
+            i64 live = 0;
+            for (i64 each : delta)
+            {
+                live += each;
+                report.live_bytes = std::max(report.live_bytes, live);
+            }
+
+            offsets.clear();
+            std::size_t total = 0;
+            for (std::size_t size : sizes)
+            {
+                offsets.push_back(total);
+                total += (size + slab_alignment - 1) / slab_alignment * slab_alignment;
+            }
+            report.slabs = static_cast<idx_type>(sizes.size());
+            report.planned_bytes = static_cast<i64>(total);
+            // storages still in the slabs of the last plan keep its buffer
+            buffer = std::make_shared<SlabBuffer>(total);
+            busy.assign(sizes.size(), false);
+        }
+    };
+
+    std::string MemoryReport::str() const
+    {
+        std::ostringstream out;
+        out << "memory: " << tensors << " tensors, " << naive_bytes << " bytes without reuse, " << live_bytes
+            << " bytes alive at most -> " << slabs << " slabs, " << planned_bytes << " bytes";
+        return out.str();
+    }
+
+    MemoryPlanner::MemoryPlanner()
+        :_arena(std::make_shared<PlannedArena>())
+    {
+    }
+
+    MemoryPlanner::~MemoryPlanner()
+    {
+    }
+
+    void MemoryPlanner::begin()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_arena->mutex);
+            if (_arena->running)
+                plan_error("Runs do not nest");
+            _arena->running = true;
+            _arena->recording = !_arena->planned;
+            _arena->next = 0;
+            _arena->diverged = false;
+            _arena->misses = 0;
+            if (_arena->recording)
+            {
+                _arena->intervals.clear();
+                _arena->clock = 0;
+                ++_arena->generation;
+            }
+        }
+        _guard.reset(new StorageArenaGuard(_arena));
+    }
+
+    void MemoryPlanner::end()
+    {
+        _guard.reset();
+        std::lock_guard<std::mutex> lock(_arena->mutex);
+        if (_arena->recording)
+        {
+            _arena->plan();
+            _arena->planned = true;
+        }
+        else if (_arena->misses > 0)
+        {
+            _arena->planned = false;
+        }
+        _arena->running = false;
+        _arena->recording = false;
+    }
+
+    void MemoryPlanner::reset()
+    {
+        std::lock_guard<std::mutex> lock(_arena->mutex);
+        _arena->planned = false;
+    }
+
+    bool MemoryPlanner::planned() const
+    {
+        return _arena->planned;
+    }
+
+    const MemoryReport& MemoryPlanner::report() const
+    {
+        return _arena->report;
+    }
+
+    idx_type MemoryPlanner::misses() const
+    {
+        return _arena->misses;
+    }
+
+    MemoryPlanner::Scope::Scope(MemoryPlanner& planner)
+        :_planner(planner)
+    {
+        _planner.begin();
+    }
+
+    MemoryPlanner::Scope::~Scope()
+    {
+        _planner.end();
+    }
+}
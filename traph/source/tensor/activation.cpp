@@ -0,0 +1,513 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/activation.h>
+
+#include "strided.h"
+
+namespace traph
+{
+	namespace
+	{
+		// elements below which a pass runs on the calling thread
+		const idx_type activation_parallel_threshold = 1 << 16;
+		const double sqrt1_2 = 0.70710678118654752440;
+		// 1 / sqrt(2 pi)
+		const double inv_sqrt_2pi = 0.39894228040143267794;
+
+		void activation_error(const char* name, const std::string& message)
+		{
+			throw std::runtime_error(std::string(name) + ": " + message + ".");
+		}
+
+		bool parallel_pass(idx_type count)
+		{
+			return count >= activation_parallel_threshold && omp_get_max_threads() > 1 && !omp_in_parallel();
+		}
+
+		// y[i] = f(x[i])
+		template<typename T, typename F>
+		std::shared_ptr<Tensor<T>> map(const Tensor<T>& input, F f)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(input.size()));
+			std::vector<T> copy;
+			const T* x = contiguous(input, copy);
+			T* y = result->data_ptr();
+			int count = input.size().flat_size();
+			bool parallel = parallel_pass(count);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int i = 0; i < count; ++i)
+				y[i] = f(x[i]);
+			return result;
+		}
+
+		// y[i] = f(a[i], b[i]) for the gradient a and a saved tensor b of the same size
+		template<typename T, typename F>
+		std::shared_ptr<Tensor<T>> map2(const char* name, const Tensor<T>& a, const Tensor<T>& b, F f)
+		{
+			if (a.size() != b.size())
+				activation_error(name, "The gradient shall have the size of the saved tensor");
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(a.size()));
+			std::vector<T> a_copy, b_copy;
+			const T* x = contiguous(a, a_copy);
+			const T* z = contiguous(b, b_copy);
+			T* y = result->data_ptr();
+			int count = a.size().flat_size();
+			bool parallel = parallel_pass(count);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int i = 0; i < count; ++i)
+				y[i] = f(x[i], z[i]);
+			return result;
+		}
+
+		// y[i] = f(x[i], i, bit) where f sets the bit of element i of the mask; a byte of the
+		// mask is written at a time, so threads never share one
+		template<typename T, typename F>
+		std::shared_ptr<Tensor<T>> map_with_mask(const Tensor<T>& input, std::shared_ptr<Tensor<u8>>* mask, F f)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(input.size()));
+			std::vector<T> copy;
+			const T* x = contiguous(input, copy);
+			T* y = result->data_ptr();
+			idx_type count = input.size().flat_size();
+			int bytes = mask_bytes(count);
+			u8* bits = nullptr;
+			if (mask)
+			{
+				*mask = std::shared_ptr<Tensor<u8>>(new Tensor<u8>(DimVector({ bytes })));
+				bits = (*mask)->data_ptr();
+			}
+			bool parallel = parallel_pass(count);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int byte = 0; byte < bytes; ++byte)
+			{
+				idx_type begin = static_cast<idx_type>(byte) * 8;
+				idx_type end = std::min(begin + 8, count);
+				u8 packed = 0;
+				for (idx_type i = begin; i < end; ++i)
+				{
+					bool bit;
+					y[i] = f(x[i], i, bit);
+					packed |= static_cast<u8>(bit) << (i - begin);
+				}
+				if (bits)
+					bits[byte] = packed;
+			}
+			return result;
+		}
+
+		// grad where the bit of the mask is set, times scale
+		template<typename T>
+		std::shared_ptr<Tensor<T>> masked_scale(const char* name, const Tensor<T>& grad, const Tensor<u8>& mask, T scale)
+		{
+			idx_type count = grad.size().flat_size();
+			if (mask.ndimension() != 1 || mask.size(0) != mask_bytes(count))
+				activation_error(name, "The mask shall have a bit per element of the gradient");
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(grad.size()));
+			std::vector<T> copy;
+			std::vector<u8> mask_copy;
+			const T* x = contiguous(grad, copy);
+			const u8* bits = contiguous(mask, mask_copy);
+			T* y = result->data_ptr();
+			int bytes = mask_bytes(count);
+			bool parallel = parallel_pass(count);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int byte = 0; byte < bytes; ++byte)
+			{
+				idx_type begin = static_cast<idx_type>(byte) * 8;
+				idx_type end = std::min(begin + 8, count);
+				u8 packed = bits[byte];
+				for (idx_type i = begin; i < end; ++i)
+					y[i] = (packed >> (i - begin)) & 1 ? x[i] * scale : T(0);
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> relu(const Tensor<T>& input, std::shared_ptr<Tensor<u8>>* mask)
+		{
+			return map_with_mask(input, mask, [](T x, idx_type, bool& bit) {
+				bit = !(x <= 0);
+				return bit ? x : T(0);
+			});
+		}
+
+		// splitmix64 of the seed and the index, whose high half decides an element
+		inline u64 element_hash(u64 seed, idx_type i)
+		{
+			u64 z = seed + (static_cast<u64>(i) + 1) * 0x9E3779B97F4A7C15ull;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+
+		void check_probability(f64 p)
+		{
+			if (!(p >= 0 && p <= 1))
+				activation_error("dropout", "The probability shall be in [0, 1]");
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> dropout(const Tensor<T>& input, f64 p, u64 seed, std::shared_ptr<Tensor<u8>>* mask)
+		{
+			check_probability(p);
+			// an element is kept when the high 32 bits of its hash are at least p * 2^32
+			const u64 threshold = static_cast<u64>(std::ldexp(p, 32));
+			const T scale = p < 1 ? static_cast<T>(1 / (1 - p)) : T(0);
+			return map_with_mask(input, mask, [=](T x, idx_type i, bool& bit) {
+				bit = (element_hash(seed, i) >> 32) >= threshold;
+				return bit ? x * scale : T(0);
+			});
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> dropout_backward(const Tensor<T>& grad, const Tensor<u8>& mask, f64 p)
+		{
+			check_probability(p);
+			return masked_scale("dropout", grad, mask, p < 1 ? static_cast<T>(1 / (1 - p)) : T(0));
+		}
+
+		template<typename T>
+		T gelu_value(T x)
+		{
+			return static_cast<T>(0.5) * x * (1 + std::erf(x * static_cast<T>(sqrt1_2)));
+		}
+
+		// Phi(x) + x * phi(x)
+		template<typename T>
+		T gelu_grad(T g, T x)
+		{
+			T cdf = static_cast<T>(0.5) * (1 + std::erf(x * static_cast<T>(sqrt1_2)));
+			T pdf = std::exp(static_cast<T>(-0.5) * x * x) * static_cast<T>(inv_sqrt_2pi);
+			return g * (cdf + x * pdf);
+		}
+
+		template<typename T>
+		T sigmoid_value(T x)
+		{
+			return T(1) / (T(1) + std::exp(-x));
+		}
+
+		template<typename T>
+		T sigmoid_grad(T g, T y)
+		{
+			return g * y * (1 - y);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> gelu(const Tensor<T>& input)
+		{
+			return map(input, gelu_value<T>);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> gelu_backward(const Tensor<T>& grad, const Tensor<T>& input)
+		{
+			return map2("gelu", grad, input, gelu_grad<T>);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> sigmoid(const Tensor<T>& input)
+		{
+			return map(input, sigmoid_value<T>);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> sigmoid_backward(const Tensor<T>& grad, const Tensor<T>& output)
+		{
+			return map2("sigmoid", grad, output, sigmoid_grad<T>);
+		}
+
+		bool has_side(ChainKind kind)
+		{
+			return kind == ChainKind::ADD || kind == ChainKind::SUB || kind == ChainKind::RSUB;
+		}
+
+		template<typename T>
+		void check_chain(const DimVector& size, const std::vector<const Tensor<T>*>& sides, const std::vector<ChainStage>& stages)
+		{
+			if (static_cast<idx_type>(stages.size()) > max_chain_stages)
+				activation_error("elementwise_chain", "A chain shall have at most " + std::to_string(max_chain_stages) + " stages");
+			for (const ChainStage& stage : stages)
+				if (has_side(stage.kind) && (stage.side < 0 || stage.side >= static_cast<idx_type>(sides.size())))
+					activation_error("elementwise_chain", "No side " + std::to_string(stage.side));
+			idx_type nd = static_cast<idx_type>(size.size());
+			for (const Tensor<T>* side : sides)
+			{
+				bool trailing = side->ndimension() <= nd;
+				for (idx_type d = 0; trailing && d < side->ndimension(); ++d)
+					trailing = side->size(d) == size[nd - side->ndimension() + d];
+				if (!trailing)
+					activation_error("elementwise_chain", "A side shall have the trailing dimensions of the input");
+			}
+		}
+
+		// the sides in row-major order, with their number of elements
+		template<typename T>
+		void chain_sides(const std::vector<const Tensor<T>*>& sides, std::vector<std::vector<T>>& copies,
+			std::vector<const T*>& data, std::vector<idx_type>& counts)
+		{
+			copies.resize(sides.size());
+			for (std::size_t k = 0; k < sides.size(); ++k)
+			{
+				data.push_back(contiguous(*sides[k], copies[k]));
+				counts.push_back(sides[k]->size().flat_size());
+			}
+		}
+
+		// as the op of the stage computes it
+		template<typename T>
+		T chain_value(const ChainStage& stage, T x, T s)
+		{
+			switch (stage.kind)
+			{
+			case ChainKind::ADD:
+				return x + s;
+			case ChainKind::SUB:
+				return x - s;
+			case ChainKind::RSUB:
+				return s - x;
+			case ChainKind::RELU:
+				return !(x <= 0) ? x : T(0);
+			case ChainKind::GELU:
+				return gelu_value(x);
+			case ChainKind::SIGMOID:
+				return sigmoid_value(x);
+			default:
+				return static_cast<T>(std::pow(x, stage.exp));
+			}
+		}
+
+		// the gradient of x from the gradient g of the output y of the stage
+		template<typename T>
+		T chain_grad(const ChainStage& stage, T g, T x, T y)
+		{
+			switch (stage.kind)
+			{
+			case ChainKind::ADD:
+			case ChainKind::SUB:
+				return g;
+			case ChainKind::RSUB:
+				return -g;
+			case ChainKind::RELU:
+				return !(x <= 0) ? g : T(0);
+			case ChainKind::GELU:
+				return gelu_grad(g, x);
+			case ChainKind::SIGMOID:
+				return sigmoid_grad(g, y);
+			default:
+				return static_cast<T>(std::pow(x, stage.exp - 1)) * stage.exp * g;
+			}
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> elementwise_chain(const Tensor<T>& input, const std::vector<const Tensor<T>*>& sides,
+			const std::vector<ChainStage>& stages)
+		{
+			check_chain(input.size(), sides, stages);
+			std::vector<std::vector<T>> side_copies;
+			std::vector<const T*> s;
+			std::vector<idx_type> counts;
+			chain_sides(sides, side_copies, s, counts);
+
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(input.size()));
+			std::vector<T> copy;
+			const T* x = contiguous(input, copy);
+			T* y = result->data_ptr();
+			int count = input.size().flat_size();
+			bool parallel = parallel_pass(count);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int i = 0; i < count; ++i)
+			{
+				T value = x[i];
+				for (const ChainStage& stage : stages)
+					value = chain_value(stage, value, has_side(stage.kind) ? s[stage.side][i % counts[stage.side]] : T(0));
+				y[i] = value;
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::vector<std::shared_ptr<Tensor<T>>> elementwise_chain_backward(const Tensor<T>& grad, const Tensor<T>& input,
+			const std::vector<const Tensor<T>*>& sides, const std::vector<ChainStage>& stages, const std::vector<bool>& side_grads)
+		{
+			check_chain(input.size(), sides, stages);
+			if (grad.size() != input.size())
+				activation_error("elementwise_chain", "The gradient shall have the size of the input");
+			if (side_grads.size() != sides.size())
+				activation_error("elementwise_chain", "A flag per side shall tell whether its gradient is wanted");
+			std::vector<std::vector<T>> side_copies;
+			std::vector<const T*> s;
+			std::vector<idx_type> counts;
+			chain_sides(sides, side_copies, s, counts);
+
+			std::vector<std::shared_ptr<Tensor<T>>> result(sides.size() + 1);
+			result[0] = std::shared_ptr<Tensor<T>>(new Tensor<T>(input.size()));
+			std::vector<T*> ds(sides.size(), nullptr);
+			int count = input.size().flat_size();
+			// element i only adds to element i % period of the sides, so the threads split
+			// the period and never share an element of a side
+			int period = count;
+			for (std::size_t k = 0; k < sides.size(); ++k)
+			{
+				if (!side_grads[k])
+					continue;
+				result[k + 1] = std::shared_ptr<Tensor<T>>(new Tensor<T>(sides[k]->size()));
+				ds[k] = result[k + 1]->data_ptr();
+				std::fill(ds[k], ds[k] + counts[k], T(0));
+				period = std::min(period, counts[k]);
+			}
+			if (count == 0)
+				return result;
+
+			std::vector<T> copy, grad_copy;
+			const T* x = contiguous(input, copy);
+			const T* dy = contiguous(grad, grad_copy);
+			T* dx = result[0]->data_ptr();
+			int rows = count / period;
+			idx_type n = static_cast<idx_type>(stages.size());
+			bool parallel = parallel_pass(count) && period > 1;
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int j = 0; j < period; ++j)
+			{
+				T values[max_chain_stages + 1];
+				for (int r = 0; r < rows; ++r)
+				{
+					int i = r * period + j;
+					values[0] = x[i];
+					for (idx_type k = 0; k < n; ++k)
+					{
+						const ChainStage& stage = stages[k];
+						values[k + 1] = chain_value(stage, values[k], has_side(stage.kind) ? s[stage.side][i % counts[stage.side]] : T(0));
+					}
+					T g = dy[i];
+					for (idx_type k = n - 1; k >= 0; --k)
+					{
+						const ChainStage& stage = stages[k];
+						if (has_side(stage.kind) && ds[stage.side])
+							ds[stage.side][i % counts[stage.side]] += stage.kind == ChainKind::SUB ? -g : g;
+						g = chain_grad(stage, g, values[k], values[k + 1]);
+					}
+					dx[i] = g;
+				}
+			}
+			return result;
+		}
+	}
+
+	idx_type mask_bytes(idx_type count)
+	{
+		return (count + 7) / 8;
+	}
+
+	std::shared_ptr<Tensor<f32>> relu_impl(const Tensor<f32>& input, std::shared_ptr<Tensor<u8>>* mask)
+	{
+		return relu(input, mask);
+	}
+
+	std::shared_ptr<Tensor<f64>> relu_impl(const Tensor<f64>& input, std::shared_ptr<Tensor<u8>>* mask)
+	{
+		return relu(input, mask);
+	}
+
+	std::shared_ptr<Tensor<f32>> relu_backward_impl(const Tensor<f32>& grad, const Tensor<u8>& mask)
+	{
+		return masked_scale("relu", grad, mask, 1.f);
+	}
+
+	std::shared_ptr<Tensor<f64>> relu_backward_impl(const Tensor<f64>& grad, const Tensor<u8>& mask)
+	{
+		return masked_scale("relu", grad, mask, 1.0);
+	}
+
+	std::shared_ptr<Tensor<f32>> dropout_impl(const Tensor<f32>& input, f64 p, u64 seed, std::shared_ptr<Tensor<u8>>* mask)
+	{
+		return dropout(input, p, seed, mask);
+	}
+
+	std::shared_ptr<Tensor<f64>> dropout_impl(const Tensor<f64>& input, f64 p, u64 seed, std::shared_ptr<Tensor<u8>>* mask)
+	{
+		return dropout(input, p, seed, mask);
+	}
+
+	std::shared_ptr<Tensor<f32>> dropout_backward_impl(const Tensor<f32>& grad, const Tensor<u8>& mask, f64 p)
+	{
+		return dropout_backward(grad, mask, p);
+	}
+
+	std::shared_ptr<Tensor<f64>> dropout_backward_impl(const Tensor<f64>& grad, const Tensor<u8>& mask, f64 p)
+	{
+		return dropout_backward(grad, mask, p);
+	}
+
+	std::shared_ptr<Tensor<f32>> gelu_impl(const Tensor<f32>& input)
+	{
+		return gelu(input);
+	}
+
+	std::shared_ptr<Tensor<f64>> gelu_impl(const Tensor<f64>& input)
+	{
+		return gelu(input);
+	}
+
+	std::shared_ptr<Tensor<f32>> gelu_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input)
+	{
+		return gelu_backward(grad, input);
+	}
+
+	std::shared_ptr<Tensor<f64>> gelu_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input)
+	{
+		return gelu_backward(grad, input);
+	}
+
+	std::shared_ptr<Tensor<f32>> sigmoid_impl(const Tensor<f32>& input)
+	{
+		return sigmoid(input);
+	}
+
+	std::shared_ptr<Tensor<f64>> sigmoid_impl(const Tensor<f64>& input)
+	{
+		return sigmoid(input);
+	}
+
+	std::shared_ptr<Tensor<f32>> sigmoid_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& output)
+	{
+		return sigmoid_backward(grad, output);
+	}
+
+	std::shared_ptr<Tensor<f64>> sigmoid_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& output)
+	{
+		return sigmoid_backward(grad, output);
+	}
+
+	std::shared_ptr<Tensor<f32>> elementwise_chain_impl(const Tensor<f32>& input, const std::vector<const Tensor<f32>*>& sides,
+		const std::vector<ChainStage>& stages)
+	{
+		return elementwise_chain(input, sides, stages);
+	}
+
+	std::shared_ptr<Tensor<f64>> elementwise_chain_impl(const Tensor<f64>& input, const std::vector<const Tensor<f64>*>& sides,
+		const std::vector<ChainStage>& stages)
+	{
+		return elementwise_chain(input, sides, stages);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f32>>> elementwise_chain_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input,
+		const std::vector<const Tensor<f32>*>& sides, const std::vector<ChainStage>& stages, const std::vector<bool>& side_grads)
+	{
+		return elementwise_chain_backward(grad, input, sides, stages, side_grads);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f64>>> elementwise_chain_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input,
+		const std::vector<const Tensor<f64>*>& sides, const std::vector<ChainStage>& stages, const std::vector<bool>& side_grads)
+	{
+		return elementwise_chain_backward(grad, input, sides, stages, side_grads);
+	}
+}
@@ -1,229 +1,572 @@
 
 #include <stdexcept>
 #include <algorithm>
+#include <vector>
 
 #include <traph/tensor/tensor.h>
 #include <traph/tensor/arithmetic.h>
+#include <traph/tensor/blas.h>
 
 #include <eigen3/Eigen/Dense>
 
-
-#ifdef TRAPH_BUILD_MKL
-#include <mkl.h>
-#include <mkl_blas.h>
-#include <mkl_cblas.h>
-#elif defined TRAPH_BUILD_OPENBLAS
-#include <openBLAS/cblas.h>
-#endif
-
 namespace traph
 {
+	namespace
+	{
+		// below this many multiply-adds per matrix a batch is split between threads,
+		// above it the matrices run one after another and each gemm is parallel itself
+		const double batch_parallel_threshold = 64.0 * 64.0 * 64.0;
+
+		template<typename T>
+		using RowMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+		template<typename T>
+		using ColMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>;
+		using GeneralStride = Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>;
+
+		// a strided matrix inside the storage of a tensor
+		template<typename T>
+		struct MatrixRef
+		{
+			T* ptr;
+			idx_type rows, cols;
+			idx_type rs, cs;
+		};
+
+		// Calls f with an Eigen::Map over the matrix m without copying it.
+		// The dimension with unit stride becomes the inner dimension of the map, so
+		// row-major tensors and transposed views both reach Eigen's gemm directly.
+		template<typename T, typename F>
+		void with_matrix_map(const MatrixRef<const T>& m, F f)
+		{
+			if (m.cs == 1 || m.cols == 1)
+				f(Eigen::Map<const RowMajorMatrix<T>, 0, Eigen::OuterStride<>>(m.ptr, m.rows, m.cols, Eigen::OuterStride<>(m.rs)));
+			else if (m.rs == 1 || m.rows == 1)
+				f(Eigen::Map<const ColMajorMatrix<T>, 0, Eigen::OuterStride<>>(m.ptr, m.rows, m.cols, Eigen::OuterStride<>(m.cs)));
+			else
+				f(Eigen::Map<const RowMajorMatrix<T>, 0, GeneralStride>(m.ptr, m.rows, m.cols, GeneralStride(m.rs, m.cs)));
+		}
+
+		template<typename Dst, typename Lhs, typename Rhs>
+		void eigen_product_to(Dst&& dst, const Lhs& lhs, const Rhs& rhs, bool accumulate)
+		{
+			if (accumulate)
+				dst.noalias() += lhs * rhs;
+			else
+				dst.noalias() = lhs * rhs;
+		}
+
+		// out (+)= a * b, evaluated by Eigen straight into the storage of out
+		template<typename T>
+		void eigen_matmul(const MatrixRef<const T>& a, const MatrixRef<const T>& b, const MatrixRef<T>& out, bool accumulate)
+		{
+			T* ptr = out.ptr;
+			idx_type rows = out.rows, cols = out.cols;
+			idx_type rs = out.rs, cs = out.cs;
+
+			with_matrix_map(a, [&](const auto& eigen_a) {
+				with_matrix_map(b, [&](const auto& eigen_b) {
+					if (cs == 1 || cols == 1)
+					{
+						Eigen::Map<RowMajorMatrix<T>, 0, Eigen::OuterStride<>> eigen_c(ptr, rows, cols, Eigen::OuterStride<>(rs));
+						eigen_product_to(eigen_c, eigen_a, eigen_b, accumulate);
+					}
+					else if (rs == 1 || rows == 1)
+					{
+						Eigen::Map<ColMajorMatrix<T>, 0, Eigen::OuterStride<>> eigen_c(ptr, rows, cols, Eigen::OuterStride<>(cs));
+						eigen_product_to(eigen_c, eigen_a, eigen_b, accumulate);
+					}
+					else
+					{
+						// Eigen's gemm can not write through a non-unit inner stride
+						RowMajorMatrix<T> eigen_tmp = eigen_a * eigen_b;
+						Eigen::Map<RowMajorMatrix<T>, 0, GeneralStride> eigen_c(ptr, rows, cols, GeneralStride(rs, cs));
+						if (accumulate)
+							eigen_c += eigen_tmp;
+						else
+							eigen_c = eigen_tmp;
+					}
+				});
+			});
+		}
+
+		// one matrix product, integer types go through Eigen
+		template<typename T>
+		void matrix_product(const MatrixRef<const T>& a, const MatrixRef<const T>& b, const MatrixRef<T>& out, bool accumulate)
+		{
+			eigen_matmul(a, b, out, accumulate);
+		}
+
+		// floating point products run on the backend the blas registry picked for the shape
+		template<typename T>
+		void blas_product(const MatrixRef<const T>& a, const MatrixRef<const T>& b, const MatrixRef<T>& out, bool accumulate)
+		{
+			BlasRegistry::get().gemm(a.rows, b.cols, a.cols, T(1),
+				a.ptr, a.rs, a.cs,
+				b.ptr, b.rs, b.cs,
+				accumulate ? T(1) : T(0),
+				out.ptr, out.rs, out.cs);
+		}
+
+		void matrix_product(const MatrixRef<const f32>& a, const MatrixRef<const f32>& b, const MatrixRef<f32>& out, bool accumulate)
+		{
+			blas_product(a, b, out, accumulate);
+		}
+
+		void matrix_product(const MatrixRef<const f64>& a, const MatrixRef<const f64>& b, const MatrixRef<f64>& out, bool accumulate)
+		{
+			blas_product(a, b, out, accumulate);
+		}
+
+		// resolves the backend before a batch is split between threads, buckets are not
+		// tuned from inside a parallel region
+		template<typename T>
+		void prepare_product(const MatrixRef<const T>& a, const MatrixRef<const T>& b)
+		{
+		}
+
+		void prepare_product(const MatrixRef<const f32>& a, const MatrixRef<const f32>& b)
+		{
+			BlasRegistry::get().select(DataType::FLOAT, a.rows, b.cols, a.cols, a.rs == 1 && a.cs != 1, b.rs == 1 && b.cs != 1);
+		}
+
+		void prepare_product(const MatrixRef<const f64>& a, const MatrixRef<const f64>& b)
+		{
+			BlasRegistry::get().select(DataType::DOUBLE, a.rows, b.cols, a.cols, a.rs == 1 && a.cs != 1, b.rs == 1 && b.cs != 1);
+		}
+
+		// the last two dimensions of a tensor as a matrix, the leading ones as a batch
+		template<typename T>
+		struct BatchedMatrix
+		{
+			MatrixRef<T> matrix;
+			DimVector batch_size;
+			DimVector batch_strides;
+		};
+
+		template<typename P, typename T>
+		BatchedMatrix<P> batched_view(const Tensor<T>& t, P* ptr)
+		{
+			idx_type dims = t.ndimension();
+			BatchedMatrix<P> result;
+			result.matrix = { ptr, t.size(dims - 2), t.size(dims - 1), t.stride(dims - 2), t.stride(dims - 1) };
+			for (idx_type i = 0; i < dims - 2; ++i)
+			{
+				result.batch_size.push_back(t.size(i));
+				result.batch_strides.push_back(t.stride(i));
+			}
+			return result;
+		}
+
+		template<typename T>
+		BatchedMatrix<const T> batched_input(const Tensor<T>& t)
+		{
+			return batched_view(t, t.data_ptr() + t.offset());
+		}
+
+		template<typename T>
+		BatchedMatrix<T> batched_output(Tensor<T>& t)
+		{
+			return batched_view(t, t.data_ptr() + t.offset());
+		}
+
+		template<typename T>
+		BatchedMatrix<T> transposed(BatchedMatrix<T> m)
+		{
+			std::swap(m.matrix.rows, m.matrix.cols);
+			std::swap(m.matrix.rs, m.matrix.cs);
+			return m;
+		}
+
+		// size and stride of batch dimension i after right-aligning m against batch_dims
+		// dimensions, broadcast dimensions get stride 0
+		template<typename T>
+		std::pair<idx_type, idx_type> aligned_batch_dim(const BatchedMatrix<T>& m, idx_type batch_dims, idx_type i)
+		{
+			idx_type j = i - (batch_dims - m.batch_size.size());
+			if (j < 0 || m.batch_size[j] == 1)
+				return { 1, 0 };
+			return { m.batch_size[j], m.batch_strides[j] };
+		}
+
+		// out (+)= a * b for every matrix of the broadcast batch. A batch dimension where out
+		// has size 1 (or is missing) but a or b do not is summed over, which is how the
+		// gradients of broadcast operands are reduced.
+		template<typename T>
+		void batched_matmul(const BatchedMatrix<const T>& a, const BatchedMatrix<const T>& b, const BatchedMatrix<T>& out, bool accumulate)
+		{
+			idx_type batch_dims = std::max(a.batch_size.size(), b.batch_size.size());
+			std::vector<idx_type> kept_size, kept_a, kept_b, kept_out;
+			std::vector<idx_type> reduced_size, reduced_a, reduced_b;
+			idx_type kept_count = 1, reduced_count = 1;
+
+			for (idx_type i = 0; i < batch_dims; ++i)
+			{
+				auto a_dim = aligned_batch_dim(a, batch_dims, i);
+				auto b_dim = aligned_batch_dim(b, batch_dims, i);
+				auto out_dim = aligned_batch_dim(out, batch_dims, i);
+				idx_type size = std::max(a_dim.first, b_dim.first);
+				if (size == 1)
+					continue;
+				if (out_dim.first == size)
+				{
+					kept_size.push_back(size);
+					kept_a.push_back(a_dim.second);
+					kept_b.push_back(b_dim.second);
+					kept_out.push_back(out_dim.second);
+					kept_count *= size;
+				}
+				else
+				{
+					reduced_size.push_back(size);
+					reduced_a.push_back(a_dim.second);
+					reduced_b.push_back(b_dim.second);
+					reduced_count *= size;
+				}
+			}
+
+			auto run_slot = [&](idx_type slot) {
+				MatrixRef<const T> a_matrix = a.matrix;
+				MatrixRef<const T> b_matrix = b.matrix;
+				MatrixRef<T> out_matrix = out.matrix;
+				for (idx_type i = static_cast<idx_type>(kept_size.size()) - 1; i >= 0; --i)
+				{
+					idx_type index = slot % kept_size[i];
+					slot /= kept_size[i];
+					a_matrix.ptr += index * kept_a[i];
+					b_matrix.ptr += index * kept_b[i];
+					out_matrix.ptr += index * kept_out[i];
+				}
+
+				for (idx_type r = 0; r < reduced_count; ++r)
+				{
+					const T* a_ptr = a_matrix.ptr;
+					const T* b_ptr = b_matrix.ptr;
+					idx_type rest = r;
+					for (idx_type i = static_cast<idx_type>(reduced_size.size()) - 1; i >= 0; --i)
+					{
+						idx_type index = rest % reduced_size[i];
+						rest /= reduced_size[i];
+						a_ptr += index * reduced_a[i];
+						b_ptr += index * reduced_b[i];
+					}
+					MatrixRef<const T> a_item = a_matrix;
+					MatrixRef<const T> b_item = b_matrix;
+					a_item.ptr = a_ptr;
+					b_item.ptr = b_ptr;
+					matrix_product(a_item, b_item, out_matrix, r == 0 ? accumulate : true);
+				}
+			};
+
+			double flops = static_cast<double>(a.matrix.rows) * b.matrix.cols * a.matrix.cols * reduced_count;
+			if (kept_count > 1 && flops < batch_parallel_threshold)
+			{
+				// small matrices: one gemm per thread, slots write disjoint parts of out
+				prepare_product(a.matrix, b.matrix);
+				int slot_num = static_cast<int>(kept_count);
+#pragma omp parallel for schedule(dynamic) if(flops * kept_count >= batch_parallel_threshold)
+				for (int slot = 0; slot < slot_num; ++slot)
+					run_slot(slot);
+			}
+			else
+			{
+				for (idx_type slot = 0; slot < kept_count; ++slot)
+					run_slot(slot);
+			}
+		}
+
+		template<typename T>
+		DimVector matmul_result_size(const Tensor<T>& a, const Tensor<T>& b)
+		{
+			idx_type a_dims = a.ndimension(), b_dims = b.ndimension();
+			idx_type batch_dims = std::max(a_dims, b_dims) - 2;
+			DimVector dim;
+			for (idx_type i = 0; i < batch_dims; ++i)
+			{
+				idx_type a_i = i - (batch_dims - (a_dims - 2));
+				idx_type b_i = i - (batch_dims - (b_dims - 2));
+				idx_type a_size = a_i >= 0 ? a.size(a_i) : 1;
+				idx_type b_size = b_i >= 0 ? b.size(b_i) : 1;
+				dim.push_back(a_size == 1 ? b_size : a_size);
+			}
+			dim.push_back(a.size(a_dims - 2));
+			dim.push_back(b.size(b_dims - 1));
+			return dim;
+		}
+
+		template<typename T>
+		void matmul_out_check(const Tensor<T>& a, const Tensor<T>& b, const Tensor<T>& out)
+		{
+			matmul_check(a, b);
+			if (out.size() != matmul_result_size(a, b))
+				throw std::runtime_error("matmul: The output shall have the broadcast batch size followed by a.size(-2) x b.size(-1).");
+			// the kernels write out while they read a and b, Eigen's noalias() and blas alike
+			if (out.data_ptr() == a.data_ptr() || out.data_ptr() == b.data_ptr())
+				throw std::runtime_error("matmul: The output shall not share its storage with an operand.");
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> matmul_result(const Tensor<T>& a, const Tensor<T>& b)
+		{
+			matmul_check(a, b);
+			return std::shared_ptr<Tensor<T>>(new Tensor<T>(matmul_result_size(a, b)));
+		}
+
+		template<typename T>
+		void matmul_to(const Tensor<T>& a, const Tensor<T>& b, Tensor<T>& out, bool accumulate)
+		{
+			matmul_out_check(a, b, out);
+			batched_matmul(batched_input(a), batched_input(b), batched_output(out), accumulate);
+		}
+
+		// grad_a = grad * b^T, summed over the batch dimensions a was broadcast along
+		template<typename T>
+		std::shared_ptr<Tensor<T>> matmul_backward_left(const Tensor<T>& grad, const Tensor<T>& b, const DimVector& a_size)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(a_size));
+			batched_matmul(batched_input(grad), transposed(batched_input(b)), batched_output(*result), false);
+			return result;
+		}
+
+		// grad_b = a^T * grad, summed over the batch dimensions b was broadcast along
+		template<typename T>
+		std::shared_ptr<Tensor<T>> matmul_backward_right(const Tensor<T>& grad, const Tensor<T>& a, const DimVector& b_size)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(b_size));
+			batched_matmul(transposed(batched_input(a)), batched_input(grad), batched_output(*result), false);
+			return result;
+		}
+
+		// whether the leading dimensions of t can be merged into the rows of one matrix
+		template<typename T>
+		bool rows_collapse(const Tensor<T>& t)
+		{
+			idx_type dims = t.ndimension();
+			if (dims <= 2)
+				return true;
+			idx_type rows = t.size(dims - 2), rs = t.stride(dims - 2);
+			for (idx_type i = dims - 3; i >= 0; --i)
+			{
+				if (t.size(i) != 1 && t.stride(i) != rs * rows)
+					return false;
+				rows *= t.size(i);
+			}
+			return true;
+		}
+
+		// the rows of a [..., features] tensor, as one matrix when flat is set (see
+		// rows_collapse) and as a batch of matrices otherwise
+		template<typename P, typename T>
+		BatchedMatrix<P> rows_view(const Tensor<T>& t, P* ptr, bool flat)
+		{
+			idx_type dims = t.ndimension();
+			idx_type features = t.size(dims - 1);
+			if (dims == 1)
+			{
+				BatchedMatrix<P> result;
+				result.matrix = { ptr, 1, features, features * t.stride(0), t.stride(0) };
+				return result;
+			}
+			if (!flat)
+				return batched_view(t, ptr);
+
+			BatchedMatrix<P> result;
+			idx_type rows = 1;
+			for (idx_type i = 0; i < dims - 1; ++i)
+				rows *= t.size(i);
+			result.matrix = { ptr, rows, features, t.stride(dims - 2), t.stride(dims - 1) };
+			return result;
+		}
+
+		template<typename T>
+		void linear_check(const Tensor<T>& input, const Tensor<T>& weight, const Tensor<T>* bias)
+		{
+			if (weight.ndimension() != 2)
+				throw std::runtime_error("linear: The weight shall be matrix (2D).");
+			if (input.ndimension() < 1 || input.size(input.ndimension() - 1) != weight.size(1))
+				throw std::runtime_error("linear: The last dimension of the input shall be equal to dimension 1 of the weight.");
+			if (bias && (bias->ndimension() != 1 || bias->size(0) != weight.size(0)))
+				throw std::runtime_error("linear: The bias shall be a vector with one value per output feature.");
+		}
+
+		// y = x * w^T + bias, the weight is read in place as the transposed right operand
+		template<typename T>
+		std::shared_ptr<Tensor<T>> linear(const Tensor<T>& input, const Tensor<T>& weight, const Tensor<T>* bias)
+		{
+			linear_check(input, weight, bias);
+			idx_type out_features = weight.size(0);
+			DimVector result_dim = input.size();
+			result_dim[result_dim.size() - 1] = out_features;
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(result_dim));
+
+			T* out = result->data_ptr();
+			idx_type rows = result_dim.flat_size() / std::max<idx_type>(out_features, 1);
+			if (bias)
+			{
+				const T* bias_ptr = bias->data_ptr() + bias->offset();
+				for (idx_type i = 0; i < rows; ++i)
+					for (idx_type j = 0; j < out_features; ++j)
+						out[i * out_features + j] = bias_ptr[j * bias->stride(0)];
+			}
+
+			bool flat = rows_collapse(input);
+			batched_matmul(rows_view(input, input.data_ptr() + input.offset(), flat),
+				transposed(batched_input(weight)),
+				rows_view(*result, out, flat), bias != nullptr);
+			return result;
+		}
+
+		// grad_input = grad * w, grad_weight = grad^T * x and grad_bias = 1^T * grad, the last two
+		// summed over all rows
+		template<typename T>
+		std::vector<std::shared_ptr<Tensor<T>>> linear_backward(const Tensor<T>& grad, const Tensor<T>& input, const Tensor<T>& weight, bool with_bias)
+		{
+			std::shared_ptr<Tensor<T>> input_grad(new Tensor<T>(input.size()));
+			std::shared_ptr<Tensor<T>> weight_grad(new Tensor<T>(weight.size()));
+			bool flat = rows_collapse(input) && rows_collapse(grad);
+			BatchedMatrix<const T> grad_rows = rows_view(grad, grad.data_ptr() + grad.offset(), flat);
+
+			batched_matmul(grad_rows, batched_input(weight),
+				rows_view(*input_grad, input_grad->data_ptr(), flat), false);
+			batched_matmul(transposed(grad_rows), rows_view(input, input.data_ptr() + input.offset(), flat),
+				batched_output(*weight_grad), false);
+
+			std::vector<std::shared_ptr<Tensor<T>>> result{ input_grad, weight_grad };
+			if (with_bias)
+			{
+				std::shared_ptr<Tensor<T>> bias_grad(new Tensor<T>(DimVector({ weight.size(0) })));
+				std::vector<T> ones(grad_rows.matrix.rows, T(1));
+				BatchedMatrix<const T> ones_row;
+				ones_row.matrix = { ones.data(), 1, grad_rows.matrix.rows, grad_rows.matrix.rows, 1 };
+				BatchedMatrix<T> bias_row;
+				bias_row.matrix = { bias_grad->data_ptr(), 1, weight.size(0), weight.size(0), 1 };
+				batched_matmul(ones_row, grad_rows, bias_row, false);
+				result.push_back(bias_grad);
+			}
+			return result;
+		}
+	}
+
 	std::shared_ptr<Tensor<u8>> matmul_impl(const Tensor<u8>& a, const Tensor<u8>& b)
 	{
-		// check
-		matmul_check(a, b);
-		// result
-		DimVector dim;
-		dim.push_back(a.size()[0]);
-		dim.push_back(b.size()[1]);
-		std::shared_ptr<Tensor<u8>> result(new Tensor<u8>(dim));
-
-		// copy data
-		Eigen::Map<const Eigen::Matrix<u8, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
-		Eigen::Map<const Eigen::Matrix<u8, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_b(b.data_ptr() + b.offset(), b.size()[0], b.size()[1]);
-
-		Eigen::Matrix<u8, Eigen::Dynamic, Eigen::Dynamic> eigen_c = eigen_a * eigen_b;
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * b.size()[1], result->data_ptr());
+		std::shared_ptr<Tensor<u8>> result = matmul_result(a, b);
+		matmul_impl(a, b, *result, false);
 		return result;
 	}
 
+	void matmul_impl(const Tensor<u8>& a, const Tensor<u8>& b, Tensor<u8>& out, bool accumulate)
+	{
+		matmul_to(a, b, out, accumulate);
+	}
+
 	std::shared_ptr<Tensor<i8>> matmul_impl(const Tensor<i8>& a, const Tensor<i8>& b)
 	{
-		// check
-		matmul_check(a, b);
-		// result
-		DimVector dim;
-		dim.push_back(a.size()[0]);
-		dim.push_back(b.size()[1]);
-		std::shared_ptr<Tensor<i8>> result(new Tensor<i8>(dim));
-
-		// copy data
-		Eigen::Map<const Eigen::Matrix<i8, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
-		Eigen::Map<const Eigen::Matrix<i8, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_b(b.data_ptr() + b.offset(), b.size()[0], b.size()[1]);
-
-		Eigen::Matrix<i8, Eigen::Dynamic, Eigen::Dynamic> eigen_c = eigen_a * eigen_b;
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * b.size()[1], result->data_ptr());
+		std::shared_ptr<Tensor<i8>> result = matmul_result(a, b);
+		matmul_impl(a, b, *result, false);
 		return result;
 	}
 
+	void matmul_impl(const Tensor<i8>& a, const Tensor<i8>& b, Tensor<i8>& out, bool accumulate)
+	{
+		matmul_to(a, b, out, accumulate);
+	}
+
 	std::shared_ptr<Tensor<i16>> matmul_impl(const Tensor<i16>& a, const Tensor<i16>& b)
 	{
-		// check
-		matmul_check(a, b);
-		// result
-		DimVector dim;
-		dim.push_back(a.size()[0]);
-		dim.push_back(b.size()[1]);
-		std::shared_ptr<Tensor<i16>> result(new Tensor<i16>(dim));
-
-		// copy data
-		Eigen::Map<const Eigen::Matrix<i16, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
-		Eigen::Map<const Eigen::Matrix<i16, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_b(b.data_ptr() + b.offset(), b.size()[0], b.size()[1]);
-
-		Eigen::Matrix<i16, Eigen::Dynamic, Eigen::Dynamic> eigen_c = eigen_a * eigen_b;
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * b.size()[1], result->data_ptr());
+		std::shared_ptr<Tensor<i16>> result = matmul_result(a, b);
+		matmul_impl(a, b, *result, false);
 		return result;
 	}
 
+	void matmul_impl(const Tensor<i16>& a, const Tensor<i16>& b, Tensor<i16>& out, bool accumulate)
+	{
+		matmul_to(a, b, out, accumulate);
+	}
+
 	std::shared_ptr<Tensor<i32>> matmul_impl(const Tensor<i32>& a, const Tensor<i32>& b)
 	{
-		// check
-		matmul_check(a, b);
-		// result
-		DimVector dim;
-		dim.push_back(a.size()[0]);
-		dim.push_back(b.size()[1]);
-		std::shared_ptr<Tensor<i32>> result(new Tensor<i32>(dim));
-
-		// copy data
-		Eigen::Map<const Eigen::Matrix<i32, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
-		Eigen::Map<const Eigen::Matrix<i32, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_b(b.data_ptr() + b.offset(), b.size()[0], b.size()[1]);
-
-		Eigen::Matrix<i32, Eigen::Dynamic, Eigen::Dynamic> eigen_c = eigen_a * eigen_b;
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * b.size()[1], result->data_ptr());
+		std::shared_ptr<Tensor<i32>> result = matmul_result(a, b);
+		matmul_impl(a, b, *result, false);
 		return result;
 	}
 
+	void matmul_impl(const Tensor<i32>& a, const Tensor<i32>& b, Tensor<i32>& out, bool accumulate)
+	{
+		matmul_to(a, b, out, accumulate);
+	}
+
 	std::shared_ptr<Tensor<i64>> matmul_impl(const Tensor<i64>& a, const Tensor<i64>& b)
 	{
-		// check
-		matmul_check(a, b);
-		// result
-		DimVector dim;
-		dim.push_back(a.size()[0]);
-		dim.push_back(b.size()[1]);
-		std::shared_ptr<Tensor<i64>> result(new Tensor<i64>(dim));
-
-		// copy data
-		Eigen::Map<const Eigen::Matrix<i64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
-		Eigen::Map<const Eigen::Matrix<i64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_b(b.data_ptr() + b.offset(), b.size()[0], b.size()[1]);
-
-		Eigen::Matrix<i64, Eigen::Dynamic, Eigen::Dynamic> eigen_c = eigen_a * eigen_b;
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * b.size()[1], result->data_ptr());
+		std::shared_ptr<Tensor<i64>> result = matmul_result(a, b);
+		matmul_impl(a, b, *result, false);
 		return result;
 	}
 
+	void matmul_impl(const Tensor<i64>& a, const Tensor<i64>& b, Tensor<i64>& out, bool accumulate)
+	{
+		matmul_to(a, b, out, accumulate);
+	}
+
 	std::shared_ptr<Tensor<f32>> matmul_impl(const Tensor<f32>& a, const Tensor<f32>& b)
 	{
-		// check
-		matmul_check(a, b);
-		// result
-		DimVector dim;
-		dim.push_back(a.size()[0]);
-		dim.push_back(b.size()[1]);
-		std::shared_ptr<Tensor<f32>> result(new Tensor<f32>(dim));
-
-		
-
-#ifdef TRAPH_BUILD_EIGEN
-		// copy data
-		Eigen::Map<const Eigen::Matrix<f32, Eigen::Dynamic, Eigen::Dynamic>, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1], Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(a.stride(1), a.stride(0)));
-		Eigen::Map<const Eigen::Matrix<f32, Eigen::Dynamic, Eigen::Dynamic>, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>> eigen_b(b.data_ptr() + b.offset(), b.size()[0], b.size()[1], Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(b.stride(1), b.stride(0)));
-
-		Eigen::Matrix<f32, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> eigen_c = eigen_a * eigen_b;
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * b.size()[1], result->data_ptr());
-#elif defined TRAPH_BUILD_MKL
-		CBLAS_LAYOUT a_layout = a.order() == layout_type::column_major ? CBLAS_LAYOUT::CblasColMajor : CBLAS_LAYOUT::CblasRowMajor;
-
-		cblas_sgemm(a_layout,
-			CBLAS_TRANSPOSE::CblasNoTrans,
-			CBLAS_TRANSPOSE::CblasNoTrans,
-			a.size()[0],
-			b.size()[1],
-			a.size()[1],
-			1.f,
-			a.data_ptr(),
-			a.size()[0],
-			b.data_ptr(),
-			b.size()[0],
-			0.f,
-			result->data_ptr(),
-			result->size()[0]);
-#endif
+		std::shared_ptr<Tensor<f32>> result = matmul_result(a, b);
+		matmul_impl(a, b, *result, false);
 		return result;
 	}
 
-	std::shared_ptr<Tensor<f64>> matmul_impl(const Tensor<f64>& a, const Tensor<f64>& b)
+	void matmul_impl(const Tensor<f32>& a, const Tensor<f32>& b, Tensor<f32>& out, bool accumulate)
 	{
-		// check
-		matmul_check(a, b);
-		// result
-		DimVector dim;
-		dim.push_back(a.size()[0]);
-		dim.push_back(b.size()[1]);
-		std::shared_ptr<Tensor<f64>> result(new Tensor<f64>(dim));
-
-#ifdef TRAPH_BUILD_EIGEN
-		// copy data
-		Eigen::Map<const Eigen::Matrix<f64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
-		Eigen::Map<const Eigen::Matrix<f64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_b(b.data_ptr() + b.offset(), b.size()[0], b.size()[1]);
-
-		Eigen::Matrix<f64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> eigen_c = eigen_a * eigen_b;
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * b.size()[1], result->data_ptr());
-#elif defined TRAPH_BUILD_MKL
-		CBLAS_LAYOUT a_layout = a.order() == layout_type::column_major ? CBLAS_LAYOUT::CblasColMajor : CBLAS_LAYOUT::CblasRowMajor;
-
-		cblas_dgemm(a_layout,
-			CBLAS_TRANSPOSE::CblasNoTrans,
-			CBLAS_TRANSPOSE::CblasNoTrans,
-			a.size()[0],
-			b.size()[1],
-			a.size()[1],
-			1.f,
-			a.data_ptr(),
-			a.size()[0],
-			b.data_ptr(),
-			b.size()[0],
-			0.f,
-			result->data_ptr(),
-			result->size()[0]);
-#endif
+		matmul_to(a, b, out, accumulate);
+	}
 
+	std::shared_ptr<Tensor<f64>> matmul_impl(const Tensor<f64>& a, const Tensor<f64>& b)
+	{
+		std::shared_ptr<Tensor<f64>> result = matmul_result(a, b);
+		matmul_impl(a, b, *result, false);
 		return result;
 	}
 
-	std::shared_ptr<Tensor<f32>> inverse_impl(const Tensor<f32>& a)
+	void matmul_impl(const Tensor<f64>& a, const Tensor<f64>& b, Tensor<f64>& out, bool accumulate)
 	{
-		// result
-		std::shared_ptr<Tensor<f32>> result(new Tensor<f32>(a.size()[0], a.size()[1]));
+		matmul_to(a, b, out, accumulate);
+	}
 
-		// copy data
-		Eigen::Map<const Eigen::Matrix<f32, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
+	std::shared_ptr<Tensor<f32>> matmul_backward_left_impl(const Tensor<f32>& grad, const Tensor<f32>& b, const DimVector& a_size)
+	{
+		return matmul_backward_left(grad, b, a_size);
+	}
 
-		Eigen::Matrix<f32, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> eigen_c = eigen_a.inverse();
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * a.size()[1], result->data_ptr());
-		return result;
+	std::shared_ptr<Tensor<f32>> matmul_backward_right_impl(const Tensor<f32>& grad, const Tensor<f32>& a, const DimVector& b_size)
+	{
+		return matmul_backward_right(grad, a, b_size);
 	}
 
-	std::shared_ptr<Tensor<f64>> inverse_impl(const Tensor<f64>& a)
+	std::shared_ptr<Tensor<f64>> matmul_backward_left_impl(const Tensor<f64>& grad, const Tensor<f64>& b, const DimVector& a_size)
 	{
-		// result
-		std::shared_ptr<Tensor<f64>> result(new Tensor<f64>(a.size()[0], a.size()[1]));
+		return matmul_backward_left(grad, b, a_size);
+	}
 
-		// copy data
-		Eigen::Map<const Eigen::Matrix<f64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> eigen_a(a.data_ptr() + a.offset(), a.size()[0], a.size()[1]);
+	std::shared_ptr<Tensor<f64>> matmul_backward_right_impl(const Tensor<f64>& grad, const Tensor<f64>& a, const DimVector& b_size)
+	{
+		return matmul_backward_right(grad, a, b_size);
+	}
 
-		Eigen::Matrix<f64, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> eigen_c = eigen_a.inverse();
-		// copy to result
-		std::copy(eigen_c.data(), eigen_c.data() + a.size()[0] * a.size()[1], result->data_ptr());
-		return result;
+	std::shared_ptr<Tensor<f32>> linear_impl(const Tensor<f32>& input, const Tensor<f32>& weight, const Tensor<f32>* bias)
+	{
+		return linear(input, weight, bias);
+	}
+
+	std::shared_ptr<Tensor<f64>> linear_impl(const Tensor<f64>& input, const Tensor<f64>& weight, const Tensor<f64>* bias)
+	{
+		return linear(input, weight, bias);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f32>>> linear_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, const Tensor<f32>& weight, bool with_bias)
+	{
+		return linear_backward(grad, input, weight, with_bias);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f64>>> linear_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, const Tensor<f64>& weight, bool with_bias)
+	{
+		return linear_backward(grad, input, weight, with_bias);
 	}
 }
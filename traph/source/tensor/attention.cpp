@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/attention.h>
+#include <traph/tensor/blas.h>
+#include <traph/tensor/kv_cache.h>
+
+// Attention as matmul, softmax and matmul makes the [Lq, Lk] scores of every head, which at
+// long sequences is most of the memory and of the traffic. Here a block of queries runs over
+// the blocks of keys it sees, the scores of one pair of blocks live in a buffer of one
+// thread, and the softmax is online: each query keeps the maximum m and the sum l of
+// exp(s - m) of the scores so far, and its partial output is rescaled by exp(m_old - m_new)
+// whenever m grows. The backward pass keeps only lse = m + log(l) per query and computes the
+// probabilities exp(s - lse) of each pair of blocks again from the scores.
+
+namespace traph
+{
+	namespace
+	{
+		// queries and keys per block; the scores of a pair of blocks take 32 KB in f64
+		const idx_type query_block = 64;
+		const idx_type key_block = 64;
+		// multiply-adds below which attention runs on the calling thread
+		const double attention_parallel_threshold = 64.0 * 64.0 * 64.0;
+
+		void attention_error(const std::string& message)
+		{
+			throw std::runtime_error("scaled_dot_product_attention: " + message + ".");
+		}
+
+		DataType data_type(f32)
+		{
+			return DataType::FLOAT;
+		}
+
+		DataType data_type(f64)
+		{
+			return DataType::DOUBLE;
+		}
+
+		template<typename T>
+		void gemm(idx_type m, idx_type n, idx_type k,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			BlasRegistry::get().gemm(m, n, k, T(1), a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+		}
+
+		// the [L, F] matrices of a [B, H, L, F] tensor of any strides
+		template<typename T>
+		struct HeadMatrices
+		{
+			T* data;
+			idx_type batch_stride, head_stride, rs, cs;
+
+			HeadMatrices(const Tensor<T>& t)
+				:data(const_cast<T*>(t.data_ptr()) + t.offset()),
+				batch_stride(t.stride(0)), head_stride(t.stride(1)), rs(t.stride(2)), cs(t.stride(3))
+			{
+			}
+
+			T* at(idx_type b, idx_type h, idx_type row) const
+			{
+				return data + b * batch_stride + h * head_stride + row * rs;
+			}
+		};
+
+		struct AttentionShape
+		{
+			idx_type batch, heads, lq, lk, d, dv;
+			double scale;
+			bool causal;
+
+			// keys seen by query i are [0, key_end(i)); the end of the keys of a block of
+			// queries is that of its last query
+			idx_type key_end(idx_type i, idx_type valid) const
+			{
+				return std::min(valid, causal ? std::max<idx_type>(i + lk - lq + 1, 0) : lk);
+			}
+		};
+
+		template<typename T>
+		AttentionShape attention_shape(const Tensor<T>& q, const Tensor<T>& k, const Tensor<T>& v,
+			const Tensor<u8>* key_padding_mask, const AttentionParams& params)
+		{
+			if (q.ndimension() != 4 || k.ndimension() != 4 || v.ndimension() != 4)
+				attention_error("Queries, keys and values shall be [B, H, L, D]");
+			AttentionShape s;
+			s.batch = q.size(0);
+			s.heads = q.size(1);
+			s.lq = q.size(2);
+			s.d = q.size(3);
+			s.lk = k.size(2);
+			s.dv = v.size(3);
+			if (k.size(0) != s.batch || k.size(1) != s.heads || k.size(3) != s.d)
+				attention_error("Keys shall be [B, H, Lk, D] for [B, H, Lq, D] queries");
+			if (v.size(0) != s.batch || v.size(1) != s.heads || v.size(2) != s.lk)
+				attention_error("Values shall be [B, H, Lk, Dv] for [B, H, Lk, D] keys");
+			if (s.d < 1 || s.dv < 1)
+				attention_error("The head size shall be positive");
+			if (key_padding_mask && key_padding_mask->size() != DimVector({ s.batch, s.lk }))
+				attention_error("The key padding mask shall be [B, Lk]");
+			if (params.scale < 0)
+				attention_error("The scale shall not be negative");
+			s.scale = params.scale > 0 ? params.scale : 1.0 / std::sqrt(static_cast<double>(s.d));
+			s.causal = params.causal;
+			return s;
+		}
+
+		// for each batch, whether each key is padded and the end of its last key that is not
+		std::vector<u8> padded_keys(const Tensor<u8>* mask, const AttentionShape& s, std::vector<idx_type>& valid)
+		{
+			std::vector<u8> result(static_cast<std::size_t>(s.batch) * s.lk, 0);
+			valid.assign(s.batch, s.lk);
+			if (!mask)
+				return result;
+			const u8* m = mask->data_ptr() + mask->offset();
+			for (idx_type b = 0; b < s.batch; ++b)
+			{
+				valid[b] = 0;
+				for (idx_type j = 0; j < s.lk; ++j)
+				{
+					u8 padded = m[b * mask->stride(0) + j * mask->stride(1)] != 0;
+					result[static_cast<std::size_t>(b) * s.lk + j] = padded;
+					if (!padded)
+						valid[b] = j + 1;
+				}
+			}
+			return result;
+		}
+
+		// scaled scores of rows queries from q0 and cols keys from k0, with -inf for the keys
+		// query q0 + i does not see; padded may be null
+		template<typename T>
+		void block_scores(const AttentionShape& s, const T* q, idx_type q_rs, idx_type q_cs, const T* k, idx_type k_rs, idx_type k_cs,
+			const u8* padded, idx_type q0, idx_type rows, idx_type k0, idx_type cols, T* scores)
+		{
+			gemm(rows, cols, s.d, q, q_rs, q_cs, k, k_cs, k_rs, T(0), scores, key_block, 1);
+			const T scale = static_cast<T>(s.scale);
+			const T minus_inf = -std::numeric_limits<T>::infinity();
+			for (idx_type i = 0; i < rows; ++i)
+			{
+				T* row = scores + i * key_block;
+				idx_type end = std::min(cols, s.key_end(q0 + i, s.lk) - k0);
+				for (idx_type j = 0; j < cols; ++j)
+					row[j] = j < end && !(padded && padded[k0 + j]) ? row[j] * scale : minus_inf;
+			}
+		}
+
+		// the output of a block of queries as key blocks are added, from the running maximum
+		// and sum of each query
+		template<typename T>
+		struct OnlineSoftmax
+		{
+			idx_type rows, dv;
+			T* y;
+			std::vector<T> scores, maxima, sums;
+
+			OnlineSoftmax(idx_type rows, idx_type dv, T* y)
+				:rows(rows), dv(dv), y(y), scores(static_cast<std::size_t>(query_block) * key_block),
+				maxima(rows, -std::numeric_limits<T>::infinity()), sums(rows, T(0))
+			{
+				std::fill(y, y + rows * dv, T(0));
+			}
+
+			// with the block_scores of cols keys in scores and their [cols, Dv] values
+			void add(idx_type cols, const T* v, idx_type v_rs, idx_type v_cs)
+			{
+				const T minus_inf = -std::numeric_limits<T>::infinity();
+				for (idx_type i = 0; i < rows; ++i)
+				{
+					T* row = scores.data() + i * key_block;
+					T block_max = *std::max_element(row, row + cols);
+					if (block_max == minus_inf)
+					{
+						std::fill(row, row + cols, T(0));
+						continue;
+					}
+					T new_max = std::max(maxima[i], block_max);
+					T sum = 0;
+					for (idx_type j = 0; j < cols; ++j)
+					{
+						row[j] = std::exp(row[j] - new_max);
+						sum += row[j];
+					}
+					if (maxima[i] != minus_inf && maxima[i] != new_max)
+					{
+						T rescale = std::exp(maxima[i] - new_max);
+						sums[i] *= rescale;
+						T* yi = y + i * dv;
+						for (idx_type j = 0; j < dv; ++j)
+							yi[j] *= rescale;
+					}
+					sums[i] += sum;
+					maxima[i] = new_max;
+				}
+				gemm(rows, dv, cols, scores.data(), key_block, 1, v, v_rs, v_cs, T(1), y, dv, 1);
+			}
+
+			void finish(T* lse)
+			{
+				for (idx_type i = 0; i < rows; ++i)
+				{
+					T* yi = y + i * dv;
+					T inverse = sums[i] > 0 ? 1 / sums[i] : T(0);
+					for (idx_type j = 0; j < dv; ++j)
+						yi[j] *= inverse;
+					if (lse)
+						lse[i] = sums[i] > 0 ? maxima[i] + std::log(sums[i]) : -std::numeric_limits<T>::infinity();
+				}
+			}
+		};
+
+		// one block of queries of one head over all the keys it sees
+		template<typename T>
+		void forward_block(const AttentionShape& s, const HeadMatrices<T>& qm, const HeadMatrices<T>& km, const HeadMatrices<T>& vm,
+			const u8* padded, idx_type valid, idx_type b, idx_type h, idx_type q0, T* y, T* lse)
+		{
+			const idx_type rows = std::min(query_block, s.lq - q0);
+			const idx_type keys = s.key_end(q0 + rows - 1, valid);
+			OnlineSoftmax<T> softmax(rows, s.dv, y);
+			for (idx_type k0 = 0; k0 < keys; k0 += key_block)
+			{
+				const idx_type cols = std::min(key_block, keys - k0);
+				block_scores(s, qm.at(b, h, q0), qm.rs, qm.cs, km.at(b, h, k0), km.rs, km.cs, padded, q0, rows, k0, cols, softmax.scores.data());
+				softmax.add(cols, vm.at(b, h, k0), vm.rs, vm.cs);
+			}
+			softmax.finish(lse);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> attention_forward(const Tensor<T>& q, const Tensor<T>& k, const Tensor<T>& v,
+			const Tensor<u8>* key_padding_mask, const AttentionParams& params, std::shared_ptr<Tensor<T>>* lse)
+		{
+			AttentionShape s = attention_shape(q, k, v, key_padding_mask, params);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ s.batch, s.heads, s.lq, s.dv })));
+			T* lse_data = nullptr;
+			if (lse)
+			{
+				*lse = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.batch, s.heads, s.lq })));
+				lse_data = (*lse)->data_ptr();
+			}
+			if (s.batch * s.heads * s.lq == 0)
+				return result;
+
+			std::vector<idx_type> valid;
+			std::vector<u8> padded = padded_keys(key_padding_mask, s, valid);
+			HeadMatrices<T> qm(q), km(k), vm(v);
+			const idx_type blocks = (s.lq + query_block - 1) / query_block;
+			const idx_type tasks = s.batch * s.heads * blocks;
+			double work = static_cast<double>(s.batch) * s.heads * s.lq * s.lk * (s.d + s.dv);
+			bool parallel = tasks > 1 && omp_get_max_threads() > 1 && !omp_in_parallel() && work >= attention_parallel_threshold;
+			if (parallel)
+			{
+				BlasRegistry::get().select(data_type(T()), query_block, key_block, s.d, false, true);
+				BlasRegistry::get().select(data_type(T()), query_block, s.dv, key_block, false, false);
+			}
+			T* y = result->data_ptr();
+			int count = static_cast<int>(tasks);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int task = 0; task < count; ++task)
+			{
+				idx_type head = task / blocks, q0 = task % blocks * query_block;
+				idx_type b = head / s.heads, h = head % s.heads;
+				std::size_t row = static_cast<std::size_t>(head) * s.lq + q0;
+				forward_block(s, qm, km, vm, padded.data() + static_cast<std::size_t>(b) * s.lk, valid[b], b, h, q0,
+					y + row * s.dv, lse_data ? lse_data + row : nullptr);
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> paged_attention(const Tensor<T>& q, const KVCacheLayer<T>& layer,
+			const std::vector<idx_type>& sequences, const AttentionParams& params)
+		{
+			const KVCache<T>& cache = layer.cache();
+			AttentionShape s;
+			if (q.ndimension() != 4 || q.size(0) != static_cast<idx_type>(sequences.size()) ||
+				q.size(1) != cache.heads() || q.size(3) != cache.head_dim())
+				attention_error("Queries shall be [B, H, Lq, D] for B sequences of the cache");
+			if (params.scale < 0)
+				attention_error("The scale shall not be negative");
+			s.batch = q.size(0);
+			s.heads = q.size(1);
+			s.lq = q.size(2);
+			s.d = s.dv = cache.head_dim();
+			s.scale = params.scale > 0 ? params.scale : 1.0 / std::sqrt(static_cast<double>(s.d));
+			s.causal = params.causal;
+			std::vector<idx_type> lengths;
+			double work = 0;
+			for (idx_type id : sequences)
+			{
+				lengths.push_back(cache.length(id));
+				work += static_cast<double>(s.heads) * s.lq * lengths.back() * (s.d + s.dv);
+			}
+
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ s.batch, s.heads, s.lq, s.dv })));
+			if (s.batch * s.heads * s.lq == 0)
+				return result;
+			HeadMatrices<T> qm(q);
+			const idx_type blocks = (s.lq + query_block - 1) / query_block;
+			const idx_type tasks = s.batch * s.heads * blocks;
+			const idx_type block_size = cache.block_size();
+			bool parallel = tasks > 1 && omp_get_max_threads() > 1 && !omp_in_parallel() && work >= attention_parallel_threshold;
+			if (parallel)
+			{
+				BlasRegistry::get().select(data_type(T()), std::min(query_block, s.lq), std::min(key_block, block_size), s.d, false, true);
+				BlasRegistry::get().select(data_type(T()), std::min(query_block, s.lq), s.dv, std::min(key_block, block_size), false, false);
+			}
+			T* y = result->data_ptr();
+			int count = static_cast<int>(tasks);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int task = 0; task < count; ++task)
+			{
+				idx_type head = task / blocks, q0 = task % blocks * query_block;
+				idx_type b = head / s.heads, h = head % s.heads;
+				AttentionShape sequence_shape = s;
+				sequence_shape.lk = lengths[b];
+				const std::vector<idx_type>& table = cache.blocks(sequences[b]);
+				const idx_type rows = std::min(query_block, s.lq - q0);
+				const idx_type keys = sequence_shape.key_end(q0 + rows - 1, lengths[b]);
+				OnlineSoftmax<T> softmax(rows, s.dv, y + (static_cast<std::size_t>(head) * s.lq + q0) * s.dv);
+				// a block of the cache at a time, or a part of it when it is larger than a key block
+				for (idx_type k0 = 0, cols = 0; k0 < keys; k0 += cols)
+				{
+					idx_type in_block = k0 % block_size;
+					cols = std::min(std::min(key_block, block_size - in_block), keys - k0);
+					idx_type block = table[k0 / block_size];
+					const T* k = cache.keys(layer.index(), block, h) + in_block * s.d;
+					const T* v = cache.values(layer.index(), block, h) + in_block * s.dv;
+					block_scores(sequence_shape, qm.at(b, h, q0), qm.rs, qm.cs, k, s.d, 1, static_cast<const u8*>(nullptr),
+						q0, rows, k0, cols, softmax.scores.data());
+					softmax.add(cols, v, s.dv, 1);
+				}
+				softmax.finish(nullptr);
+			}
+			return result;
+		}
+
+		// every block pair of one head, key blocks outside so that each block of dk and dv is
+		// finished before the next
+		template<typename T>
+		void backward_head(const AttentionShape& s, const HeadMatrices<T>& dym, const HeadMatrices<T>& qm, const HeadMatrices<T>& km,
+			const HeadMatrices<T>& vm, const HeadMatrices<T>& ym, const T* lse, const u8* padded, idx_type valid,
+			idx_type b, idx_type h, T* dq, T* dk, T* dv)
+		{
+			const T minus_inf = -std::numeric_limits<T>::infinity();
+			const T scale = static_cast<T>(s.scale);
+			std::fill(dq, dq + s.lq * s.d, T(0));
+			std::fill(dk, dk + s.lk * s.d, T(0));
+			std::fill(dv, dv + s.lk * s.dv, T(0));
+
+			// rowsum(dy * y) is the sum of p * dp over the keys of each query
+			std::vector<T> dot(s.lq);
+			for (idx_type i = 0; i < s.lq; ++i)
+			{
+				const T* dyi = dym.at(b, h, i);
+				const T* yi = ym.at(b, h, i);
+				T sum = 0;
+				for (idx_type j = 0; j < s.dv; ++j)
+					sum += dyi[j * dym.cs] * yi[j * ym.cs];
+				dot[i] = sum;
+			}
+
+			std::vector<T> probs(static_cast<std::size_t>(query_block) * key_block);
+			std::vector<T> dprobs(probs.size());
+			const idx_type keys = std::min(valid, s.lk);
+			for (idx_type k0 = 0; k0 < keys; k0 += key_block)
+			{
+				const idx_type cols = std::min(key_block, keys - k0);
+				// with a causal mask the queries before the block see none of it
+				idx_type first = s.causal ? std::max<idx_type>(k0 - (s.lk - s.lq), 0) / query_block * query_block : 0;
+				for (idx_type q0 = first; q0 < s.lq; q0 += query_block)
+				{
+					const idx_type rows = std::min(query_block, s.lq - q0);
+					block_scores(s, qm.at(b, h, q0), qm.rs, qm.cs, km.at(b, h, k0), km.rs, km.cs, padded, q0, rows, k0, cols, probs.data());
+					for (idx_type i = 0; i < rows; ++i)
+					{
+						T* row = probs.data() + i * key_block;
+						T l = lse[q0 + i];
+						for (idx_type j = 0; j < cols; ++j)
+							row[j] = l == minus_inf ? T(0) : std::exp(row[j] - l);
+					}
+					// dv += p^T dy, dp = dy v^T
+					gemm(cols, s.dv, rows, probs.data(), 1, key_block, dym.at(b, h, q0), dym.rs, dym.cs, T(1), dv + k0 * s.dv, s.dv, 1);
+					gemm(rows, cols, s.dv, dym.at(b, h, q0), dym.rs, dym.cs, vm.at(b, h, k0), vm.cs, vm.rs, T(0), dprobs.data(), key_block, 1);
+					// ds = p * (dp - dot) * scale, the gradient of the scores before scaling
+					for (idx_type i = 0; i < rows; ++i)
+					{
+						T* p = probs.data() + i * key_block;
+						T* dp = dprobs.data() + i * key_block;
+						for (idx_type j = 0; j < cols; ++j)
+							dp[j] = p[j] * (dp[j] - dot[q0 + i]) * scale;
+					}
+					// dq += ds k, dk += ds^T q
+					gemm(rows, s.d, cols, dprobs.data(), key_block, 1, km.at(b, h, k0), km.rs, km.cs, T(1), dq + q0 * s.d, s.d, 1);
+					gemm(cols, s.d, rows, dprobs.data(), 1, key_block, qm.at(b, h, q0), qm.rs, qm.cs, T(1), dk + k0 * s.d, s.d, 1);
+				}
+			}
+		}
+
+		template<typename T>
+		std::vector<std::shared_ptr<Tensor<T>>> attention_backward(const Tensor<T>& grad, const Tensor<T>& q, const Tensor<T>& k,
+			const Tensor<T>& v, const Tensor<T>& output, const Tensor<T>& lse, const Tensor<u8>* key_padding_mask, const AttentionParams& params)
+		{
+			AttentionShape s = attention_shape(q, k, v, key_padding_mask, params);
+			DimVector output_size({ s.batch, s.heads, s.lq, s.dv });
+			if (grad.size() != output_size || output.size() != output_size)
+				attention_error("The output and its gradient shall be [B, H, Lq, Dv]");
+			if (lse.size() != DimVector({ s.batch, s.heads, s.lq }))
+				attention_error("The log-sum-exp shall be [B, H, Lq]");
+
+			std::shared_ptr<Tensor<T>> dq(new Tensor<T>(q.size()));
+			std::shared_ptr<Tensor<T>> dk(new Tensor<T>(k.size()));
+			std::shared_ptr<Tensor<T>> dv(new Tensor<T>(v.size()));
+			std::vector<idx_type> valid;
+			std::vector<u8> padded = padded_keys(key_padding_mask, s, valid);
+			HeadMatrices<T> dym(grad), qm(q), km(k), vm(v), ym(output);
+			const T* l = lse.data_ptr() + lse.offset();
+			const idx_type heads = s.batch * s.heads;
+			double work = 2.0 * heads * s.lq * s.lk * (s.d + s.dv);
+			bool parallel = heads > 1 && omp_get_max_threads() > 1 && !omp_in_parallel() && work >= attention_parallel_threshold;
+			if (parallel)
+			{
+				BlasRegistry::get().select(data_type(T()), query_block, key_block, s.d, false, true);
+				BlasRegistry::get().select(data_type(T()), key_block, s.dv, query_block, true, false);
+				BlasRegistry::get().select(data_type(T()), query_block, s.d, key_block, false, false);
+			}
+			int count = static_cast<int>(heads);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int head = 0; head < count; ++head)
+			{
+				idx_type b = head / s.heads, h = head % s.heads;
+				std::vector<T> lse_row(s.lq);
+				for (idx_type i = 0; i < s.lq; ++i)
+					lse_row[i] = l[b * lse.stride(0) + h * lse.stride(1) + i * lse.stride(2)];
+				backward_head(s, dym, qm, km, vm, ym, lse_row.data(), padded.data() + static_cast<std::size_t>(b) * s.lk, valid[b], b, h,
+					dq->data_ptr() + static_cast<std::size_t>(head) * s.lq * s.d,
+					dk->data_ptr() + static_cast<std::size_t>(head) * s.lk * s.d,
+					dv->data_ptr() + static_cast<std::size_t>(head) * s.lk * s.dv);
+			}
+			return { dq, dk, dv };
+		}
+	}
+
+	std::shared_ptr<Tensor<f32>> scaled_dot_product_attention_impl(const Tensor<f32>& q, const Tensor<f32>& k, const Tensor<f32>& v,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params, std::shared_ptr<Tensor<f32>>* lse)
+	{
+		return attention_forward(q, k, v, key_padding_mask, params, lse);
+	}
+
+	std::shared_ptr<Tensor<f64>> scaled_dot_product_attention_impl(const Tensor<f64>& q, const Tensor<f64>& k, const Tensor<f64>& v,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params, std::shared_ptr<Tensor<f64>>* lse)
+	{
+		return attention_forward(q, k, v, key_padding_mask, params, lse);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f32>>> scaled_dot_product_attention_backward_impl(const Tensor<f32>& grad,
+		const Tensor<f32>& q, const Tensor<f32>& k, const Tensor<f32>& v, const Tensor<f32>& output, const Tensor<f32>& lse,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params)
+	{
+		return attention_backward(grad, q, k, v, output, lse, key_padding_mask, params);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f64>>> scaled_dot_product_attention_backward_impl(const Tensor<f64>& grad,
+		const Tensor<f64>& q, const Tensor<f64>& k, const Tensor<f64>& v, const Tensor<f64>& output, const Tensor<f64>& lse,
+		const Tensor<u8>* key_padding_mask, const AttentionParams& params)
+	{
+		return attention_backward(grad, q, k, v, output, lse, key_padding_mask, params);
+	}
+
+	std::shared_ptr<Tensor<f32>> paged_attention_impl(const Tensor<f32>& q, const KVCacheLayer<f32>& cache,
+		const std::vector<idx_type>& sequences, const AttentionParams& params)
+	{
+		return paged_attention(q, cache, sequences, params);
+	}
+
+	std::shared_ptr<Tensor<f64>> paged_attention_impl(const Tensor<f64>& q, const KVCacheLayer<f64>& cache,
+		const std::vector<idx_type>& sequences, const AttentionParams& params)
+	{
+		return paged_attention(q, cache, sequences, params);
+	}
+}
@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <omp.h>
+
+#include <traph/tensor/blas.h>
+#include <traph/tensor/gemm.h>
+
+#include <eigen3/Eigen/Dense>
+
+#ifdef TRAPH_BUILD_MKL
+#include <mkl.h>
+#include <mkl_blas.h>
+#include <mkl_cblas.h>
+#elif defined TRAPH_BUILD_OPENBLAS
+#include <openBLAS/cblas.h>
+#endif
+
+namespace traph
+{
+	namespace
+	{
+		template<typename T>
+		using GemmFunction = bool(*)(idx_type m, idx_type n, idx_type k, T alpha,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs);
+
+		// largest bucket, every dimension above 2^16 shares it
+		const int max_bucket = 16;
+		// multiply-adds timed per backend when tuning a bucket, small shapes are repeated
+		const double tune_flops = 1e7;
+		const int tune_max_repeat = 20;
+
+		template<typename T>
+		bool native_backend(idx_type m, idx_type n, idx_type k, T alpha,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			native_gemm(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+			return true;
+		}
+
+		template<typename T>
+		using RowMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+		template<typename T>
+		using ColMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>;
+
+		// Calls f with a Map (ConstMap or MutableMap) over a matrix with one unit stride,
+		// other layouts return false.
+		template<template<typename> class Map, typename T, typename P, typename F>
+		bool with_eigen_map(P* ptr, idx_type rows, idx_type cols, idx_type rs, idx_type cs, F f)
+		{
+			if (cs == 1 || cols == 1)
+				f(Map<RowMajorMatrix<T>>(ptr, rows, cols, Eigen::OuterStride<>(std::max<idx_type>(rs, 1))));
+			else if (rs == 1 || rows == 1)
+				f(Map<ColMajorMatrix<T>>(ptr, rows, cols, Eigen::OuterStride<>(std::max<idx_type>(cs, 1))));
+			else
+				return false;
+			return true;
+		}
+
+		template<typename M>
+		using ConstMap = Eigen::Map<const M, 0, Eigen::OuterStride<>>;
+		template<typename M>
+		using MutableMap = Eigen::Map<M, 0, Eigen::OuterStride<>>;
+
+		template<typename T>
+		bool eigen_backend(idx_type m, idx_type n, idx_type k, T alpha,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			bool done = false;
+			with_eigen_map<ConstMap, T>(a, m, k, a_rs, a_cs, [&](const auto& eigen_a) {
+				with_eigen_map<ConstMap, T>(b, k, n, b_rs, b_cs, [&](const auto& eigen_b) {
+					done = with_eigen_map<MutableMap, T>(c, m, n, c_rs, c_cs, [&](auto&& eigen_c) {
+						if (beta == T(0))
+						{
+							eigen_c.noalias() = alpha * eigen_a * eigen_b;
+						}
+						else
+						{
+							if (beta != T(1))
+								eigen_c *= beta;
+							eigen_c.noalias() += alpha * eigen_a * eigen_b;
+						}
+					});
+				});
+			});
+			return done;
+		}
+
+#if defined TRAPH_BUILD_MKL || defined TRAPH_BUILD_OPENBLAS
+		// Describes a matrix the way cblas does for a call in row- or column-major order: either
+		// it is stored in that order (NoTrans) or its transpose is (Trans), with ld as the
+		// distance between consecutive rows (columns) of the stored matrix. Other layouts
+		// return false.
+		bool cblas_operand(idx_type rows, idx_type cols, idx_type rs, idx_type cs, bool row_major_call,
+			CBLAS_TRANSPOSE& trans, idx_type& ld)
+		{
+			idx_type outer = row_major_call ? rs : cs, inner = row_major_call ? cs : rs;
+			idx_type outer_size = row_major_call ? rows : cols, inner_size = row_major_call ? cols : rows;
+
+			if ((inner == 1 || inner_size == 1) && (outer >= inner_size || outer_size == 1))
+			{
+				trans = CblasNoTrans;
+				ld = std::max<idx_type>(outer_size == 1 ? inner_size : outer, 1);
+				return true;
+			}
+			if ((outer == 1 || outer_size == 1) && (inner >= outer_size || inner_size == 1))
+			{
+				trans = CblasTrans;
+				ld = std::max<idx_type>(inner_size == 1 ? outer_size : inner, 1);
+				return true;
+			}
+			return false;
+		}
+
+		void cblas_call(bool row_major_call, CBLAS_TRANSPOSE trans_a, CBLAS_TRANSPOSE trans_b,
+			idx_type m, idx_type n, idx_type k, f32 alpha, const f32* a, idx_type lda, const f32* b, idx_type ldb,
+			f32 beta, f32* c, idx_type ldc)
+		{
+			cblas_sgemm(row_major_call ? CblasRowMajor : CblasColMajor, trans_a, trans_b,
+				m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+		}
+
+		void cblas_call(bool row_major_call, CBLAS_TRANSPOSE trans_a, CBLAS_TRANSPOSE trans_b,
+			idx_type m, idx_type n, idx_type k, f64 alpha, const f64* a, idx_type lda, const f64* b, idx_type ldb,
+			f64 beta, f64* c, idx_type ldc)
+		{
+			cblas_dgemm(row_major_call ? CblasRowMajor : CblasColMajor, trans_a, trans_b,
+				m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+		}
+
+		void cblas_gemv_call(bool row_major_call, CBLAS_TRANSPOSE trans, idx_type m, idx_type n, f32 alpha,
+			const f32* a, idx_type lda, const f32* x, idx_type incx, f32 beta, f32* y, idx_type incy)
+		{
+			cblas_sgemv(row_major_call ? CblasRowMajor : CblasColMajor, trans, m, n, alpha, a, lda, x, incx, beta, y, incy);
+		}
+
+		void cblas_gemv_call(bool row_major_call, CBLAS_TRANSPOSE trans, idx_type m, idx_type n, f64 alpha,
+			const f64* a, idx_type lda, const f64* x, idx_type incx, f64 beta, f64* y, idx_type incy)
+		{
+			cblas_dgemv(row_major_call ? CblasRowMajor : CblasColMajor, trans, m, n, alpha, a, lda, x, incx, beta, y, incy);
+		}
+
+		// the call order follows C, transposed views of A and B become transpose flags, and a
+		// single output column (or row) goes to gemv
+		template<typename T>
+		bool cblas_backend(idx_type m, idx_type n, idx_type k, T alpha,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			if (m == 1 && n > 1)
+				return cblas_backend(n, m, k, alpha, b, b_cs, b_rs, a, a_cs, a_rs, beta, c, c_cs, c_rs);
+
+			if (n == 1 && k > 0 && b_rs != 0 && c_rs != 0)
+			{
+				// y = A x, with A stored in row-major order or transposed
+				CBLAS_TRANSPOSE trans_a;
+				idx_type lda;
+				if (!cblas_operand(m, k, a_rs, a_cs, true, trans_a, lda))
+					return false;
+				if (trans_a == CblasNoTrans)
+					cblas_gemv_call(true, CblasNoTrans, m, k, alpha, a, lda, b, b_rs, beta, c, c_rs);
+				else
+					cblas_gemv_call(true, CblasTrans, k, m, alpha, a, lda, b, b_rs, beta, c, c_rs);
+				return true;
+			}
+
+			for (int order = 0; order < 2; ++order)
+			{
+				bool row_major_call = order == 0;
+				CBLAS_TRANSPOSE trans_a, trans_b, trans_c;
+				idx_type lda, ldb, ldc;
+				if (cblas_operand(m, n, c_rs, c_cs, row_major_call, trans_c, ldc) && trans_c == CblasNoTrans &&
+					cblas_operand(m, k, a_rs, a_cs, row_major_call, trans_a, lda) &&
+					cblas_operand(k, n, b_rs, b_cs, row_major_call, trans_b, ldb))
+				{
+					cblas_call(row_major_call, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+					return true;
+				}
+			}
+			return false;
+		}
+#endif
+
+		int bucket(idx_type x)
+		{
+			int result = 0;
+			while (result < max_bucket && (idx_type(1) << result) < x)
+				++result;
+			return result;
+		}
+
+		// A (or B) counts as transposed when its columns are contiguous
+		bool is_transposed(idx_type rs, idx_type cs)
+		{
+			return rs == 1 && cs != 1;
+		}
+
+		const char* dtype_name(int dtype)
+		{
+			return dtype == DataType::DOUBLE ? "f64" : "f32";
+		}
+
+		// best of a few runs of one backend on scratch operands of the given shape, infinite
+		// when the backend rejects the layout
+		template<typename T>
+		double time_backend(GemmFunction<T> gemm, idx_type m, idx_type n, idx_type k, bool trans_a, bool trans_b)
+		{
+			std::vector<T> a(static_cast<std::size_t>(m) * k, T(0.5));
+			std::vector<T> b(static_cast<std::size_t>(k) * n, T(0.25));
+			std::vector<T> c(static_cast<std::size_t>(m) * n, T(0));
+			idx_type a_rs = trans_a ? 1 : k, a_cs = trans_a ? m : 1;
+			idx_type b_rs = trans_b ? 1 : n, b_cs = trans_b ? k : 1;
+
+			auto run = [&]() {
+				return gemm(m, n, k, T(1), a.data(), a_rs, a_cs, b.data(), b_rs, b_cs, T(0), c.data(), n, 1);
+			};
+			if (!run())
+				return std::numeric_limits<double>::infinity();
+
+			double flops = static_cast<double>(m) * n * k;
+			int repeat = static_cast<int>(std::min<double>(tune_max_repeat, std::max(1.0, tune_flops / std::max(flops, 1.0))));
+			double best = std::numeric_limits<double>::infinity();
+			for (int i = 0; i < repeat; ++i)
+			{
+				auto begin = std::chrono::steady_clock::now();
+				run();
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+				best = std::min(best, elapsed.count());
+			}
+			return best;
+		}
+
+		// none unless asked for, so programs and tests do not write to the home directory
+		std::string default_cache_path()
+		{
+			const char* path = std::getenv("TRAPH_BLAS_CACHE");
+			return path ? std::string(path) : std::string();
+		}
+	}
+
+	BlasRegistry::BlasRegistry()
+		:_autotune(true), _cache_path(default_cache_path())
+	{
+		// native first: it accepts every layout and is the choice while a bucket is untuned
+		_backends.push_back({ "native", native_backend<f32>, native_backend<f64> });
+		_backends.push_back({ "eigen", eigen_backend<f32>, eigen_backend<f64> });
+#ifdef TRAPH_BUILD_MKL
+		_backends.push_back({ "mkl", cblas_backend<f32>, cblas_backend<f64> });
+#elif defined TRAPH_BUILD_OPENBLAS
+		_backends.push_back({ "openblas", cblas_backend<f32>, cblas_backend<f64> });
+#endif
+		load_cache();
+	}
+
+	BlasRegistry& BlasRegistry::get()
+	{
+		static BlasRegistry registry;
+		return registry;
+	}
+
+	void BlasRegistry::load_cache()
+	{
+		if (_cache_path.empty())
+			return;
+		std::ifstream file(_cache_path);
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+			std::istringstream fields(line);
+			std::string dtype, name;
+			int trans_a, trans_b, m, n, k;
+			if (fields >> dtype >> trans_a >> trans_b >> m >> n >> k >> name)
+			{
+				int dtype_id = dtype == "f64" ? DataType::DOUBLE : DataType::FLOAT;
+				_choices[BucketKey(dtype_id, trans_a != 0, trans_b != 0, m, n, k)] = name;
+			}
+		}
+	}
+
+	void BlasRegistry::store_choice(const BucketKey& key, const std::string& name)
+	{
+		if (_cache_path.empty())
+			return;
+		std::ofstream file(_cache_path, std::ios::app);
+		file << dtype_name(std::get<0>(key)) << ' ' << std::get<1>(key) << ' ' << std::get<2>(key) << ' '
+			<< std::get<3>(key) << ' ' << std::get<4>(key) << ' ' << std::get<5>(key) << ' ' << name << '\n';
+	}
+
+	std::size_t BlasRegistry::find_backend(const std::string& name) const
+	{
+		for (std::size_t i = 0; i < _backends.size(); ++i)
+			if (_backends[i].name == name)
+				return i;
+		return _backends.size();
+	}
+
+	std::size_t BlasRegistry::tune(const BucketKey& key, DataType dtype, idx_type m, idx_type n, idx_type k, bool trans_a, bool trans_b)
+	{
+		std::size_t best = 0;
+		double best_time = std::numeric_limits<double>::infinity();
+		for (std::size_t i = 0; i < _backends.size(); ++i)
+		{
+			double time = dtype == DataType::DOUBLE ?
+				time_backend<f64>(_backends[i].dgemm, m, n, k, trans_a, trans_b) :
+				time_backend<f32>(_backends[i].sgemm, m, n, k, trans_a, trans_b);
+			if (time < best_time)
+			{
+				best = i;
+				best_time = time;
+			}
+		}
+		_choices[key] = _backends[best].name;
+		store_choice(key, _backends[best].name);
+		return best;
+	}
+
+	std::size_t BlasRegistry::choose(DataType dtype, idx_type m, idx_type n, idx_type k, bool trans_a, bool trans_b)
+	{
+		BucketKey key(dtype, trans_a, trans_b, bucket(m), bucket(n), bucket(k));
+		{
+			std::shared_lock<std::shared_mutex> lock(_mutex);
+			if (!_forced.empty())
+				return find_backend(_forced);
+			auto found = _choices.find(key);
+			if (found != _choices.end())
+			{
+				std::size_t index = find_backend(found->second);
+				if (index < _backends.size())
+					return index;
+			}
+			// timings taken inside a parallel region would not be representative
+			if (!_autotune || _backends.size() == 1 || omp_in_parallel())
+				return 0;
+		}
+
+		std::unique_lock<std::shared_mutex> lock(_mutex);
+		auto found = _choices.find(key);
+		if (found != _choices.end() && find_backend(found->second) < _backends.size())
+			return find_backend(found->second);
+		return tune(key, dtype, m, n, k, trans_a, trans_b);
+	}
+
+	void BlasRegistry::register_backend(const std::string& name, SgemmFunction sgemm, DgemmFunction dgemm)
+	{
+		std::unique_lock<std::shared_mutex> lock(_mutex);
+		std::size_t index = find_backend(name);
+		if (index < _backends.size())
+			_backends[index] = { name, sgemm, dgemm };
+		else
+			_backends.push_back({ name, sgemm, dgemm });
+	}
+
+	std::vector<std::string> BlasRegistry::backends() const
+	{
+		std::shared_lock<std::shared_mutex> lock(_mutex);
+		std::vector<std::string> names;
+		for (const Backend& backend : _backends)
+			names.push_back(backend.name);
+		return names;
+	}
+
+	void BlasRegistry::backend_(const std::string& name)
+	{
+		std::unique_lock<std::shared_mutex> lock(_mutex);
+		if (!name.empty() && find_backend(name) == _backends.size())
+			throw std::runtime_error("blas: Unknown backend " + name + ".");
+		_forced = name;
+	}
+
+	std::string BlasRegistry::backend() const
+	{
+		std::shared_lock<std::shared_mutex> lock(_mutex);
+		return _forced;
+	}
+
+	void BlasRegistry::autotune_(bool enable)
+	{
+		std::unique_lock<std::shared_mutex> lock(_mutex);
+		_autotune = enable;
+	}
+
+	bool BlasRegistry::autotune() const
+	{
+		std::shared_lock<std::shared_mutex> lock(_mutex);
+		return _autotune;
+	}
+
+	void BlasRegistry::cache_path_(const std::string& path)
+	{
+		std::unique_lock<std::shared_mutex> lock(_mutex);
+		_cache_path = path;
+		load_cache();
+	}
+
+	std::string BlasRegistry::cache_path() const
+	{
+		std::shared_lock<std::shared_mutex> lock(_mutex);
+		return _cache_path;
+	}
+
+	void BlasRegistry::clear_choices()
+	{
+		std::unique_lock<std::shared_mutex> lock(_mutex);
+		_choices.clear();
+	}
+
+	std::string BlasRegistry::select(DataType dtype, idx_type m, idx_type n, idx_type k, bool trans_a, bool trans_b)
+	{
+		std::size_t index = choose(dtype, m, n, k, trans_a, trans_b);
+		std::shared_lock<std::shared_mutex> lock(_mutex);
+		return _backends[index].name;
+	}
+
+	void BlasRegistry::gemm(idx_type m, idx_type n, idx_type k, f32 alpha,
+		const f32* a, idx_type a_rs, idx_type a_cs,
+		const f32* b, idx_type b_rs, idx_type b_cs,
+		f32 beta, f32* c, idx_type c_rs, idx_type c_cs)
+	{
+		std::size_t index = choose(DataType::FLOAT, m, n, k, is_transposed(a_rs, a_cs), is_transposed(b_rs, b_cs));
+		SgemmFunction function;
+		{
+			std::shared_lock<std::shared_mutex> lock(_mutex);
+			function = _backends[index].sgemm;
+		}
+		if (!function(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs))
+			native_gemm(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+	}
+
+	void BlasRegistry::gemm(idx_type m, idx_type n, idx_type k, f64 alpha,
+		const f64* a, idx_type a_rs, idx_type a_cs,
+		const f64* b, idx_type b_rs, idx_type b_cs,
+		f64 beta, f64* c, idx_type c_rs, idx_type c_cs)
+	{
+		std::size_t index = choose(DataType::DOUBLE, m, n, k, is_transposed(a_rs, a_cs), is_transposed(b_rs, b_cs));
+		DgemmFunction function;
+		{
+			std::shared_lock<std::shared_mutex> lock(_mutex);
+			function = _backends[index].dgemm;
+		}
+		if (!function(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs))
+			native_gemm(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+	}
+}
@@ -0,0 +1,1241 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <omp.h>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/conv.h>
+#include <traph/tensor/blas.h>
+#include <traph/tensor/gemm.h>
+
+namespace traph
+{
+	namespace
+	{
+		// below this many multiply-adds per image the batch is split between threads instead of
+		// the gemms, like in arithmetic.cpp
+		const double batch_parallel_threshold = 64.0 * 64.0 * 64.0;
+
+		std::atomic<ConvAlgorithm> algorithm_choice(ConvAlgorithm::AUTO);
+		std::atomic<idx_type> workspace_allocations(0);
+
+		void conv_error(const std::string& message)
+		{
+			throw std::runtime_error("conv2d: " + message + ".");
+		}
+
+		// Scratch memory of one thread that only grows. It lives as long as the thread, so the
+		// im2col matrix of repeated convolutions (and of every image of a batch) reuses it.
+		class Workspace
+		{
+		private:
+			std::unique_ptr<char[]> _data;
+			std::size_t _capacity = 0;
+		public:
+			template<typename T>
+			T* get(std::size_t count)
+			{
+				std::size_t bytes = count * sizeof(T);
+				if (bytes > _capacity)
+				{
+					_data.reset(new char[bytes]);
+					_capacity = bytes;
+					++workspace_allocations;
+				}
+				return reinterpret_cast<T*>(_data.get());
+			}
+		};
+
+		enum WorkspaceSlot
+		{
+			COLUMNS_SLOT,
+			PADDED_SLOT,
+			WEIGHT_SLOT,
+			PRODUCT_SLOT,
+			SLOT_COUNT
+		};
+
+		Workspace& workspace(WorkspaceSlot slot)
+		{
+			thread_local Workspace spaces[SLOT_COUNT];
+			return spaces[slot];
+		}
+
+		DataType data_type(f32)
+		{
+			return DataType::FLOAT;
+		}
+
+		DataType data_type(f64)
+		{
+			return DataType::DOUBLE;
+		}
+
+		struct ConvShape
+		{
+			idx_type batch, channels, height, width;
+			idx_type out_channels, kernel_h, kernel_w, out_h, out_w;
+			idx_type groups, group_channels, group_out;
+
+			// rows of the im2col matrix of one group
+			idx_type col_rows() const { return group_channels * kernel_h * kernel_w; }
+			idx_type pixels() const { return out_h * out_w; }
+		};
+
+		ConvShape conv_shape(const DimVector& input, const DimVector& weight, const Conv2dParams& params)
+		{
+			if (input.size() != 4)
+				conv_error("The input shall be [N, C, H, W]");
+			if (weight.size() != 4)
+				conv_error("The weight shall be [O, C / groups, KH, KW]");
+			if (params.stride_h < 1 || params.stride_w < 1 || params.dilation_h < 1 || params.dilation_w < 1)
+				conv_error("Stride and dilation shall be positive");
+			if (params.padding_h < 0 || params.padding_w < 0)
+				conv_error("Padding shall not be negative");
+			if (params.groups < 1)
+				conv_error("Groups shall be positive");
+
+			ConvShape s;
+			s.batch = input[0];
+			s.channels = input[1];
+			s.height = input[2];
+			s.width = input[3];
+			s.out_channels = weight[0];
+			s.kernel_h = weight[2];
+			s.kernel_w = weight[3];
+			s.groups = params.groups;
+			if (s.channels % s.groups != 0 || s.out_channels % s.groups != 0)
+				conv_error("Input and output channels shall be divisible by groups");
+			s.group_channels = s.channels / s.groups;
+			s.group_out = s.out_channels / s.groups;
+			if (weight[1] != s.group_channels)
+				conv_error("The weight has " + std::to_string(weight[1]) + " input channels, expected " + std::to_string(s.group_channels));
+
+			s.out_h = conv_output_size(s.height, s.kernel_h, params.stride_h, params.padding_h, params.dilation_h);
+			s.out_w = conv_output_size(s.width, s.kernel_w, params.stride_w, params.padding_w, params.dilation_w);
+			if (s.out_h <= 0 || s.out_w <= 0)
+				conv_error("The padded input is smaller than the dilated kernel");
+			return s;
+		}
+
+		template<typename T>
+		ConvShape conv_shape(const Tensor<T>& input, const Tensor<T>& weight, const Tensor<T>* bias, const Conv2dParams& params)
+		{
+			ConvShape s = conv_shape(input.size(), weight.size(), params);
+			if (bias && (bias->ndimension() != 1 || bias->size(0) != s.out_channels))
+				conv_error("The bias shall be [O]");
+			return s;
+		}
+
+		// a 1x1 kernel without stride and padding reads the input as the im2col matrix
+		bool pointwise(const ConvShape& s, const Conv2dParams& params)
+		{
+			return s.kernel_h == 1 && s.kernel_w == 1 && params.stride_h == 1 && params.stride_w == 1 &&
+				params.padding_h == 0 && params.padding_w == 0;
+		}
+
+		template<typename T>
+		bool is_contiguous(const Tensor<T>& t)
+		{
+			idx_type expected = 1;
+			for (idx_type d = t.ndimension() - 1; d >= 0; --d)
+			{
+				if (t.size(d) != 1 && t.stride(d) != expected)
+					return false;
+				expected *= t.size(d);
+			}
+			return true;
+		}
+
+		// data of t in row-major order, copied into storage when t is a strided view
+		template<typename T>
+		const T* contiguous_data(const Tensor<T>& t, std::vector<T>& storage)
+		{
+			const T* base = t.data_ptr() + t.offset();
+			if (is_contiguous(t))
+				return base;
+			idx_type dims = t.ndimension();
+			idx_type count = t.size().flat_size();
+			storage.resize(count);
+			std::vector<idx_type> index(dims, 0);
+			for (idx_type i = 0; i < count; ++i)
+			{
+				idx_type pos = 0;
+				for (idx_type d = 0; d < dims; ++d)
+					pos += index[d] * t.stride(d);
+				storage[i] = base[pos];
+				for (idx_type d = dims - 1; d >= 0; --d)
+				{
+					if (++index[d] < t.size(d))
+						break;
+					index[d] = 0;
+				}
+			}
+			return storage.data();
+		}
+
+		// output columns [first, last) of a row read input columns iw0 + ow * stride inside [0, width)
+		void valid_columns(idx_type iw0, idx_type stride, idx_type width, idx_type out_w, idx_type& first, idx_type& last)
+		{
+			first = iw0 >= 0 ? 0 : (-iw0 + stride - 1) / stride;
+			last = iw0 >= width ? 0 : std::min(out_w, (width - 1 - iw0) / stride + 1);
+			first = std::min(first, out_w);
+			last = std::max(last, first);
+		}
+
+		// columns[(c * KH + kh) * KW + kw][oh * OW + ow] is the input pixel under tap (kh, kw) of
+		// output pixel (oh, ow), zero in the padding
+		template<typename T>
+		void im2col(const T* input, idx_type channels, const ConvShape& s, const Conv2dParams& params, T* columns)
+		{
+			const idx_type pixels = s.pixels();
+			for (idx_type c = 0; c < channels; ++c)
+			{
+				const T* plane = input + c * s.height * s.width;
+				for (idx_type kh = 0; kh < s.kernel_h; ++kh)
+					for (idx_type kw = 0; kw < s.kernel_w; ++kw)
+					{
+						T* col = columns + ((c * s.kernel_h + kh) * s.kernel_w + kw) * pixels;
+						idx_type iw0 = kw * params.dilation_w - params.padding_w;
+						idx_type first, last;
+						valid_columns(iw0, params.stride_w, s.width, s.out_w, first, last);
+						for (idx_type oh = 0; oh < s.out_h; ++oh)
+						{
+							T* dst = col + oh * s.out_w;
+							idx_type ih = oh * params.stride_h - params.padding_h + kh * params.dilation_h;
+							if (ih < 0 || ih >= s.height)
+							{
+								std::fill(dst, dst + s.out_w, T(0));
+								continue;
+							}
+							const T* src = plane + ih * s.width + iw0;
+							std::fill(dst, dst + first, T(0));
+							if (params.stride_w == 1)
+								std::copy(src + first, src + last, dst + first);
+							else
+								for (idx_type ow = first; ow < last; ++ow)
+									dst[ow] = src[ow * params.stride_w];
+							std::fill(dst + last, dst + s.out_w, T(0));
+						}
+					}
+			}
+		}
+
+		// adds every column back to the input pixel it was read from
+		template<typename T>
+		void col2im(const T* columns, idx_type channels, const ConvShape& s, const Conv2dParams& params, T* input)
+		{
+			const idx_type pixels = s.pixels();
+			for (idx_type c = 0; c < channels; ++c)
+			{
+				T* plane = input + c * s.height * s.width;
+				for (idx_type kh = 0; kh < s.kernel_h; ++kh)
+					for (idx_type kw = 0; kw < s.kernel_w; ++kw)
+					{
+						const T* col = columns + ((c * s.kernel_h + kh) * s.kernel_w + kw) * pixels;
+						idx_type iw0 = kw * params.dilation_w - params.padding_w;
+						idx_type first, last;
+						valid_columns(iw0, params.stride_w, s.width, s.out_w, first, last);
+						for (idx_type oh = 0; oh < s.out_h; ++oh)
+						{
+							idx_type ih = oh * params.stride_h - params.padding_h + kh * params.dilation_h;
+							if (ih < 0 || ih >= s.height)
+								continue;
+							const T* src = col + oh * s.out_w;
+							T* dst = plane + ih * s.width + iw0;
+							for (idx_type ow = first; ow < last; ++ow)
+								dst[ow * params.stride_w] += src[ow];
+						}
+					}
+			}
+		}
+
+		// y[O, OH * OW] = W * columns + bias, one gemm per group
+		template<typename T>
+		void forward_image(const T* x, const T* weight, const T* bias, const ConvShape& s, const Conv2dParams& params, T* y)
+		{
+			const idx_type k = s.col_rows(), pixels = s.pixels();
+			const bool direct_input = pointwise(s, params);
+			T* columns = direct_input ? nullptr : workspace(COLUMNS_SLOT).get<T>(k * pixels);
+			for (idx_type g = 0; g < s.groups; ++g)
+			{
+				const T* x_g = x + g * s.group_channels * s.height * s.width;
+				T* y_g = y + g * s.group_out * pixels;
+				const T* b = x_g;
+				if (!direct_input)
+				{
+					im2col(x_g, s.group_channels, s, params, columns);
+					b = columns;
+				}
+				T beta = T(0);
+				if (bias)
+				{
+					for (idx_type o = 0; o < s.group_out; ++o)
+						std::fill(y_g + o * pixels, y_g + (o + 1) * pixels, bias[g * s.group_out + o]);
+					beta = T(1);
+				}
+				BlasRegistry::get().gemm(s.group_out, pixels, k, T(1), weight + g * s.group_out * k, k, idx_type(1),
+					b, pixels, idx_type(1), beta, y_g, pixels, idx_type(1));
+			}
+		}
+
+		// dW += dY * columns^T and dX = col2im(W^T * dY), one pair of gemms per group; the
+		// gradient of the columns overwrites the columns once dW is done with them
+		template<typename T>
+		void backward_image(const T* x, const T* weight, const T* dy, const ConvShape& s, const Conv2dParams& params, T* dx, T* dw)
+		{
+			const idx_type k = s.col_rows(), pixels = s.pixels();
+			const bool direct_input = pointwise(s, params);
+			T* columns = direct_input ? nullptr : workspace(COLUMNS_SLOT).get<T>(k * pixels);
+			for (idx_type g = 0; g < s.groups; ++g)
+			{
+				const T* x_g = x + g * s.group_channels * s.height * s.width;
+				const T* w_g = weight + g * s.group_out * k;
+				const T* dy_g = dy + g * s.group_out * pixels;
+				T* dx_g = dx + g * s.group_channels * s.height * s.width;
+				const T* cols = x_g;
+				if (!direct_input)
+				{
+					im2col(x_g, s.group_channels, s, params, columns);
+					cols = columns;
+				}
+				BlasRegistry::get().gemm(s.group_out, k, pixels, T(1), dy_g, pixels, idx_type(1),
+					cols, idx_type(1), pixels, T(1), dw + g * s.group_out * k, k, idx_type(1));
+				if (direct_input)
+				{
+					BlasRegistry::get().gemm(k, pixels, s.group_out, T(1), w_g, idx_type(1), k,
+						dy_g, pixels, idx_type(1), T(0), dx_g, pixels, idx_type(1));
+				}
+				else
+				{
+					BlasRegistry::get().gemm(k, pixels, s.group_out, T(1), w_g, idx_type(1), k,
+						dy_g, pixels, idx_type(1), T(0), columns, pixels, idx_type(1));
+					col2im(columns, s.group_channels, s, params, dx_g);
+				}
+			}
+		}
+
+		// Independent products go to separate threads when there are enough of them to keep
+		// every thread busy or when each one is too small to split.
+		bool parallel_batch(idx_type count, double flops)
+		{
+			int threads = omp_get_max_threads();
+			return count > 1 && threads > 1 && !omp_in_parallel() &&
+				(count >= threads || flops < batch_parallel_threshold) &&
+				flops * count >= batch_parallel_threshold;
+		}
+
+		bool parallel_images(const ConvShape& s)
+		{
+			return parallel_batch(s.batch, static_cast<double>(s.out_channels) * s.pixels() * s.col_rows());
+		}
+
+		template<typename T>
+		void im2col_conv(const T* x, const T* weight, const T* bias, const ConvShape& s, const Conv2dParams& params, T* y)
+		{
+			const idx_type image_size = s.channels * s.height * s.width, out_size = s.out_channels * s.pixels();
+			bool parallel = parallel_images(s);
+			if (parallel)
+				BlasRegistry::get().select(data_type(T()), s.group_out, s.pixels(), s.col_rows(), false, false);
+			int batch = static_cast<int>(s.batch);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int n = 0; n < batch; ++n)
+				forward_image(x + n * image_size, weight, bias, s, params, y + n * out_size);
+		}
+
+		// one image in the input layout of native_direct_conv2d: [C / cb][HP][WP][cb] with zeros
+		// around the image and past the last channel, then zeros the last tile may read
+		void pack_image(const f32* image, const ConvShape& s, const Conv2dParams& params, idx_type channel_block, idx_type slack, f32* packed)
+		{
+			const idx_type padded_h = s.height + 2 * params.padding_h, padded_w = s.width + 2 * params.padding_w;
+			const idx_type channel_blocks = (s.channels + channel_block - 1) / channel_block;
+			const idx_type block_size = padded_h * padded_w * channel_block;
+			std::fill(packed, packed + channel_blocks * block_size + slack, 0.f);
+			for (idx_type c = 0; c < s.channels; ++c)
+			{
+				f32* block = packed + (c / channel_block) * block_size + c % channel_block;
+				for (idx_type h = 0; h < s.height; ++h)
+				{
+					const f32* src = image + (c * s.height + h) * s.width;
+					f32* dst = block + ((h + params.padding_h) * padded_w + params.padding_w) * channel_block;
+					for (idx_type w = 0; w < s.width; ++w)
+						dst[w * channel_block] = src[w];
+				}
+			}
+		}
+
+		void direct_conv(const f32* x, const f32* weight, const f32* bias, const ConvShape& s, const Conv2dParams& params, f32* y)
+		{
+			const DirectConvLayout layout = native_direct_conv2d_layout();
+			const idx_type lanes = layout.lanes;
+			const idx_type channel_block = std::min(s.channels, layout.channel_block);
+			const idx_type channel_blocks = (s.channels + channel_block - 1) / channel_block;
+			const idx_type blocks = (s.out_channels + lanes - 1) / lanes;
+			const idx_type taps = s.kernel_h * s.kernel_w;
+
+			// [O / lanes][C / cb][KH][KW][cb][lanes]
+			const idx_type weight_size = blocks * channel_blocks * taps * channel_block * lanes;
+			f32* packed_weight = workspace(WEIGHT_SLOT).get<f32>(weight_size);
+			std::fill(packed_weight, packed_weight + weight_size, 0.f);
+			for (idx_type o = 0; o < s.out_channels; ++o)
+				for (idx_type c = 0; c < s.channels; ++c)
+					for (idx_type t = 0; t < taps; ++t)
+						packed_weight[((((o / lanes) * channel_blocks + c / channel_block) * taps + t) * channel_block + c % channel_block) * lanes + o % lanes] =
+							weight[(o * s.channels + c) * taps + t];
+
+			const idx_type padded_h = s.height + 2 * params.padding_h, padded_w = s.width + 2 * params.padding_w;
+			const idx_type slack = layout.tile_width * params.stride_w * channel_block;
+			f32* packed = workspace(PADDED_SLOT).get<f32>(channel_blocks * padded_h * padded_w * channel_block + slack);
+			for (idx_type n = 0; n < s.batch; ++n)
+			{
+				pack_image(x + n * s.channels * s.height * s.width, s, params, channel_block, slack, packed);
+				native_direct_conv2d(channel_blocks, channel_block, padded_h, padded_w, packed, s.out_channels, s.kernel_h, s.kernel_w,
+					packed_weight, bias, params, s.out_h, s.out_w, y + n * s.out_channels * s.pixels());
+			}
+		}
+
+		void direct_conv(const f64*, const f64*, const f64*, const ConvShape&, const Conv2dParams&, f64*)
+		{
+			conv_error("The direct kernels only support f32");
+		}
+
+		// Winograd F(m x m, 3 x 3), Lavin and Gray, "Fast Algorithms for Convolutional Neural
+		// Networks". Every m x m output tile is A^T [(G g G^T) * (B^T d B)] A for the
+		// (m + 2) x (m + 2) input tile d it reads, so the products of all tiles are alpha^2
+		// gemms over the channels of the transformed weights and inputs, 16 instead of 36
+		// multiplications per 2x2 tile and 36 instead of 144 per 4x4 tile.
+		// Tiles are transformed in blocks of this many consecutive tiles of a row. B^T d and
+		// A^T m are spelled out for one column (or row) of a block: element k of tile t is at
+		// in[k * in_stride + t * in_step] and goes to out[k * out_stride + t * out_step], the
+		// loop over the tiles has a fixed trip count and vectorises. The tiles past the end of
+		// a row are computed and dropped.
+		const int winograd_block = 16;
+
+		template<int M>
+		struct WinogradMatrices;
+
+		template<>
+		struct WinogradMatrices<2>
+		{
+			static const int alpha = 4;
+			static constexpr double g[4][3] = {
+				{ 1, 0, 0 },
+				{ 0.5, 0.5, 0.5 },
+				{ 0.5, -0.5, 0.5 },
+				{ 0, 0, 1 } };
+
+			template<typename T>
+			static void input(const T* in, idx_type in_stride, idx_type in_step, T* out, idx_type out_stride, idx_type out_step)
+			{
+				for (int t = 0; t < winograd_block; ++t)
+				{
+					const T* d = in + t * in_step;
+					T* o = out + t * out_step;
+					T d0 = d[0], d1 = d[in_stride], d2 = d[2 * in_stride], d3 = d[3 * in_stride];
+					o[0] = d0 - d2;
+					o[out_stride] = d1 + d2;
+					o[2 * out_stride] = d2 - d1;
+					o[3 * out_stride] = d1 - d3;
+				}
+			}
+
+			template<typename T>
+			static void output(const T* in, idx_type in_stride, idx_type in_step, T* out, idx_type out_stride, idx_type out_step)
+			{
+				for (int t = 0; t < winograd_block; ++t)
+				{
+					const T* m = in + t * in_step;
+					T* o = out + t * out_step;
+					T m1 = m[in_stride], m2 = m[2 * in_stride];
+					o[0] = m[0] + m1 + m2;
+					o[out_stride] = m1 - m2 - m[3 * in_stride];
+				}
+			}
+		};
+
+		template<>
+		struct WinogradMatrices<4>
+		{
+			static const int alpha = 6;
+			static constexpr double g[6][3] = {
+				{ 1.0 / 4, 0, 0 },
+				{ -1.0 / 6, -1.0 / 6, -1.0 / 6 },
+				{ -1.0 / 6, 1.0 / 6, -1.0 / 6 },
+				{ 1.0 / 24, 1.0 / 12, 1.0 / 6 },
+				{ 1.0 / 24, -1.0 / 12, 1.0 / 6 },
+				{ 0, 0, 1 } };
+
+			template<typename T>
+			static void input(const T* in, idx_type in_stride, idx_type in_step, T* out, idx_type out_stride, idx_type out_step)
+			{
+				for (int t = 0; t < winograd_block; ++t)
+				{
+					const T* d = in + t * in_step;
+					T* o = out + t * out_step;
+					T d0 = d[0], d1 = d[in_stride], d2 = d[2 * in_stride];
+					T d3 = d[3 * in_stride], d4 = d[4 * in_stride], d5 = d[5 * in_stride];
+					o[0] = T(4) * d0 - T(5) * d2 + d4;
+					o[out_stride] = d3 + d4 - T(4) * (d1 + d2);
+					o[2 * out_stride] = d4 - d3 + T(4) * (d1 - d2);
+					o[3 * out_stride] = d4 - d2 + T(2) * (d3 - d1);
+					o[4 * out_stride] = d4 - d2 + T(2) * (d1 - d3);
+					o[5 * out_stride] = T(4) * d1 - T(5) * d3 + d5;
+				}
+			}
+
+			template<typename T>
+			static void output(const T* in, idx_type in_stride, idx_type in_step, T* out, idx_type out_stride, idx_type out_step)
+			{
+				for (int t = 0; t < winograd_block; ++t)
+				{
+					const T* m = in + t * in_step;
+					T* o = out + t * out_step;
+					T sum12 = m[in_stride] + m[2 * in_stride], diff12 = m[in_stride] - m[2 * in_stride];
+					T sum34 = m[3 * in_stride] + m[4 * in_stride], diff34 = m[3 * in_stride] - m[4 * in_stride];
+					o[0] = m[0] + sum12 + sum34;
+					o[out_stride] = diff12 + T(2) * diff34;
+					o[2 * out_stride] = sum12 + T(4) * sum34;
+					o[3 * out_stride] = diff12 + T(8) * diff34 + m[5 * in_stride];
+				}
+			}
+		};
+
+		// Planes of transformed weights, and of inputs and products of a chunk, are this many
+		// elements longer than their [O][C] or [C or O][tiles], else they are often a multiple of
+		// 4 KiB apart and the alpha^2 streams of a transform thrash the same L1 sets.
+		const idx_type winograd_plane_padding = 16;
+
+		// u[xi * plane_stride + o * cg + c] = (G g G^T)[xi] of the 3x3 kernel of every output and
+		// input channel pair
+		template<typename T, int M>
+		void winograd_weight(const T* weight, idx_type pairs, idx_type plane_stride, T* u)
+		{
+			typedef WinogradMatrices<M> W;
+			const int A = W::alpha;
+			int count = static_cast<int>(pairs);
+#pragma omp parallel for schedule(static) if(count >= 256 && !omp_in_parallel())
+			for (int pair = 0; pair < count; ++pair)
+			{
+				const T* g = weight + pair * 9;
+				T gg[A][3];
+				for (int i = 0; i < A; ++i)
+					for (int j = 0; j < 3; ++j)
+						gg[i][j] = T(W::g[i][0]) * g[j] + T(W::g[i][1]) * g[3 + j] + T(W::g[i][2]) * g[6 + j];
+				for (int i = 0; i < A; ++i)
+					for (int j = 0; j < A; ++j)
+						u[(i * A + j) * plane_stride + pair] = gg[i][0] * T(W::g[j][0]) + gg[i][1] * T(W::g[j][1]) + gg[i][2] * T(W::g[j][2]);
+			}
+		}
+
+		// Tiles are processed in chunks of whole rows of tiles, about this many bytes of
+		// transformed inputs and products each so they stay in L2 between the transforms and
+		// the gemms, but at least winograd_min_tiles tiles for the gemms to be efficient.
+		const idx_type winograd_chunk_bytes = 1024 * 1024;
+		const idx_type winograd_min_tiles = 128;
+
+		struct WinogradTiles
+		{
+			idx_type rows, cols;
+			// rows of tiles of a chunk, the last chunk may have fewer
+			idx_type chunk_rows;
+		};
+
+		// v[xi * plane_stride + c * tiles + p] = (B^T d B)[xi] of the input tile d of channel c and
+		// tile p, for the tiles of `rows` rows of tiles from `first` on, counted over the whole
+		// batch; zero outside the image
+		template<typename T, int M>
+		void winograd_input(const T* x, const ConvShape& s, const Conv2dParams& params, const WinogradTiles& tiles, idx_type first, idx_type rows,
+			idx_type plane_stride, T* v)
+		{
+			typedef WinogradMatrices<M> W;
+			const int A = W::alpha;
+			// input columns of one block of tiles
+			const idx_type span = winograd_block * M + A - M;
+			T d[A][A][winograd_block], bd[A][A][winograd_block];
+			T row[winograd_block * M + A];
+			for (idx_type r = 0; r < rows; ++r)
+			{
+				const idx_type n = (first + r) / tiles.rows, th = (first + r) % tiles.rows;
+				for (idx_type c = 0; c < s.channels; ++c)
+				{
+					const T* src = x + (n * s.channels + c) * s.height * s.width;
+					T* dst = v + c * rows * tiles.cols + r * tiles.cols;
+					for (idx_type tw0 = 0; tw0 < tiles.cols; tw0 += winograd_block)
+					{
+						const idx_type count = std::min<idx_type>(winograd_block, tiles.cols - tw0);
+						const idx_type w0 = tw0 * M - params.padding_w;
+						idx_type begin, end;
+						valid_columns(w0, 1, s.width, span, begin, end);
+						// d B straight from the zero padded input rows under the block, then B^T (d B)
+						for (int i = 0; i < A; ++i)
+						{
+							idx_type ih = th * M - params.padding_h + i;
+							const T* line = src + ih * s.width + w0;
+							bool inside = ih >= 0 && ih < s.height;
+							for (idx_type k = 0; k < span; ++k)
+								row[k] = inside && k >= begin && k < end ? line[k] : T(0);
+							W::input(row, 1, M, bd[i][0], winograd_block, 1);
+						}
+						for (int j = 0; j < A; ++j)
+							W::input(bd[0][j], A * winograd_block, 1, d[0][j], A * winograd_block, 1);
+						for (int i = 0; i < A; ++i)
+							for (int j = 0; j < A; ++j)
+							{
+								T* tile = dst + (i * A + j) * plane_stride + tw0;
+								for (idx_type t = 0; t < count; ++t)
+									tile[t] = d[i][j][t];
+							}
+					}
+				}
+			}
+		}
+
+		// y = A^T m A + bias for the products m[xi * plane_stride + o * tiles + p] of every
+		// output channel and tile of the chunk, dropping the pixels of the last tiles past the
+		// output
+		template<typename T, int M>
+		void winograd_output(const T* m, const T* bias, const ConvShape& s, const WinogradTiles& tiles, idx_type first, idx_type rows,
+			idx_type plane_stride, T* y)
+		{
+			typedef WinogradMatrices<M> W;
+			const int A = W::alpha;
+			T mm[A][A][winograd_block], am[M][A][winograd_block], line[M * winograd_block];
+			for (idx_type r = 0; r < rows; ++r)
+			{
+				const idx_type n = (first + r) / tiles.rows, th = (first + r) % tiles.rows;
+				const idx_type out_rows = std::min<idx_type>(M, s.out_h - th * M);
+				for (idx_type o = 0; o < s.out_channels; ++o)
+				{
+					const T* src = m + o * rows * tiles.cols + r * tiles.cols;
+					T* dst = y + ((n * s.out_channels + o) * s.out_h + th * M) * s.out_w;
+					const T b = bias ? bias[o] : T(0);
+					for (idx_type tw0 = 0; tw0 < tiles.cols; tw0 += winograd_block)
+					{
+						const idx_type count = std::min<idx_type>(winograd_block, tiles.cols - tw0);
+						for (int i = 0; i < A; ++i)
+							for (int j = 0; j < A; ++j)
+							{
+								const T* tile = src + (i * A + j) * plane_stride + tw0;
+								for (idx_type t = 0; t < winograd_block; ++t)
+									mm[i][j][t] = t < count ? tile[t] : T(0);
+							}
+						// A^T m, then every output row of (A^T m) A in pixel order
+						for (int j = 0; j < A; ++j)
+							W::output(mm[0][j], A * winograd_block, 1, am[0][j], A * winograd_block, 1);
+						const idx_type cols = std::min<idx_type>(count * M, s.out_w - tw0 * M);
+						for (idx_type i = 0; i < out_rows; ++i)
+						{
+							W::output(am[i][0], winograd_block, 1, line, 1, M);
+							T* dst_row = dst + i * s.out_w + tw0 * M;
+							for (idx_type ow = 0; ow < cols; ++ow)
+								dst_row[ow] = line[ow] + b;
+						}
+					}
+				}
+			}
+		}
+
+		template<typename T, int M>
+		void winograd_conv(const T* x, const T* weight, const T* bias, const ConvShape& s, const Conv2dParams& params, T* y)
+		{
+			const idx_type A = WinogradMatrices<M>::alpha, points = A * A;
+			const idx_type pairs = s.out_channels * s.group_channels, cg = s.group_channels, og = s.group_out;
+			const idx_type u_stride = pairs + winograd_plane_padding;
+			T* u = workspace(WEIGHT_SLOT).get<T>(points * u_stride);
+			winograd_weight<T, M>(weight, pairs, u_stride, u);
+
+			WinogradTiles tiles;
+			tiles.rows = (s.out_h + M - 1) / M;
+			tiles.cols = (s.out_w + M - 1) / M;
+			const idx_type chunk_tiles = std::max(winograd_min_tiles,
+				winograd_chunk_bytes / static_cast<idx_type>(points * (s.channels + s.out_channels) * sizeof(T)));
+			const idx_type tile_rows = s.batch * tiles.rows;
+			tiles.chunk_rows = std::min(tile_rows, std::max<idx_type>(1, chunk_tiles / tiles.cols));
+			const idx_type chunks = (tile_rows + tiles.chunk_rows - 1) / tiles.chunk_rows;
+			const idx_type chunk_size = tiles.chunk_rows * tiles.cols;
+
+			// chunks go to separate threads like images, otherwise the gemms are split
+			bool parallel = parallel_batch(chunks, static_cast<double>(points) * s.out_channels * cg * chunk_size);
+			if (parallel)
+				BlasRegistry::get().select(data_type(T()), og, chunk_size, cg, false, false);
+			int count = static_cast<int>(chunks);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int chunk = 0; chunk < count; ++chunk)
+			{
+				const idx_type first = chunk * tiles.chunk_rows, rows = std::min(tiles.chunk_rows, tile_rows - first);
+				const idx_type size = rows * tiles.cols;
+				const idx_type v_stride = s.channels * size + winograd_plane_padding;
+				const idx_type product_stride = s.out_channels * size + winograd_plane_padding;
+				T* v = workspace(COLUMNS_SLOT).get<T>(points * (s.channels * chunk_size + winograd_plane_padding));
+				T* product = workspace(PRODUCT_SLOT).get<T>(points * (s.out_channels * chunk_size + winograd_plane_padding));
+				winograd_input<T, M>(x, s, params, tiles, first, rows, v_stride, v);
+				// product[xi][o][p] = u[xi][o][c] * v[xi][c][p] for every point and group
+				for (idx_type xi = 0; xi < points; ++xi)
+					for (idx_type g = 0; g < s.groups; ++g)
+						BlasRegistry::get().gemm(og, size, cg, T(1), u + xi * u_stride + g * og * cg, cg, idx_type(1),
+							v + xi * v_stride + g * cg * size, size, idx_type(1), T(0),
+							product + xi * product_stride + g * og * size, size, idx_type(1));
+				winograd_output<T, M>(product, bias, s, tiles, first, rows, product_stride, y);
+			}
+		}
+
+		// Radix-2 fft of n rows of `count` values in place: row k holds element k of `count`
+		// independent transforms, so the butterflies of a column transform run over contiguous
+		// rows. twiddle_re/im[k] = exp(-2 pi i k / n) for k < n / 2, conjugated when inverse.
+		template<typename T>
+		void fft(T* re, T* im, idx_type n, idx_type count, const T* twiddle_re, const T* twiddle_im, bool inverse)
+		{
+			for (idx_type i = 1, j = 0; i < n; ++i)
+			{
+				idx_type bit = n >> 1;
+				for (; j & bit; bit >>= 1)
+					j ^= bit;
+				j ^= bit;
+				if (i < j)
+				{
+					std::swap_ranges(re + i * count, re + (i + 1) * count, re + j * count);
+					std::swap_ranges(im + i * count, im + (i + 1) * count, im + j * count);
+				}
+			}
+			for (idx_type len = 2; len <= n; len <<= 1)
+			{
+				const idx_type half = len / 2, step = n / len;
+				for (idx_type start = 0; start < n; start += len)
+					for (idx_type k = 0; k < half; ++k)
+					{
+						const T wr = twiddle_re[k * step], wi = inverse ? -twiddle_im[k * step] : twiddle_im[k * step];
+						T* ar = re + (start + k) * count;
+						T* ai = im + (start + k) * count;
+						T* br = ar + half * count;
+						T* bi = ai + half * count;
+						for (idx_type j = 0; j < count; ++j)
+						{
+							T tr = br[j] * wr - bi[j] * wi, ti = br[j] * wi + bi[j] * wr;
+							br[j] = ar[j] - tr;
+							bi[j] = ai[j] - ti;
+							ar[j] += tr;
+							ai[j] += ti;
+						}
+					}
+			}
+		}
+
+		// the fft transforms images in chunks of about this many elements, so the spectra of
+		// a large batch stay bounded
+		const idx_type transform_chunk_elements = 1 << 22;
+
+		idx_type chunk_images(idx_type batch, idx_type per_image)
+		{
+			return std::max<idx_type>(1, std::min<idx_type>(batch, transform_chunk_elements / std::max<idx_type>(per_image, 1)));
+		}
+
+		idx_type next_power_of_two(idx_type n)
+		{
+			idx_type result = 1;
+			while (result < n)
+				result <<= 1;
+			return result;
+		}
+
+		// 2D transforms of rows x cols planes, split into real and imaginary planes
+		template<typename T>
+		class FftPlan
+		{
+		private:
+			std::vector<T> _row_re, _row_im, _col_re, _col_im;
+
+			static void twiddles(idx_type n, std::vector<T>& re, std::vector<T>& im)
+			{
+				const double pi = 3.14159265358979323846;
+				for (idx_type k = 0; k < n / 2; ++k)
+				{
+					re.push_back(static_cast<T>(std::cos(2 * pi * k / n)));
+					im.push_back(static_cast<T>(-std::sin(2 * pi * k / n)));
+				}
+			}
+		public:
+			idx_type rows, cols;
+
+			FftPlan(idx_type rows, idx_type cols)
+				:rows(rows), cols(cols)
+			{
+				twiddles(rows, _col_re, _col_im);
+				twiddles(cols, _row_re, _row_im);
+			}
+
+			idx_type size() const { return rows * cols; }
+
+			// only the first `used` rows are nonzero
+			void forward(T* re, T* im, idx_type used) const
+			{
+				for (idx_type r = 0; r < used; ++r)
+					fft(re + r * cols, im + r * cols, cols, idx_type(1), _row_re.data(), _row_im.data(), false);
+				fft(re, im, rows, cols, _col_re.data(), _col_im.data(), false);
+			}
+
+			// unscaled, only the first `used` rows are transformed back
+			void inverse(T* re, T* im, idx_type used) const
+			{
+				fft(re, im, rows, cols, _col_re.data(), _col_im.data(), true);
+				for (idx_type r = 0; r < used; ++r)
+					fft(re + r * cols, im + r * cols, cols, idx_type(1), _row_re.data(), _row_im.data(), true);
+			}
+		};
+
+		// Cross-correlation through the spectra of the padded input plane and of the kernel,
+		// both zero padded to powers of two at least as large as the padded input: the
+		// circular correlation does not wrap over the valid output pixels.
+		template<typename T>
+		void fft_conv(const T* x, const T* weight, const T* bias, const ConvShape& s, const Conv2dParams& params, T* y)
+		{
+			const idx_type padded_h = s.height + 2 * params.padding_h, padded_w = s.width + 2 * params.padding_w;
+			const FftPlan<T> plan(next_power_of_two(padded_h), next_power_of_two(padded_w));
+			const idx_type F = plan.size(), cg = s.group_channels, og = s.group_out;
+			const T scale = T(1) / static_cast<T>(F);
+
+			const idx_type chunk = chunk_images(s.batch, 2 * F * s.channels);
+			T* spectra = workspace(COLUMNS_SLOT).get<T>(2 * F * s.channels * chunk);
+			for (idx_type n0 = 0; n0 < s.batch; n0 += chunk)
+			{
+				const idx_type images = std::min(chunk, s.batch - n0);
+				int planes = static_cast<int>(images * s.channels);
+#pragma omp parallel for schedule(static) if(!omp_in_parallel())
+				for (int plane = 0; plane < planes; ++plane)
+				{
+					T* re = spectra + 2 * F * plane;
+					T* im = re + F;
+					std::fill(re, re + 2 * F, T(0));
+					const T* src = x + (n0 * s.channels + plane) * s.height * s.width;
+					for (idx_type h = 0; h < s.height; ++h)
+						std::copy(src + h * s.width, src + (h + 1) * s.width, re + (h + params.padding_h) * plan.cols + params.padding_w);
+					plan.forward(re, im, params.padding_h + s.height);
+				}
+
+				// every output channel sums the products of the input spectra with the conjugate
+				// spectrum of its kernel, one input channel at a time, then transforms back
+				int outputs = static_cast<int>(s.out_channels);
+#pragma omp parallel for schedule(static) if(!omp_in_parallel())
+				for (int o = 0; o < outputs; ++o)
+				{
+					T* kernel_re = workspace(PRODUCT_SLOT).get<T>(2 * F * (images + 1));
+					T* kernel_im = kernel_re + F;
+					T* sums = kernel_re + 2 * F;
+					std::fill(sums, sums + 2 * F * images, T(0));
+					const idx_type g = o / og;
+					for (idx_type c = 0; c < cg; ++c)
+					{
+						std::fill(kernel_re, kernel_re + 2 * F, T(0));
+						const T* taps = weight + (o * cg + c) * s.kernel_h * s.kernel_w;
+						for (idx_type kh = 0; kh < s.kernel_h; ++kh)
+							std::copy(taps + kh * s.kernel_w, taps + (kh + 1) * s.kernel_w, kernel_re + kh * plan.cols);
+						plan.forward(kernel_re, kernel_im, s.kernel_h);
+						for (idx_type n = 0; n < images; ++n)
+						{
+							const T* xr = spectra + 2 * F * (n * s.channels + g * cg + c);
+							const T* xi = xr + F;
+							T* sr = sums + 2 * F * n;
+							T* si = sr + F;
+							for (idx_type f = 0; f < F; ++f)
+							{
+								sr[f] += xr[f] * kernel_re[f] + xi[f] * kernel_im[f];
+								si[f] += xi[f] * kernel_re[f] - xr[f] * kernel_im[f];
+							}
+						}
+					}
+					T b = bias ? bias[o] : T(0);
+					for (idx_type n = 0; n < images; ++n)
+					{
+						T* sr = sums + 2 * F * n;
+						plan.inverse(sr, sr + F, s.out_h);
+						T* dst = y + ((n0 + n) * s.out_channels + o) * s.pixels();
+						for (idx_type oh = 0; oh < s.out_h; ++oh)
+							for (idx_type ow = 0; ow < s.out_w; ++ow)
+								dst[oh * s.out_w + ow] = sr[oh * plan.cols + ow] * scale + b;
+					}
+				}
+			}
+		}
+
+		bool algorithm_applies(ConvAlgorithm algorithm, bool single, const ConvShape& s, const Conv2dParams& params)
+		{
+			bool unit = params.stride_h == 1 && params.stride_w == 1 && params.dilation_h == 1 && params.dilation_w == 1;
+			bool three = s.kernel_h == 3 && s.kernel_w == 3;
+			bool one = s.kernel_h == 1 && s.kernel_w == 1;
+			switch (algorithm)
+			{
+			case ConvAlgorithm::DIRECT:
+				return single && s.groups == 1 && (three || one);
+			case ConvAlgorithm::WINOGRAD_2X2:
+			case ConvAlgorithm::WINOGRAD_4X4:
+				return unit && three;
+			case ConvAlgorithm::FFT:
+				return unit;
+			default:
+				return true;
+			}
+		}
+
+		// Rough costs in multiply-adds of the gemm of each dtype, fitted to single threaded runs
+		// of VGG and ResNet like layers and of large kernels: per element copied by im2col, per
+		// multiply-add of the Winograd gemms, per element the Winograd transforms write for the
+		// input, output and weight, per flop of the ffts and per complex multiply-add of the
+		// spectra. The transforms are not blocked like the gemm, they cost relatively more in f32.
+		struct ConvCosts
+		{
+			double copy, winograd_gemm, winograd_input, winograd_output, winograd_weight, fft, spectrum;
+		};
+
+		const ConvCosts f32_costs = { 50.0, 0.6, 160.0, 110.0, 230.0, 9.0, 12.0 };
+		const ConvCosts f64_costs = { 30.0, 0.8, 90.0, 50.0, 160.0, 3.0, 5.0 };
+
+		double algorithm_cost(ConvAlgorithm algorithm, bool single, const ConvShape& s, const Conv2dParams& params)
+		{
+			const ConvCosts& k = single ? f32_costs : f64_costs;
+			const double n = s.batch, c = s.channels, o = s.out_channels, cg = s.group_channels;
+			const double taps = static_cast<double>(s.kernel_h) * s.kernel_w, pixels = s.pixels();
+			const double gemm = n * o * cg * taps * pixels;
+			switch (algorithm)
+			{
+			case ConvAlgorithm::IM2COL:
+				return gemm + (pointwise(s, params) ? 0.0 : k.copy * n * c * taps * pixels);
+			case ConvAlgorithm::DIRECT:
+				// the direct kernels win on 3x3 kernels once a pixel fills a channel block and
+				// while the weight of an output channel block stays in L2
+				if (single && s.kernel_h == 3 && s.kernel_w == 3 && s.channels >= 16 && s.channels <= 128)
+					return 0.75 * gemm;
+				return std::numeric_limits<double>::infinity();
+			case ConvAlgorithm::WINOGRAD_2X2:
+			case ConvAlgorithm::WINOGRAD_4X4:
+			{
+				const double m = algorithm == ConvAlgorithm::WINOGRAD_2X2 ? 2 : 4, points = (m + 2) * (m + 2);
+				const double tiles = n * std::ceil(s.out_h / m) * std::ceil(s.out_w / m);
+				return points * (k.winograd_gemm * o * cg * tiles + k.winograd_input * c * tiles
+					+ k.winograd_output * o * tiles + k.winograd_weight * o * cg);
+			}
+			case ConvAlgorithm::FFT:
+			{
+				const double rows = next_power_of_two(s.height + 2 * params.padding_h), cols = next_power_of_two(s.width + 2 * params.padding_w);
+				const double size = rows * cols, chunks = std::ceil(n / chunk_images(s.batch, static_cast<idx_type>(2 * size * c)));
+				const double transforms = n * c + chunks * o * cg + n * o;
+				return k.fft * transforms * 5 * size * std::log2(size) + k.spectrum * n * o * cg * size * 8;
+			}
+			default:
+				return std::numeric_limits<double>::infinity();
+			}
+		}
+
+		const ConvAlgorithm algorithms[] = { ConvAlgorithm::IM2COL, ConvAlgorithm::DIRECT,
+			ConvAlgorithm::WINOGRAD_2X2, ConvAlgorithm::WINOGRAD_4X4, ConvAlgorithm::FFT };
+
+		ConvAlgorithm model_algorithm(bool single, const ConvShape& s, const Conv2dParams& params)
+		{
+			ConvAlgorithm best = ConvAlgorithm::IM2COL;
+			double best_cost = algorithm_cost(best, single, s, params);
+			for (ConvAlgorithm algorithm : algorithms)
+			{
+				if (!algorithm_applies(algorithm, single, s, params))
+					continue;
+				double cost = algorithm_cost(algorithm, single, s, params);
+				if (cost < best_cost)
+				{
+					best = algorithm;
+					best_cost = cost;
+				}
+			}
+			return best;
+		}
+
+		template<typename T>
+		void run_algorithm(ConvAlgorithm algorithm, const T* x, const T* weight, const T* bias, const ConvShape& s, const Conv2dParams& params, T* y)
+		{
+			switch (algorithm)
+			{
+			case ConvAlgorithm::DIRECT:
+				direct_conv(x, weight, bias, s, params, y);
+				break;
+			case ConvAlgorithm::WINOGRAD_2X2:
+				winograd_conv<T, 2>(x, weight, bias, s, params, y);
+				break;
+			case ConvAlgorithm::WINOGRAD_4X4:
+				winograd_conv<T, 4>(x, weight, bias, s, params, y);
+				break;
+			case ConvAlgorithm::FFT:
+				fft_conv(x, weight, bias, s, params, y);
+				break;
+			default:
+				im2col_conv(x, weight, bias, s, params, y);
+				break;
+			}
+		}
+
+		// fastest applicable algorithm on these tensors, every candidate runs once to warm up
+		// its workspace and once timed
+		template<typename T>
+		ConvAlgorithm benchmark_algorithm(const T* x, const T* weight, const ConvShape& s, const Conv2dParams& params, T* y)
+		{
+			const bool single = std::is_same<T, f32>::value;
+			ConvAlgorithm best = ConvAlgorithm::IM2COL;
+			double best_time = std::numeric_limits<double>::infinity();
+			for (ConvAlgorithm algorithm : algorithms)
+			{
+				if (!algorithm_applies(algorithm, single, s, params))
+					continue;
+				run_algorithm<T>(algorithm, x, weight, nullptr, s, params, y);
+				auto start = std::chrono::steady_clock::now();
+				run_algorithm<T>(algorithm, x, weight, nullptr, s, params, y);
+				double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (time < best_time)
+				{
+					best = algorithm;
+					best_time = time;
+				}
+			}
+			return best;
+		}
+
+		std::atomic<bool> benchmark_choice(false);
+
+		// benchmarked algorithms by dtype, shapes, parameters, thread count and gemm isa
+		class AlgorithmCache
+		{
+		private:
+			std::mutex _mutex;
+			std::map<std::vector<idx_type>, ConvAlgorithm> _choices;
+		public:
+			static AlgorithmCache& get()
+			{
+				static AlgorithmCache cache;
+				return cache;
+			}
+
+			template<typename F>
+			ConvAlgorithm choice(const std::vector<idx_type>& key, F measure)
+			{
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					auto found = _choices.find(key);
+					if (found != _choices.end())
+						return found->second;
+				}
+				ConvAlgorithm result = measure();
+				std::lock_guard<std::mutex> lock(_mutex);
+				_choices[key] = result;
+				return result;
+			}
+
+			idx_type size()
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				return _choices.size();
+			}
+
+			void clear()
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_choices.clear();
+			}
+		};
+
+		template<typename T>
+		ConvAlgorithm choose_algorithm(const T* x, const T* weight, const ConvShape& s, const Conv2dParams& params, T* y)
+		{
+			const bool single = std::is_same<T, f32>::value;
+			ConvAlgorithm forced = algorithm_choice.load();
+			if (forced != ConvAlgorithm::AUTO)
+				return algorithm_applies(forced, single, s, params) ? forced : ConvAlgorithm::IM2COL;
+			if (!benchmark_choice.load())
+				return model_algorithm(single, s, params);
+			std::vector<idx_type> key{ static_cast<idx_type>(data_type(T())), static_cast<idx_type>(omp_get_max_threads()),
+				static_cast<idx_type>(native_gemm_isa()), s.batch, s.channels, s.height, s.width, s.out_channels, s.kernel_h, s.kernel_w,
+				params.stride_h, params.stride_w, params.padding_h, params.padding_w, params.dilation_h, params.dilation_w, params.groups };
+			return AlgorithmCache::get().choice(key, [&]() { return benchmark_algorithm(x, weight, s, params, y); });
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> conv2d(const Tensor<T>& input, const Tensor<T>& weight, const Tensor<T>* bias, const Conv2dParams& params)
+		{
+			ConvShape s = conv_shape(input, weight, bias, params);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ s.batch, s.out_channels, s.out_h, s.out_w })));
+			if (s.batch == 0 || s.out_channels == 0)
+				return result;
+
+			std::vector<T> input_copy, weight_copy, bias_copy;
+			const T* x = contiguous_data(input, input_copy);
+			const T* w = contiguous_data(weight, weight_copy);
+			const T* b = bias ? contiguous_data(*bias, bias_copy) : nullptr;
+			T* y = result->data_ptr();
+			run_algorithm(choose_algorithm(x, w, s, params, y), x, w, b, s, params, y);
+			return result;
+		}
+
+		template<typename T>
+		ConvAlgorithm find_algorithm(const Tensor<T>& input, const Tensor<T>& weight, const Conv2dParams& params)
+		{
+			ConvShape s = conv_shape<T>(input, weight, nullptr, params);
+			if (s.batch == 0 || s.out_channels == 0)
+				return ConvAlgorithm::IM2COL;
+			std::vector<T> input_copy, weight_copy;
+			std::vector<T> output(static_cast<std::size_t>(s.batch) * s.out_channels * s.pixels());
+			return choose_algorithm(contiguous_data(input, input_copy), contiguous_data(weight, weight_copy), s, params, output.data());
+		}
+
+		template<typename T>
+		std::vector<std::shared_ptr<Tensor<T>>> conv2d_backward(const Tensor<T>& grad, const Tensor<T>& input, const Tensor<T>& weight, bool with_bias, const Conv2dParams& params)
+		{
+			ConvShape s = conv_shape<T>(input, weight, nullptr, params);
+			if (grad.size() != DimVector({ s.batch, s.out_channels, s.out_h, s.out_w }))
+				conv_error("The gradient shall have the shape of the output");
+
+			std::shared_ptr<Tensor<T>> input_grad(new Tensor<T>(input.size()));
+			std::shared_ptr<Tensor<T>> weight_grad(new Tensor<T>(weight.size()));
+			T* dx = input_grad->data_ptr();
+			T* dw = weight_grad->data_ptr();
+			const idx_type image_size = s.channels * s.height * s.width, out_size = s.out_channels * s.pixels();
+			const idx_type weight_count = s.out_channels * s.col_rows();
+			std::fill(dx, dx + s.batch * image_size, T(0));
+			std::fill(dw, dw + weight_count, T(0));
+
+			std::vector<T> input_copy, weight_copy, grad_copy;
+			const T* x = contiguous_data(input, input_copy);
+			const T* w = contiguous_data(weight, weight_copy);
+			const T* dy = contiguous_data(grad, grad_copy);
+
+			std::vector<std::shared_ptr<Tensor<T>>> result{ input_grad, weight_grad };
+			if (with_bias)
+			{
+				std::shared_ptr<Tensor<T>> bias_grad(new Tensor<T>(DimVector({ s.out_channels })));
+				for (idx_type o = 0; o < s.out_channels; ++o)
+				{
+					T sum = T(0);
+					for (idx_type n = 0; n < s.batch; ++n)
+					{
+						const T* row = dy + n * out_size + o * s.pixels();
+						for (idx_type p = 0; p < s.pixels(); ++p)
+							sum += row[p];
+					}
+					bias_grad->data_ptr()[o] = sum;
+				}
+				result.push_back(bias_grad);
+			}
+			if (s.batch == 0 || s.out_channels == 0)
+				return result;
+
+			// every thread sums the weight gradient of a fixed range of images into its own
+			// buffer, the buffers are added in order so the result does not depend on timing
+			bool parallel = parallel_images(s);
+			int threads = parallel ? omp_get_max_threads() : 1;
+			std::vector<T> partials(static_cast<std::size_t>(threads - 1) * weight_count, T(0));
+			if (parallel)
+			{
+				const idx_type k = s.col_rows(), pixels = s.pixels();
+				BlasRegistry::get().select(data_type(T()), s.group_out, k, pixels, false, true);
+				BlasRegistry::get().select(data_type(T()), k, pixels, s.group_out, true, false);
+			}
+#pragma omp parallel num_threads(threads) if(parallel)
+			{
+				int count = omp_get_num_threads(), t = omp_get_thread_num();
+				T* partial = t == 0 ? dw : partials.data() + static_cast<std::size_t>(t - 1) * weight_count;
+				idx_type first = s.batch * t / count, last = s.batch * (t + 1) / count;
+				for (idx_type n = first; n < last; ++n)
+					backward_image(x + n * image_size, w, dy + n * out_size, s, params, dx + n * image_size, partial);
+			}
+			for (int t = 1; t < threads; ++t)
+			{
+				const T* partial = partials.data() + static_cast<std::size_t>(t - 1) * weight_count;
+				for (idx_type i = 0; i < weight_count; ++i)
+					dw[i] += partial[i];
+			}
+			return result;
+		}
+	}
+
+	idx_type conv_output_size(idx_type input, idx_type kernel, idx_type stride, idx_type padding, idx_type dilation)
+	{
+		idx_type span = input + 2 * padding - dilation * (kernel - 1);
+		if (span <= 0)
+			return 0;
+		return (span - 1) / stride + 1;
+	}
+
+	std::shared_ptr<Tensor<f32>> conv2d_impl(const Tensor<f32>& input, const Tensor<f32>& weight, const Tensor<f32>* bias, const Conv2dParams& params)
+	{
+		return conv2d(input, weight, bias, params);
+	}
+
+	std::shared_ptr<Tensor<f64>> conv2d_impl(const Tensor<f64>& input, const Tensor<f64>& weight, const Tensor<f64>* bias, const Conv2dParams& params)
+	{
+		return conv2d(input, weight, bias, params);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f32>>> conv2d_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, const Tensor<f32>& weight, bool with_bias, const Conv2dParams& params)
+	{
+		return conv2d_backward(grad, input, weight, with_bias, params);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f64>>> conv2d_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, const Tensor<f64>& weight, bool with_bias, const Conv2dParams& params)
+	{
+		return conv2d_backward(grad, input, weight, with_bias, params);
+	}
+
+	ConvAlgorithm conv2d_algorithm()
+	{
+		return algorithm_choice.load();
+	}
+
+	void conv2d_algorithm_(ConvAlgorithm algorithm)
+	{
+		algorithm_choice.store(algorithm);
+	}
+
+	bool conv2d_algorithm_applies(ConvAlgorithm algorithm, DataType dtype, const DimVector& input, const DimVector& weight, const Conv2dParams& params)
+	{
+		if (dtype != DataType::FLOAT && dtype != DataType::DOUBLE)
+			return false;
+		return algorithm_applies(algorithm, dtype == DataType::FLOAT, conv_shape(input, weight, params), params);
+	}
+
+	ConvAlgorithm conv2d_find_algorithm(const Tensor<f32>& input, const Tensor<f32>& weight, const Conv2dParams& params)
+	{
+		return find_algorithm(input, weight, params);
+	}
+
+	ConvAlgorithm conv2d_find_algorithm(const Tensor<f64>& input, const Tensor<f64>& weight, const Conv2dParams& params)
+	{
+		return find_algorithm(input, weight, params);
+	}
+
+	bool conv2d_benchmark()
+	{
+		return benchmark_choice.load();
+	}
+
+	void conv2d_benchmark_(bool enabled)
+	{
+		benchmark_choice.store(enabled);
+	}
+
+	idx_type conv2d_algorithm_cache_size()
+	{
+		return AlgorithmCache::get().size();
+	}
+
+	void conv2d_clear_algorithm_cache()
+	{
+		AlgorithmCache::get().clear();
+	}
+
+	idx_type conv_workspace_allocations()
+	{
+		return workspace_allocations.load();
+	}
+}
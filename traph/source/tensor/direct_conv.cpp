@@ -0,0 +1,195 @@
+#include <algorithm>
+
+#include <omp.h>
+
+#include <traph/core/cpu.h>
+#include <traph/tensor/gemm.h>
+#include <traph/tensor/conv.h>
+
+#if defined(TRAPH_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+// Direct convolution for small kernels. im2col copies every input pixel KH * KW times before
+// the gemm reads it again; for 3x3 kernels that copy costs about as much memory traffic as
+// the product. Here both operands are channel blocked: the weight by output channels, so two
+// vectors hold one tap of `lanes` output channels, and the input by input channels, so the
+// channels of one pixel are contiguous. A tile of output pixels of one row keeps two vector
+// accumulators per pixel, like the rows of the gemm kernels: every tap of every input
+// channel is two weight loads and one broadcast and two fmas per pixel.
+
+namespace traph
+{
+	namespace
+	{
+		const idx_type direct_max_tile = 12;
+		const idx_type direct_max_lanes = 32;
+		// below this many multiply-adds the image runs on the calling thread
+		const double direct_parallel_threshold = 64.0 * 64.0 * 64.0;
+
+		// out[r * lanes + l] = sum over channel blocks b, taps (kh, kw) and channels c of the
+		// block of weight[b][kh][kw][c][l] times
+		// input[b * block_stride + kh * tap_h + kw * tap_w + r * pixel_stride + c], for the
+		// kernel's tile width R
+		using DirectTileKernel = void(*)(idx_type channel_blocks, idx_type channel_block, idx_type kernel_h, idx_type kernel_w,
+			const f32* input, idx_type block_stride, idx_type tap_h, idx_type tap_w, idx_type pixel_stride,
+			const f32* weight, f32* out);
+
+		struct DirectKernels
+		{
+			// tiles of tile_width and of tile_width / 2 pixels
+			DirectTileKernel full, half;
+			DirectConvLayout layout;
+		};
+
+		template<int L, int R>
+		void sdirect_tile_generic(idx_type channel_blocks, idx_type channel_block, idx_type kernel_h, idx_type kernel_w,
+			const f32* input, idx_type block_stride, idx_type tap_h, idx_type tap_w, idx_type pixel_stride,
+			const f32* weight, f32* out)
+		{
+			f32 acc[R][L] = {};
+			for (idx_type b = 0; b < channel_blocks; ++b)
+				for (idx_type kh = 0; kh < kernel_h; ++kh)
+					for (idx_type kw = 0; kw < kernel_w; ++kw)
+					{
+						const f32* in = input + b * block_stride + kh * tap_h + kw * tap_w;
+						for (idx_type c = 0; c < channel_block; ++c)
+						{
+							for (int r = 0; r < R; ++r)
+							{
+								f32 x = in[r * pixel_stride + c];
+								for (int l = 0; l < L; ++l)
+									acc[r][l] += x * weight[l];
+							}
+							weight += L;
+						}
+					}
+			for (int r = 0; r < R; ++r)
+				for (int l = 0; l < L; ++l)
+					out[r * L + l] = acc[r][l];
+		}
+
+#if defined(TRAPH_ARCH_X86)
+		// the accumulators are named registers, like in the gemm kernels
+#define TRAPH_DIRECT_EACH3(M) M(0) M(1) M(2)
+#define TRAPH_DIRECT_EACH6(M) TRAPH_DIRECT_EACH3(M) M(3) M(4) M(5)
+#define TRAPH_DIRECT_EACH12(M) TRAPH_DIRECT_EACH6(M) M(6) M(7) M(8) M(9) M(10) M(11)
+
+#define TRAPH_SDIRECT_AVX2_ZERO(r) __m256 c##r##_0 = _mm256_setzero_ps(), c##r##_1 = _mm256_setzero_ps();
+#define TRAPH_SDIRECT_AVX2_PIXEL(r)                                                                  \
+		{                                                                                           \
+			__m256 x = _mm256_set1_ps(in[r * pixel_stride + c]);                                    \
+			c##r##_0 = _mm256_fmadd_ps(x, w0, c##r##_0);                                            \
+			c##r##_1 = _mm256_fmadd_ps(x, w1, c##r##_1);                                            \
+		}
+#define TRAPH_SDIRECT_AVX2_STORE(r) _mm256_storeu_ps(out + r * 16, c##r##_0); _mm256_storeu_ps(out + r * 16 + 8, c##r##_1);
+
+#define TRAPH_SDIRECT_AVX512_ZERO(r) __m512 c##r##_0 = _mm512_setzero_ps(), c##r##_1 = _mm512_setzero_ps();
+#define TRAPH_SDIRECT_AVX512_PIXEL(r)                                                                \
+		{                                                                                           \
+			__m512 x = _mm512_set1_ps(in[r * pixel_stride + c]);                                    \
+			c##r##_0 = _mm512_fmadd_ps(x, w0, c##r##_0);                                            \
+			c##r##_1 = _mm512_fmadd_ps(x, w1, c##r##_1);                                            \
+		}
+#define TRAPH_SDIRECT_AVX512_STORE(r) _mm512_storeu_ps(out + r * 32, c##r##_0); _mm512_storeu_ps(out + r * 32 + 16, c##r##_1);
+
+		// a tile kernel for the pixels of each, with two vectors of v output channels
+#define TRAPH_SDIRECT_KERNEL(name, target, vec, load, v, each, zero, pixel, store)                   \
+		target                                                                                      \
+		void name(idx_type channel_blocks, idx_type channel_block, idx_type kernel_h, idx_type kernel_w, \
+			const f32* input, idx_type block_stride, idx_type tap_h, idx_type tap_w, idx_type pixel_stride, \
+			const f32* weight, f32* out)                                                            \
+		{                                                                                           \
+			each(zero)                                                                              \
+			for (idx_type b = 0; b < channel_blocks; ++b)                                           \
+				for (idx_type kh = 0; kh < kernel_h; ++kh)                                          \
+					for (idx_type kw = 0; kw < kernel_w; ++kw)                                      \
+					{                                                                               \
+						const f32* in = input + b * block_stride + kh * tap_h + kw * tap_w;         \
+						for (idx_type c = 0; c < channel_block; ++c)                                \
+						{                                                                           \
+							vec w0 = load(weight);                                                  \
+							vec w1 = load(weight + v);                                              \
+							each(pixel)                                                             \
+							weight += 2 * v;                                                        \
+						}                                                                           \
+					}                                                                               \
+			each(store)                                                                             \
+		}
+
+		TRAPH_SDIRECT_KERNEL(sdirect_tile6_avx2, TRAPH_TARGET_AVX2, __m256, _mm256_loadu_ps, 8,
+			TRAPH_DIRECT_EACH6, TRAPH_SDIRECT_AVX2_ZERO, TRAPH_SDIRECT_AVX2_PIXEL, TRAPH_SDIRECT_AVX2_STORE)
+		TRAPH_SDIRECT_KERNEL(sdirect_tile3_avx2, TRAPH_TARGET_AVX2, __m256, _mm256_loadu_ps, 8,
+			TRAPH_DIRECT_EACH3, TRAPH_SDIRECT_AVX2_ZERO, TRAPH_SDIRECT_AVX2_PIXEL, TRAPH_SDIRECT_AVX2_STORE)
+		TRAPH_SDIRECT_KERNEL(sdirect_tile12_avx512, TRAPH_TARGET_AVX512, __m512, _mm512_loadu_ps, 16,
+			TRAPH_DIRECT_EACH12, TRAPH_SDIRECT_AVX512_ZERO, TRAPH_SDIRECT_AVX512_PIXEL, TRAPH_SDIRECT_AVX512_STORE)
+		TRAPH_SDIRECT_KERNEL(sdirect_tile6_avx512, TRAPH_TARGET_AVX512, __m512, _mm512_loadu_ps, 16,
+			TRAPH_DIRECT_EACH6, TRAPH_SDIRECT_AVX512_ZERO, TRAPH_SDIRECT_AVX512_PIXEL, TRAPH_SDIRECT_AVX512_STORE)
+#endif
+
+		DirectKernels select_direct_kernels(GemmIsa isa)
+		{
+#if defined(TRAPH_ARCH_X86)
+			if (isa == GemmIsa::AVX512)
+			{
+				DirectKernels kernels = { sdirect_tile12_avx512, sdirect_tile6_avx512, { 32, 16, 12 } };
+				return kernels;
+			}
+			if (isa == GemmIsa::AVX2)
+			{
+				DirectKernels kernels = { sdirect_tile6_avx2, sdirect_tile3_avx2, { 16, 16, 6 } };
+				return kernels;
+			}
+#endif
+			DirectKernels kernels = { sdirect_tile_generic<16, 4>, sdirect_tile_generic<16, 2>, { 16, 16, 4 } };
+			return kernels;
+		}
+	}
+
+	DirectConvLayout native_direct_conv2d_layout()
+	{
+		return select_direct_kernels(native_gemm_isa()).layout;
+	}
+
+	void native_direct_conv2d(idx_type channel_blocks, idx_type channel_block, idx_type padded_h, idx_type padded_w,
+		const f32* input, idx_type out_channels, idx_type kernel_h, idx_type kernel_w, const f32* weight, const f32* bias,
+		const Conv2dParams& params, idx_type out_h, idx_type out_w, f32* output)
+	{
+		const DirectKernels kern = select_direct_kernels(native_gemm_isa());
+		const idx_type lanes = kern.layout.lanes, width = kern.layout.tile_width;
+		const idx_type blocks = (out_channels + lanes - 1) / lanes;
+		const idx_type block_size = channel_blocks * kernel_h * kernel_w * channel_block * lanes;
+		const idx_type block_stride = padded_h * padded_w * channel_block;
+		const idx_type row_stride = padded_w * channel_block;
+
+		double flops = static_cast<double>(out_channels) * out_h * out_w * channel_blocks * channel_block * kernel_h * kernel_w;
+		bool parallel = !omp_in_parallel() && omp_get_max_threads() > 1 && flops >= direct_parallel_threshold;
+		// consecutive rows share the weight block
+		int rows = static_cast<int>(blocks * out_h);
+#pragma omp parallel for schedule(static) if(parallel)
+		for (int row = 0; row < rows; ++row)
+		{
+			idx_type block = row / out_h, oh = row % out_h;
+			const f32* block_weight = weight + block * block_size;
+			const f32* in_row = input + oh * params.stride_h * row_stride;
+			idx_type valid = std::min(lanes, out_channels - block * lanes);
+			f32 tile[direct_max_tile * direct_max_lanes];
+			for (idx_type ow = 0; ow < out_w; ow += width)
+			{
+				// the last tile may compute pixels past the row, they are dropped
+				idx_type count = std::min(width, out_w - ow);
+				DirectTileKernel kernel = count <= width / 2 ? kern.half : kern.full;
+				kernel(channel_blocks, channel_block, kernel_h, kernel_w, in_row + ow * params.stride_w * channel_block, block_stride,
+					params.dilation_h * row_stride, params.dilation_w * channel_block, params.stride_w * channel_block, block_weight, tile);
+				// back to [O, OH, OW]
+				for (idx_type l = 0; l < valid; ++l)
+				{
+					f32* out = output + ((block * lanes + l) * out_h + oh) * out_w + ow;
+					f32 b = bias ? bias[block * lanes + l] : 0.f;
+					for (idx_type r = 0; r < count; ++r)
+						out[r] = tile[r * lanes + l] + b;
+				}
+			}
+		}
+	}
+}
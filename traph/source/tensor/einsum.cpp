@@ -0,0 +1,873 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <omp.h>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/einsum.h>
+#include <traph/tensor/blas.h>
+
+namespace traph
+{
+	namespace
+	{
+		// below this many multiply-adds per gemm a batch is split between threads, like in
+		// arithmetic.cpp
+		const double batch_parallel_threshold = 64.0 * 64.0 * 64.0;
+		// up to this many operands the contraction order is searched exhaustively (3^n splits),
+		// more operands are contracted greedily
+		const idx_type optimal_path_limit = 10;
+
+		using LabelSet = std::uint64_t;
+
+		void einsum_error(const std::string& message)
+		{
+			throw std::runtime_error("einsum: " + message + ".");
+		}
+
+		std::string label_name(int label)
+		{
+			if (label >= 0 && label < 128 && std::isalpha(label))
+				return std::string("'") + static_cast<char>(label) + "'";
+			return std::to_string(label);
+		}
+
+		idx_type count_label(const std::vector<int>& labels, int label)
+		{
+			return std::count(labels.begin(), labels.end(), label);
+		}
+
+		bool has_label(const std::vector<int>& labels, int label)
+		{
+			return std::find(labels.begin(), labels.end(), label) != labels.end();
+		}
+
+		// labels in order of first occurrence, each once
+		std::vector<int> unique_labels(const std::vector<int>& labels)
+		{
+			std::vector<int> result;
+			for (int label : labels)
+				if (!has_label(result, label))
+					result.push_back(label);
+			return result;
+		}
+
+		// Checks the equation against the operand shapes and returns the size of every label.
+		// A scalar operand may be a one element tensor.
+		std::map<int, idx_type> label_sizes(const EinsumEquation& equation, const std::vector<DimVector>& shapes)
+		{
+			if (equation.inputs.size() != shapes.size())
+				einsum_error("The number of operands shall match the equation");
+			if (shapes.empty())
+				einsum_error("At least one operand is required");
+
+			std::map<int, idx_type> result;
+			for (std::size_t i = 0; i < shapes.size(); ++i)
+			{
+				const std::vector<int>& labels = equation.inputs[i];
+				const DimVector& shape = shapes[i];
+				if (labels.empty() && shape.flat_size() == 1)
+					continue;
+				if (static_cast<idx_type>(labels.size()) != shape.size())
+					einsum_error("Operand " + std::to_string(i) + " has " + std::to_string(shape.size()) +
+						" dimensions but " + std::to_string(labels.size()) + " labels");
+				for (std::size_t d = 0; d < labels.size(); ++d)
+				{
+					auto found = result.find(labels[d]);
+					if (found == result.end())
+						result[labels[d]] = shape[d];
+					else if (found->second != shape[d])
+						einsum_error("Label " + label_name(labels[d]) + " has sizes " +
+							std::to_string(found->second) + " and " + std::to_string(shape[d]));
+				}
+			}
+			for (int label : equation.output)
+			{
+				if (result.find(label) == result.end())
+					einsum_error("Output label " + label_name(label) + " does not occur in the operands");
+				if (count_label(equation.output, label) != 1)
+					einsum_error("Output label " + label_name(label) + " occurs more than once");
+			}
+			if (result.size() > 64)
+				einsum_error("At most 64 different labels are supported");
+			return result;
+		}
+
+		// labels of operand i left after its diagonals are taken and the labels no other operand
+		// or the output refers to are summed over
+		std::vector<int> reduced_labels(const EinsumEquation& equation, std::size_t i)
+		{
+			std::vector<int> result;
+			for (int label : unique_labels(equation.inputs[i]))
+			{
+				bool needed = has_label(equation.output, label);
+				for (std::size_t j = 0; j < equation.inputs.size() && !needed; ++j)
+					needed = j != i && has_label(equation.inputs[j], label);
+				if (needed)
+					result.push_back(label);
+			}
+			return result;
+		}
+
+		class PathPlanner
+		{
+		private:
+			std::vector<LabelSet> _operands;
+			LabelSet _output;
+			std::vector<double> _label_size;
+
+			double set_size(LabelSet labels) const
+			{
+				double result = 1;
+				for (std::size_t bit = 0; bit < _label_size.size(); ++bit)
+					if (labels & (LabelSet(1) << bit))
+						result *= _label_size[bit];
+				return result;
+			}
+
+			// labels an intermediate of the operands in mask keeps: the ones the output or an
+			// operand outside mask refers to
+			LabelSet kept_labels(std::uint32_t mask) const
+			{
+				LabelSet inside = 0, outside = _output;
+				for (std::size_t i = 0; i < _operands.size(); ++i)
+				{
+					if (mask & (1u << i))
+						inside |= _operands[i];
+					else
+						outside |= _operands[i];
+				}
+				return inside & outside;
+			}
+
+			// dynamic programming over subsets of operands, the cheapest split of every subset
+			std::vector<std::pair<idx_type, idx_type>> optimal_path() const
+			{
+				std::uint32_t count = static_cast<std::uint32_t>(_operands.size());
+				std::uint32_t full = (1u << count) - 1;
+				std::vector<LabelSet> kept(full + 1);
+				std::vector<double> flops(full + 1, std::numeric_limits<double>::infinity());
+				std::vector<double> memory(full + 1, 0);
+				std::vector<std::uint32_t> split(full + 1, 0);
+				for (std::uint32_t mask = 1; mask <= full; ++mask)
+					kept[mask] = kept_labels(mask);
+				for (std::uint32_t i = 0; i < count; ++i)
+					flops[1u << i] = 0;
+
+				for (std::uint32_t mask = 1; mask <= full; ++mask)
+				{
+					if ((mask & (mask - 1)) == 0)
+						continue;
+					std::uint32_t lowest = mask & (~mask + 1);
+					for (std::uint32_t left = (mask - 1) & mask; left > 0; left = (left - 1) & mask)
+					{
+						// every split is visited once, with the lowest operand on the left
+						if (!(left & lowest))
+							continue;
+						std::uint32_t right = mask ^ left;
+						double step = set_size(kept[left] | kept[right]);
+						double total = flops[left] + flops[right] + step;
+						double total_memory = memory[left] + memory[right];
+						if (total < flops[mask] || (total == flops[mask] && total_memory < memory[mask]))
+						{
+							flops[mask] = total;
+							memory[mask] = total_memory;
+							split[mask] = left;
+						}
+					}
+					memory[mask] += set_size(kept[mask]);
+				}
+
+				std::vector<std::uint32_t> pending;
+				for (std::uint32_t i = 0; i < count; ++i)
+					pending.push_back(1u << i);
+				std::vector<std::pair<idx_type, idx_type>> path;
+				emit(full, split, pending, path);
+				return path;
+			}
+
+			static void emit(std::uint32_t mask, const std::vector<std::uint32_t>& split,
+				std::vector<std::uint32_t>& pending, std::vector<std::pair<idx_type, idx_type>>& path)
+			{
+				if ((mask & (mask - 1)) == 0)
+					return;
+				std::uint32_t left = split[mask], right = mask ^ left;
+				emit(left, split, pending, path);
+				emit(right, split, pending, path);
+				idx_type left_pos = std::find(pending.begin(), pending.end(), left) - pending.begin();
+				idx_type right_pos = std::find(pending.begin(), pending.end(), right) - pending.begin();
+				path.push_back({ std::min(left_pos, right_pos), std::max(left_pos, right_pos) });
+				pending.erase(pending.begin() + std::max(left_pos, right_pos));
+				pending.erase(pending.begin() + std::min(left_pos, right_pos));
+				pending.push_back(mask);
+			}
+
+			// contracts the pair with the fewest flops (then the smallest result) until one is left
+			std::vector<std::pair<idx_type, idx_type>> greedy_path() const
+			{
+				std::vector<LabelSet> pending = _operands;
+				std::vector<std::pair<idx_type, idx_type>> path;
+				while (pending.size() > 1)
+				{
+					double best_flops = std::numeric_limits<double>::infinity(), best_size = 0;
+					idx_type best_i = 0, best_j = 1;
+					LabelSet best_kept = 0;
+					for (std::size_t i = 0; i < pending.size(); ++i)
+						for (std::size_t j = i + 1; j < pending.size(); ++j)
+						{
+							LabelSet outside = _output;
+							for (std::size_t l = 0; l < pending.size(); ++l)
+								if (l != i && l != j)
+									outside |= pending[l];
+							LabelSet both = pending[i] | pending[j];
+							double step = set_size(both), size = set_size(both & outside);
+							if (step < best_flops || (step == best_flops && size < best_size))
+							{
+								best_flops = step;
+								best_size = size;
+								best_i = i;
+								best_j = j;
+								best_kept = both & outside;
+							}
+						}
+					path.push_back({ best_i, best_j });
+					pending.erase(pending.begin() + best_j);
+					pending.erase(pending.begin() + best_i);
+					pending.push_back(best_kept);
+				}
+				return path;
+			}
+		public:
+			PathPlanner(const EinsumEquation& equation, const std::map<int, idx_type>& sizes)
+				:_output(0)
+			{
+				std::map<int, std::size_t> bits;
+				for (const auto& each : sizes)
+				{
+					bits[each.first] = _label_size.size();
+					_label_size.push_back(static_cast<double>(each.second));
+				}
+				for (std::size_t i = 0; i < equation.inputs.size(); ++i)
+				{
+					LabelSet operand = 0;
+					for (int label : reduced_labels(equation, i))
+						operand |= LabelSet(1) << bits[label];
+					_operands.push_back(operand);
+				}
+				for (int label : equation.output)
+					_output |= LabelSet(1) << bits[label];
+			}
+
+			std::vector<std::pair<idx_type, idx_type>> path() const
+			{
+				if (_operands.size() <= static_cast<std::size_t>(optimal_path_limit))
+					return optimal_path();
+				return greedy_path();
+			}
+		};
+
+		std::string plan_key(const EinsumEquation& equation, const std::vector<DimVector>& shapes)
+		{
+			std::ostringstream key;
+			for (std::size_t i = 0; i < equation.inputs.size(); ++i)
+			{
+				for (int label : equation.inputs[i])
+					key << label << ' ';
+				key << ':';
+				for (idx_type d = 0; d < shapes[i].size(); ++d)
+					key << shapes[i][d] << ' ';
+				key << ';';
+			}
+			key << '>';
+			for (int label : equation.output)
+				key << label << ' ';
+			return key.str();
+		}
+
+		class PlanCache
+		{
+		private:
+			std::mutex _mutex;
+			std::unordered_map<std::string, std::vector<std::pair<idx_type, idx_type>>> _plans;
+		public:
+			static PlanCache& get()
+			{
+				static PlanCache cache;
+				return cache;
+			}
+
+			std::vector<std::pair<idx_type, idx_type>> path(const EinsumEquation& equation, const std::vector<DimVector>& shapes)
+			{
+				std::map<int, idx_type> sizes = label_sizes(equation, shapes);
+				std::string key = plan_key(equation, shapes);
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					auto found = _plans.find(key);
+					if (found != _plans.end())
+						return found->second;
+				}
+				std::vector<std::pair<idx_type, idx_type>> result = PathPlanner(equation, sizes).path();
+				std::lock_guard<std::mutex> lock(_mutex);
+				_plans[key] = result;
+				return result;
+			}
+
+			idx_type size()
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				return _plans.size();
+			}
+
+			void clear()
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_plans.clear();
+			}
+		};
+
+		// An operand or intermediate as a strided view with one label per dimension, labels are
+		// unique. Intermediates own their storage.
+		template<typename T>
+		struct Term
+		{
+			std::shared_ptr<Tensor<T>> storage;
+			const T* ptr;
+			std::vector<int> labels;
+			std::vector<idx_type> sizes;
+			std::vector<idx_type> strides;
+
+			idx_type find(int label) const
+			{
+				return std::find(labels.begin(), labels.end(), label) - labels.begin();
+			}
+		};
+
+		// a repeated label becomes one dimension with the summed strides: the diagonal
+		template<typename T>
+		Term<T> make_term(const Tensor<T>& t, const std::vector<int>& labels)
+		{
+			Term<T> result;
+			result.ptr = t.data_ptr() + t.offset();
+			for (std::size_t d = 0; d < labels.size(); ++d)
+			{
+				idx_type pos = result.find(labels[d]);
+				if (pos < static_cast<idx_type>(result.labels.size()))
+				{
+					result.strides[pos] += t.stride(d);
+					continue;
+				}
+				result.labels.push_back(labels[d]);
+				result.sizes.push_back(t.size(d));
+				result.strides.push_back(t.stride(d));
+			}
+			return result;
+		}
+
+		// a zero filled row-major tensor, scalars are stored with one dimension of size 1
+		template<typename T>
+		std::shared_ptr<Tensor<T>> new_tensor(const std::vector<idx_type>& sizes)
+		{
+			DimVector dims;
+			for (idx_type size : sizes)
+				dims.push_back(size);
+			if (sizes.empty())
+				dims.push_back(1);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(dims));
+			std::fill(result->data_ptr(), result->data_ptr() + dims.flat_size(), T(0));
+			return result;
+		}
+
+		// a contiguous copy of t with the given labels in that order, labels of t that are not
+		// listed are summed over
+		template<typename T>
+		Term<T> rearrange(const Term<T>& t, const std::vector<int>& labels)
+		{
+			Term<T> result;
+			result.labels = labels;
+			for (int label : labels)
+				result.sizes.push_back(t.sizes[t.find(label)]);
+			result.strides.resize(labels.size());
+			idx_type stride = 1;
+			for (idx_type i = static_cast<idx_type>(labels.size()) - 1; i >= 0; --i)
+			{
+				result.strides[i] = stride;
+				stride *= result.sizes[i];
+			}
+			result.storage = new_tensor<T>(result.sizes);
+			result.ptr = result.storage->data_ptr();
+
+			idx_type dims = t.labels.size();
+			std::vector<idx_type> out_strides(dims, 0);
+			idx_type count = 1;
+			for (idx_type d = 0; d < dims; ++d)
+			{
+				idx_type pos = result.find(t.labels[d]);
+				if (pos < static_cast<idx_type>(labels.size()))
+					out_strides[d] = result.strides[pos];
+				count *= t.sizes[d];
+			}
+			if (count == 0)
+				return result;
+
+			T* out = result.storage->data_ptr();
+			const T* in = t.ptr;
+			if (dims == 0)
+			{
+				*out += *in;
+				return result;
+			}
+
+			std::vector<idx_type> index(dims, 0);
+			idx_type inner_size = t.sizes[dims - 1], inner_in = t.strides[dims - 1], inner_out = out_strides[dims - 1];
+			while (true)
+			{
+				for (idx_type j = 0; j < inner_size; ++j)
+					out[j * inner_out] += in[j * inner_in];
+				idx_type d = dims - 2;
+				for (; d >= 0; --d)
+				{
+					++index[d];
+					in += t.strides[d];
+					out += out_strides[d];
+					if (index[d] < t.sizes[d])
+						break;
+					in -= t.strides[d] * t.sizes[d];
+					out -= out_strides[d] * t.sizes[d];
+					index[d] = 0;
+				}
+				if (d < 0)
+					break;
+			}
+			return result;
+		}
+
+		// Whether the dimensions of the group can be walked with one stride, as in a matrix whose
+		// rows (or columns) are the flattened group. The stride is written to stride.
+		template<typename T>
+		bool group_stride(const Term<T>& t, const std::vector<int>& group, idx_type& stride)
+		{
+			stride = 1;
+			idx_type extent = 0;
+			for (idx_type i = static_cast<idx_type>(group.size()) - 1; i >= 0; --i)
+			{
+				idx_type pos = t.find(group[i]);
+				if (t.sizes[pos] == 1)
+					continue;
+				if (extent == 0)
+				{
+					stride = t.strides[pos];
+					extent = t.sizes[pos];
+				}
+				else
+				{
+					if (t.strides[pos] != stride * extent)
+						return false;
+					extent *= t.sizes[pos];
+				}
+			}
+			return true;
+		}
+
+		template<typename T>
+		bool groups_collapse(const Term<T>& t, const std::vector<int>& rows, const std::vector<int>& cols)
+		{
+			idx_type stride;
+			return group_stride(t, rows, stride) && group_stride(t, cols, stride);
+		}
+
+		// labels of the group sorted by decreasing stride in t, the order its memory is laid out in
+		template<typename T>
+		std::vector<int> memory_order(const Term<T>& t, std::vector<int> group)
+		{
+			std::stable_sort(group.begin(), group.end(), [&t](int x, int y) {
+				return t.strides[t.find(x)] > t.strides[t.find(y)];
+			});
+			return group;
+		}
+
+		template<typename T>
+		idx_type group_size(const Term<T>& t, const std::vector<int>& group)
+		{
+			idx_type result = 1;
+			for (int label : group)
+				result *= t.sizes[t.find(label)];
+			return result;
+		}
+
+		template<typename T>
+		void gemm(idx_type m, idx_type n, idx_type k,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T* c, idx_type c_rs, idx_type c_cs)
+		{
+			BlasRegistry::get().gemm(m, n, k, T(1), a, a_rs, a_cs, b, b_rs, b_cs, T(0), c, c_rs, c_cs);
+		}
+
+		DataType data_type(f32)
+		{
+			return DataType::FLOAT;
+		}
+
+		DataType data_type(f64)
+		{
+			return DataType::DOUBLE;
+		}
+
+		// Contracts a and b into a term with the labels the rest of the contraction needs.
+		// Shared labels that are needed are the batch, the other shared ones are summed by the
+		// gemm: a is viewed as [batch, left, contracted] and b as [batch, contracted, right].
+		template<typename T>
+		Term<T> contract(Term<T> a, Term<T> b, const std::vector<int>& needed)
+		{
+			// labels of one side nothing else refers to are summed up front
+			std::vector<int> a_keep, b_keep;
+			for (int label : a.labels)
+				if (has_label(b.labels, label) || has_label(needed, label))
+					a_keep.push_back(label);
+			for (int label : b.labels)
+				if (has_label(a.labels, label) || has_label(needed, label))
+					b_keep.push_back(label);
+			if (a_keep.size() != a.labels.size())
+				a = rearrange(a, a_keep);
+			if (b_keep.size() != b.labels.size())
+				b = rearrange(b, b_keep);
+
+			std::vector<int> batch, left, contracted, right;
+			for (int label : a.labels)
+			{
+				if (!has_label(b.labels, label))
+					left.push_back(label);
+				else if (has_label(needed, label))
+					batch.push_back(label);
+				else
+					contracted.push_back(label);
+			}
+			for (int label : b.labels)
+				if (!has_label(a.labels, label))
+					right.push_back(label);
+			batch = memory_order(a, batch);
+			left = memory_order(a, left);
+			right = memory_order(b, right);
+			contracted = memory_order(a, contracted);
+
+			idx_type stride;
+			if (!group_stride(b, contracted, stride))
+			{
+				std::vector<int> b_order = memory_order(b, contracted);
+				if (group_stride(a, b_order, stride))
+					contracted = b_order;
+			}
+			if (!groups_collapse(a, left, contracted))
+			{
+				std::vector<int> order = batch;
+				order.insert(order.end(), left.begin(), left.end());
+				order.insert(order.end(), contracted.begin(), contracted.end());
+				a = rearrange(a, order);
+			}
+			if (!groups_collapse(b, contracted, right))
+			{
+				std::vector<int> order = batch;
+				order.insert(order.end(), contracted.begin(), contracted.end());
+				order.insert(order.end(), right.begin(), right.end());
+				b = rearrange(b, order);
+			}
+
+			Term<T> result;
+			result.labels = batch;
+			result.labels.insert(result.labels.end(), left.begin(), left.end());
+			result.labels.insert(result.labels.end(), right.begin(), right.end());
+			for (int label : result.labels)
+				result.sizes.push_back(has_label(a.labels, label) ? a.sizes[a.find(label)] : b.sizes[b.find(label)]);
+			result.strides.resize(result.labels.size());
+			idx_type out_stride = 1;
+			for (idx_type i = static_cast<idx_type>(result.labels.size()) - 1; i >= 0; --i)
+			{
+				result.strides[i] = out_stride;
+				out_stride *= result.sizes[i];
+			}
+			result.storage = new_tensor<T>(result.sizes);
+			result.ptr = result.storage->data_ptr();
+
+			idx_type m = group_size(a, left), n = group_size(b, right), k = group_size(a, contracted);
+			idx_type batch_count = group_size(a, batch);
+			if (m == 0 || n == 0 || k == 0 || batch_count == 0)
+				return result;
+
+			idx_type a_rs, a_cs, b_rs, b_cs;
+			group_stride(a, left, a_rs);
+			group_stride(a, contracted, a_cs);
+			group_stride(b, contracted, b_rs);
+			group_stride(b, right, b_cs);
+
+			T* out = result.storage->data_ptr();
+			auto run_slot = [&](idx_type slot) {
+				const T* a_ptr = a.ptr;
+				const T* b_ptr = b.ptr;
+				T* out_ptr = out + slot * m * n;
+				for (idx_type i = static_cast<idx_type>(batch.size()) - 1; i >= 0; --i)
+				{
+					idx_type size = a.sizes[a.find(batch[i])];
+					idx_type index = slot % size;
+					slot /= size;
+					a_ptr += index * a.strides[a.find(batch[i])];
+					b_ptr += index * b.strides[b.find(batch[i])];
+				}
+				gemm(m, n, k, a_ptr, a_rs, a_cs, b_ptr, b_rs, b_cs, out_ptr, n, idx_type(1));
+			};
+
+			double flops = static_cast<double>(m) * n * k;
+			if (batch_count > 1 && flops < batch_parallel_threshold && !omp_in_parallel())
+			{
+				// small matrices: one gemm per thread, like batched_matmul
+				BlasRegistry::get().select(data_type(T()), m, n, k, a_rs == 1 && a_cs != 1, b_rs == 1 && b_cs != 1);
+				int slot_num = static_cast<int>(batch_count);
+#pragma omp parallel for schedule(dynamic) if(flops * batch_count >= batch_parallel_threshold)
+				for (int slot = 0; slot < slot_num; ++slot)
+					run_slot(slot);
+			}
+			else
+			{
+				for (idx_type slot = 0; slot < batch_count; ++slot)
+					run_slot(slot);
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::vector<DimVector> operand_shapes(const std::vector<const Tensor<T>*>& operands)
+		{
+			std::vector<DimVector> result;
+			for (const Tensor<T>* each : operands)
+				result.push_back(each->size());
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> einsum(const EinsumEquation& equation, const std::vector<const Tensor<T>*>& operands)
+		{
+			std::vector<std::pair<idx_type, idx_type>> path = PlanCache::get().path(equation, operand_shapes(operands));
+
+			std::vector<Term<T>> pending;
+			for (std::size_t i = 0; i < operands.size(); ++i)
+			{
+				Term<T> term = make_term(*operands[i], equation.inputs[i]);
+				std::vector<int> labels = reduced_labels(equation, i);
+				if (labels.size() != term.labels.size())
+					term = rearrange(term, labels);
+				pending.push_back(term);
+			}
+
+			for (const auto& step : path)
+			{
+				std::vector<int> needed = equation.output;
+				for (std::size_t i = 0; i < pending.size(); ++i)
+					if (static_cast<idx_type>(i) != step.first && static_cast<idx_type>(i) != step.second)
+						needed.insert(needed.end(), pending[i].labels.begin(), pending[i].labels.end());
+				Term<T> product = contract(pending[step.first], pending[step.second], needed);
+				pending.erase(pending.begin() + step.second);
+				pending.erase(pending.begin() + step.first);
+				pending.push_back(product);
+			}
+
+			// the result is handed out directly when it is already laid out in output order
+			Term<T>& last = pending.front();
+			if (last.storage && last.labels == equation.output)
+				return last.storage;
+			return rearrange(last, equation.output).storage;
+		}
+
+		// the gradient of operand i: the einsum of the gradient with the other operands, broadcast
+		// along the labels only operand i has
+		template<typename T>
+		std::shared_ptr<Tensor<T>> einsum_grad(const Tensor<T>& grad, const EinsumEquation& equation,
+			const std::vector<const Tensor<T>*>& operands, std::size_t i)
+		{
+			const std::vector<int>& labels = equation.inputs[i];
+			if (unique_labels(labels).size() != labels.size())
+				einsum_error("Gradients of operands with a repeated label are not supported");
+
+			EinsumEquation grad_equation;
+			std::vector<const Tensor<T>*> grad_operands;
+			grad_equation.inputs.push_back(equation.output);
+			grad_operands.push_back(&grad);
+			for (std::size_t j = 0; j < operands.size(); ++j)
+			{
+				if (j == i)
+					continue;
+				grad_equation.inputs.push_back(equation.inputs[j]);
+				grad_operands.push_back(operands[j]);
+			}
+			grad_equation.output = reduced_labels(equation, i);
+			std::shared_ptr<Tensor<T>> reduced = einsum(grad_equation, grad_operands);
+			if (grad_equation.output.size() == labels.size())
+				return reduced;
+
+			Term<T> source;
+			source.storage = reduced;
+			source.ptr = reduced->data_ptr();
+			idx_type stride = 1;
+			for (idx_type d = static_cast<idx_type>(labels.size()) - 1; d >= 0; --d)
+			{
+				source.labels.insert(source.labels.begin(), labels[d]);
+				source.sizes.insert(source.sizes.begin(), operands[i]->size(d));
+				if (has_label(grad_equation.output, labels[d]))
+				{
+					source.strides.insert(source.strides.begin(), stride);
+					stride *= operands[i]->size(d);
+				}
+				else
+				{
+					source.strides.insert(source.strides.begin(), 0);
+				}
+			}
+			return rearrange(source, labels).storage;
+		}
+
+		template<typename T>
+		std::vector<std::shared_ptr<Tensor<T>>> einsum_backward(const Tensor<T>& grad, const EinsumEquation& equation,
+			const std::vector<const Tensor<T>*>& operands)
+		{
+			std::vector<std::shared_ptr<Tensor<T>>> result;
+			for (std::size_t i = 0; i < operands.size(); ++i)
+				result.push_back(einsum_grad(grad, equation, operands, i));
+			return result;
+		}
+	}
+
+	EinsumEquation parse_einsum(const std::string& spec)
+	{
+		EinsumEquation result;
+		std::string::size_type arrow = spec.find("->");
+		std::string inputs = spec.substr(0, arrow);
+		std::vector<int> current;
+		for (char c : inputs)
+		{
+			if (c == ',')
+			{
+				result.inputs.push_back(current);
+				current.clear();
+			}
+			else if (std::isalpha(static_cast<unsigned char>(c)))
+				current.push_back(c);
+			else if (c == '.')
+				einsum_error("Ellipsis is not supported, name every dimension");
+			else if (!std::isspace(static_cast<unsigned char>(c)))
+				einsum_error(std::string("Invalid character '") + c + "' in the equation");
+		}
+		result.inputs.push_back(current);
+
+		if (arrow != std::string::npos)
+		{
+			for (char c : spec.substr(arrow + 2))
+			{
+				if (std::isalpha(static_cast<unsigned char>(c)))
+					result.output.push_back(c);
+				else if (!std::isspace(static_cast<unsigned char>(c)))
+					einsum_error(std::string("Invalid character '") + c + "' in the output");
+			}
+		}
+		else
+		{
+			std::map<int, idx_type> count;
+			for (const auto& labels : result.inputs)
+				for (int label : labels)
+					++count[label];
+			for (const auto& each : count)
+				if (each.second == 1)
+					result.output.push_back(each.first);
+		}
+		return result;
+	}
+
+	std::vector<std::pair<idx_type, idx_type>> einsum_path(const EinsumEquation& equation, const std::vector<DimVector>& shapes)
+	{
+		return PlanCache::get().path(equation, shapes);
+	}
+
+	idx_type einsum_plan_cache_size()
+	{
+		return PlanCache::get().size();
+	}
+
+	void einsum_clear_plan_cache()
+	{
+		PlanCache::get().clear();
+	}
+
+	std::shared_ptr<Tensor<f32>> einsum_impl(const EinsumEquation& equation, const std::vector<const Tensor<f32>*>& operands)
+	{
+		return einsum(equation, operands);
+	}
+
+	std::shared_ptr<Tensor<f64>> einsum_impl(const EinsumEquation& equation, const std::vector<const Tensor<f64>*>& operands)
+	{
+		return einsum(equation, operands);
+	}
+
+	std::shared_ptr<Tensor<f32>> einsum_impl(const std::string& spec, const std::vector<const Tensor<f32>*>& operands)
+	{
+		return einsum(parse_einsum(spec), operands);
+	}
+
+	std::shared_ptr<Tensor<f64>> einsum_impl(const std::string& spec, const std::vector<const Tensor<f64>*>& operands)
+	{
+		return einsum(parse_einsum(spec), operands);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f32>>> einsum_backward_impl(const Tensor<f32>& grad, const EinsumEquation& equation, const std::vector<const Tensor<f32>*>& operands)
+	{
+		return einsum_backward(grad, equation, operands);
+	}
+
+	std::vector<std::shared_ptr<Tensor<f64>>> einsum_backward_impl(const Tensor<f64>& grad, const EinsumEquation& equation, const std::vector<const Tensor<f64>*>& operands)
+	{
+		return einsum_backward(grad, equation, operands);
+	}
+
+	EinsumEquation tensordot_equation(idx_type a_dims, idx_type b_dims, const std::vector<idx_type>& dims_a, const std::vector<idx_type>& dims_b)
+	{
+		if (dims_a.size() != dims_b.size())
+			throw std::runtime_error("tensordot: Both operands shall contract the same number of dimensions.");
+
+		// labels 0 .. a_dims - 1 name the dimensions of a, b reuses them where it is contracted
+		EinsumEquation result;
+		result.inputs.resize(2);
+		for (idx_type d = 0; d < a_dims; ++d)
+			result.inputs[0].push_back(static_cast<int>(d));
+		for (idx_type d = 0; d < b_dims; ++d)
+			result.inputs[1].push_back(static_cast<int>(a_dims + d));
+		for (std::size_t i = 0; i < dims_a.size(); ++i)
+		{
+			if (dims_a[i] < 0 || dims_a[i] >= a_dims || dims_b[i] < 0 || dims_b[i] >= b_dims)
+				throw std::runtime_error("tensordot: Dimension out of range.");
+			if (result.inputs[1][dims_b[i]] < a_dims || std::count(dims_a.begin(), dims_a.end(), dims_a[i]) > 1)
+				throw std::runtime_error("tensordot: A dimension is contracted twice.");
+			result.inputs[1][dims_b[i]] = static_cast<int>(dims_a[i]);
+		}
+		for (idx_type d = 0; d < a_dims; ++d)
+			if (std::find(dims_a.begin(), dims_a.end(), d) == dims_a.end())
+				result.output.push_back(static_cast<int>(d));
+		for (idx_type d = 0; d < b_dims; ++d)
+			if (result.inputs[1][d] >= a_dims)
+				result.output.push_back(result.inputs[1][d]);
+		return result;
+	}
+
+	std::shared_ptr<Tensor<f32>> tensordot_impl(const Tensor<f32>& a, const Tensor<f32>& b, const std::vector<idx_type>& dims_a, const std::vector<idx_type>& dims_b)
+	{
+		return einsum(tensordot_equation(a.ndimension(), b.ndimension(), dims_a, dims_b), std::vector<const Tensor<f32>*>{ &a, &b });
+	}
+
+	std::shared_ptr<Tensor<f64>> tensordot_impl(const Tensor<f64>& a, const Tensor<f64>& b, const std::vector<idx_type>& dims_a, const std::vector<idx_type>& dims_b)
+	{
+		return einsum(tensordot_equation(a.ndimension(), b.ndimension(), dims_a, dims_b), std::vector<const Tensor<f64>*>{ &a, &b });
+	}
+}
@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <traph/core/cpu.h>
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/embedding.h>
+
+#include "strided.h"
+
+#if defined(TRAPH_ARCH_X86)
+#include <xmmintrin.h>
+#endif
+
+// A lookup copies or accumulates whole rows of the table, so the forward passes split the
+// output rows, or bags, between threads and every thread writes only its own rows. The
+// backward passes never scatter into a [rows, dim] gradient: the lookups are grouped by the
+// row they read with a stable radix sort, and each row read sums the gradient of its lookups
+// in their order into one row of the result. The work and the memory are those of the lookups
+// whatever the size of the table, and the sums do not depend on the number of threads.
+
+namespace traph
+{
+	namespace
+	{
+		// below this many elements copied or added the work runs on the calling thread
+		const double embedding_parallel_threshold = 64.0 * 64.0 * 64.0;
+		// bits of the row sorted in each pass of the radix sort
+		const int radix_bits = 11;
+		// rows of the table are fetched this many lookups ahead
+		const idx_type prefetch_distance = 8;
+
+		void embedding_error(const char* name, const std::string& message)
+		{
+			throw std::runtime_error(std::string(name) + ": " + message + ".");
+		}
+
+		// whether to split rows between threads, work is the number of elements read
+		bool parallel_rows(idx_type rows, double work)
+		{
+			return !omp_in_parallel() && omp_get_max_threads() > 1 && rows > 1 && work >= embedding_parallel_threshold;
+		}
+
+		// the elements of t in row-major order, checked to be in [0, limit)
+		std::vector<idx_type> read_indices(const char* name, const Tensor<i64>& t, idx_type limit, const char* what)
+		{
+			std::vector<idx_type> result(t.size().flat_size());
+			const i64* data = t.data_ptr();
+			for_each_offset(t, t.ndimension(), [&](idx_type i, idx_type pos) {
+				i64 value = data[pos];
+				if (value < 0 || value >= limit)
+					embedding_error(name, std::string(what) + " out of range");
+				result[i] = static_cast<idx_type>(value);
+			});
+			return result;
+		}
+
+		// [rows, dim] table of any strides
+		struct RowTable
+		{
+			idx_type rows, dim, row_stride, col_stride;
+		};
+
+		template<typename T>
+		RowTable row_table(const char* name, const Tensor<T>& t, const char* what)
+		{
+			if (t.ndimension() != 2)
+				embedding_error(name, std::string("The ") + what + " shall be [rows, dim]");
+			RowTable table = { t.size(0), t.size(1), t.stride(0), t.stride(1) };
+			return table;
+		}
+
+		// offsets of the rows of a [..., dim] tensor of any strides, in row-major order
+		template<typename T>
+		std::vector<idx_type> row_offsets(const Tensor<T>& t)
+		{
+			idx_type nd = t.ndimension() - 1;
+			idx_type count = 1;
+			for (idx_type d = 0; d < nd; ++d)
+				count *= t.size(d);
+			std::vector<idx_type> result(count);
+			for_each_offset(t, nd, [&](idx_type i, idx_type pos) { result[i] = pos; });
+			return result;
+		}
+
+		// Starts loading a row of the table, contiguous rows only. Lookups read random rows of
+		// a table much larger than the caches, so a row is fetched a few lookups before it is
+		// read and the loads of several rows overlap.
+		template<typename T>
+		void prefetch_row(const T* row, idx_type dim, idx_type col_stride)
+		{
+#if defined(TRAPH_ARCH_X86)
+			if (col_stride != 1)
+				return;
+			const char* begin = reinterpret_cast<const char*>(row);
+			const char* end = reinterpret_cast<const char*>(row + dim);
+			for (const char* p = begin; p < end; p += 64)
+				_mm_prefetch(p, _MM_HINT_T0);
+#endif
+		}
+
+		template<typename T>
+		void copy_row(T* dst, const T* src, idx_type dim, idx_type col_stride)
+		{
+			if (col_stride == 1)
+			{
+				std::copy(src, src + dim, dst);
+			}
+			else
+			{
+				for (idx_type j = 0; j < dim; ++j)
+					dst[j] = src[j * col_stride];
+			}
+		}
+
+		template<typename T>
+		void add_row(T* dst, const T* src, T alpha, idx_type dim, idx_type col_stride)
+		{
+			if (col_stride == 1)
+			{
+				for (idx_type j = 0; j < dim; ++j)
+					dst[j] += alpha * src[j];
+			}
+			else
+			{
+				for (idx_type j = 0; j < dim; ++j)
+					dst[j] += alpha * src[j * col_stride];
+			}
+		}
+
+		// first lookup of every bag, and one past the last lookup at the end
+		std::vector<idx_type> bag_starts(const char* name, const Tensor<i64>& indices, const Tensor<i64>* offsets)
+		{
+			std::vector<idx_type> starts;
+			if (offsets)
+			{
+				if (indices.ndimension() != 1 || offsets->ndimension() != 1)
+					embedding_error(name, "Indices and offsets shall be 1-D");
+				idx_type count = indices.size(0);
+				starts = read_indices(name, *offsets, count + 1, "Offset");
+				if (!starts.empty() && starts[0] != 0)
+					embedding_error(name, "The first offset shall be 0");
+				for (std::size_t b = 1; b < starts.size(); ++b)
+					if (starts[b] < starts[b - 1])
+						embedding_error(name, "Offsets shall not decrease");
+				starts.push_back(count);
+			}
+			else
+			{
+				if (indices.ndimension() != 2)
+					embedding_error(name, "Indices without offsets shall be [bags, length]");
+				idx_type bags = indices.size(0);
+				idx_type length = indices.size(1);
+				starts.resize(bags + 1);
+				for (idx_type b = 0; b <= bags; ++b)
+					starts[b] = b * length;
+			}
+			return starts;
+		}
+
+		// The lookups of row rows[s] are order[start[s], start[s + 1]), in increasing order.
+		struct RowGroups
+		{
+			std::vector<idx_type> rows;
+			std::vector<idx_type> start;
+			std::vector<idx_type> order;
+		};
+
+		RowGroups group_rows(const std::vector<idx_type>& index, idx_type table_rows)
+		{
+			idx_type count = static_cast<idx_type>(index.size());
+			RowGroups groups;
+			groups.order.resize(count);
+			for (idx_type i = 0; i < count; ++i)
+				groups.order[i] = i;
+
+			// stable least significant digit first, as many digits as the largest row has
+			int bits = 0;
+			while (bits < 31 && ((table_rows - 1) >> bits) != 0)
+				++bits;
+			const idx_type radix = idx_type(1) << radix_bits;
+			std::vector<idx_type> scratch(count);
+			std::vector<idx_type> bucket(radix + 1);
+			for (int shift = 0; shift == 0 || shift < bits; shift += radix_bits)
+			{
+				std::fill(bucket.begin(), bucket.end(), 0);
+				for (idx_type i = 0; i < count; ++i)
+					++bucket[((index[groups.order[i]] >> shift) & (radix - 1)) + 1];
+				for (idx_type d = 0; d < radix; ++d)
+					bucket[d + 1] += bucket[d];
+				for (idx_type i = 0; i < count; ++i)
+				{
+					idx_type lookup = groups.order[i];
+					scratch[bucket[(index[lookup] >> shift) & (radix - 1)]++] = lookup;
+				}
+				groups.order.swap(scratch);
+			}
+
+			for (idx_type i = 0; i < count; ++i)
+			{
+				idx_type row = index[groups.order[i]];
+				if (groups.rows.empty() || groups.rows.back() != row)
+				{
+					groups.rows.push_back(row);
+					groups.start.push_back(i);
+				}
+			}
+			groups.start.push_back(count);
+			return groups;
+		}
+
+		// Gradient of the table from the [outputs, dim] gradient: lookup i adds
+		// scale[output[i]] * grad[output[i]] to row index[i]. An empty output maps lookup i
+		// to output i, an empty scale is 1.
+		template<typename T>
+		std::shared_ptr<SparseRows<T>> gather_backward(const Tensor<T>& grad, const std::vector<idx_type>& index,
+			const std::vector<idx_type>& output, const std::vector<T>& scale, idx_type table_rows, idx_type dim)
+		{
+			std::shared_ptr<SparseRows<T>> result(new SparseRows<T>(table_rows, dim));
+			RowGroups groups = group_rows(index, table_rows);
+			idx_type nnz = static_cast<idx_type>(groups.rows.size());
+			result->indices = groups.rows;
+			if (nnz == 0)
+				return result;
+
+			result->values = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ nnz, dim })));
+			T* values = result->values->data_ptr();
+			const T* g = grad.data_ptr();
+			std::vector<idx_type> grad_rows = row_offsets(grad);
+			idx_type col_stride = grad.stride(grad.ndimension() - 1);
+
+			bool parallel = parallel_rows(nnz, static_cast<double>(index.size()) * dim);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int s = 0; s < nnz; ++s)
+			{
+				T* dst = values + static_cast<std::size_t>(s) * dim;
+				std::fill(dst, dst + dim, T(0));
+				for (idx_type k = groups.start[s]; k < groups.start[s + 1]; ++k)
+				{
+					idx_type lookup = groups.order[k];
+					idx_type out = output.empty() ? lookup : output[lookup];
+					add_row(dst, g + grad_rows[out], scale.empty() ? T(1) : scale[out], dim, col_stride);
+				}
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> embedding(const Tensor<T>& weight, const Tensor<i64>& indices)
+		{
+			const char* name = "embedding";
+			RowTable table = row_table(name, weight, "weight");
+			std::vector<idx_type> index = read_indices(name, indices, table.rows, "Index");
+			idx_type count = static_cast<idx_type>(index.size());
+
+			DimVector result_size = indices.size();
+			result_size.push_back(table.dim);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(result_size));
+			T* y = result->data_ptr();
+			const T* w = weight.data_ptr() + weight.offset();
+
+			bool parallel = parallel_rows(count, static_cast<double>(count) * table.dim);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int i = 0; i < count; ++i)
+			{
+				if (i + prefetch_distance < count)
+					prefetch_row(w + static_cast<std::size_t>(index[i + prefetch_distance]) * table.row_stride, table.dim, table.col_stride);
+				T* dst = y + static_cast<std::size_t>(i) * table.dim;
+				copy_row(dst, w + static_cast<std::size_t>(index[i]) * table.row_stride, table.dim, table.col_stride);
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<SparseRows<T>> embedding_backward(const Tensor<T>& grad, const Tensor<i64>& indices, idx_type rows)
+		{
+			const char* name = "embedding_backward";
+			std::vector<idx_type> index = read_indices(name, indices, rows, "Index");
+			DimVector grad_size = grad.size();
+			DimVector indices_size = indices.size();
+			if (grad_size.size() != indices_size.size() + 1)
+				embedding_error(name, "The gradient shall be [*indices, dim]");
+			for (idx_type d = 0; d < indices_size.size(); ++d)
+				if (grad_size[d] != indices_size[d])
+					embedding_error(name, "The gradient shall be [*indices, dim]");
+			return gather_backward(grad, index, std::vector<idx_type>(), std::vector<T>(), rows, grad_size[grad_size.size() - 1]);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> embedding_bag(const Tensor<T>& weight, const Tensor<i64>& indices, const Tensor<i64>* offsets, EmbeddingBagMode mode)
+		{
+			const char* name = "embedding_bag";
+			RowTable table = row_table(name, weight, "weight");
+			std::vector<idx_type> starts = bag_starts(name, indices, offsets);
+			std::vector<idx_type> index = read_indices(name, indices, table.rows, "Index");
+			idx_type bags = static_cast<idx_type>(starts.size()) - 1;
+
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ bags, table.dim })));
+			T* y = result->data_ptr();
+			const T* w = weight.data_ptr() + weight.offset();
+
+			bool parallel = parallel_rows(bags, static_cast<double>(index.size()) * table.dim);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int b = 0; b < bags; ++b)
+			{
+				T* dst = y + static_cast<std::size_t>(b) * table.dim;
+				std::fill(dst, dst + table.dim, T(0));
+				for (idx_type k = starts[b]; k < starts[b + 1]; ++k)
+				{
+					if (k + prefetch_distance < static_cast<idx_type>(index.size()))
+						prefetch_row(w + static_cast<std::size_t>(index[k + prefetch_distance]) * table.row_stride, table.dim, table.col_stride);
+					add_row(dst, w + static_cast<std::size_t>(index[k]) * table.row_stride, T(1), table.dim, table.col_stride);
+				}
+				idx_type length = starts[b + 1] - starts[b];
+				if (mode == EmbeddingBagMode::MEAN && length > 1)
+				{
+					T scale = T(1) / length;
+					for (idx_type j = 0; j < table.dim; ++j)
+						dst[j] *= scale;
+				}
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<SparseRows<T>> embedding_bag_backward(const Tensor<T>& grad, const Tensor<i64>& indices, const Tensor<i64>* offsets, idx_type rows, EmbeddingBagMode mode)
+		{
+			const char* name = "embedding_bag_backward";
+			std::vector<idx_type> starts = bag_starts(name, indices, offsets);
+			std::vector<idx_type> index = read_indices(name, indices, rows, "Index");
+			idx_type bags = static_cast<idx_type>(starts.size()) - 1;
+			if (grad.ndimension() != 2 || grad.size(0) != bags)
+				embedding_error(name, "The gradient shall be [bags, dim]");
+
+			std::vector<idx_type> output(index.size());
+			std::vector<T> scale;
+			if (mode == EmbeddingBagMode::MEAN)
+				scale.resize(bags);
+			for (idx_type b = 0; b < bags; ++b)
+			{
+				for (idx_type k = starts[b]; k < starts[b + 1]; ++k)
+					output[k] = b;
+				if (mode == EmbeddingBagMode::MEAN)
+					scale[b] = starts[b + 1] > starts[b] ? T(1) / (starts[b + 1] - starts[b]) : T(0);
+			}
+			return gather_backward(grad, index, output, scale, rows, grad.size(1));
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> values_copy(const Tensor<T>& values)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(values.size()));
+			const T* src = values.data_ptr() + values.offset();
+			std::copy(src, src + values.size().flat_size(), result->data_ptr());
+			return result;
+		}
+
+		void check_same_table(const char* name, idx_type lhs_rows, idx_type lhs_dim, idx_type rhs_rows, idx_type rhs_dim)
+		{
+			if (lhs_rows != rhs_rows || lhs_dim != rhs_dim)
+				embedding_error(name, "The tables shall have the same size");
+		}
+
+		template<typename T>
+		void sparse_rows_add(SparseRows<T>& lhs, const SparseRows<T>& rhs)
+		{
+			const char* name = "sparse_rows_add_";
+			check_same_table(name, lhs.rows, lhs.dim, rhs.rows, rhs.dim);
+			if (rhs.indices.empty())
+				return;
+			if (lhs.indices.empty())
+			{
+				lhs.indices = rhs.indices;
+				lhs.values = values_copy(*rhs.values);
+				return;
+			}
+
+			// rows of the union and where they come from, -1 when only in the other
+			std::vector<idx_type> indices, from_lhs, from_rhs;
+			std::size_t i = 0, j = 0;
+			while (i < lhs.indices.size() || j < rhs.indices.size())
+			{
+				bool take_lhs = j == rhs.indices.size() || (i < lhs.indices.size() && lhs.indices[i] <= rhs.indices[j]);
+				bool take_rhs = i == lhs.indices.size() || (j < rhs.indices.size() && rhs.indices[j] <= lhs.indices[i]);
+				indices.push_back(take_lhs ? lhs.indices[i] : rhs.indices[j]);
+				from_lhs.push_back(take_lhs ? static_cast<idx_type>(i++) : -1);
+				from_rhs.push_back(take_rhs ? static_cast<idx_type>(j++) : -1);
+			}
+
+			idx_type nnz = static_cast<idx_type>(indices.size());
+			idx_type dim = lhs.dim;
+			std::shared_ptr<Tensor<T>> values(new Tensor<T>(DimVector({ nnz, dim })));
+			T* v = values->data_ptr();
+			const T* l = lhs.values->data_ptr() + lhs.values->offset();
+			const T* r = rhs.values->data_ptr() + rhs.values->offset();
+
+			bool parallel = parallel_rows(nnz, 2.0 * nnz * dim);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int s = 0; s < nnz; ++s)
+			{
+				T* dst = v + static_cast<std::size_t>(s) * dim;
+				std::fill(dst, dst + dim, T(0));
+				if (from_lhs[s] >= 0)
+					add_row(dst, l + static_cast<std::size_t>(from_lhs[s]) * dim, T(1), dim, 1);
+				if (from_rhs[s] >= 0)
+					add_row(dst, r + static_cast<std::size_t>(from_rhs[s]) * dim, T(1), dim, 1);
+			}
+			lhs.indices.swap(indices);
+			lhs.values = values;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> to_dense(const SparseRows<T>& rows)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ rows.rows, rows.dim })));
+			T* y = result->data_ptr();
+			std::fill(y, y + static_cast<std::size_t>(rows.rows) * rows.dim, T(0));
+			if (rows.indices.empty())
+				return result;
+
+			idx_type nnz = rows.nnz();
+			const T* v = rows.values->data_ptr() + rows.values->offset();
+			bool parallel = parallel_rows(nnz, static_cast<double>(nnz) * rows.dim);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int s = 0; s < nnz; ++s)
+				copy_row(y + static_cast<std::size_t>(rows.indices[s]) * rows.dim, v + static_cast<std::size_t>(s) * rows.dim, rows.dim, 1);
+			return result;
+		}
+
+		template<typename T>
+		void index_add_rows(Tensor<T>& table, const SparseRows<T>& rows, T alpha)
+		{
+			const char* name = "index_add_rows_";
+			RowTable t = row_table(name, table, "table");
+			check_same_table(name, t.rows, t.dim, rows.rows, rows.dim);
+			if (rows.indices.empty())
+				return;
+
+			idx_type nnz = rows.nnz();
+			T* w = table.data_ptr() + table.offset();
+			const T* v = rows.values->data_ptr() + rows.values->offset();
+			bool parallel = parallel_rows(nnz, static_cast<double>(nnz) * t.dim);
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int s = 0; s < nnz; ++s)
+			{
+				if (s + prefetch_distance < nnz)
+					prefetch_row(w + static_cast<std::size_t>(rows.indices[s + prefetch_distance]) * t.row_stride, t.dim, t.col_stride);
+				T* dst = w + static_cast<std::size_t>(rows.indices[s]) * t.row_stride;
+				const T* src = v + static_cast<std::size_t>(s) * t.dim;
+				if (t.col_stride == 1)
+				{
+					add_row(dst, src, alpha, t.dim, 1);
+				}
+				else
+				{
+					for (idx_type j = 0; j < t.dim; ++j)
+						dst[j * t.col_stride] += alpha * src[j];
+				}
+			}
+		}
+	}
+
+	std::shared_ptr<Tensor<f32>> embedding_impl(const Tensor<f32>& weight, const Tensor<i64>& indices)
+	{
+		return embedding(weight, indices);
+	}
+
+	std::shared_ptr<Tensor<f64>> embedding_impl(const Tensor<f64>& weight, const Tensor<i64>& indices)
+	{
+		return embedding(weight, indices);
+	}
+
+	std::shared_ptr<SparseRows<f32>> embedding_backward_impl(const Tensor<f32>& grad, const Tensor<i64>& indices, idx_type rows)
+	{
+		return embedding_backward(grad, indices, rows);
+	}
+
+	std::shared_ptr<SparseRows<f64>> embedding_backward_impl(const Tensor<f64>& grad, const Tensor<i64>& indices, idx_type rows)
+	{
+		return embedding_backward(grad, indices, rows);
+	}
+
+	std::shared_ptr<Tensor<f32>> embedding_bag_impl(const Tensor<f32>& weight, const Tensor<i64>& indices, const Tensor<i64>* offsets, EmbeddingBagMode mode)
+	{
+		return embedding_bag(weight, indices, offsets, mode);
+	}
+
+	std::shared_ptr<Tensor<f64>> embedding_bag_impl(const Tensor<f64>& weight, const Tensor<i64>& indices, const Tensor<i64>* offsets, EmbeddingBagMode mode)
+	{
+		return embedding_bag(weight, indices, offsets, mode);
+	}
+
+	std::shared_ptr<SparseRows<f32>> embedding_bag_backward_impl(const Tensor<f32>& grad, const Tensor<i64>& indices, const Tensor<i64>* offsets, idx_type rows, EmbeddingBagMode mode)
+	{
+		return embedding_bag_backward(grad, indices, offsets, rows, mode);
+	}
+
+	std::shared_ptr<SparseRows<f64>> embedding_bag_backward_impl(const Tensor<f64>& grad, const Tensor<i64>& indices, const Tensor<i64>* offsets, idx_type rows, EmbeddingBagMode mode)
+	{
+		return embedding_bag_backward(grad, indices, offsets, rows, mode);
+	}
+
+	void sparse_rows_add_(SparseRows<f32>& lhs, const SparseRows<f32>& rhs)
+	{
+		sparse_rows_add(lhs, rhs);
+	}
+
+	void sparse_rows_add_(SparseRows<f64>& lhs, const SparseRows<f64>& rhs)
+	{
+		sparse_rows_add(lhs, rhs);
+	}
+
+	std::shared_ptr<Tensor<f32>> sparse_rows_to_dense(const SparseRows<f32>& rows)
+	{
+		return to_dense(rows);
+	}
+
+	std::shared_ptr<Tensor<f64>> sparse_rows_to_dense(const SparseRows<f64>& rows)
+	{
+		return to_dense(rows);
+	}
+
+	void index_add_rows_(Tensor<f32>& table, const SparseRows<f32>& rows, f32 alpha)
+	{
+		index_add_rows(table, rows, alpha);
+	}
+
+	void index_add_rows_(Tensor<f64>& table, const SparseRows<f64>& rows, f64 alpha)
+	{
+		index_add_rows(table, rows, alpha);
+	}
+}
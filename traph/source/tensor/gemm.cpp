@@ -0,0 +1,647 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include <omp.h>
+
+#include <traph/core/cpu.h>
+#include <traph/tensor/gemm.h>
+
+#if defined(TRAPH_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+// BLIS-style gemm: C is cut into nc wide column blocks and kc deep rank updates, the
+// kc x nc block of B is packed into nr wide panels that stay in L3, every mc x kc block of
+// A is packed into mr high panels that stay in L2, and a register blocked mr x nr
+// micro-kernel streams one A panel against one B panel out of L1.
+
+namespace traph
+{
+	namespace
+	{
+		// below this many multiply-adds the gemm runs on the calling thread
+		const double gemm_parallel_threshold = 64.0 * 64.0 * 64.0;
+		// largest mr x nr tile of all micro-kernels
+		const idx_type gemm_max_tile = 12 * 32;
+
+		template<typename T>
+		struct GemmMicroKernel
+		{
+			GemmIsa isa;
+			idx_type mr, nr;
+			idx_type mc, kc, nc;
+			// C[0:mr, 0:nr] = alpha * A_panel * B_panel + beta * C, column stride of C is 1
+			void(*kernel)(idx_type k, const T* a, const T* b, T* c, idx_type rs_c, T alpha, T beta);
+		};
+
+		// grows on demand, reused across calls by the owning thread
+		class AlignedBuffer
+		{
+		private:
+			std::unique_ptr<unsigned char[]> _raw;
+			std::size_t _capacity = 0;
+			void* _aligned = nullptr;
+		public:
+			void* get(std::size_t bytes)
+			{
+				if (bytes > _capacity)
+				{
+					_raw.reset(new unsigned char[bytes + 64]);
+					std::uintptr_t p = reinterpret_cast<std::uintptr_t>(_raw.get());
+					_aligned = reinterpret_cast<void*>((p + 63) & ~std::uintptr_t(63));
+					_capacity = bytes;
+				}
+				return _aligned;
+			}
+		};
+
+		template<typename T>
+		T* packed_a_buffer(std::size_t count)
+		{
+			thread_local AlignedBuffer buffer;
+			return static_cast<T*>(buffer.get(count * sizeof(T)));
+		}
+
+		template<typename T>
+		T* packed_b_buffer(std::size_t count)
+		{
+			thread_local AlignedBuffer buffer;
+			return static_cast<T*>(buffer.get(count * sizeof(T)));
+		}
+
+		// generic micro-kernel, also the reference for the simd ones
+		template<typename T, idx_type MR, idx_type NR>
+		void gemm_kernel_generic(idx_type k, const T* a, const T* b, T* c, idx_type rs_c, T alpha, T beta)
+		{
+			T acc[MR][NR] = {};
+			for (idx_type p = 0; p < k; ++p)
+			{
+				for (idx_type i = 0; i < MR; ++i)
+				{
+					T a_value = a[i];
+					for (idx_type j = 0; j < NR; ++j)
+						acc[i][j] += a_value * b[j];
+				}
+				a += MR;
+				b += NR;
+			}
+
+			for (idx_type i = 0; i < MR; ++i)
+			{
+				T* c_row = c + i * rs_c;
+				for (idx_type j = 0; j < NR; ++j)
+					c_row[j] = beta == T(0) ? alpha * acc[i][j] : alpha * acc[i][j] + beta * c_row[j];
+			}
+		}
+
+#if defined(TRAPH_ARCH_X86)
+		// avx2 + fma, 6 x 16 floats: 12 ymm accumulators, 2 for B and 1 broadcast of A
+#define TRAPH_SGEMM_AVX2_ROW(i)                                           \
+		{                                                                 \
+			__m256 a_i = _mm256_broadcast_ss(a + i);                      \
+			c##i##0 = _mm256_fmadd_ps(a_i, b0, c##i##0);                  \
+			c##i##1 = _mm256_fmadd_ps(a_i, b1, c##i##1);                  \
+		}
+
+#define TRAPH_SGEMM_AVX2_STORE(i)                                         \
+		{                                                                 \
+			f32* c_row = c + i * rs_c;                                    \
+			__m256 r0 = _mm256_mul_ps(alpha_v, c##i##0);                  \
+			__m256 r1 = _mm256_mul_ps(alpha_v, c##i##1);                  \
+			if (beta != 0.f)                                              \
+			{                                                             \
+				r0 = _mm256_fmadd_ps(beta_v, _mm256_loadu_ps(c_row), r0);    \
+				r1 = _mm256_fmadd_ps(beta_v, _mm256_loadu_ps(c_row + 8), r1);\
+			}                                                             \
+			_mm256_storeu_ps(c_row, r0);                                  \
+			_mm256_storeu_ps(c_row + 8, r1);                              \
+		}
+
+		TRAPH_TARGET_AVX2
+		void sgemm_kernel_avx2(idx_type k, const f32* a, const f32* b, f32* c, idx_type rs_c, f32 alpha, f32 beta)
+		{
+			__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+			__m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+			__m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+			__m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+			__m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+			__m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+			for (idx_type p = 0; p < k; ++p)
+			{
+				__m256 b0 = _mm256_load_ps(b);
+				__m256 b1 = _mm256_load_ps(b + 8);
+				TRAPH_SGEMM_AVX2_ROW(0)
+				TRAPH_SGEMM_AVX2_ROW(1)
+				TRAPH_SGEMM_AVX2_ROW(2)
+				TRAPH_SGEMM_AVX2_ROW(3)
+				TRAPH_SGEMM_AVX2_ROW(4)
+				TRAPH_SGEMM_AVX2_ROW(5)
+				a += 6;
+				b += 16;
+			}
+
+			__m256 alpha_v = _mm256_set1_ps(alpha);
+			__m256 beta_v = _mm256_set1_ps(beta);
+			TRAPH_SGEMM_AVX2_STORE(0)
+			TRAPH_SGEMM_AVX2_STORE(1)
+			TRAPH_SGEMM_AVX2_STORE(2)
+			TRAPH_SGEMM_AVX2_STORE(3)
+			TRAPH_SGEMM_AVX2_STORE(4)
+			TRAPH_SGEMM_AVX2_STORE(5)
+		}
+
+		// avx2 + fma, 6 x 8 doubles
+#define TRAPH_DGEMM_AVX2_ROW(i)                                           \
+		{                                                                 \
+			__m256d a_i = _mm256_broadcast_sd(a + i);                     \
+			c##i##0 = _mm256_fmadd_pd(a_i, b0, c##i##0);                  \
+			c##i##1 = _mm256_fmadd_pd(a_i, b1, c##i##1);                  \
+		}
+
+#define TRAPH_DGEMM_AVX2_STORE(i)                                         \
+		{                                                                 \
+			f64* c_row = c + i * rs_c;                                    \
+			__m256d r0 = _mm256_mul_pd(alpha_v, c##i##0);                 \
+			__m256d r1 = _mm256_mul_pd(alpha_v, c##i##1);                 \
+			if (beta != 0.0)                                              \
+			{                                                             \
+				r0 = _mm256_fmadd_pd(beta_v, _mm256_loadu_pd(c_row), r0);    \
+				r1 = _mm256_fmadd_pd(beta_v, _mm256_loadu_pd(c_row + 4), r1);\
+			}                                                             \
+			_mm256_storeu_pd(c_row, r0);                                  \
+			_mm256_storeu_pd(c_row + 4, r1);                              \
+		}
+
+		TRAPH_TARGET_AVX2
+		void dgemm_kernel_avx2(idx_type k, const f64* a, const f64* b, f64* c, idx_type rs_c, f64 alpha, f64 beta)
+		{
+			__m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+			__m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+			__m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+			__m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+			__m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+			__m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+
+			for (idx_type p = 0; p < k; ++p)
+			{
+				__m256d b0 = _mm256_load_pd(b);
+				__m256d b1 = _mm256_load_pd(b + 4);
+				TRAPH_DGEMM_AVX2_ROW(0)
+				TRAPH_DGEMM_AVX2_ROW(1)
+				TRAPH_DGEMM_AVX2_ROW(2)
+				TRAPH_DGEMM_AVX2_ROW(3)
+				TRAPH_DGEMM_AVX2_ROW(4)
+				TRAPH_DGEMM_AVX2_ROW(5)
+				a += 6;
+				b += 8;
+			}
+
+			__m256d alpha_v = _mm256_set1_pd(alpha);
+			__m256d beta_v = _mm256_set1_pd(beta);
+			TRAPH_DGEMM_AVX2_STORE(0)
+			TRAPH_DGEMM_AVX2_STORE(1)
+			TRAPH_DGEMM_AVX2_STORE(2)
+			TRAPH_DGEMM_AVX2_STORE(3)
+			TRAPH_DGEMM_AVX2_STORE(4)
+			TRAPH_DGEMM_AVX2_STORE(5)
+		}
+
+		// avx-512, 12 x 32 floats: 24 zmm accumulators, 2 for B and 1 broadcast of A
+#define TRAPH_SGEMM_AVX512_ROW(i)                                         \
+		{                                                                 \
+			__m512 a_i = _mm512_set1_ps(a[i]);                            \
+			c##i##_0 = _mm512_fmadd_ps(a_i, b0, c##i##_0);                \
+			c##i##_1 = _mm512_fmadd_ps(a_i, b1, c##i##_1);                \
+		}
+
+#define TRAPH_SGEMM_AVX512_STORE(i)                                       \
+		{                                                                 \
+			f32* c_row = c + i * rs_c;                                    \
+			__m512 r0 = _mm512_mul_ps(alpha_v, c##i##_0);                 \
+			__m512 r1 = _mm512_mul_ps(alpha_v, c##i##_1);                 \
+			if (beta != 0.f)                                              \
+			{                                                             \
+				r0 = _mm512_fmadd_ps(beta_v, _mm512_loadu_ps(c_row), r0);     \
+				r1 = _mm512_fmadd_ps(beta_v, _mm512_loadu_ps(c_row + 16), r1);\
+			}                                                             \
+			_mm512_storeu_ps(c_row, r0);                                  \
+			_mm512_storeu_ps(c_row + 16, r1);                             \
+		}
+
+		TRAPH_TARGET_AVX512
+		void sgemm_kernel_avx512(idx_type k, const f32* a, const f32* b, f32* c, idx_type rs_c, f32 alpha, f32 beta)
+		{
+			__m512 c0_0 = _mm512_setzero_ps(), c0_1 = _mm512_setzero_ps();
+			__m512 c1_0 = _mm512_setzero_ps(), c1_1 = _mm512_setzero_ps();
+			__m512 c2_0 = _mm512_setzero_ps(), c2_1 = _mm512_setzero_ps();
+			__m512 c3_0 = _mm512_setzero_ps(), c3_1 = _mm512_setzero_ps();
+			__m512 c4_0 = _mm512_setzero_ps(), c4_1 = _mm512_setzero_ps();
+			__m512 c5_0 = _mm512_setzero_ps(), c5_1 = _mm512_setzero_ps();
+			__m512 c6_0 = _mm512_setzero_ps(), c6_1 = _mm512_setzero_ps();
+			__m512 c7_0 = _mm512_setzero_ps(), c7_1 = _mm512_setzero_ps();
+			__m512 c8_0 = _mm512_setzero_ps(), c8_1 = _mm512_setzero_ps();
+			__m512 c9_0 = _mm512_setzero_ps(), c9_1 = _mm512_setzero_ps();
+			__m512 c10_0 = _mm512_setzero_ps(), c10_1 = _mm512_setzero_ps();
+			__m512 c11_0 = _mm512_setzero_ps(), c11_1 = _mm512_setzero_ps();
+
+			for (idx_type p = 0; p < k; ++p)
+			{
+				__m512 b0 = _mm512_load_ps(b);
+				__m512 b1 = _mm512_load_ps(b + 16);
+				TRAPH_SGEMM_AVX512_ROW(0)
+				TRAPH_SGEMM_AVX512_ROW(1)
+				TRAPH_SGEMM_AVX512_ROW(2)
+				TRAPH_SGEMM_AVX512_ROW(3)
+				TRAPH_SGEMM_AVX512_ROW(4)
+				TRAPH_SGEMM_AVX512_ROW(5)
+				TRAPH_SGEMM_AVX512_ROW(6)
+				TRAPH_SGEMM_AVX512_ROW(7)
+				TRAPH_SGEMM_AVX512_ROW(8)
+				TRAPH_SGEMM_AVX512_ROW(9)
+				TRAPH_SGEMM_AVX512_ROW(10)
+				TRAPH_SGEMM_AVX512_ROW(11)
+				a += 12;
+				b += 32;
+			}
+
+			__m512 alpha_v = _mm512_set1_ps(alpha);
+			__m512 beta_v = _mm512_set1_ps(beta);
+			TRAPH_SGEMM_AVX512_STORE(0)
+			TRAPH_SGEMM_AVX512_STORE(1)
+			TRAPH_SGEMM_AVX512_STORE(2)
+			TRAPH_SGEMM_AVX512_STORE(3)
+			TRAPH_SGEMM_AVX512_STORE(4)
+			TRAPH_SGEMM_AVX512_STORE(5)
+			TRAPH_SGEMM_AVX512_STORE(6)
+			TRAPH_SGEMM_AVX512_STORE(7)
+			TRAPH_SGEMM_AVX512_STORE(8)
+			TRAPH_SGEMM_AVX512_STORE(9)
+			TRAPH_SGEMM_AVX512_STORE(10)
+			TRAPH_SGEMM_AVX512_STORE(11)
+		}
+
+		// avx-512, 12 x 16 doubles
+#define TRAPH_DGEMM_AVX512_ROW(i)                                         \
+		{                                                                 \
+			__m512d a_i = _mm512_set1_pd(a[i]);                           \
+			c##i##_0 = _mm512_fmadd_pd(a_i, b0, c##i##_0);                \
+			c##i##_1 = _mm512_fmadd_pd(a_i, b1, c##i##_1);                \
+		}
+
+#define TRAPH_DGEMM_AVX512_STORE(i)                                       \
+		{                                                                 \
+			f64* c_row = c + i * rs_c;                                    \
+			__m512d r0 = _mm512_mul_pd(alpha_v, c##i##_0);                \
+			__m512d r1 = _mm512_mul_pd(alpha_v, c##i##_1);                \
+			if (beta != 0.0)                                              \
+			{                                                             \
+				r0 = _mm512_fmadd_pd(beta_v, _mm512_loadu_pd(c_row), r0);    \
+				r1 = _mm512_fmadd_pd(beta_v, _mm512_loadu_pd(c_row + 8), r1);\
+			}                                                             \
+			_mm512_storeu_pd(c_row, r0);                                  \
+			_mm512_storeu_pd(c_row + 8, r1);                              \
+		}
+
+		TRAPH_TARGET_AVX512
+		void dgemm_kernel_avx512(idx_type k, const f64* a, const f64* b, f64* c, idx_type rs_c, f64 alpha, f64 beta)
+		{
+			__m512d c0_0 = _mm512_setzero_pd(), c0_1 = _mm512_setzero_pd();
+			__m512d c1_0 = _mm512_setzero_pd(), c1_1 = _mm512_setzero_pd();
+			__m512d c2_0 = _mm512_setzero_pd(), c2_1 = _mm512_setzero_pd();
+			__m512d c3_0 = _mm512_setzero_pd(), c3_1 = _mm512_setzero_pd();
+			__m512d c4_0 = _mm512_setzero_pd(), c4_1 = _mm512_setzero_pd();
+			__m512d c5_0 = _mm512_setzero_pd(), c5_1 = _mm512_setzero_pd();
+			__m512d c6_0 = _mm512_setzero_pd(), c6_1 = _mm512_setzero_pd();
+			__m512d c7_0 = _mm512_setzero_pd(), c7_1 = _mm512_setzero_pd();
+			__m512d c8_0 = _mm512_setzero_pd(), c8_1 = _mm512_setzero_pd();
+			__m512d c9_0 = _mm512_setzero_pd(), c9_1 = _mm512_setzero_pd();
+			__m512d c10_0 = _mm512_setzero_pd(), c10_1 = _mm512_setzero_pd();
+			__m512d c11_0 = _mm512_setzero_pd(), c11_1 = _mm512_setzero_pd();
+
+			for (idx_type p = 0; p < k; ++p)
+			{
+				__m512d b0 = _mm512_load_pd(b);
+				__m512d b1 = _mm512_load_pd(b + 8);
+				TRAPH_DGEMM_AVX512_ROW(0)
+				TRAPH_DGEMM_AVX512_ROW(1)
+				TRAPH_DGEMM_AVX512_ROW(2)
+				TRAPH_DGEMM_AVX512_ROW(3)
+				TRAPH_DGEMM_AVX512_ROW(4)
+				TRAPH_DGEMM_AVX512_ROW(5)
+				TRAPH_DGEMM_AVX512_ROW(6)
+				TRAPH_DGEMM_AVX512_ROW(7)
+				TRAPH_DGEMM_AVX512_ROW(8)
+				TRAPH_DGEMM_AVX512_ROW(9)
+				TRAPH_DGEMM_AVX512_ROW(10)
+				TRAPH_DGEMM_AVX512_ROW(11)
+				a += 12;
+				b += 16;
+			}
+
+			__m512d alpha_v = _mm512_set1_pd(alpha);
+			__m512d beta_v = _mm512_set1_pd(beta);
+			TRAPH_DGEMM_AVX512_STORE(0)
+			TRAPH_DGEMM_AVX512_STORE(1)
+			TRAPH_DGEMM_AVX512_STORE(2)
+			TRAPH_DGEMM_AVX512_STORE(3)
+			TRAPH_DGEMM_AVX512_STORE(4)
+			TRAPH_DGEMM_AVX512_STORE(5)
+			TRAPH_DGEMM_AVX512_STORE(6)
+			TRAPH_DGEMM_AVX512_STORE(7)
+			TRAPH_DGEMM_AVX512_STORE(8)
+			TRAPH_DGEMM_AVX512_STORE(9)
+			TRAPH_DGEMM_AVX512_STORE(10)
+			TRAPH_DGEMM_AVX512_STORE(11)
+		}
+#endif
+
+		// -1 until the first gemm, then the selected GemmIsa
+		std::atomic<int> selected_isa(-1);
+
+		GemmIsa clamp_isa(GemmIsa isa)
+		{
+			const CpuFeatures& features = cpu_features();
+			if (isa == GemmIsa::AVX512 && !features.avx512f)
+				isa = GemmIsa::AVX2;
+			if (isa == GemmIsa::AVX2 && !(features.avx2 && features.fma))
+				isa = GemmIsa::GENERIC;
+			return isa;
+		}
+
+		template<typename T>
+		GemmMicroKernel<T> select_kernel(GemmIsa isa);
+
+		template<>
+		GemmMicroKernel<f32> select_kernel<f32>(GemmIsa isa)
+		{
+#if defined(TRAPH_ARCH_X86)
+			if (isa == GemmIsa::AVX512)
+				return { GemmIsa::AVX512, 12, 32, 144, 384, 4096, sgemm_kernel_avx512 };
+			if (isa == GemmIsa::AVX2)
+				return { GemmIsa::AVX2, 6, 16, 144, 256, 4096, sgemm_kernel_avx2 };
+#endif
+			return { GemmIsa::GENERIC, 4, 8, 128, 256, 4096, gemm_kernel_generic<f32, 4, 8> };
+		}
+
+		template<>
+		GemmMicroKernel<f64> select_kernel<f64>(GemmIsa isa)
+		{
+#if defined(TRAPH_ARCH_X86)
+			if (isa == GemmIsa::AVX512)
+				return { GemmIsa::AVX512, 12, 16, 96, 256, 4096, dgemm_kernel_avx512 };
+			if (isa == GemmIsa::AVX2)
+				return { GemmIsa::AVX2, 6, 8, 96, 256, 4096, dgemm_kernel_avx2 };
+#endif
+			return { GemmIsa::GENERIC, 4, 8, 96, 256, 4096, gemm_kernel_generic<f64, 4, 8> };
+		}
+
+		// one mr x kc panel of A, rows past m are zero
+		template<typename T>
+		void pack_a_panel(idx_type m, idx_type k, const T* a, idx_type rs, idx_type cs, idx_type mr, T* buf)
+		{
+			if (m == mr && rs == 1)
+			{
+				// column of the panel is contiguous (transposed A)
+				for (idx_type p = 0; p < k; ++p)
+					std::memcpy(buf + p * mr, a + p * cs, mr * sizeof(T));
+			}
+			else if (m == mr && cs == 1)
+			{
+				for (idx_type i = 0; i < mr; ++i)
+				{
+					const T* a_row = a + i * rs;
+					for (idx_type p = 0; p < k; ++p)
+						buf[p * mr + i] = a_row[p];
+				}
+			}
+			else
+			{
+				for (idx_type p = 0; p < k; ++p)
+					for (idx_type i = 0; i < mr; ++i)
+						buf[p * mr + i] = i < m ? a[i * rs + p * cs] : T(0);
+			}
+		}
+
+		// one kc x nr panel of B, columns past n are zero
+		template<typename T>
+		void pack_b_panel(idx_type n, idx_type k, const T* b, idx_type rs, idx_type cs, idx_type nr, T* buf)
+		{
+			if (n == nr && cs == 1)
+			{
+				for (idx_type p = 0; p < k; ++p)
+					std::memcpy(buf + p * nr, b + p * rs, nr * sizeof(T));
+			}
+			else if (n == nr && rs == 1)
+			{
+				// row of the panel is strided, columns are contiguous (transposed B)
+				for (idx_type j = 0; j < nr; ++j)
+				{
+					const T* b_col = b + j * cs;
+					for (idx_type p = 0; p < k; ++p)
+						buf[p * nr + j] = b_col[p];
+				}
+			}
+			else
+			{
+				for (idx_type p = 0; p < k; ++p)
+					for (idx_type j = 0; j < nr; ++j)
+						buf[p * nr + j] = j < n ? b[p * rs + j * cs] : T(0);
+			}
+		}
+
+		// multiplies a packed mc x kc block of A with the packed B panels [jr_begin, jr_end)
+		template<typename T>
+		void gemm_macro_kernel(const GemmMicroKernel<T>& kern, idx_type mc, idx_type nc, idx_type kc,
+			idx_type jr_begin, idx_type jr_end, T alpha, const T* a_packed, const T* b_packed,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			idx_type mr = kern.mr;
+			idx_type nr = kern.nr;
+			alignas(64) T tile[gemm_max_tile];
+
+			for (idx_type jr = jr_begin; jr < jr_end; ++jr)
+			{
+				idx_type j = jr * nr;
+				idx_type n_eff = std::min(nr, nc - j);
+				const T* b_panel = b_packed + jr * nr * kc;
+
+				for (idx_type i = 0; i < mc; i += mr)
+				{
+					idx_type m_eff = std::min(mr, mc - i);
+					const T* a_panel = a_packed + i * kc;
+					T* c_tile = c + i * c_rs + j * c_cs;
+
+					if (m_eff == mr && n_eff == nr && c_cs == 1)
+					{
+						kern.kernel(kc, a_panel, b_panel, c_tile, c_rs, alpha, beta);
+					}
+					else
+					{
+						// edge tile, computed in a scratch tile and merged
+						kern.kernel(kc, a_panel, b_panel, tile, nr, alpha, T(0));
+						for (idx_type ii = 0; ii < m_eff; ++ii)
+						{
+							for (idx_type jj = 0; jj < n_eff; ++jj)
+							{
+								T& c_value = c_tile[ii * c_rs + jj * c_cs];
+								c_value = beta == T(0) ? tile[ii * nr + jj] : tile[ii * nr + jj] + beta * c_value;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		template<typename T>
+		void scale_matrix(idx_type m, idx_type n, T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			for (idx_type i = 0; i < m; ++i)
+				for (idx_type j = 0; j < n; ++j)
+					c[i * c_rs + j * c_cs] = beta == T(0) ? T(0) : beta * c[i * c_rs + j * c_cs];
+		}
+
+		template<typename T>
+		void gemm_impl(idx_type m, idx_type n, idx_type k, T alpha,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			if (m <= 0 || n <= 0)
+				return;
+			if (k <= 0 || alpha == T(0))
+			{
+				scale_matrix(m, n, beta, c, c_rs, c_cs);
+				return;
+			}
+
+			// matrix-vector and other thin products, C^T = B^T A^T when C has few columns
+			if (native_thin_gemm(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs) ||
+				native_thin_gemm(n, m, k, alpha, b, b_cs, b_rs, a, a_cs, a_rs, beta, c, c_cs, c_rs))
+				return;
+
+			// the micro-kernels store rows of C, so a column-major C is computed as C^T = B^T A^T
+			if (c_cs != 1 && c_rs == 1)
+			{
+				gemm_impl(n, m, k, alpha, b, b_cs, b_rs, a, a_cs, a_rs, beta, c, c_cs, c_rs);
+				return;
+			}
+
+			const GemmMicroKernel<T> kern = select_kernel<T>(native_gemm_isa());
+			const idx_type mr = kern.mr;
+			const idx_type nr = kern.nr;
+
+			bool parallel = !omp_in_parallel() && omp_get_max_threads() > 1 &&
+				static_cast<double>(m) * n * k >= gemm_parallel_threshold;
+
+			idx_type nc_max = std::min(kern.nc, (n + nr - 1) / nr * nr);
+			idx_type kc_max = std::min(kern.kc, k);
+			idx_type mc_max = std::min(kern.mc, (m + mr - 1) / mr * mr);
+			T* b_packed = packed_b_buffer<T>(static_cast<std::size_t>(nc_max) * kc_max);
+			// shared A block for the case where m is too small to give every thread its own block
+			T* a_shared = packed_a_buffer<T>(static_cast<std::size_t>(mc_max) * kc_max);
+
+			for (idx_type jc = 0; jc < n; jc += kern.nc)
+			{
+				idx_type nc = std::min(kern.nc, n - jc);
+				int b_panels = (nc + nr - 1) / nr;
+
+				for (idx_type pc = 0; pc < k; pc += kern.kc)
+				{
+					idx_type kc = std::min(kern.kc, k - pc);
+					T beta_eff = pc == 0 ? beta : T(1);
+					const T* a_block = a + pc * a_cs;
+					const T* b_block = b + pc * b_rs + jc * b_cs;
+					T* c_block = c + jc * c_cs;
+					int m_blocks = (m + kern.mc - 1) / kern.mc;
+
+#pragma omp parallel if(parallel)
+					{
+						int thread_num = omp_get_num_threads();
+
+#pragma omp for
+						for (int jp = 0; jp < b_panels; ++jp)
+						{
+							idx_type j = jp * nr;
+							pack_b_panel(std::min(nr, nc - j), kc, b_block + j * b_cs, b_rs, b_cs, nr, b_packed + j * kc);
+						}
+
+						if (m_blocks >= thread_num)
+						{
+							// every thread packs and multiplies its own mc x kc blocks of A
+							T* a_packed = packed_a_buffer<T>(static_cast<std::size_t>(mc_max) * kc_max);
+#pragma omp for schedule(dynamic)
+							for (int ib = 0; ib < m_blocks; ++ib)
+							{
+								idx_type ic = ib * kern.mc;
+								idx_type mc = std::min(kern.mc, m - ic);
+								for (idx_type i = 0; i < mc; i += mr)
+									pack_a_panel(std::min(mr, mc - i), kc, a_block + (ic + i) * a_rs, a_rs, a_cs, mr, a_packed + i * kc);
+								gemm_macro_kernel(kern, mc, nc, kc, 0, b_panels, alpha, a_packed, b_packed,
+									beta_eff, c_block + ic * c_rs, c_rs, c_cs);
+							}
+						}
+						else
+						{
+							// few rows: pack A together, then split the B panels between threads
+							for (int ib = 0; ib < m_blocks; ++ib)
+							{
+								idx_type ic = ib * kern.mc;
+								idx_type mc = std::min(kern.mc, m - ic);
+								int a_panels = (mc + mr - 1) / mr;
+#pragma omp for
+								for (int ip = 0; ip < a_panels; ++ip)
+								{
+									idx_type i = ip * mr;
+									pack_a_panel(std::min(mr, mc - i), kc, a_block + (ic + i) * a_rs, a_rs, a_cs, mr, a_shared + i * kc);
+								}
+#pragma omp for
+								for (int jp = 0; jp < b_panels; ++jp)
+								{
+									gemm_macro_kernel(kern, mc, nc, kc, jp, jp + 1, alpha, a_shared, b_packed,
+										beta_eff, c_block + ic * c_rs, c_rs, c_cs);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	GemmIsa native_gemm_isa()
+	{
+		int isa = selected_isa.load(std::memory_order_relaxed);
+		if (isa < 0)
+		{
+			isa = static_cast<int>(clamp_isa(GemmIsa::AVX512));
+			selected_isa.store(isa, std::memory_order_relaxed);
+		}
+		return static_cast<GemmIsa>(isa);
+	}
+
+	void native_gemm_isa_(GemmIsa isa)
+	{
+		selected_isa.store(static_cast<int>(clamp_isa(isa)), std::memory_order_relaxed);
+	}
+
+	void native_gemm(idx_type m, idx_type n, idx_type k, f32 alpha,
+		const f32* a, idx_type a_rs, idx_type a_cs,
+		const f32* b, idx_type b_rs, idx_type b_cs,
+		f32 beta, f32* c, idx_type c_rs, idx_type c_cs)
+	{
+		gemm_impl(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+	}
+
+	void native_gemm(idx_type m, idx_type n, idx_type k, f64 alpha,
+		const f64* a, idx_type a_rs, idx_type a_cs,
+		const f64* b, idx_type b_rs, idx_type b_cs,
+		f64 beta, f64* c, idx_type c_rs, idx_type c_cs)
+	{
+		gemm_impl(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+	}
+}
@@ -0,0 +1,494 @@
+#include <algorithm>
+
+#include <omp.h>
+
+#include <traph/core/cpu.h>
+#include <traph/tensor/gemm.h>
+
+#if defined(TRAPH_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+#include "simd_reduce.h"
+
+// Matrix-vector and thin-matrix products. With a handful of rows in C, packing B costs as
+// much memory traffic as the product itself, so these kernels stream A and B straight from
+// their storage and every element of B is read once:
+//  - dot form, rows of A and columns of B contiguous (x * W^T with a row-major [out, in]
+//    weight): every C[i][j] is a dot product, pairs of columns are split between threads
+//  - axpy form, rows of B contiguous (x * W with a row-major [in, out] weight): rows of B
+//    are scaled by A and summed into a block of C, column blocks are split between threads
+
+namespace traph
+{
+	namespace
+	{
+		const idx_type thin_max_rows = 4;
+		// below this many multiply-adds the product runs on the calling thread
+		const double thin_parallel_threshold = 32.0 * 1024.0;
+
+		// out[i * 2 + c] = dot(a row i, column c of B) for M rows and 2 columns
+		template<typename T>
+		using ThinDotKernel = void(*)(idx_type k, const T* a, idx_type a_rs, const T* b0, const T* b1, T* out);
+		// out[i * width + j] = sum_p a[i][p] * b[p][j] for M rows and the kernel's width
+		template<typename T>
+		using ThinAxpyKernel = void(*)(idx_type k, const T* a, idx_type a_rs, idx_type a_cs, const T* b, idx_type b_rs, T* out);
+
+		template<typename T>
+		struct ThinKernels
+		{
+			// indexed by M - 1
+			ThinDotKernel<T> dot[thin_max_rows];
+			ThinAxpyKernel<T> axpy[thin_max_rows];
+			ThinAxpyKernel<T> axpy_narrow[thin_max_rows];
+			idx_type width, narrow_width;
+		};
+
+		template<typename T, int M>
+		void thin_dot_generic(idx_type k, const T* a, idx_type a_rs, const T* b0, const T* b1, T* out)
+		{
+			for (int i = 0; i < M; ++i)
+			{
+				const T* a_row = a + i * a_rs;
+				T s0 = T(0), s1 = T(0);
+				for (idx_type p = 0; p < k; ++p)
+				{
+					s0 += a_row[p] * b0[p];
+					s1 += a_row[p] * b1[p];
+				}
+				out[i * 2] = s0;
+				out[i * 2 + 1] = s1;
+			}
+		}
+
+		template<typename T, int M, int W>
+		void thin_axpy_generic(idx_type k, const T* a, idx_type a_rs, idx_type a_cs, const T* b, idx_type b_rs, T* out)
+		{
+			T acc[M][W] = {};
+			for (idx_type p = 0; p < k; ++p)
+			{
+				const T* b_row = b + p * b_rs;
+				for (int i = 0; i < M; ++i)
+				{
+					T a_value = a[i * a_rs + p * a_cs];
+					for (int j = 0; j < W; ++j)
+						acc[i][j] += a_value * b_row[j];
+				}
+			}
+			for (int i = 0; i < M; ++i)
+				for (int j = 0; j < W; ++j)
+					out[i * W + j] = acc[i][j];
+		}
+
+#if defined(TRAPH_ARCH_X86)
+		TRAPH_TARGET_AVX2
+		f32 horizontal_sum_avx2(__m256 v)
+		{
+			__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+			s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+			s = _mm_add_ss(s, _mm_movehdup_ps(s));
+			return _mm_cvtss_f32(s);
+		}
+
+		TRAPH_TARGET_AVX2
+		f64 horizontal_sum_avx2(__m256d v)
+		{
+			__m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+			s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+			return _mm_cvtsd_f64(s);
+		}
+
+		template<int M>
+		TRAPH_TARGET_AVX2
+		void sthin_dot_avx2(idx_type k, const f32* a, idx_type a_rs, const f32* b0, const f32* b1, f32* out)
+		{
+			__m256 acc0[M], acc1[M];
+			for (int i = 0; i < M; ++i)
+				acc0[i] = acc1[i] = _mm256_setzero_ps();
+			idx_type p = 0;
+			for (; p + 8 <= k; p += 8)
+			{
+				__m256 x0 = _mm256_loadu_ps(b0 + p);
+				__m256 x1 = _mm256_loadu_ps(b1 + p);
+				for (int i = 0; i < M; ++i)
+				{
+					__m256 a_i = _mm256_loadu_ps(a + i * a_rs + p);
+					acc0[i] = _mm256_fmadd_ps(a_i, x0, acc0[i]);
+					acc1[i] = _mm256_fmadd_ps(a_i, x1, acc1[i]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+			{
+				f32 s0 = horizontal_sum_avx2(acc0[i]), s1 = horizontal_sum_avx2(acc1[i]);
+				for (idx_type q = p; q < k; ++q)
+				{
+					s0 += a[i * a_rs + q] * b0[q];
+					s1 += a[i * a_rs + q] * b1[q];
+				}
+				out[i * 2] = s0;
+				out[i * 2 + 1] = s1;
+			}
+		}
+
+		template<int M>
+		TRAPH_TARGET_AVX2
+		void dthin_dot_avx2(idx_type k, const f64* a, idx_type a_rs, const f64* b0, const f64* b1, f64* out)
+		{
+			__m256d acc0[M], acc1[M];
+			for (int i = 0; i < M; ++i)
+				acc0[i] = acc1[i] = _mm256_setzero_pd();
+			idx_type p = 0;
+			for (; p + 4 <= k; p += 4)
+			{
+				__m256d x0 = _mm256_loadu_pd(b0 + p);
+				__m256d x1 = _mm256_loadu_pd(b1 + p);
+				for (int i = 0; i < M; ++i)
+				{
+					__m256d a_i = _mm256_loadu_pd(a + i * a_rs + p);
+					acc0[i] = _mm256_fmadd_pd(a_i, x0, acc0[i]);
+					acc1[i] = _mm256_fmadd_pd(a_i, x1, acc1[i]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+			{
+				f64 s0 = horizontal_sum_avx2(acc0[i]), s1 = horizontal_sum_avx2(acc1[i]);
+				for (idx_type q = p; q < k; ++q)
+				{
+					s0 += a[i * a_rs + q] * b0[q];
+					s1 += a[i * a_rs + q] * b1[q];
+				}
+				out[i * 2] = s0;
+				out[i * 2 + 1] = s1;
+			}
+		}
+
+		// V vectors of 8 floats per row
+		template<int M, int V>
+		TRAPH_TARGET_AVX2
+		void sthin_axpy_avx2(idx_type k, const f32* a, idx_type a_rs, idx_type a_cs, const f32* b, idx_type b_rs, f32* out)
+		{
+			__m256 acc[M][V];
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					acc[i][v] = _mm256_setzero_ps();
+			for (idx_type p = 0; p < k; ++p)
+			{
+				const f32* b_row = b + p * b_rs;
+				__m256 x[V];
+				for (int v = 0; v < V; ++v)
+					x[v] = _mm256_loadu_ps(b_row + v * 8);
+				for (int i = 0; i < M; ++i)
+				{
+					__m256 a_i = _mm256_set1_ps(a[i * a_rs + p * a_cs]);
+					for (int v = 0; v < V; ++v)
+						acc[i][v] = _mm256_fmadd_ps(a_i, x[v], acc[i][v]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					_mm256_storeu_ps(out + i * V * 8 + v * 8, acc[i][v]);
+		}
+
+		// V vectors of 4 doubles per row
+		template<int M, int V>
+		TRAPH_TARGET_AVX2
+		void dthin_axpy_avx2(idx_type k, const f64* a, idx_type a_rs, idx_type a_cs, const f64* b, idx_type b_rs, f64* out)
+		{
+			__m256d acc[M][V];
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					acc[i][v] = _mm256_setzero_pd();
+			for (idx_type p = 0; p < k; ++p)
+			{
+				const f64* b_row = b + p * b_rs;
+				__m256d x[V];
+				for (int v = 0; v < V; ++v)
+					x[v] = _mm256_loadu_pd(b_row + v * 4);
+				for (int i = 0; i < M; ++i)
+				{
+					__m256d a_i = _mm256_set1_pd(a[i * a_rs + p * a_cs]);
+					for (int v = 0; v < V; ++v)
+						acc[i][v] = _mm256_fmadd_pd(a_i, x[v], acc[i][v]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					_mm256_storeu_pd(out + i * V * 4 + v * 4, acc[i][v]);
+		}
+
+		template<int M>
+		TRAPH_TARGET_AVX512
+		void sthin_dot_avx512(idx_type k, const f32* a, idx_type a_rs, const f32* b0, const f32* b1, f32* out)
+		{
+			__m512 acc0[M], acc1[M];
+			for (int i = 0; i < M; ++i)
+				acc0[i] = acc1[i] = _mm512_setzero_ps();
+			idx_type p = 0;
+			for (; p + 16 <= k; p += 16)
+			{
+				__m512 x0 = _mm512_loadu_ps(b0 + p);
+				__m512 x1 = _mm512_loadu_ps(b1 + p);
+				for (int i = 0; i < M; ++i)
+				{
+					__m512 a_i = _mm512_loadu_ps(a + i * a_rs + p);
+					acc0[i] = _mm512_fmadd_ps(a_i, x0, acc0[i]);
+					acc1[i] = _mm512_fmadd_ps(a_i, x1, acc1[i]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+			{
+				f32 s0 = horizontal_sum_avx512(acc0[i]), s1 = horizontal_sum_avx512(acc1[i]);
+				for (idx_type q = p; q < k; ++q)
+				{
+					s0 += a[i * a_rs + q] * b0[q];
+					s1 += a[i * a_rs + q] * b1[q];
+				}
+				out[i * 2] = s0;
+				out[i * 2 + 1] = s1;
+			}
+		}
+
+		template<int M>
+		TRAPH_TARGET_AVX512
+		void dthin_dot_avx512(idx_type k, const f64* a, idx_type a_rs, const f64* b0, const f64* b1, f64* out)
+		{
+			__m512d acc0[M], acc1[M];
+			for (int i = 0; i < M; ++i)
+				acc0[i] = acc1[i] = _mm512_setzero_pd();
+			idx_type p = 0;
+			for (; p + 8 <= k; p += 8)
+			{
+				__m512d x0 = _mm512_loadu_pd(b0 + p);
+				__m512d x1 = _mm512_loadu_pd(b1 + p);
+				for (int i = 0; i < M; ++i)
+				{
+					__m512d a_i = _mm512_loadu_pd(a + i * a_rs + p);
+					acc0[i] = _mm512_fmadd_pd(a_i, x0, acc0[i]);
+					acc1[i] = _mm512_fmadd_pd(a_i, x1, acc1[i]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+			{
+				f64 s0 = horizontal_sum_avx512(acc0[i]), s1 = horizontal_sum_avx512(acc1[i]);
+				for (idx_type q = p; q < k; ++q)
+				{
+					s0 += a[i * a_rs + q] * b0[q];
+					s1 += a[i * a_rs + q] * b1[q];
+				}
+				out[i * 2] = s0;
+				out[i * 2 + 1] = s1;
+			}
+		}
+
+		// V vectors of 16 floats per row
+		template<int M, int V>
+		TRAPH_TARGET_AVX512
+		void sthin_axpy_avx512(idx_type k, const f32* a, idx_type a_rs, idx_type a_cs, const f32* b, idx_type b_rs, f32* out)
+		{
+			__m512 acc[M][V];
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					acc[i][v] = _mm512_setzero_ps();
+			for (idx_type p = 0; p < k; ++p)
+			{
+				const f32* b_row = b + p * b_rs;
+				__m512 x[V];
+				for (int v = 0; v < V; ++v)
+					x[v] = _mm512_loadu_ps(b_row + v * 16);
+				for (int i = 0; i < M; ++i)
+				{
+					__m512 a_i = _mm512_set1_ps(a[i * a_rs + p * a_cs]);
+					for (int v = 0; v < V; ++v)
+						acc[i][v] = _mm512_fmadd_ps(a_i, x[v], acc[i][v]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					_mm512_storeu_ps(out + i * V * 16 + v * 16, acc[i][v]);
+		}
+
+		// V vectors of 8 doubles per row
+		template<int M, int V>
+		TRAPH_TARGET_AVX512
+		void dthin_axpy_avx512(idx_type k, const f64* a, idx_type a_rs, idx_type a_cs, const f64* b, idx_type b_rs, f64* out)
+		{
+			__m512d acc[M][V];
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					acc[i][v] = _mm512_setzero_pd();
+			for (idx_type p = 0; p < k; ++p)
+			{
+				const f64* b_row = b + p * b_rs;
+				__m512d x[V];
+				for (int v = 0; v < V; ++v)
+					x[v] = _mm512_loadu_pd(b_row + v * 8);
+				for (int i = 0; i < M; ++i)
+				{
+					__m512d a_i = _mm512_set1_pd(a[i * a_rs + p * a_cs]);
+					for (int v = 0; v < V; ++v)
+						acc[i][v] = _mm512_fmadd_pd(a_i, x[v], acc[i][v]);
+				}
+			}
+			for (int i = 0; i < M; ++i)
+				for (int v = 0; v < V; ++v)
+					_mm512_storeu_pd(out + i * V * 8 + v * 8, acc[i][v]);
+		}
+#endif
+
+		// kernels of one isa, V vectors of lanes elements wide and 1 vector narrow
+#define TRAPH_THIN_TABLE(dot, axpy, V, lanes)                                                       \
+		{ { dot<1>, dot<2>, dot<3>, dot<4> },                                                       \
+		  { axpy<1, V>, axpy<2, V>, axpy<3, V>, axpy<4, V> },                                       \
+		  { axpy<1, 1>, axpy<2, 1>, axpy<3, 1>, axpy<4, 1> },                                       \
+		  V * lanes, lanes }
+
+		template<typename T>
+		ThinKernels<T> generic_thin_kernels()
+		{
+			ThinKernels<T> kernels = {
+				{ thin_dot_generic<T, 1>, thin_dot_generic<T, 2>, thin_dot_generic<T, 3>, thin_dot_generic<T, 4> },
+				{ thin_axpy_generic<T, 1, 16>, thin_axpy_generic<T, 2, 16>, thin_axpy_generic<T, 3, 16>, thin_axpy_generic<T, 4, 16> },
+				{ thin_axpy_generic<T, 1, 1>, thin_axpy_generic<T, 2, 1>, thin_axpy_generic<T, 3, 1>, thin_axpy_generic<T, 4, 1> },
+				16, 1 };
+			return kernels;
+		}
+
+		template<typename T>
+		ThinKernels<T> select_thin_kernels(GemmIsa isa);
+
+		template<>
+		ThinKernels<f32> select_thin_kernels<f32>(GemmIsa isa)
+		{
+#if defined(TRAPH_ARCH_X86)
+			if (isa == GemmIsa::AVX512)
+			{
+				ThinKernels<f32> kernels = TRAPH_THIN_TABLE(sthin_dot_avx512, sthin_axpy_avx512, 4, 16);
+				return kernels;
+			}
+			if (isa == GemmIsa::AVX2)
+			{
+				ThinKernels<f32> kernels = TRAPH_THIN_TABLE(sthin_dot_avx2, sthin_axpy_avx2, 4, 8);
+				return kernels;
+			}
+#endif
+			return generic_thin_kernels<f32>();
+		}
+
+		template<>
+		ThinKernels<f64> select_thin_kernels<f64>(GemmIsa isa)
+		{
+#if defined(TRAPH_ARCH_X86)
+			if (isa == GemmIsa::AVX512)
+			{
+				ThinKernels<f64> kernels = TRAPH_THIN_TABLE(dthin_dot_avx512, dthin_axpy_avx512, 4, 8);
+				return kernels;
+			}
+			if (isa == GemmIsa::AVX2)
+			{
+				ThinKernels<f64> kernels = TRAPH_THIN_TABLE(dthin_dot_avx2, dthin_axpy_avx2, 4, 4);
+				return kernels;
+			}
+#endif
+			return generic_thin_kernels<f64>();
+		}
+
+		template<typename T>
+		void store_result(T alpha, T value, T beta, T& c)
+		{
+			c = beta == T(0) ? alpha * value : alpha * value + beta * c;
+		}
+
+		template<typename T>
+		bool thin_gemm_impl(idx_type m, idx_type n, idx_type k, T alpha,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			if (m <= 0 || m > thin_max_rows || n <= 0 || k <= 0)
+				return false;
+			bool dot_form = a_cs == 1 && b_rs == 1;
+			if (!dot_form && b_cs != 1)
+				return false;
+
+			const ThinKernels<T> kern = select_thin_kernels<T>(native_gemm_isa());
+			bool parallel = !omp_in_parallel() && omp_get_max_threads() > 1 &&
+				static_cast<double>(m) * n * k >= thin_parallel_threshold;
+
+			if (dot_form)
+			{
+				ThinDotKernel<T> dot = kern.dot[m - 1];
+				int pairs = (n + 1) / 2;
+#pragma omp parallel for schedule(static) if(parallel)
+				for (int jp = 0; jp < pairs; ++jp)
+				{
+					T out[thin_max_rows * 2];
+					idx_type j = jp * 2;
+					bool both = j + 1 < n;
+					const T* b0 = b + j * b_cs;
+					dot(k, a, a_rs, b0, both ? b0 + b_cs : b0, out);
+					for (idx_type i = 0; i < m; ++i)
+					{
+						store_result(alpha, out[i * 2], beta, c[i * c_rs + j * c_cs]);
+						if (both)
+							store_result(alpha, out[i * 2 + 1], beta, c[i * c_rs + (j + 1) * c_cs]);
+					}
+				}
+				return true;
+			}
+
+			// column blocks of the kernel width, the rest in narrow blocks and single columns
+			idx_type width = kern.width;
+			int blocks = n / width;
+			idx_type wide_end = blocks * width;
+			int narrow_blocks = (n - wide_end) / kern.narrow_width;
+			idx_type narrow_end = wide_end + narrow_blocks * kern.narrow_width;
+			int tail = n - narrow_end;
+			int tasks = blocks + narrow_blocks + tail;
+			ThinAxpyKernel<T> single = generic_thin_kernels<T>().axpy_narrow[m - 1];
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int t = 0; t < tasks; ++t)
+			{
+				T out[thin_max_rows * 64];
+				idx_type j, w;
+				if (t < blocks)
+				{
+					j = t * width;
+					w = width;
+					kern.axpy[m - 1](k, a, a_rs, a_cs, b + j, b_rs, out);
+				}
+				else if (t < blocks + narrow_blocks)
+				{
+					j = wide_end + (t - blocks) * kern.narrow_width;
+					w = kern.narrow_width;
+					kern.axpy_narrow[m - 1](k, a, a_rs, a_cs, b + j, b_rs, out);
+				}
+				else
+				{
+					j = narrow_end + (t - blocks - narrow_blocks);
+					w = 1;
+					single(k, a, a_rs, a_cs, b + j, b_rs, out);
+				}
+				for (idx_type i = 0; i < m; ++i)
+					for (idx_type jj = 0; jj < w; ++jj)
+						store_result(alpha, out[i * w + jj], beta, c[i * c_rs + (j + jj) * c_cs]);
+			}
+			return true;
+		}
+	}
+
+	bool native_thin_gemm(idx_type m, idx_type n, idx_type k, f32 alpha,
+		const f32* a, idx_type a_rs, idx_type a_cs,
+		const f32* b, idx_type b_rs, idx_type b_cs,
+		f32 beta, f32* c, idx_type c_rs, idx_type c_cs)
+	{
+		return thin_gemm_impl(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+	}
+
+	bool native_thin_gemm(idx_type m, idx_type n, idx_type k, f64 alpha,
+		const f64* a, idx_type a_rs, idx_type a_cs,
+		const f64* b, idx_type b_rs, idx_type b_cs,
+		f64 beta, f64* c, idx_type c_rs, idx_type c_cs)
+	{
+		return thin_gemm_impl(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+	}
+}
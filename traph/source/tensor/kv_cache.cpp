@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/kv_cache.h>
+
+namespace traph
+{
+	namespace
+	{
+		void cache_error(const std::string& message)
+		{
+			throw std::runtime_error("KVCache: " + message + ".");
+		}
+	}
+
+	template<typename T>
+	KVCache<T>::KVCache(idx_type layers, idx_type heads, idx_type head_dim, idx_type block_size, idx_type num_blocks)
+		:_layers(layers), _heads(heads), _head_dim(head_dim), _block_size(block_size), _num_blocks(num_blocks)
+	{
+		if (layers < 1 || heads < 1 || head_dim < 1 || block_size < 1 || num_blocks < 1)
+			cache_error("Sizes shall be positive");
+		std::size_t size = static_cast<std::size_t>(layers) * num_blocks * heads * block_size * head_dim;
+		_keys.resize(size);
+		_values.resize(size);
+		// blocks are taken from the back, lowest first
+		for (idx_type block = num_blocks - 1; block >= 0; --block)
+			_free_blocks.push_back(block);
+	}
+
+	template<typename T>
+	const typename KVCache<T>::Sequence& KVCache<T>::sequence(idx_type id) const
+	{
+		if (id < 0 || id >= static_cast<idx_type>(_sequences.size()) || !_sequences[id].active)
+			cache_error("No sequence " + std::to_string(id));
+		return _sequences[id];
+	}
+
+	template<typename T>
+	std::size_t KVCache<T>::block_offset(idx_type layer, idx_type block, idx_type head) const
+	{
+		return ((static_cast<std::size_t>(layer) * _num_blocks + block) * _heads + head) * _block_size * _head_dim;
+	}
+
+	template<typename T>
+	idx_type KVCache<T>::add_sequence()
+	{
+		idx_type id = 0;
+		while (id < static_cast<idx_type>(_sequences.size()) && _sequences[id].active)
+			++id;
+		if (id == static_cast<idx_type>(_sequences.size()))
+			_sequences.emplace_back();
+		_sequences[id].active = true;
+		_sequences[id].length = 0;
+		return id;
+	}
+
+	template<typename T>
+	void KVCache<T>::remove_sequence(idx_type id)
+	{
+		sequence(id);
+		Sequence& s = _sequences[id];
+		_free_blocks.insert(_free_blocks.end(), s.blocks.rbegin(), s.blocks.rend());
+		s.blocks.clear();
+		s.length = 0;
+		s.active = false;
+	}
+
+	template<typename T>
+	void KVCache<T>::append(const std::vector<idx_type>& sequences, idx_type count)
+	{
+		if (count < 0)
+			cache_error("The number of tokens shall not be negative");
+		idx_type needed = 0;
+		for (std::size_t i = 0; i < sequences.size(); ++i)
+		{
+			const Sequence& s = sequence(sequences[i]);
+			if (std::find(sequences.begin(), sequences.begin() + i, sequences[i]) != sequences.begin() + i)
+				cache_error("Sequence " + std::to_string(sequences[i]) + " is given twice");
+			idx_type blocks = (s.length + count + _block_size - 1) / _block_size;
+			needed += blocks - static_cast<idx_type>(s.blocks.size());
+		}
+		if (needed > free_blocks())
+			cache_error("Out of blocks, " + std::to_string(needed) + " needed and " + std::to_string(free_blocks()) + " free");
+
+		for (idx_type id : sequences)
+		{
+			Sequence& s = _sequences[id];
+			s.length += count;
+			while (static_cast<idx_type>(s.blocks.size()) * _block_size < s.length)
+			{
+				s.blocks.push_back(_free_blocks.back());
+				_free_blocks.pop_back();
+			}
+		}
+	}
+
+	template<typename T>
+	idx_type KVCache<T>::length(idx_type id) const
+	{
+		return sequence(id).length;
+	}
+
+	template<typename T>
+	const std::vector<idx_type>& KVCache<T>::blocks(idx_type id) const
+	{
+		return sequence(id).blocks;
+	}
+
+	template<typename T>
+	KVCacheLayer<T> KVCache<T>::layer(idx_type index)
+	{
+		return KVCacheLayer<T>(*this, index);
+	}
+
+	template<typename T>
+	T* KVCache<T>::keys(idx_type layer, idx_type block, idx_type head)
+	{
+		return _keys.data() + block_offset(layer, block, head);
+	}
+
+	template<typename T>
+	const T* KVCache<T>::keys(idx_type layer, idx_type block, idx_type head) const
+	{
+		return _keys.data() + block_offset(layer, block, head);
+	}
+
+	template<typename T>
+	T* KVCache<T>::values(idx_type layer, idx_type block, idx_type head)
+	{
+		return _values.data() + block_offset(layer, block, head);
+	}
+
+	template<typename T>
+	const T* KVCache<T>::values(idx_type layer, idx_type block, idx_type head) const
+	{
+		return _values.data() + block_offset(layer, block, head);
+	}
+
+	template<typename T>
+	KVCacheLayer<T>::KVCacheLayer(KVCache<T>& cache, idx_type index)
+		:_cache(&cache), _index(index)
+	{
+		if (index < 0 || index >= cache.layers())
+			cache_error("No layer " + std::to_string(index));
+	}
+
+	template<typename T>
+	void KVCacheLayer<T>::write(const std::vector<idx_type>& sequences, const Tensor<T>& keys, const Tensor<T>& values)
+	{
+		KVCache<T>& c = *_cache;
+		idx_type batch = static_cast<idx_type>(sequences.size());
+		if (keys.ndimension() != 4 || keys.size(0) != batch || keys.size(1) != c.heads() || keys.size(3) != c.head_dim())
+			cache_error("Keys shall be [B, H, n, D] for B sequences");
+		if (values.size() != keys.size())
+			cache_error("Values shall have the size of the keys");
+		idx_type count = keys.size(2);
+		const T* k = keys.data_ptr() + keys.offset();
+		const T* v = values.data_ptr() + values.offset();
+		for (idx_type b = 0; b < batch; ++b)
+		{
+			idx_type length = c.length(sequences[b]);
+			if (count > length)
+				cache_error("Sequence " + std::to_string(sequences[b]) + " has no room for the tokens, see append");
+			const std::vector<idx_type>& blocks = c.blocks(sequences[b]);
+			for (idx_type h = 0; h < c.heads(); ++h)
+			{
+				for (idx_type t = 0; t < count; ++t)
+				{
+					idx_type position = length - count + t;
+					idx_type block = blocks[position / c.block_size()];
+					std::size_t row = static_cast<std::size_t>(position % c.block_size()) * c.head_dim();
+					T* k_row = c.keys(_index, block, h) + row;
+					T* v_row = c.values(_index, block, h) + row;
+					const T* k_in = k + b * keys.stride(0) + h * keys.stride(1) + t * keys.stride(2);
+					const T* v_in = v + b * values.stride(0) + h * values.stride(1) + t * values.stride(2);
+					for (idx_type j = 0; j < c.head_dim(); ++j)
+					{
+						k_row[j] = k_in[j * keys.stride(3)];
+						v_row[j] = v_in[j * values.stride(3)];
+					}
+				}
+			}
+		}
+	}
+
+	namespace
+	{
+		template<typename T>
+		std::shared_ptr<Tensor<T>> gather(const KVCache<T>& c, idx_type layer, idx_type id, bool keys)
+		{
+			idx_type length = c.length(id);
+			const std::vector<idx_type>& blocks = c.blocks(id);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ c.heads(), length, c.head_dim() })));
+			T* y = result->data_ptr();
+			for (idx_type h = 0; h < c.heads(); ++h)
+			{
+				for (idx_type t = 0; t < length; t += c.block_size())
+				{
+					idx_type block = blocks[t / c.block_size()];
+					const T* x = keys ? c.keys(layer, block, h) : c.values(layer, block, h);
+					idx_type rows = std::min(c.block_size(), length - t);
+					std::copy(x, x + rows * c.head_dim(), y + (static_cast<std::size_t>(h) * length + t) * c.head_dim());
+				}
+			}
+			return result;
+		}
+	}
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> KVCacheLayer<T>::keys(idx_type id) const
+	{
+		return gather(static_cast<const KVCache<T>&>(*_cache), _index, id, true);
+	}
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> KVCacheLayer<T>::values(idx_type id) const
+	{
+		return gather(static_cast<const KVCache<T>&>(*_cache), _index, id, false);
+	}
+
+	template class KVCache<f32>;
+	template class KVCache<f64>;
+	template class KVCacheLayer<f32>;
+	template class KVCacheLayer<f64>;
+}
@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include <omp.h>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/linalg.h>
+
+// Eigen forwards PartialPivLU, LLT and HouseholderQR to the LAPACKE routines (getrf, potrf,
+// geqrf) when it is told they are linked. CMake defines TRAPH_HAVE_LAPACKE only when it found
+// them with the BLAS library, MKL has them but a distro OpenBLAS may not, otherwise Eigen
+// decomposes itself. Products keep using Eigen's own kernels like in arithmetic.cpp.
+#ifdef TRAPH_HAVE_LAPACKE
+#define EIGEN_USE_LAPACKE
+#endif
+#include <eigen3/Eigen/Dense>
+
+namespace traph
+{
+	namespace
+	{
+		// batches with fewer flops than this run on the calling thread
+		const double batch_parallel_threshold = 64.0 * 64.0 * 64.0;
+
+		template<typename T>
+		using RowMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+		template<typename T>
+		using ColMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>;
+		using GeneralStride = Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>;
+
+		void linalg_error(const char* name, const char* message)
+		{
+			throw std::runtime_error(std::string(name) + ": " + message);
+		}
+
+		template<typename T>
+		void square_check(const char* name, const Tensor<T>& a)
+		{
+			idx_type dims = a.ndimension();
+			if (dims < 2)
+				linalg_error(name, "The parameter shall be matrix (2D) or batch of matrices.");
+			if (a.size(dims - 1) != a.size(dims - 2))
+				linalg_error(name, "The matrices shall be square.");
+		}
+
+		// the batch dimensions of a tensor whose last matrix_dims dimensions are one item
+		template<typename T>
+		DimVector batch_size(const Tensor<T>& t, idx_type matrix_dims)
+		{
+			DimVector result;
+			for (idx_type i = 0; i < t.ndimension() - matrix_dims; ++i)
+				result.push_back(t.size(i));
+			return result;
+		}
+
+		idx_type batch_count(const DimVector& batch)
+		{
+			idx_type count = 1;
+			for (idx_type i = 0; i < batch.size(); ++i)
+				count *= batch[i];
+			return count;
+		}
+
+		// batch dimensions right aligned and broadcast against each other, like in matmul
+		DimVector broadcast_batch(const char* name, const DimVector& a, const DimVector& b)
+		{
+			idx_type dims = std::max(a.size(), b.size());
+			DimVector result;
+			for (idx_type i = 0; i < dims; ++i)
+			{
+				idx_type a_i = i - (dims - a.size()), b_i = i - (dims - b.size());
+				idx_type a_size = a_i >= 0 ? a[a_i] : 1;
+				idx_type b_size = b_i >= 0 ? b[b_i] : 1;
+				if (a_size != b_size && a_size != 1 && b_size != 1)
+					linalg_error(name, "The batch dimensions shall be broadcastable.");
+				result.push_back(a_size == 1 ? b_size : a_size);
+			}
+			return result;
+		}
+
+		// offset of the item of t at position slot of the broadcast batch
+		template<typename T>
+		idx_type batch_offset(const Tensor<T>& t, idx_type matrix_dims, const DimVector& batch, idx_type slot)
+		{
+			idx_type t_batch = t.ndimension() - matrix_dims;
+			idx_type offset = t.offset();
+			for (idx_type i = batch.size() - 1; i >= 0; --i)
+			{
+				idx_type index = slot % batch[i];
+				slot /= batch[i];
+				idx_type j = i - (batch.size() - t_batch);
+				if (j >= 0 && t.size(j) != 1)
+					offset += index * t.stride(j);
+			}
+			return offset;
+		}
+
+		DimVector concat(DimVector batch, std::initializer_list<idx_type> matrix)
+		{
+			for (idx_type each : matrix)
+				batch.push_back(each);
+			return batch;
+		}
+
+		template<typename T>
+		void load_matrix(const T* ptr, idx_type rows, idx_type cols, idx_type rs, idx_type cs, ColMajorMatrix<T>& m)
+		{
+			m = Eigen::Map<const RowMajorMatrix<T>, 0, GeneralStride>(ptr, rows, cols, GeneralStride(rs, cs));
+		}
+
+		// the matrix of a [..., rows, cols] tensor at offset
+		template<typename T>
+		void load_matrix(const Tensor<T>& t, idx_type offset, ColMajorMatrix<T>& m)
+		{
+			idx_type dims = t.ndimension();
+			load_matrix(t.data_ptr() + offset, t.size(dims - 2), t.size(dims - 1),
+				t.stride(dims - 2), t.stride(dims - 1), m);
+		}
+
+		template<typename T, typename M>
+		void store_matrix(const M& m, T* ptr)
+		{
+			Eigen::Map<RowMajorMatrix<T>>(ptr, m.rows(), m.cols()) = m;
+		}
+
+		// Runs f(slot) for every item of a batch, one item per thread. The factorisations are
+		// only partly parallel inside Eigen (the blocked updates), so splitting the batch wins
+		// even for large matrices. Exceptions can not leave an OpenMP region, the first one is
+		// rethrown after the loop.
+		template<typename F>
+		void for_each_item(idx_type count, double flops, F f)
+		{
+			bool parallel = count > 1 && flops * count >= batch_parallel_threshold && !omp_in_parallel();
+			std::exception_ptr error;
+			int slot_num = static_cast<int>(count);
+#pragma omp parallel for schedule(dynamic) if(parallel)
+			for (int slot = 0; slot < slot_num; ++slot)
+			{
+				try
+				{
+					f(slot);
+				}
+				catch (...)
+				{
+#pragma omp critical(traph_linalg_error)
+					if (!error)
+						error = std::current_exception();
+				}
+			}
+			if (error)
+				std::rethrow_exception(error);
+		}
+
+		template<typename T>
+		bool has_zero_pivot(const ColMajorMatrix<T>& lu)
+		{
+			return (lu.diagonal().array() == T(0)).any();
+		}
+
+		template<typename T>
+		std::pair<std::shared_ptr<Tensor<T>>, std::shared_ptr<Tensor<i32>>> lu_factor(const char* name, const Tensor<T>& a, bool check_singular)
+		{
+			square_check(name, a);
+			idx_type n = a.size(a.ndimension() - 1);
+			DimVector batch = batch_size(a, 2);
+			std::shared_ptr<Tensor<T>> lu(new Tensor<T>(a.size()));
+			std::shared_ptr<Tensor<i32>> pivots(new Tensor<i32>(concat(batch, { n })));
+
+			for_each_item(batch_count(batch), static_cast<double>(n) * n * n, [&](idx_type slot) {
+				ColMajorMatrix<T> m;
+				load_matrix(a, batch_offset(a, 2, batch, slot), m);
+				Eigen::PartialPivLU<Eigen::Ref<ColMajorMatrix<T>>> decomposition(m);
+				if (check_singular && has_zero_pivot(m))
+					linalg_error(name, "The matrix is singular.");
+
+				// P * a = L * U and row i of a moves to row indices[i]
+				const auto& indices = decomposition.permutationP().indices();
+				i32* slot_pivots = pivots->data_ptr() + slot * n;
+				for (idx_type i = 0; i < n; ++i)
+					slot_pivots[indices[i]] = static_cast<i32>(i);
+				store_matrix(m, lu->data_ptr() + slot * n * n);
+			});
+			return { lu, pivots };
+		}
+
+		// x with a * x = b for every matrix (or vector) of b, given the square factor of every
+		// matrix of a. solve(slot, f, x) overwrites x with the solution for the factor f.
+		// When a single factor serves the whole batch, the right hand sides are solved together
+		// as one wide matrix, so the triangular solves run as level 3 blas.
+		template<typename T, typename F>
+		std::shared_ptr<Tensor<T>> batched_solve(const char* name, const Tensor<T>& factor, const Tensor<T>& b, F solve)
+		{
+			square_check(name, factor);
+			idx_type n = factor.size(factor.ndimension() - 1);
+			bool vector = b.ndimension() == 1;
+			idx_type b_dims = vector ? 1 : 2;
+			if (b.ndimension() < 1 || b.size(b.ndimension() - b_dims) != n)
+				linalg_error(name, "The rows of b shall be equal to the order of the matrix.");
+
+			idx_type k = vector ? 1 : b.size(b.ndimension() - 1);
+			idx_type b_rs = b.stride(b.ndimension() - b_dims);
+			idx_type b_cs = vector ? 1 : b.stride(b.ndimension() - 1);
+			DimVector factor_batch = batch_size(factor, 2);
+			DimVector batch = broadcast_batch(name, factor_batch, batch_size(b, b_dims));
+			idx_type count = batch_count(batch);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(vector ? concat(batch, { n }) : concat(batch, { n, k })));
+			T* out = result->data_ptr();
+
+			if (batch_count(factor_batch) == 1 && count > 1)
+			{
+				ColMajorMatrix<T> f, x(n, count * k);
+				load_matrix(factor, factor.offset(), f);
+				for (idx_type slot = 0; slot < count; ++slot)
+					x.middleCols(slot * k, k) = Eigen::Map<const RowMajorMatrix<T>, 0, GeneralStride>(
+						b.data_ptr() + batch_offset(b, b_dims, batch, slot), n, k, GeneralStride(b_rs, b_cs));
+				solve(0, f, x);
+				for (idx_type slot = 0; slot < count; ++slot)
+					store_matrix(x.middleCols(slot * k, k), out + slot * n * k);
+				return result;
+			}
+
+			for_each_item(count, static_cast<double>(n) * n * (n + k), [&](idx_type slot) {
+				ColMajorMatrix<T> f, x;
+				load_matrix(factor, batch_offset(factor, 2, batch, slot), f);
+				load_matrix(b.data_ptr() + batch_offset(b, b_dims, batch, slot), n, k, b_rs, b_cs, x);
+				solve(slot, f, x);
+				store_matrix(x, out + slot * n * k);
+			});
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> lu_solve(const char* name, const Tensor<T>& lu, const Tensor<i32>& pivots, const Tensor<T>& b)
+		{
+			square_check(name, lu);
+			idx_type n = lu.size(lu.ndimension() - 1);
+			if (pivots.ndimension() != lu.ndimension() - 1 || pivots.size(pivots.ndimension() - 1) != n)
+				linalg_error(name, "The pivots shall hold one row index per row of every matrix.");
+			DimVector batch = broadcast_batch(name, batch_size(lu, 2), batch_size(b, b.ndimension() == 1 ? 1 : 2));
+
+			return batched_solve(name, lu, b, [&](idx_type slot, const ColMajorMatrix<T>& f, ColMajorMatrix<T>& x) {
+				const i32* slot_pivots = pivots.data_ptr() + batch_offset(pivots, 1, batch, slot);
+				idx_type pivot_stride = pivots.stride(pivots.ndimension() - 1);
+				ColMajorMatrix<T> permuted(x.rows(), x.cols());
+				for (idx_type i = 0; i < n; ++i)
+				{
+					i32 row = slot_pivots[i * pivot_stride];
+					if (row < 0 || row >= n)
+						linalg_error(name, "The pivots shall be row indices of the matrix.");
+					permuted.row(i) = x.row(row);
+				}
+				f.template triangularView<Eigen::UnitLower>().solveInPlace(permuted);
+				f.template triangularView<Eigen::Upper>().solveInPlace(permuted);
+				x.swap(permuted);
+			});
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> solve(const Tensor<T>& a, const Tensor<T>& b)
+		{
+			auto factors = lu_factor("solve", a, true);
+			return lu_solve("solve", *factors.first, *factors.second, b);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> cholesky(const Tensor<T>& a, bool upper)
+		{
+			square_check("cholesky", a);
+			idx_type n = a.size(a.ndimension() - 1);
+			DimVector batch = batch_size(a, 2);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(a.size()));
+
+			for_each_item(batch_count(batch), static_cast<double>(n) * n * n / 3, [&](idx_type slot) {
+				ColMajorMatrix<T> m;
+				load_matrix(a, batch_offset(a, 2, batch, slot), m);
+				Eigen::LLT<Eigen::Ref<ColMajorMatrix<T>>, Eigen::Lower> decomposition(m);
+				if (decomposition.info() != Eigen::Success)
+					linalg_error("cholesky", "The matrix is not positive definite.");
+				m.template triangularView<Eigen::StrictlyUpper>().setZero();
+				if (upper)
+					store_matrix(m.transpose(), result->data_ptr() + slot * n * n);
+				else
+					store_matrix(m, result->data_ptr() + slot * n * n);
+			});
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> cholesky_solve(const Tensor<T>& factor, const Tensor<T>& b, bool upper)
+		{
+			return batched_solve("cholesky_solve", factor, b, [&](idx_type slot, const ColMajorMatrix<T>& f, ColMajorMatrix<T>& x) {
+				if (upper)
+				{
+					f.template triangularView<Eigen::Upper>().transpose().solveInPlace(x);
+					f.template triangularView<Eigen::Upper>().solveInPlace(x);
+				}
+				else
+				{
+					f.template triangularView<Eigen::Lower>().solveInPlace(x);
+					f.template triangularView<Eigen::Lower>().transpose().solveInPlace(x);
+				}
+			});
+		}
+
+		template<typename T>
+		std::pair<std::shared_ptr<Tensor<T>>, std::shared_ptr<Tensor<T>>> qr(const Tensor<T>& a)
+		{
+			idx_type dims = a.ndimension();
+			if (dims < 2)
+				linalg_error("qr", "The parameter shall be matrix (2D) or batch of matrices.");
+			idx_type m = a.size(dims - 2), n = a.size(dims - 1), r = std::min(m, n);
+			DimVector batch = batch_size(a, 2);
+			std::shared_ptr<Tensor<T>> q(new Tensor<T>(concat(batch, { m, r })));
+			std::shared_ptr<Tensor<T>> upper(new Tensor<T>(concat(batch, { r, n })));
+
+			for_each_item(batch_count(batch), 2.0 * m * n * r, [&](idx_type slot) {
+				ColMajorMatrix<T> matrix;
+				load_matrix(a, batch_offset(a, 2, batch, slot), matrix);
+				Eigen::HouseholderQR<Eigen::Ref<ColMajorMatrix<T>>> decomposition(matrix);
+				ColMajorMatrix<T> thin_q = decomposition.householderQ() * ColMajorMatrix<T>::Identity(m, r);
+				ColMajorMatrix<T> r_matrix = matrix.topRows(r).template triangularView<Eigen::Upper>();
+				store_matrix(thin_q, q->data_ptr() + slot * m * r);
+				store_matrix(r_matrix, upper->data_ptr() + slot * r * n);
+			});
+			return { q, upper };
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> inverse(const Tensor<T>& a)
+		{
+			square_check("inverse", a);
+			idx_type n = a.size(a.ndimension() - 1);
+			DimVector batch = batch_size(a, 2);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(a.size()));
+
+			for_each_item(batch_count(batch), 2.0 * n * n * n, [&](idx_type slot) {
+				ColMajorMatrix<T> m;
+				load_matrix(a, batch_offset(a, 2, batch, slot), m);
+				Eigen::PartialPivLU<Eigen::Ref<ColMajorMatrix<T>>> decomposition(m);
+				if (has_zero_pivot(m))
+					linalg_error("inverse", "The matrix is singular.");
+				store_matrix(decomposition.inverse(), result->data_ptr() + slot * n * n);
+			});
+			return result;
+		}
+	}
+
+	std::pair<std::shared_ptr<Tensor<f32>>, std::shared_ptr<Tensor<i32>>> lu_impl(const Tensor<f32>& a)
+	{
+		return lu_factor("lu", a, false);
+	}
+
+	std::pair<std::shared_ptr<Tensor<f64>>, std::shared_ptr<Tensor<i32>>> lu_impl(const Tensor<f64>& a)
+	{
+		return lu_factor("lu", a, false);
+	}
+
+	std::shared_ptr<Tensor<f32>> lu_solve_impl(const Tensor<f32>& lu, const Tensor<i32>& pivots, const Tensor<f32>& b)
+	{
+		return lu_solve("lu_solve", lu, pivots, b);
+	}
+
+	std::shared_ptr<Tensor<f64>> lu_solve_impl(const Tensor<f64>& lu, const Tensor<i32>& pivots, const Tensor<f64>& b)
+	{
+		return lu_solve("lu_solve", lu, pivots, b);
+	}
+
+	std::shared_ptr<Tensor<f32>> solve_impl(const Tensor<f32>& a, const Tensor<f32>& b)
+	{
+		return solve(a, b);
+	}
+
+	std::shared_ptr<Tensor<f64>> solve_impl(const Tensor<f64>& a, const Tensor<f64>& b)
+	{
+		return solve(a, b);
+	}
+
+	std::shared_ptr<Tensor<f32>> cholesky_impl(const Tensor<f32>& a, bool upper)
+	{
+		return cholesky(a, upper);
+	}
+
+	std::shared_ptr<Tensor<f64>> cholesky_impl(const Tensor<f64>& a, bool upper)
+	{
+		return cholesky(a, upper);
+	}
+
+	std::shared_ptr<Tensor<f32>> cholesky_solve_impl(const Tensor<f32>& factor, const Tensor<f32>& b, bool upper)
+	{
+		return cholesky_solve(factor, b, upper);
+	}
+
+	std::shared_ptr<Tensor<f64>> cholesky_solve_impl(const Tensor<f64>& factor, const Tensor<f64>& b, bool upper)
+	{
+		return cholesky_solve(factor, b, upper);
+	}
+
+	std::pair<std::shared_ptr<Tensor<f32>>, std::shared_ptr<Tensor<f32>>> qr_impl(const Tensor<f32>& a)
+	{
+		return qr(a);
+	}
+
+	std::pair<std::shared_ptr<Tensor<f64>>, std::shared_ptr<Tensor<f64>>> qr_impl(const Tensor<f64>& a)
+	{
+		return qr(a);
+	}
+
+	std::shared_ptr<Tensor<f32>> inverse_impl(const Tensor<f32>& a)
+	{
+		return inverse(a);
+	}
+
+	std::shared_ptr<Tensor<f64>> inverse_impl(const Tensor<f64>& a)
+	{
+		return inverse(a);
+	}
+}
@@ -0,0 +1,627 @@
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <traph/core/cpu.h>
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/conv.h>
+#include <traph/tensor/gemm.h>
+#include <traph/tensor/pooling.h>
+
+#if defined(_MSC_VER)
+#define TRAPH_POOL_INLINE __forceinline
+#else
+#define TRAPH_POOL_INLINE inline __attribute__((always_inline))
+#endif
+
+// Pooling reads a block of pool_lanes channels of one image channels last, [H][W][lanes], and
+// reduces every window for all channels of the block at once: the loops over the lanes have
+// a fixed trip count and vectorise, while in [C][H][W] the windows of neighbouring outputs
+// overlap and strided windows would need gathers. Inputs that are channels last in memory
+// are read in place, others are copied one block at a time. The block kernels are inlined
+// into a copy per instruction set so the lanes fill AVX2 and AVX-512 vectors. The backward
+// passes scatter the gradient of every output plane to its input plane and are split between
+// threads by plane.
+
+namespace traph
+{
+	namespace
+	{
+		// channels pooled together
+		const idx_type pool_lanes = 16;
+		// windows up to this many pixels keep the offset of their maximum in one byte
+		const idx_type max_offset_taps = 256;
+		// below this many reads of the input the pooling runs on the calling thread
+		const double pool_parallel_threshold = 64.0 * 64.0 * 64.0;
+
+		void pool_error(const char* name, const std::string& message)
+		{
+			throw std::runtime_error(std::string(name) + ": " + message + ".");
+		}
+
+		struct PoolShape
+		{
+			idx_type batch, channels, height, width, out_h, out_w;
+
+			idx_type blocks() const { return (channels + pool_lanes - 1) / pool_lanes; }
+			idx_type plane() const { return out_h * out_w; }
+			bool empty() const { return batch == 0 || channels == 0; }
+		};
+
+		PoolShape image_shape(const char* name, const DimVector& input)
+		{
+			if (input.size() != 4)
+				pool_error(name, "The input shall be [N, C, H, W]");
+			PoolShape s;
+			s.batch = input[0];
+			s.channels = input[1];
+			s.height = input[2];
+			s.width = input[3];
+			return s;
+		}
+
+		PoolShape pool_shape(const char* name, const DimVector& input, const Pool2dParams& params)
+		{
+			PoolShape s = image_shape(name, input);
+			if (params.kernel_h < 1 || params.kernel_w < 1 || params.stride_h < 1 || params.stride_w < 1)
+				pool_error(name, "Kernel and stride shall be positive");
+			if (params.padding_h < 0 || params.padding_w < 0 || 2 * params.padding_h > params.kernel_h || 2 * params.padding_w > params.kernel_w)
+				pool_error(name, "Padding shall be between zero and half of the kernel");
+			s.out_h = conv_output_size(s.height, params.kernel_h, params.stride_h, params.padding_h, 1);
+			s.out_w = conv_output_size(s.width, params.kernel_w, params.stride_w, params.padding_w, 1);
+			if (s.out_h <= 0 || s.out_w <= 0)
+				pool_error(name, "The padded input is smaller than the kernel");
+			return s;
+		}
+
+		PoolShape adaptive_shape(const char* name, const DimVector& input, idx_type out_h, idx_type out_w)
+		{
+			PoolShape s = image_shape(name, input);
+			if (out_h < 1 || out_w < 1)
+				pool_error(name, "The output size shall be positive");
+			if (s.height < 1 || s.width < 1)
+				pool_error(name, "The input shall not be empty");
+			s.out_h = out_h;
+			s.out_w = out_w;
+			return s;
+		}
+
+		// Output i of one spatial dimension reads the input [begin[i], end[i]), its window starts
+		// at start[i] before clipping and averages count[i] pixels.
+		struct PoolWindows
+		{
+			std::vector<idx_type> start, begin, end, count;
+		};
+
+		PoolWindows pool_windows(idx_type size, idx_type out, idx_type kernel, idx_type stride, idx_type padding, bool count_include_pad)
+		{
+			PoolWindows w;
+			for (idx_type i = 0; i < out; ++i)
+			{
+				idx_type start = i * stride - padding;
+				idx_type begin = std::max<idx_type>(start, 0), end = std::min(start + kernel, size);
+				w.start.push_back(start);
+				w.begin.push_back(begin);
+				w.end.push_back(end);
+				// the padding counts, pixels past it do not
+				w.count.push_back(count_include_pad ? std::min(start + kernel, size + padding) - start : end - begin);
+			}
+			return w;
+		}
+
+		PoolWindows adaptive_windows(idx_type size, idx_type out)
+		{
+			PoolWindows w;
+			for (idx_type i = 0; i < out; ++i)
+			{
+				idx_type begin = i * size / out, end = ((i + 1) * size + out - 1) / out;
+				w.start.push_back(begin);
+				w.begin.push_back(begin);
+				w.end.push_back(end);
+				w.count.push_back(end - begin);
+			}
+			return w;
+		}
+
+		// element (n, c, h, w) is data[n * batch_stride + c * channel_stride + h * row_stride + w * pixel_stride]
+		template<typename T>
+		struct PoolInput
+		{
+			const T* data;
+			idx_type batch_stride, channel_stride, row_stride, pixel_stride;
+		};
+
+		template<typename T>
+		PoolInput<T> pool_input(const Tensor<T>& t)
+		{
+			PoolInput<T> input = { t.data_ptr() + t.offset(), t.stride(0), t.stride(1), t.stride(2), t.stride(3) };
+			return input;
+		}
+
+		// scratch memory of one thread that only grows, Slot tells the buffers of a kernel apart
+		template<typename T, int Slot>
+		T* pool_buffer(idx_type count)
+		{
+			thread_local std::vector<T> buffer;
+			if (buffer.size() < static_cast<std::size_t>(count))
+				buffer.resize(count);
+			return buffer.data();
+		}
+
+		// The channels [c0, c0 + pool_lanes) of image n as [H][W][pool_lanes] with row_stride and
+		// pixel_stride: the input itself when the channels of a pixel are contiguous and the
+		// block is full, else a copy with zero lanes past the channels.
+		template<typename T>
+		const T* channels_last(const PoolInput<T>& x, const PoolShape& s, idx_type n, idx_type c0, idx_type& row_stride, idx_type& pixel_stride)
+		{
+			const T* image = x.data + n * x.batch_stride + c0 * x.channel_stride;
+			if (x.channel_stride == 1 && c0 + pool_lanes <= s.channels)
+			{
+				row_stride = x.row_stride;
+				pixel_stride = x.pixel_stride;
+				return image;
+			}
+			const idx_type lanes = std::min(pool_lanes, s.channels - c0);
+			row_stride = s.width * pool_lanes;
+			pixel_stride = pool_lanes;
+			T* block = pool_buffer<T, 0>(s.height * row_stride);
+			if (lanes < pool_lanes)
+				std::fill(block, block + s.height * row_stride, T(0));
+			// a row of the block stays in L1 while its lanes are filled
+			for (idx_type h = 0; h < s.height; ++h)
+				for (idx_type l = 0; l < lanes; ++l)
+				{
+					const T* src = image + l * x.channel_stride + h * x.row_stride;
+					T* dst = block + h * row_stride + l;
+					for (idx_type w = 0; w < s.width; ++w)
+						dst[w * pool_lanes] = src[w * x.pixel_stride];
+				}
+			return block;
+		}
+
+		// Calls f(n, c0, lanes, block, row_stride, pixel_stride) with the channels last block of
+		// every image n and first channel c0, lanes of them real. Blocks go to separate threads
+		// when the windows make enough reads of the input.
+		template<typename T, typename F>
+		void for_each_block(const PoolInput<T>& x, const PoolShape& s, double reads, F f)
+		{
+			const idx_type blocks = s.blocks();
+			int tasks = static_cast<int>(s.batch * blocks);
+			bool parallel = !omp_in_parallel() && omp_get_max_threads() > 1 && tasks > 1 && reads >= pool_parallel_threshold;
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int task = 0; task < tasks; ++task)
+			{
+				idx_type n = task / blocks, c0 = task % blocks * pool_lanes;
+				idx_type row_stride, pixel_stride;
+				const T* block = channels_last(x, s, n, c0, row_stride, pixel_stride);
+				f(n, c0, std::min(pool_lanes, s.channels - c0), block, row_stride, pixel_stride);
+			}
+		}
+
+		// Maximum of every window of a block, lane l of output (oh, ow) at
+		// values[l * plane + oh * out_w + ow] for the first `lanes` lanes; with Taps also its
+		// offset in the window at taps[] in the same layout. The offset is kept as a T beside
+		// the value so both are selected by the same compare of a vector of lanes.
+		template<typename T, bool Taps>
+		TRAPH_POOL_INLINE void max_block(const T* in, idx_type row_stride, idx_type pixel_stride, const PoolShape& s,
+			const PoolWindows& rows, const PoolWindows& cols, idx_type kernel_w, idx_type lanes, T* values, T* taps)
+		{
+			const idx_type plane = s.plane();
+			for (idx_type oh = 0; oh < s.out_h; ++oh)
+				for (idx_type ow = 0; ow < s.out_w; ++ow)
+				{
+					T best[pool_lanes], offset[pool_lanes];
+					const T first = T((rows.begin[oh] - rows.start[oh]) * kernel_w + cols.begin[ow] - cols.start[ow]);
+					for (idx_type l = 0; l < pool_lanes; ++l)
+					{
+						best[l] = -std::numeric_limits<T>::infinity();
+						offset[l] = first;
+					}
+					for (idx_type ih = rows.begin[oh]; ih < rows.end[oh]; ++ih)
+						for (idx_type iw = cols.begin[ow]; iw < cols.end[ow]; ++iw)
+						{
+							const T* x = in + ih * row_stride + iw * pixel_stride;
+							const T tap = T((ih - rows.start[oh]) * kernel_w + iw - cols.start[ow]);
+							for (idx_type l = 0; l < pool_lanes; ++l)
+							{
+								// a NaN wins and stays
+								bool take = x[l] > best[l] || x[l] != x[l];
+								best[l] = take ? x[l] : best[l];
+								if (Taps)
+									offset[l] = take ? tap : offset[l];
+							}
+						}
+					const idx_type p = oh * s.out_w + ow;
+					for (idx_type l = 0; l < lanes; ++l)
+						values[l * plane + p] = best[l];
+					if (Taps)
+						for (idx_type l = 0; l < lanes; ++l)
+							taps[l * plane + p] = offset[l];
+				}
+		}
+
+		// average of every window of a block, stored like the maxima of max_block; kernel_w and
+		// taps are unused
+		template<typename T>
+		TRAPH_POOL_INLINE void avg_block(const T* in, idx_type row_stride, idx_type pixel_stride, const PoolShape& s,
+			const PoolWindows& rows, const PoolWindows& cols, idx_type kernel_w, idx_type lanes, T* values, T* taps)
+		{
+			const idx_type plane = s.plane();
+			for (idx_type oh = 0; oh < s.out_h; ++oh)
+				for (idx_type ow = 0; ow < s.out_w; ++ow)
+				{
+					T sum[pool_lanes] = {};
+					for (idx_type ih = rows.begin[oh]; ih < rows.end[oh]; ++ih)
+						for (idx_type iw = cols.begin[ow]; iw < cols.end[ow]; ++iw)
+						{
+							const T* x = in + ih * row_stride + iw * pixel_stride;
+							for (idx_type l = 0; l < pool_lanes; ++l)
+								sum[l] += x[l];
+						}
+					const T scale = T(1) / T(rows.count[oh] * cols.count[ow]);
+					const idx_type p = oh * s.out_w + ow;
+					for (idx_type l = 0; l < lanes; ++l)
+						values[l * plane + p] = sum[l] * scale;
+				}
+		}
+
+		template<typename T>
+		using PoolKernel = void(*)(const T* in, idx_type row_stride, idx_type pixel_stride, const PoolShape& s,
+			const PoolWindows& rows, const PoolWindows& cols, idx_type kernel_w, idx_type lanes, T* values, T* taps);
+
+		// the block kernels compiled for one instruction set
+		template<typename T>
+		struct PoolKernels
+		{
+			PoolKernel<T> max, max_taps, avg;
+		};
+
+#define TRAPH_POOL_KERNEL(name, target, block)                                                          \
+		template<typename T>                                                                        \
+		target void name(const T* in, idx_type row_stride, idx_type pixel_stride, const PoolShape& s, \
+			const PoolWindows& rows, const PoolWindows& cols, idx_type kernel_w, idx_type lanes, T* values, T* taps) \
+		{                                                                                           \
+			block(in, row_stride, pixel_stride, s, rows, cols, kernel_w, lanes, values, taps);      \
+		}
+
+#define TRAPH_POOL_MAX(...) max_block<T, false>(__VA_ARGS__)
+#define TRAPH_POOL_MAX_TAPS(...) max_block<T, true>(__VA_ARGS__)
+#define TRAPH_POOL_AVG(...) avg_block<T>(__VA_ARGS__)
+
+		TRAPH_POOL_KERNEL(max_generic, , TRAPH_POOL_MAX)
+		TRAPH_POOL_KERNEL(max_taps_generic, , TRAPH_POOL_MAX_TAPS)
+		TRAPH_POOL_KERNEL(avg_generic, , TRAPH_POOL_AVG)
+#if defined(TRAPH_ARCH_X86)
+		TRAPH_POOL_KERNEL(max_avx2, TRAPH_TARGET_AVX2, TRAPH_POOL_MAX)
+		TRAPH_POOL_KERNEL(max_taps_avx2, TRAPH_TARGET_AVX2, TRAPH_POOL_MAX_TAPS)
+		TRAPH_POOL_KERNEL(avg_avx2, TRAPH_TARGET_AVX2, TRAPH_POOL_AVG)
+		TRAPH_POOL_KERNEL(max_avx512, TRAPH_TARGET_AVX512, TRAPH_POOL_MAX)
+		TRAPH_POOL_KERNEL(max_taps_avx512, TRAPH_TARGET_AVX512, TRAPH_POOL_MAX_TAPS)
+		TRAPH_POOL_KERNEL(avg_avx512, TRAPH_TARGET_AVX512, TRAPH_POOL_AVG)
+#endif
+
+		template<typename T>
+		PoolKernels<T> pool_kernels()
+		{
+#if defined(TRAPH_ARCH_X86)
+			GemmIsa isa = native_gemm_isa();
+			if (isa == GemmIsa::AVX512)
+			{
+				PoolKernels<T> kernels = { max_avx512<T>, max_taps_avx512<T>, avg_avx512<T> };
+				return kernels;
+			}
+			if (isa == GemmIsa::AVX2)
+			{
+				PoolKernels<T> kernels = { max_avx2<T>, max_taps_avx2<T>, avg_avx2<T> };
+				return kernels;
+			}
+#endif
+			PoolKernels<T> kernels = { max_generic<T>, max_taps_generic<T>, avg_generic<T> };
+			return kernels;
+		}
+
+		// reads of the input by every window of every plane
+		double window_reads(const PoolShape& s, const PoolWindows& rows, const PoolWindows& cols)
+		{
+			double row_reads = 0, col_reads = 0;
+			for (idx_type i = 0; i < s.out_h; ++i)
+				row_reads += rows.end[i] - rows.begin[i];
+			for (idx_type i = 0; i < s.out_w; ++i)
+				col_reads += cols.end[i] - cols.begin[i];
+			return static_cast<double>(s.batch) * s.channels * row_reads * col_reads;
+		}
+
+		// adds the gradient of every output of plane (n, c) to the input pixel at its offset
+		template<typename T, typename Offset>
+		void scatter_max(const PoolInput<T>& grad, idx_type n, idx_type c, const Offset* offsets, idx_type offset_row, idx_type offset_pixel,
+			const PoolShape& s, const PoolWindows& rows, const PoolWindows& cols, idx_type kernel_w, T* dx)
+		{
+			const T* g = grad.data + n * grad.batch_stride + c * grad.channel_stride;
+			for (idx_type oh = 0; oh < s.out_h; ++oh)
+				for (idx_type ow = 0; ow < s.out_w; ++ow)
+				{
+					idx_type tap = static_cast<idx_type>(offsets[oh * offset_row + ow * offset_pixel]);
+					idx_type ih = rows.start[oh] + tap / kernel_w, iw = cols.start[ow] + tap % kernel_w;
+					dx[ih * s.width + iw] += g[oh * grad.row_stride + ow * grad.pixel_stride];
+				}
+		}
+
+		bool parallel_planes(const PoolShape& s, double reads)
+		{
+			return !omp_in_parallel() && omp_get_max_threads() > 1 && s.batch * s.channels > 1 && reads >= pool_parallel_threshold;
+		}
+
+		void check_grad(const char* name, const DimVector& grad, const PoolShape& s)
+		{
+			if (grad != DimVector({ s.batch, s.channels, s.out_h, s.out_w }))
+				pool_error(name, "The gradient shall have the shape of the output");
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> max_pool2d(const Tensor<T>& input, const Pool2dParams& params, std::shared_ptr<Tensor<u8>>* offsets)
+		{
+			PoolShape s = pool_shape("max_pool2d", input.size(), params);
+			const DimVector out_size({ s.batch, s.channels, s.out_h, s.out_w });
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(out_size));
+			const bool with_offsets = offsets && max_pool2d_has_offsets(params);
+			if (offsets)
+				offsets->reset(with_offsets ? new Tensor<u8>(out_size) : nullptr);
+			if (s.empty())
+				return result;
+
+			PoolWindows rows = pool_windows(s.height, s.out_h, params.kernel_h, params.stride_h, params.padding_h, false);
+			PoolWindows cols = pool_windows(s.width, s.out_w, params.kernel_w, params.stride_w, params.padding_w, false);
+			const idx_type plane = s.plane();
+			const PoolKernels<T> kernels = pool_kernels<T>();
+			T* y = result->data_ptr();
+			u8* o = with_offsets ? (*offsets)->data_ptr() : nullptr;
+			for_each_block(pool_input(input), s, window_reads(s, rows, cols),
+				[&](idx_type n, idx_type c0, idx_type lanes, const T* block, idx_type row_stride, idx_type pixel_stride)
+			{
+				T* values = y + (n * s.channels + c0) * plane;
+				if (!with_offsets)
+				{
+					kernels.max(block, row_stride, pixel_stride, s, rows, cols, params.kernel_w, lanes, values, nullptr);
+					return;
+				}
+				T* taps = pool_buffer<T, 1>(pool_lanes * plane);
+				kernels.max_taps(block, row_stride, pixel_stride, s, rows, cols, params.kernel_w, lanes, values, taps);
+				u8* dst = o + (n * s.channels + c0) * plane;
+				for (idx_type i = 0; i < lanes * plane; ++i)
+					dst[i] = static_cast<u8>(taps[i]);
+			});
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> max_pool2d_backward(const Tensor<T>& grad, const DimVector& input_size, const Tensor<u8>& offsets, const Pool2dParams& params)
+		{
+			const char* name = "max_pool2d_backward";
+			PoolShape s = pool_shape(name, input_size, params);
+			check_grad(name, grad.size(), s);
+			if (offsets.size() != grad.size())
+				pool_error(name, "The offsets shall have the shape of the output");
+			if (!max_pool2d_has_offsets(params))
+				pool_error(name, "The windows are too large for offsets");
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(input_size));
+			if (s.empty())
+				return result;
+
+			PoolWindows rows = pool_windows(s.height, s.out_h, params.kernel_h, params.stride_h, params.padding_h, false);
+			PoolWindows cols = pool_windows(s.width, s.out_w, params.kernel_w, params.stride_w, params.padding_w, false);
+			PoolInput<T> dy = pool_input(grad);
+			PoolInput<u8> off = pool_input(offsets);
+			T* dx = result->data_ptr();
+			const idx_type image = s.height * s.width;
+			int planes = static_cast<int>(s.batch * s.channels);
+#pragma omp parallel for schedule(static) if(parallel_planes(s, static_cast<double>(planes) * s.plane()))
+			for (int p = 0; p < planes; ++p)
+			{
+				idx_type n = p / s.channels, c = p % s.channels;
+				T* plane = dx + p * image;
+				std::fill(plane, plane + image, T(0));
+				scatter_max(dy, n, c, off.data + n * off.batch_stride + c * off.channel_stride, off.row_stride, off.pixel_stride,
+					s, rows, cols, params.kernel_w, plane);
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> max_pool2d_backward(const Tensor<T>& grad, const Tensor<T>& input, const Pool2dParams& params)
+		{
+			const char* name = "max_pool2d_backward";
+			PoolShape s = pool_shape(name, input.size(), params);
+			check_grad(name, grad.size(), s);
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(input.size()));
+			if (s.empty())
+				return result;
+
+			PoolWindows rows = pool_windows(s.height, s.out_h, params.kernel_h, params.stride_h, params.padding_h, false);
+			PoolWindows cols = pool_windows(s.width, s.out_w, params.kernel_w, params.stride_w, params.padding_w, false);
+			PoolInput<T> dy = pool_input(grad);
+			const idx_type plane = s.plane(), image = s.height * s.width;
+			const PoolKernels<T> kernels = pool_kernels<T>();
+			T* dx = result->data_ptr();
+			// the maxima are found again a block at a time, then scattered plane by plane
+			for_each_block(pool_input(input), s, window_reads(s, rows, cols),
+				[&](idx_type n, idx_type c0, idx_type lanes, const T* block, idx_type row_stride, idx_type pixel_stride)
+			{
+				T* values = pool_buffer<T, 1>(pool_lanes * plane);
+				T* taps = pool_buffer<T, 2>(pool_lanes * plane);
+				kernels.max_taps(block, row_stride, pixel_stride, s, rows, cols, params.kernel_w, lanes, values, taps);
+				for (idx_type l = 0; l < lanes; ++l)
+				{
+					T* dst = dx + (n * s.channels + c0 + l) * image;
+					std::fill(dst, dst + image, T(0));
+					scatter_max(dy, n, c0 + l, taps + l * plane, s.out_w, idx_type(1), s, rows, cols, params.kernel_w, dst);
+				}
+			});
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> avg_pool(const Tensor<T>& input, const PoolShape& s, const PoolWindows& rows, const PoolWindows& cols)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ s.batch, s.channels, s.out_h, s.out_w })));
+			if (s.empty())
+				return result;
+			const PoolKernels<T> kernels = pool_kernels<T>();
+			T* y = result->data_ptr();
+			for_each_block(pool_input(input), s, window_reads(s, rows, cols),
+				[&](idx_type n, idx_type c0, idx_type lanes, const T* block, idx_type row_stride, idx_type pixel_stride)
+			{
+				kernels.avg(block, row_stride, pixel_stride, s, rows, cols, 0, lanes, y + (n * s.channels + c0) * s.plane(), nullptr);
+			});
+			return result;
+		}
+
+		// spreads the gradient of every output evenly over the count of its window
+		template<typename T>
+		std::shared_ptr<Tensor<T>> avg_pool_backward(const Tensor<T>& grad, const DimVector& input_size, const PoolShape& s,
+			const PoolWindows& rows, const PoolWindows& cols)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(input_size));
+			if (s.empty())
+				return result;
+			PoolInput<T> dy = pool_input(grad);
+			T* dx = result->data_ptr();
+			const idx_type image = s.height * s.width;
+			int planes = static_cast<int>(s.batch * s.channels);
+#pragma omp parallel for schedule(static) if(parallel_planes(s, window_reads(s, rows, cols)))
+			for (int p = 0; p < planes; ++p)
+			{
+				idx_type n = p / s.channels, c = p % s.channels;
+				const T* g = dy.data + n * dy.batch_stride + c * dy.channel_stride;
+				T* plane = dx + p * image;
+				std::fill(plane, plane + image, T(0));
+				for (idx_type oh = 0; oh < s.out_h; ++oh)
+					for (idx_type ow = 0; ow < s.out_w; ++ow)
+					{
+						T share = g[oh * dy.row_stride + ow * dy.pixel_stride] / T(rows.count[oh] * cols.count[ow]);
+						for (idx_type ih = rows.begin[oh]; ih < rows.end[oh]; ++ih)
+							for (idx_type iw = cols.begin[ow]; iw < cols.end[ow]; ++iw)
+								plane[ih * s.width + iw] += share;
+					}
+			}
+			return result;
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> avg_pool2d(const Tensor<T>& input, const Pool2dParams& params)
+		{
+			PoolShape s = pool_shape("avg_pool2d", input.size(), params);
+			return avg_pool(input, s,
+				pool_windows(s.height, s.out_h, params.kernel_h, params.stride_h, params.padding_h, params.count_include_pad),
+				pool_windows(s.width, s.out_w, params.kernel_w, params.stride_w, params.padding_w, params.count_include_pad));
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> avg_pool2d_backward(const Tensor<T>& grad, const DimVector& input_size, const Pool2dParams& params)
+		{
+			const char* name = "avg_pool2d_backward";
+			PoolShape s = pool_shape(name, input_size, params);
+			check_grad(name, grad.size(), s);
+			return avg_pool_backward(grad, input_size, s,
+				pool_windows(s.height, s.out_h, params.kernel_h, params.stride_h, params.padding_h, params.count_include_pad),
+				pool_windows(s.width, s.out_w, params.kernel_w, params.stride_w, params.padding_w, params.count_include_pad));
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> adaptive_avg_pool2d(const Tensor<T>& input, idx_type out_h, idx_type out_w)
+		{
+			PoolShape s = adaptive_shape("adaptive_avg_pool2d", input.size(), out_h, out_w);
+			return avg_pool(input, s, adaptive_windows(s.height, out_h), adaptive_windows(s.width, out_w));
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> adaptive_avg_pool2d_backward(const Tensor<T>& grad, const DimVector& input_size)
+		{
+			const char* name = "adaptive_avg_pool2d_backward";
+			if (grad.ndimension() != 4)
+				pool_error(name, "The gradient shall be [N, C, OH, OW]");
+			PoolShape s = adaptive_shape(name, input_size, grad.size(2), grad.size(3));
+			check_grad(name, grad.size(), s);
+			return avg_pool_backward(grad, input_size, s, adaptive_windows(s.height, s.out_h), adaptive_windows(s.width, s.out_w));
+		}
+	}
+
+	std::shared_ptr<Tensor<f32>> max_pool2d_impl(const Tensor<f32>& input, const Pool2dParams& params, std::shared_ptr<Tensor<u8>>* offsets)
+	{
+		return max_pool2d(input, params, offsets);
+	}
+
+	std::shared_ptr<Tensor<f64>> max_pool2d_impl(const Tensor<f64>& input, const Pool2dParams& params, std::shared_ptr<Tensor<u8>>* offsets)
+	{
+		return max_pool2d(input, params, offsets);
+	}
+
+	bool max_pool2d_has_offsets(const Pool2dParams& params)
+	{
+		return params.kernel_h * params.kernel_w <= max_offset_taps;
+	}
+
+	std::shared_ptr<Tensor<f32>> max_pool2d_backward_impl(const Tensor<f32>& grad, const DimVector& input_size, const Tensor<u8>& offsets, const Pool2dParams& params)
+	{
+		return max_pool2d_backward(grad, input_size, offsets, params);
+	}
+
+	std::shared_ptr<Tensor<f64>> max_pool2d_backward_impl(const Tensor<f64>& grad, const DimVector& input_size, const Tensor<u8>& offsets, const Pool2dParams& params)
+	{
+		return max_pool2d_backward(grad, input_size, offsets, params);
+	}
+
+	std::shared_ptr<Tensor<f32>> max_pool2d_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, const Pool2dParams& params)
+	{
+		return max_pool2d_backward(grad, input, params);
+	}
+
+	std::shared_ptr<Tensor<f64>> max_pool2d_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, const Pool2dParams& params)
+	{
+		return max_pool2d_backward(grad, input, params);
+	}
+
+	std::shared_ptr<Tensor<f32>> avg_pool2d_impl(const Tensor<f32>& input, const Pool2dParams& params)
+	{
+		return avg_pool2d(input, params);
+	}
+
+	std::shared_ptr<Tensor<f64>> avg_pool2d_impl(const Tensor<f64>& input, const Pool2dParams& params)
+	{
+		return avg_pool2d(input, params);
+	}
+
+	std::shared_ptr<Tensor<f32>> avg_pool2d_backward_impl(const Tensor<f32>& grad, const DimVector& input_size, const Pool2dParams& params)
+	{
+		return avg_pool2d_backward(grad, input_size, params);
+	}
+
+	std::shared_ptr<Tensor<f64>> avg_pool2d_backward_impl(const Tensor<f64>& grad, const DimVector& input_size, const Pool2dParams& params)
+	{
+		return avg_pool2d_backward(grad, input_size, params);
+	}
+
+	std::shared_ptr<Tensor<f32>> adaptive_avg_pool2d_impl(const Tensor<f32>& input, idx_type out_h, idx_type out_w)
+	{
+		return adaptive_avg_pool2d(input, out_h, out_w);
+	}
+
+	std::shared_ptr<Tensor<f64>> adaptive_avg_pool2d_impl(const Tensor<f64>& input, idx_type out_h, idx_type out_w)
+	{
+		return adaptive_avg_pool2d(input, out_h, out_w);
+	}
+
+	std::shared_ptr<Tensor<f32>> adaptive_avg_pool2d_backward_impl(const Tensor<f32>& grad, const DimVector& input_size)
+	{
+		return adaptive_avg_pool2d_backward(grad, input_size);
+	}
+
+	std::shared_ptr<Tensor<f64>> adaptive_avg_pool2d_backward_impl(const Tensor<f64>& grad, const DimVector& input_size)
+	{
+		return adaptive_avg_pool2d_backward(grad, input_size);
+	}
+}
@@ -0,0 +1,769 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <omp.h>
+
+#include <traph/core/cpu.h>
+#include <traph/tensor/gemm.h>
+#include <traph/tensor/qgemm.h>
+
+#if defined(TRAPH_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+#include "simd_reduce.h"
+
+// Integer gemm in the blocking scheme of gemm.cpp. The kernels only compute raw u8 x i8
+// dot products: an i8 A is shifted into u8 while packing (a + 128, with its zero point
+// shifted as well), and the zero points are applied at the end through the row sums of A
+// and column sums of B:
+//   sum (a - za)(b - zb) = sum a b - zb sum a - za sum b + k za zb
+// Both operands are packed in groups of 4 consecutive k, the layout vpdpbusd consumes.
+
+namespace traph
+{
+	namespace
+	{
+		const double qgemm_parallel_threshold = 64.0 * 64.0 * 64.0;
+		const idx_type qgemm_mc = 96;
+		const idx_type qgemm_kc = 1024;
+		const idx_type qgemm_nc = 2048;
+		// largest mr x nr tile of all micro-kernels
+		const idx_type qgemm_max_tile = 8 * 32;
+		// inputs with at most this many rows skip the packed gemm in qlinear
+		const idx_type qlinear_gemv_rows = 4;
+
+		struct QGemmMicroKernel
+		{
+			GemmIsa isa;
+			idx_type mr, nr;
+			// vpmaddubsw saturates its i16 pair sums, the AVX2 kernel therefore multiplies the
+			// low 7 bits and the high bit of A in two passes, each of which is exact
+			bool split_high_bit;
+			// C[0:mr, 0:nr] = (accumulate ? C : 0) + (A_panel * B_panel << shift), unit column stride
+			void(*kernel)(idx_type k4, const u8* a, const i8* b, i32* c, idx_type rs_c, int shift, bool accumulate);
+		};
+
+		i32 load_group(const void* p)
+		{
+			i32 value;
+			std::memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		template<idx_type MR, idx_type NR>
+		void qgemm_kernel_generic(idx_type k4, const u8* a, const i8* b, i32* c, idx_type rs_c, int shift, bool accumulate)
+		{
+			i32 acc[MR][NR] = {};
+			for (idx_type g = 0; g < k4; ++g)
+			{
+				for (idx_type i = 0; i < MR; ++i)
+					for (idx_type j = 0; j < NR; ++j)
+						for (idx_type q = 0; q < 4; ++q)
+							acc[i][j] += static_cast<i32>(a[i * 4 + q]) * static_cast<i32>(b[j * 4 + q]);
+				a += MR * 4;
+				b += NR * 4;
+			}
+
+			for (idx_type i = 0; i < MR; ++i)
+			{
+				i32* c_row = c + i * rs_c;
+				for (idx_type j = 0; j < NR; ++j)
+					c_row[j] = (accumulate ? c_row[j] : 0) + (acc[i][j] << shift);
+			}
+		}
+
+#if defined(TRAPH_ARCH_X86)
+		// avx2, 4 x 16: vpmaddubsw gives i16 sums of 2 products, vpmaddwd with ones folds
+		// them to i32 sums of 4 products
+#define TRAPH_QGEMM_AVX2_ROW(i)                                                          \
+		{                                                                                \
+			__m256i a_i = _mm256_set1_epi32(load_group(a + 4 * i));                      \
+			c##i##0 = _mm256_add_epi32(c##i##0, _mm256_madd_epi16(_mm256_maddubs_epi16(a_i, b0), ones)); \
+			c##i##1 = _mm256_add_epi32(c##i##1, _mm256_madd_epi16(_mm256_maddubs_epi16(a_i, b1), ones)); \
+		}
+
+#define TRAPH_QGEMM_AVX2_STORE(i)                                                        \
+		{                                                                                \
+			i32* c_row = c + i * rs_c;                                                   \
+			__m256i r0 = _mm256_sll_epi32(c##i##0, shift_v);                             \
+			__m256i r1 = _mm256_sll_epi32(c##i##1, shift_v);                             \
+			if (accumulate)                                                              \
+			{                                                                            \
+				r0 = _mm256_add_epi32(r0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c_row)));     \
+				r1 = _mm256_add_epi32(r1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c_row + 8))); \
+			}                                                                            \
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(c_row), r0);                  \
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(c_row + 8), r1);              \
+		}
+
+		TRAPH_TARGET_AVX2
+		void qgemm_kernel_avx2(idx_type k4, const u8* a, const i8* b, i32* c, idx_type rs_c, int shift, bool accumulate)
+		{
+			const __m256i ones = _mm256_set1_epi16(1);
+			__m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+			__m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+			__m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+			__m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+
+			for (idx_type g = 0; g < k4; ++g)
+			{
+				__m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+				__m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 32));
+				TRAPH_QGEMM_AVX2_ROW(0)
+				TRAPH_QGEMM_AVX2_ROW(1)
+				TRAPH_QGEMM_AVX2_ROW(2)
+				TRAPH_QGEMM_AVX2_ROW(3)
+				a += 16;
+				b += 64;
+			}
+
+			__m128i shift_v = _mm_cvtsi32_si128(shift);
+			TRAPH_QGEMM_AVX2_STORE(0)
+			TRAPH_QGEMM_AVX2_STORE(1)
+			TRAPH_QGEMM_AVX2_STORE(2)
+			TRAPH_QGEMM_AVX2_STORE(3)
+		}
+
+		// avx-512 vnni, 8 x 32: vpdpbusd accumulates 4 u8 x i8 products per lane in i32
+#define TRAPH_QGEMM_VNNI_ROW(i)                                                          \
+		{                                                                                \
+			__m512i a_i = _mm512_set1_epi32(load_group(a + 4 * i));                      \
+			c##i##0 = _mm512_dpbusd_epi32(c##i##0, a_i, b0);                             \
+			c##i##1 = _mm512_dpbusd_epi32(c##i##1, a_i, b1);                             \
+		}
+
+#define TRAPH_QGEMM_VNNI_STORE(i)                                                        \
+		{                                                                                \
+			i32* c_row = c + i * rs_c;                                                   \
+			__m512i r0 = _mm512_maskz_sll_epi32(all_lanes, c##i##0, shift_v);            \
+			__m512i r1 = _mm512_maskz_sll_epi32(all_lanes, c##i##1, shift_v);            \
+			if (accumulate)                                                              \
+			{                                                                            \
+				r0 = _mm512_add_epi32(r0, _mm512_loadu_si512(c_row));                    \
+				r1 = _mm512_add_epi32(r1, _mm512_loadu_si512(c_row + 16));               \
+			}                                                                            \
+			_mm512_storeu_si512(c_row, r0);                                              \
+			_mm512_storeu_si512(c_row + 16, r1);                                         \
+		}
+
+		TRAPH_TARGET_AVX512_VNNI
+		void qgemm_kernel_vnni(idx_type k4, const u8* a, const i8* b, i32* c, idx_type rs_c, int shift, bool accumulate)
+		{
+			__m512i c00 = _mm512_setzero_si512(), c01 = _mm512_setzero_si512();
+			__m512i c10 = _mm512_setzero_si512(), c11 = _mm512_setzero_si512();
+			__m512i c20 = _mm512_setzero_si512(), c21 = _mm512_setzero_si512();
+			__m512i c30 = _mm512_setzero_si512(), c31 = _mm512_setzero_si512();
+			__m512i c40 = _mm512_setzero_si512(), c41 = _mm512_setzero_si512();
+			__m512i c50 = _mm512_setzero_si512(), c51 = _mm512_setzero_si512();
+			__m512i c60 = _mm512_setzero_si512(), c61 = _mm512_setzero_si512();
+			__m512i c70 = _mm512_setzero_si512(), c71 = _mm512_setzero_si512();
+
+			for (idx_type g = 0; g < k4; ++g)
+			{
+				__m512i b0 = _mm512_loadu_si512(b);
+				__m512i b1 = _mm512_loadu_si512(b + 64);
+				TRAPH_QGEMM_VNNI_ROW(0)
+				TRAPH_QGEMM_VNNI_ROW(1)
+				TRAPH_QGEMM_VNNI_ROW(2)
+				TRAPH_QGEMM_VNNI_ROW(3)
+				TRAPH_QGEMM_VNNI_ROW(4)
+				TRAPH_QGEMM_VNNI_ROW(5)
+				TRAPH_QGEMM_VNNI_ROW(6)
+				TRAPH_QGEMM_VNNI_ROW(7)
+				a += 32;
+				b += 128;
+			}
+
+			// the zero-masked shift, the plain one starts from an undefined vector gcc 12 warns on
+			const __mmask16 all_lanes = 0xFFFF;
+			__m128i shift_v = _mm_cvtsi32_si128(shift);
+			TRAPH_QGEMM_VNNI_STORE(0)
+			TRAPH_QGEMM_VNNI_STORE(1)
+			TRAPH_QGEMM_VNNI_STORE(2)
+			TRAPH_QGEMM_VNNI_STORE(3)
+			TRAPH_QGEMM_VNNI_STORE(4)
+			TRAPH_QGEMM_VNNI_STORE(5)
+			TRAPH_QGEMM_VNNI_STORE(6)
+			TRAPH_QGEMM_VNNI_STORE(7)
+		}
+#endif
+
+		// sum a[p] * b[p] over contiguous u8 and i8 vectors
+		i32 qdot_generic(const u8* a, const i8* b, idx_type k)
+		{
+			i32 dot = 0;
+			for (idx_type p = 0; p < k; ++p)
+				dot += static_cast<i32>(a[p]) * b[p];
+			return dot;
+		}
+
+#if defined(TRAPH_ARCH_X86)
+		// both operands widened to i16, vpmaddwd keeps the pair sums exact
+		TRAPH_TARGET_AVX2
+		i32 qdot_avx2(const u8* a, const i8* b, idx_type k)
+		{
+			__m256i acc = _mm256_setzero_si256();
+			idx_type p = 0;
+			for (; p + 16 <= k; p += 16)
+			{
+				__m256i a16 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + p)));
+				__m256i b16 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + p)));
+				acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a16, b16));
+			}
+			__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+			sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+			sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+			return _mm_cvtsi128_si32(sum) + qdot_generic(a + p, b + p, k - p);
+		}
+
+		TRAPH_TARGET_AVX512_VNNI
+		i32 qdot_vnni(const u8* a, const i8* b, idx_type k)
+		{
+			__m512i acc = _mm512_setzero_si512();
+			idx_type p = 0;
+			for (; p + 64 <= k; p += 64)
+				acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a + p), _mm512_loadu_si512(b + p));
+			return horizontal_sum_avx512(acc) + qdot_generic(a + p, b + p, k - p);
+		}
+#endif
+
+		using QDotFunction = i32(*)(const u8* a, const i8* b, idx_type k);
+
+		QDotFunction select_qdot()
+		{
+#if defined(TRAPH_ARCH_X86)
+			GemmIsa isa = native_gemm_isa();
+			if (isa == GemmIsa::AVX512 && cpu_features().avx512vnni)
+				return qdot_vnni;
+			if (isa != GemmIsa::GENERIC)
+				return qdot_avx2;
+#endif
+			return qdot_generic;
+		}
+
+		QGemmMicroKernel select_qkernel()
+		{
+#if defined(TRAPH_ARCH_X86)
+			GemmIsa isa = native_gemm_isa();
+			if (isa == GemmIsa::AVX512 && cpu_features().avx512vnni)
+				return { GemmIsa::AVX512, 8, 32, false, qgemm_kernel_vnni };
+			if (isa != GemmIsa::GENERIC)
+				return { GemmIsa::AVX2, 4, 16, true, qgemm_kernel_avx2 };
+#endif
+			return { GemmIsa::GENERIC, 4, 8, false, qgemm_kernel_generic<4, 8> };
+		}
+
+		template<typename AT>
+		u8 shifted(AT value)
+		{
+			// i8 -> u8 by adding 128, u8 unchanged
+			return std::is_same<AT, i8>::value ? static_cast<u8>(static_cast<u8>(value) ^ 0x80) : static_cast<u8>(value);
+		}
+
+		// one mr x kc panel of A in groups of 4 k, zero padded. With hi set the low 7 bits go
+		// to lo and the high bit to hi, returns whether any high bit was set.
+		template<typename AT>
+		bool pack_a_panel(idx_type m, idx_type k, const AT* a, idx_type rs, idx_type cs, idx_type mr, u8* lo, u8* hi)
+		{
+			idx_type k4 = (k + 3) / 4;
+			u8 any_high = 0;
+			for (idx_type g = 0; g < k4; ++g)
+			{
+				if (m == mr && g * 4 + 3 < k)
+				{
+					// full group, no padding
+					for (idx_type i = 0; i < mr; ++i)
+					{
+						const AT* a_group = a + i * rs + g * 4 * cs;
+						idx_type index = (g * mr + i) * 4;
+						for (idx_type q = 0; q < 4; ++q)
+						{
+							u8 value = shifted(a_group[q * cs]);
+							lo[index + q] = hi ? value & 0x7f : value;
+							if (hi)
+								hi[index + q] = value >> 7;
+							any_high |= value;
+						}
+					}
+					continue;
+				}
+
+				for (idx_type i = 0; i < mr; ++i)
+				{
+					for (idx_type q = 0; q < 4; ++q)
+					{
+						idx_type p = g * 4 + q;
+						u8 value = (i < m && p < k) ? shifted(a[i * rs + p * cs]) : 0;
+						idx_type index = (g * mr + i) * 4 + q;
+						if (hi)
+						{
+							lo[index] = value & 0x7f;
+							hi[index] = value >> 7;
+							any_high |= value;
+						}
+						else
+						{
+							lo[index] = value;
+						}
+					}
+				}
+			}
+			return hi && (any_high & 0x80) != 0;
+		}
+
+		// one kc x nr panel of B in groups of 4 k, zero padded
+		void pack_b_panel(idx_type n, idx_type k, const i8* b, idx_type rs, idx_type cs, idx_type nr, i8* buf)
+		{
+			idx_type k4 = (k + 3) / 4;
+			for (idx_type g = 0; g < k4; ++g)
+			{
+				for (idx_type j = 0; j < nr; ++j)
+				{
+					i8* out = buf + (g * nr + j) * 4;
+					if (j < n && g * 4 + 3 < k)
+					{
+						const i8* b_col = b + j * cs + g * 4 * rs;
+						out[0] = b_col[0];
+						out[1] = b_col[rs];
+						out[2] = b_col[2 * rs];
+						out[3] = b_col[3 * rs];
+					}
+					else
+					{
+						for (idx_type q = 0; q < 4; ++q)
+						{
+							idx_type p = g * 4 + q;
+							out[q] = (j < n && p < k) ? b[p * rs + j * cs] : 0;
+						}
+					}
+				}
+			}
+		}
+
+		template<typename AT>
+		void qgemm_impl(idx_type m, idx_type n, idx_type k,
+			const AT* a, idx_type a_rs, idx_type a_cs, i32 a_zero,
+			const i8* b, idx_type b_rs, idx_type b_cs, const i32* b_zero, idx_type b_zero_num,
+			i32* c, idx_type c_rs, idx_type c_cs)
+		{
+			if (m <= 0 || n <= 0)
+				return;
+			if (b_zero_num != 1 && b_zero_num != n)
+				throw std::runtime_error("qgemm: The number of zero points of B shall be 1 or n.");
+
+			const QGemmMicroKernel kern = select_qkernel();
+			const idx_type mr = kern.mr;
+			const idx_type nr = kern.nr;
+			const i32 shifted_zero = std::is_same<AT, i8>::value ? a_zero + 128 : a_zero;
+
+			bool parallel = !omp_in_parallel() && omp_get_max_threads() > 1 &&
+				static_cast<double>(m) * n * k >= qgemm_parallel_threshold;
+
+			idx_type mc_max = std::min(qgemm_mc, (m + mr - 1) / mr * mr);
+			idx_type nc_max = std::min(qgemm_nc, (n + nr - 1) / nr * nr);
+			idx_type kc_max = (std::min(qgemm_kc, std::max<idx_type>(k, 1)) + 3) / 4 * 4;
+			std::vector<i8> b_packed(static_cast<std::size_t>(nc_max) * kc_max);
+			std::vector<u8> a_lo(static_cast<std::size_t>(mc_max) * kc_max);
+			std::vector<u8> a_hi(kern.split_high_bit ? a_lo.size() : 0);
+			std::vector<char> panel_high(mc_max / mr + 1);
+			std::vector<i32> row_sum(m), col_sum(n);
+
+			int row_num = m;
+			int col_num = n;
+#pragma omp parallel if(parallel)
+			{
+#pragma omp for
+				for (int i = 0; i < row_num; ++i)
+				{
+					i32 sum = 0;
+					for (idx_type p = 0; p < k; ++p)
+						sum += shifted(a[i * a_rs + p * a_cs]);
+					row_sum[i] = sum;
+				}
+#pragma omp for
+				for (int j = 0; j < col_num; ++j)
+				{
+					i32 sum = 0;
+					for (idx_type p = 0; p < k; ++p)
+						sum += b[p * b_rs + j * b_cs];
+					col_sum[j] = sum;
+				}
+
+				if (k <= 0)
+				{
+#pragma omp for
+					for (int i = 0; i < row_num; ++i)
+						for (idx_type j = 0; j < n; ++j)
+							c[i * c_rs + j * c_cs] = 0;
+				}
+
+				for (idx_type jc = 0; jc < n; jc += qgemm_nc)
+				{
+					idx_type nc = std::min(qgemm_nc, n - jc);
+					int b_panels = (nc + nr - 1) / nr;
+
+					for (idx_type pc = 0; pc < k; pc += qgemm_kc)
+					{
+						idx_type kc = std::min(qgemm_kc, k - pc);
+						idx_type panel_k = (kc + 3) / 4 * 4;
+						bool accumulate = pc > 0;
+
+#pragma omp for
+						for (int jp = 0; jp < b_panels; ++jp)
+						{
+							idx_type j = jp * nr;
+							pack_b_panel(std::min(nr, nc - j), kc, b + pc * b_rs + (jc + j) * b_cs, b_rs, b_cs, nr, b_packed.data() + j * panel_k);
+						}
+
+						for (idx_type ic = 0; ic < m; ic += qgemm_mc)
+						{
+							idx_type mc = std::min(qgemm_mc, m - ic);
+							int a_panels = (mc + mr - 1) / mr;
+
+#pragma omp for
+							for (int ip = 0; ip < a_panels; ++ip)
+							{
+								idx_type i = ip * mr;
+								panel_high[ip] = pack_a_panel(std::min(mr, mc - i), kc, a + (ic + i) * a_rs + pc * a_cs, a_rs, a_cs, mr,
+									a_lo.data() + i * panel_k, kern.split_high_bit ? a_hi.data() + i * panel_k : nullptr);
+							}
+
+							int tiles = a_panels * b_panels;
+#pragma omp for schedule(static)
+							for (int t = 0; t < tiles; ++t)
+							{
+								alignas(64) i32 tile[qgemm_max_tile];
+								int ip = t % a_panels, jp = t / a_panels;
+								idx_type i = ip * mr, j = jp * nr;
+								idx_type m_eff = std::min(mr, mc - i), n_eff = std::min(nr, nc - j);
+								const u8* lo_panel = a_lo.data() + i * panel_k;
+								const i8* b_panel = b_packed.data() + j * panel_k;
+								i32* c_tile = c + (ic + i) * c_rs + (jc + j) * c_cs;
+
+								if (m_eff == mr && n_eff == nr && c_cs == 1)
+								{
+									kern.kernel(panel_k / 4, lo_panel, b_panel, c_tile, c_rs, 0, accumulate);
+									if (panel_high[ip])
+										kern.kernel(panel_k / 4, a_hi.data() + i * panel_k, b_panel, c_tile, c_rs, 7, true);
+								}
+								else
+								{
+									// edge tile, computed in a scratch tile and merged
+									kern.kernel(panel_k / 4, lo_panel, b_panel, tile, nr, 0, false);
+									if (panel_high[ip])
+										kern.kernel(panel_k / 4, a_hi.data() + i * panel_k, b_panel, tile, nr, 7, true);
+									for (idx_type ii = 0; ii < m_eff; ++ii)
+									{
+										for (idx_type jj = 0; jj < n_eff; ++jj)
+										{
+											i32& c_value = c_tile[ii * c_rs + jj * c_cs];
+											c_value = accumulate ? c_value + tile[ii * nr + jj] : tile[ii * nr + jj];
+										}
+									}
+								}
+							}
+						}
+					}
+				}
+
+				// zero point correction
+#pragma omp for
+				for (int i = 0; i < row_num; ++i)
+				{
+					for (idx_type j = 0; j < n; ++j)
+					{
+						i32 zb = b_zero ? b_zero[b_zero_num == 1 ? 0 : j] : 0;
+						c[i * c_rs + j * c_cs] += k * shifted_zero * zb - zb * row_sum[i] - shifted_zero * col_sum[j];
+					}
+				}
+			}
+		}
+
+		template<typename OT>
+		void requantize_matrix(idx_type m, idx_type n, const i32* acc, idx_type acc_rs, idx_type acc_cs,
+			const i32* bias, const f32* scale, idx_type scale_num, i32 out_zero,
+			OT* out, idx_type out_rs, idx_type out_cs)
+		{
+			if (scale_num != 1 && scale_num != n)
+				throw std::runtime_error("requantize: The number of scales shall be 1 or n.");
+			const double lowest = std::numeric_limits<OT>::min();
+			const double highest = std::numeric_limits<OT>::max();
+			bool parallel = !omp_in_parallel() && static_cast<double>(m) * n >= qgemm_parallel_threshold;
+
+			int row_num = m;
+#pragma omp parallel for if(parallel)
+			for (int i = 0; i < row_num; ++i)
+			{
+				for (idx_type j = 0; j < n; ++j)
+				{
+					i32 value = acc[i * acc_rs + j * acc_cs] + (bias ? bias[j] : 0);
+					double scaled = std::nearbyint(static_cast<double>(value) * scale[scale_num == 1 ? 0 : j]) + out_zero;
+					out[i * out_rs + j * out_cs] = static_cast<OT>(std::min(std::max(scaled, lowest), highest));
+				}
+			}
+		}
+
+		template<typename AT>
+		std::shared_ptr<Tensor<i32>> qmatmul(const Tensor<AT>& a, i32 a_zero, const Tensor<i8>& b, const std::vector<i32>& b_zero)
+		{
+			if (a.ndimension() != 2 || b.ndimension() != 2)
+				throw std::runtime_error("qmatmul: Two parameters shall be matrix (2D).");
+			if (a.size(1) != b.size(0))
+				throw std::runtime_error("qmatmul: Dimension 1 of the first matrix shall be equal to dimension 0 of the second matrix.");
+			idx_type m = a.size(0), n = b.size(1), k = a.size(1);
+			std::shared_ptr<Tensor<i32>> result(new Tensor<i32>(DimVector({ m, n })));
+			qgemm(m, n, k, a.data_ptr() + a.offset(), a.stride(0), a.stride(1), a_zero,
+				b.data_ptr() + b.offset(), b.stride(0), b.stride(1), b_zero.data(), static_cast<idx_type>(b_zero.size()),
+				result->data_ptr(), n, 1);
+			return result;
+		}
+
+		// pointer to the first element when the elements are laid out densely in row-major order
+		template<typename T>
+		const T* dense_data(const Tensor<T>& t)
+		{
+			idx_type expected = 1;
+			for (idx_type i = t.ndimension() - 1; i >= 0; --i)
+			{
+				if (t.size(i) != 1 && t.stride(i) != expected)
+					return nullptr;
+				expected *= t.size(i);
+			}
+			return t.data_ptr() + t.offset();
+		}
+
+		// out[i] = f(t[i]) over the elements of t in row-major order
+		template<typename T, typename OT, typename F>
+		void map_elements(const Tensor<T>& t, OT* out, F f)
+		{
+			idx_type total = t.size().flat_size();
+			const T* dense = dense_data(t);
+			if (dense)
+			{
+				bool parallel = !omp_in_parallel() && total >= qgemm_parallel_threshold;
+#pragma omp parallel for if(parallel)
+				for (int i = 0; i < total; ++i)
+					out[i] = f(dense[i]);
+				return;
+			}
+
+			idx_type dims = t.ndimension();
+			std::vector<idx_type> index(dims, 0);
+			const T* base = t.data_ptr() + t.offset();
+			for (idx_type i = 0; i < total; ++i)
+			{
+				idx_type pos = 0;
+				for (idx_type d = 0; d < dims; ++d)
+					pos += index[d] * t.stride(d);
+				out[i] = f(base[pos]);
+				for (idx_type d = dims - 1; d >= 0; --d)
+				{
+					if (++index[d] < t.size(d))
+						break;
+					index[d] = 0;
+				}
+			}
+		}
+
+		// runs qgemm for y = x * w^T and hands the [rows, out] accumulator to finish
+		template<typename F>
+		void qlinear_accumulate(const Tensor<u8>& x, i32 x_zero, const Tensor<i8>& w, F finish)
+		{
+			if (w.ndimension() != 2)
+				throw std::runtime_error("qlinear: The weight shall be matrix (2D).");
+			if (x.ndimension() < 1 || x.size(x.ndimension() - 1) != w.size(1))
+				throw std::runtime_error("qlinear: The last dimension of the input shall be equal to dimension 1 of the weight.");
+
+			idx_type k = w.size(1), n = w.size(0);
+			idx_type m = k > 0 ? x.size().flat_size() / k : 0;
+			std::vector<u8> x_copy;
+			const u8* a = dense_data(x);
+			idx_type a_rs = k, a_cs = 1;
+			if (!a && x.ndimension() == 2)
+			{
+				a = x.data_ptr() + x.offset();
+				a_rs = x.stride(0);
+				a_cs = x.stride(1);
+			}
+			else if (!a)
+			{
+				x_copy.resize(x.size().flat_size());
+				map_elements(x, x_copy.data(), [](u8 v) { return v; });
+				a = x_copy.data();
+			}
+
+			std::vector<i32> acc(static_cast<std::size_t>(m) * n);
+			const i8* w_data = w.data_ptr() + w.offset();
+			if (m <= qlinear_gemv_rows && a_cs == 1 && w.stride(1) == 1)
+			{
+				// a few rows: packing the whole weight would cost more than the products,
+				// dot products with the contiguous weight rows instead
+				const QDotFunction dot = select_qdot();
+				std::vector<u8> ones(k, 1);
+				bool parallel = !omp_in_parallel() && static_cast<double>(m) * n * k >= qgemm_parallel_threshold;
+				int col_num = n;
+#pragma omp parallel for if(parallel)
+				for (int j = 0; j < col_num; ++j)
+				{
+					const i8* w_row = w_data + j * w.stride(0);
+					i32 w_sum = dot(ones.data(), w_row, k);
+					for (idx_type i = 0; i < m; ++i)
+						acc[i * n + j] = dot(a + i * a_rs, w_row, k) - x_zero * w_sum;
+				}
+			}
+			else
+			{
+				const i32 w_zero = 0;
+				qgemm(m, n, k, a, a_rs, a_cs, x_zero, w_data, w.stride(1), w.stride(0), &w_zero, 1, acc.data(), n, 1);
+			}
+
+			DimVector result_dim = x.size();
+			result_dim[result_dim.size() - 1] = n;
+			finish(m, n, acc.data(), result_dim);
+		}
+	}
+
+	void qgemm(idx_type m, idx_type n, idx_type k,
+		const u8* a, idx_type a_rs, idx_type a_cs, i32 a_zero,
+		const i8* b, idx_type b_rs, idx_type b_cs, const i32* b_zero, idx_type b_zero_num,
+		i32* c, idx_type c_rs, idx_type c_cs)
+	{
+		qgemm_impl(m, n, k, a, a_rs, a_cs, a_zero, b, b_rs, b_cs, b_zero, b_zero_num, c, c_rs, c_cs);
+	}
+
+	void qgemm(idx_type m, idx_type n, idx_type k,
+		const i8* a, idx_type a_rs, idx_type a_cs, i32 a_zero,
+		const i8* b, idx_type b_rs, idx_type b_cs, const i32* b_zero, idx_type b_zero_num,
+		i32* c, idx_type c_rs, idx_type c_cs)
+	{
+		qgemm_impl(m, n, k, a, a_rs, a_cs, a_zero, b, b_rs, b_cs, b_zero, b_zero_num, c, c_rs, c_cs);
+	}
+
+	void requantize(idx_type m, idx_type n, const i32* acc, idx_type acc_rs, idx_type acc_cs,
+		const i32* bias, const f32* scale, idx_type scale_num, i32 out_zero,
+		i8* out, idx_type out_rs, idx_type out_cs)
+	{
+		requantize_matrix(m, n, acc, acc_rs, acc_cs, bias, scale, scale_num, out_zero, out, out_rs, out_cs);
+	}
+
+	void requantize(idx_type m, idx_type n, const i32* acc, idx_type acc_rs, idx_type acc_cs,
+		const i32* bias, const f32* scale, idx_type scale_num, i32 out_zero,
+		u8* out, idx_type out_rs, idx_type out_cs)
+	{
+		requantize_matrix(m, n, acc, acc_rs, acc_cs, bias, scale, scale_num, out_zero, out, out_rs, out_cs);
+	}
+
+	std::shared_ptr<Tensor<i32>> qmatmul_impl(const Tensor<u8>& a, i32 a_zero, const Tensor<i8>& b, const std::vector<i32>& b_zero)
+	{
+		return qmatmul(a, a_zero, b, b_zero);
+	}
+
+	std::shared_ptr<Tensor<i32>> qmatmul_impl(const Tensor<i8>& a, i32 a_zero, const Tensor<i8>& b, const std::vector<i32>& b_zero)
+	{
+		return qmatmul(a, a_zero, b, b_zero);
+	}
+
+	std::shared_ptr<Tensor<i8>> requantize_impl(const Tensor<i32>& acc, const std::vector<f32>& scale, i32 out_zero)
+	{
+		if (acc.ndimension() != 2)
+			throw std::runtime_error("requantize: The accumulator shall be matrix (2D).");
+		idx_type m = acc.size(0), n = acc.size(1);
+		std::shared_ptr<Tensor<i8>> result(new Tensor<i8>(DimVector({ m, n })));
+		requantize(m, n, acc.data_ptr() + acc.offset(), acc.stride(0), acc.stride(1),
+			nullptr, scale.data(), static_cast<idx_type>(scale.size()), out_zero,
+			result->data_ptr(), n, 1);
+		return result;
+	}
+
+	std::shared_ptr<Tensor<u8>> quantize_impl(const Tensor<f32>& x, f32 scale, i32 zero)
+	{
+		std::shared_ptr<Tensor<u8>> result(new Tensor<u8>(x.size()));
+		const f32 inv_scale = 1.f / scale;
+		map_elements(x, result->data_ptr(), [inv_scale, zero](f32 v) {
+			f32 q = std::nearbyint(v * inv_scale) + zero;
+			return static_cast<u8>(std::min(std::max(q, 0.f), 255.f));
+		});
+		return result;
+	}
+
+	std::shared_ptr<Tensor<f32>> dequantize_impl(const Tensor<u8>& q, f32 scale, i32 zero)
+	{
+		std::shared_ptr<Tensor<f32>> result(new Tensor<f32>(q.size()));
+		map_elements(q, result->data_ptr(), [scale, zero](u8 v) {
+			return (static_cast<i32>(v) - zero) * scale;
+		});
+		return result;
+	}
+
+	std::shared_ptr<Tensor<i8>> quantize_per_channel_impl(const Tensor<f32>& w, std::vector<f32>& scale)
+	{
+		if (w.ndimension() != 2)
+			throw std::runtime_error("quantize_per_channel: The weight shall be matrix (2D).");
+		idx_type rows = w.size(0), cols = w.size(1);
+		std::shared_ptr<Tensor<i8>> result(new Tensor<i8>(w.size()));
+		scale.assign(rows, 1.f);
+		const f32* data = w.data_ptr() + w.offset();
+		i8* out = result->data_ptr();
+		for (idx_type i = 0; i < rows; ++i)
+		{
+			f32 max_abs = 0.f;
+			for (idx_type j = 0; j < cols; ++j)
+				max_abs = std::max(max_abs, std::abs(data[i * w.stride(0) + j * w.stride(1)]));
+			// [-127, 127] keeps the range symmetric, an all zero row keeps scale 1
+			if (max_abs > 0.f)
+				scale[i] = max_abs / 127.f;
+			for (idx_type j = 0; j < cols; ++j)
+			{
+				f32 q = std::nearbyint(data[i * w.stride(0) + j * w.stride(1)] / scale[i]);
+				out[i * cols + j] = static_cast<i8>(std::min(std::max(q, -127.f), 127.f));
+			}
+		}
+		return result;
+	}
+
+	std::shared_ptr<Tensor<u8>> qlinear_impl(const Tensor<u8>& x, i32 x_zero, const Tensor<i8>& w,
+		const std::vector<i32>& bias, const std::vector<f32>& acc_scale, i32 y_zero)
+	{
+		if (!bias.empty() && static_cast<idx_type>(bias.size()) != w.size(0))
+			throw std::runtime_error("qlinear: The bias shall have one value per output channel.");
+		std::shared_ptr<Tensor<u8>> result;
+		qlinear_accumulate(x, x_zero, w, [&](idx_type m, idx_type n, const i32* acc, const DimVector& result_dim) {
+			result.reset(new Tensor<u8>(result_dim));
+			requantize(m, n, acc, n, 1, bias.empty() ? nullptr : bias.data(),
+				acc_scale.data(), static_cast<idx_type>(acc_scale.size()), y_zero, result->data_ptr(), n, 1);
+		});
+		return result;
+	}
+
+	std::shared_ptr<Tensor<f32>> qlinear_dequantize_impl(const Tensor<u8>& x, i32 x_zero, const Tensor<i8>& w,
+		const std::vector<f32>& bias, const std::vector<f32>& acc_scale)
+	{
+		if (!bias.empty() && static_cast<idx_type>(bias.size()) != w.size(0))
+			throw std::runtime_error("qlinear: The bias shall have one value per output channel.");
+		if (acc_scale.size() != 1 && static_cast<idx_type>(acc_scale.size()) != w.size(0))
+			throw std::runtime_error("qlinear: The number of scales shall be 1 or out.");
+		std::shared_ptr<Tensor<f32>> result;
+		qlinear_accumulate(x, x_zero, w, [&](idx_type m, idx_type n, const i32* acc, const DimVector& result_dim) {
+			result.reset(new Tensor<f32>(result_dim));
+			f32* out = result->data_ptr();
+			bool parallel = !omp_in_parallel() && static_cast<double>(m) * n >= qgemm_parallel_threshold;
+			int row_num = m;
+#pragma omp parallel for if(parallel)
+			for (int i = 0; i < row_num; ++i)
+			{
+				for (idx_type j = 0; j < n; ++j)
+				{
+					f32 value = acc[i * n + j] * acc_scale[acc_scale.size() == 1 ? 0 : j];
+					out[i * n + j] = bias.empty() ? value : value + bias[j];
+				}
+			}
+		});
+		return result;
+	}
+}
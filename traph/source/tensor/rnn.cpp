@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/rnn.h>
+#include <traph/tensor/blas.h>
+
+#include "strided.h"
+
+// A layer written with matmul and add per step runs a handful of small operations and
+// allocations every step. Here the input projection x_t W_ih^T + b of all steps is one gemm
+// into the gate buffer, and each step adds h_{t-1} W_hh^T to its rows with one more gemm and
+// then applies the activations and the state update in one pass over the gates, in place.
+// The gate buffer then holds the activations, which is all the backward pass needs besides
+// the states. The backward pass walks the steps in reverse once, writing the gradients of
+// the gate pre-activations of every step; only the gradient of h_{t-1} is a gemm per step,
+// the gradients of the weights and the input are gemms over all steps at the end.
+
+namespace traph
+{
+	namespace
+	{
+		// below this many gate elements per step the update runs on the calling thread, each
+		// of them costs an exp or a tanh
+		const double rnn_parallel_threshold = 16384.0;
+
+		void rnn_error(const std::string& message)
+		{
+			throw std::runtime_error("rnn: " + message + ".");
+		}
+
+		template<typename T>
+		T sigmoid(T x)
+		{
+			return T(1) / (T(1) + std::exp(-x));
+		}
+
+		template<typename T>
+		void gemm(idx_type m, idx_type n, idx_type k,
+			const T* a, idx_type a_rs, idx_type a_cs,
+			const T* b, idx_type b_rs, idx_type b_cs,
+			T beta, T* c, idx_type c_rs, idx_type c_cs)
+		{
+			BlasRegistry::get().gemm(m, n, k, T(1), a, a_rs, a_cs, b, b_rs, b_cs, beta, c, c_rs, c_cs);
+		}
+
+		struct RnnShape
+		{
+			idx_type steps, batch, input, hidden, gates;
+
+			idx_type width() const { return gates * hidden; }
+			idx_type rows() const { return steps * batch; }
+			bool parallel() const
+			{
+				return !omp_in_parallel() && omp_get_max_threads() > 1 && batch > 1 &&
+					static_cast<double>(batch) * width() >= rnn_parallel_threshold;
+			}
+		};
+
+		template<typename T>
+		RnnShape rnn_shape(RnnMode mode, const Tensor<T>& input, const Tensor<T>& w_ih, const Tensor<T>& w_hh)
+		{
+			if (input.ndimension() != 3)
+				rnn_error("The input shall be [T, B, I]");
+			if (w_ih.ndimension() != 2 || w_hh.ndimension() != 2)
+				rnn_error("The weights shall be 2-D");
+			RnnShape s;
+			s.steps = input.size(0);
+			s.batch = input.size(1);
+			s.input = input.size(2);
+			s.hidden = w_hh.size(1);
+			s.gates = rnn_gates(mode);
+			if (s.steps < 1 || s.batch < 1 || s.input < 1 || s.hidden < 1)
+				rnn_error("The input and the hidden state shall not be empty");
+			if (w_hh.size(0) != s.width() || w_ih.size(0) != s.width() || w_ih.size(1) != s.input)
+				rnn_error("The weights shall be [G * H, I] and [G * H, H]");
+			return s;
+		}
+
+		template<typename T>
+		void check_size(const Tensor<T>* t, const DimVector& size, const char* message)
+		{
+			if (t && t->size() != size)
+				rnn_error(message);
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> state_copy(const Tensor<T>* t, idx_type batch, idx_type hidden)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ batch, hidden })));
+			T* y = result->data_ptr();
+			if (!t)
+			{
+				std::fill(y, y + batch * hidden, T(0));
+				return result;
+			}
+			std::vector<T> copy;
+			const T* x = contiguous(*t, copy);
+			std::copy(x, x + batch * hidden, y);
+			return result;
+		}
+
+		// adds a 1-D vector of any stride to values[begin, end)
+		template<typename T>
+		void add_bias(std::vector<T>& values, const Tensor<T>* bias, idx_type begin, idx_type end)
+		{
+			if (!bias)
+				return;
+			const T* b = bias->data_ptr() + bias->offset();
+			for (idx_type j = begin; j < end; ++j)
+				values[j] += b[j * bias->stride(0)];
+		}
+
+		// gates [B, 4H] from pre-activations to activations, and the new states
+		template<typename T>
+		void lstm_step(const RnnShape& s, T* gates, const T* c_prev, T* c, T* h)
+		{
+			idx_type hidden = s.hidden;
+			idx_type width = s.width();
+			bool parallel = s.parallel();
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int b = 0; b < s.batch; ++b)
+			{
+				T* g = gates + static_cast<std::size_t>(b) * width;
+				const T* cp = c_prev + static_cast<std::size_t>(b) * hidden;
+				T* cb = c + static_cast<std::size_t>(b) * hidden;
+				T* hb = h + static_cast<std::size_t>(b) * hidden;
+				for (idx_type j = 0; j < hidden; ++j)
+				{
+					T i = sigmoid(g[j]);
+					T f = sigmoid(g[hidden + j]);
+					T n = std::tanh(g[2 * hidden + j]);
+					T o = sigmoid(g[3 * hidden + j]);
+					g[j] = i;
+					g[hidden + j] = f;
+					g[2 * hidden + j] = n;
+					g[3 * hidden + j] = o;
+					T cell = f * cp[j] + i * n;
+					cb[j] = cell;
+					hb[j] = o * std::tanh(cell);
+				}
+			}
+		}
+
+		// gates [B, 3H] with the input part of the new gate, candidates [B, H] W_hn h_{t-1}
+		template<typename T>
+		void gru_step(const RnnShape& s, T* gates, T* candidates, const T* b_hn, const T* h_prev, T* h)
+		{
+			idx_type hidden = s.hidden;
+			idx_type width = s.width();
+			bool parallel = s.parallel();
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int b = 0; b < s.batch; ++b)
+			{
+				T* g = gates + static_cast<std::size_t>(b) * width;
+				T* cand = candidates + static_cast<std::size_t>(b) * hidden;
+				const T* hp = h_prev + static_cast<std::size_t>(b) * hidden;
+				T* hb = h + static_cast<std::size_t>(b) * hidden;
+				for (idx_type j = 0; j < hidden; ++j)
+				{
+					T r = sigmoid(g[j]);
+					T z = sigmoid(g[hidden + j]);
+					cand[j] += b_hn[j];
+					T n = std::tanh(g[2 * hidden + j] + r * cand[j]);
+					g[j] = r;
+					g[hidden + j] = z;
+					g[2 * hidden + j] = n;
+					hb[j] = (1 - z) * n + z * hp[j];
+				}
+			}
+		}
+
+		template<typename T>
+		std::shared_ptr<Tensor<T>> rnn_forward(RnnMode mode, const Tensor<T>& input,
+			const Tensor<T>& w_ih, const Tensor<T>& w_hh, const Tensor<T>* b_ih, const Tensor<T>* b_hh,
+			const Tensor<T>* h0, const Tensor<T>* c0, RnnState<T>& state)
+		{
+			RnnShape s = rnn_shape(mode, input, w_ih, w_hh);
+			bool lstm = mode == RnnMode::LSTM;
+			idx_type hidden = s.hidden;
+			idx_type width = s.width();
+			check_size(b_ih, DimVector({ width }), "The biases shall be [G * H]");
+			check_size(b_hh, DimVector({ width }), "The biases shall be [G * H]");
+			check_size(h0, DimVector({ s.batch, hidden }), "The initial states shall be [B, H]");
+			check_size(c0, DimVector({ s.batch, hidden }), "The initial states shall be [B, H]");
+			if (c0 && !lstm)
+				rnn_error("Only LSTM has a cell state");
+
+			// b_ih and b_hh are added to the projection, except for the hidden part of the GRU
+			// new gate that the reset gate multiplies
+			idx_type folded = lstm ? width : 2 * hidden;
+			std::vector<T> bias(width, T(0));
+			add_bias(bias, b_ih, 0, width);
+			add_bias(bias, b_hh, 0, folded);
+			std::vector<T> b_hn(hidden, T(0));
+			if (b_hh)
+			{
+				const T* b = b_hh->data_ptr() + b_hh->offset();
+				for (idx_type j = 0; j < hidden; ++j)
+					b_hn[j] = b[(folded + j) * b_hh->stride(0)];
+			}
+
+			state.gates = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.steps, s.batch, width })));
+			T* gates = state.gates->data_ptr();
+			for (idx_type row = 0; row < s.rows(); ++row)
+				std::copy(bias.begin(), bias.end(), gates + static_cast<std::size_t>(row) * width);
+			std::vector<T> input_copy;
+			const T* x = contiguous(input, input_copy);
+			gemm(s.rows(), width, s.input, x, s.input, 1,
+				w_ih.data_ptr() + w_ih.offset(), w_ih.stride(1), w_ih.stride(0), T(1), gates, width, 1);
+
+			state.h0 = state_copy(h0, s.batch, hidden);
+			state.c0 = lstm ? state_copy(c0, s.batch, hidden) : nullptr;
+			state.cells = lstm ? std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.steps, s.batch, hidden }))) : nullptr;
+			state.candidates = lstm ? nullptr : std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.steps, s.batch, hidden })));
+
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ s.steps, s.batch, hidden })));
+			T* y = result->data_ptr();
+			const T* w = w_hh.data_ptr() + w_hh.offset();
+			std::size_t state_size = static_cast<std::size_t>(s.batch) * hidden;
+			for (idx_type t = 0; t < s.steps; ++t)
+			{
+				const T* h_prev = t == 0 ? state.h0->data_ptr() : y + (t - 1) * state_size;
+				T* g = gates + t * state_size * s.gates;
+				T* h = y + t * state_size;
+				if (lstm)
+				{
+					T* cells = state.cells->data_ptr();
+					const T* c_prev = t == 0 ? state.c0->data_ptr() : cells + (t - 1) * state_size;
+					gemm(s.batch, width, hidden, h_prev, hidden, 1, w, w_hh.stride(1), w_hh.stride(0), T(1), g, width, 1);
+					lstm_step(s, g, c_prev, cells + t * state_size, h);
+				}
+				else
+				{
+					T* cand = state.candidates->data_ptr() + t * state_size;
+					gemm(s.batch, 2 * hidden, hidden, h_prev, hidden, 1, w, w_hh.stride(1), w_hh.stride(0), T(1), g, width, 1);
+					gemm(s.batch, hidden, hidden, h_prev, hidden, 1, w + 2 * hidden * w_hh.stride(0), w_hh.stride(1), w_hh.stride(0), T(0), cand, hidden, 1);
+					gru_step(s, g, cand, b_hn.data(), h_prev, h);
+				}
+			}
+
+			state.h_n = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.batch, hidden })));
+			std::copy(y + (s.steps - 1) * state_size, y + s.steps * state_size, state.h_n->data_ptr());
+			if (lstm)
+			{
+				state.c_n = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.batch, hidden })));
+				const T* cells = state.cells->data_ptr();
+				std::copy(cells + (s.steps - 1) * state_size, cells + s.steps * state_size, state.c_n->data_ptr());
+			}
+			return result;
+		}
+
+		// Gradients of the gate pre-activations of one step, from the gradient of the output dy,
+		// the gradient of h_t from the later steps dh and of c_t dc. dc becomes that of c_{t-1}.
+		template<typename T>
+		void lstm_step_backward(const RnnShape& s, const T* gates, const T* c_prev, const T* c,
+			const T* dy, const T* dh, T* dc, T* dgates)
+		{
+			idx_type hidden = s.hidden;
+			idx_type width = s.width();
+			bool parallel = s.parallel();
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int b = 0; b < s.batch; ++b)
+			{
+				std::size_t state_offset = static_cast<std::size_t>(b) * hidden;
+				const T* g = gates + static_cast<std::size_t>(b) * width;
+				T* dg = dgates + static_cast<std::size_t>(b) * width;
+				for (idx_type j = 0; j < hidden; ++j)
+				{
+					T i = g[j], f = g[hidden + j], n = g[2 * hidden + j], o = g[3 * hidden + j];
+					T tanh_c = std::tanh(c[state_offset + j]);
+					T dh_t = dy[state_offset + j] + dh[state_offset + j];
+					T dcell = dc[state_offset + j] + dh_t * o * (1 - tanh_c * tanh_c);
+					dg[j] = dcell * n * i * (1 - i);
+					dg[hidden + j] = dcell * c_prev[state_offset + j] * f * (1 - f);
+					dg[2 * hidden + j] = dcell * i * (1 - n * n);
+					dg[3 * hidden + j] = dh_t * tanh_c * o * (1 - o);
+					dc[state_offset + j] = dcell * f;
+				}
+			}
+		}
+
+		// dx_gates are the gradients of the input projection and dh_gates those of h_{t-1} W_hh^T
+		// + b_hh, which differ in the new gate. dh becomes the part of the gradient of h_{t-1}
+		// that does not go through W_hh.
+		template<typename T>
+		void gru_step_backward(const RnnShape& s, const T* gates, const T* candidates, const T* h_prev,
+			const T* dy, T* dh, T* dx_gates, T* dh_gates)
+		{
+			idx_type hidden = s.hidden;
+			idx_type width = s.width();
+			bool parallel = s.parallel();
+#pragma omp parallel for schedule(static) if(parallel)
+			for (int b = 0; b < s.batch; ++b)
+			{
+				std::size_t state_offset = static_cast<std::size_t>(b) * hidden;
+				const T* g = gates + static_cast<std::size_t>(b) * width;
+				T* dxg = dx_gates + static_cast<std::size_t>(b) * width;
+				T* dhg = dh_gates + static_cast<std::size_t>(b) * width;
+				for (idx_type j = 0; j < hidden; ++j)
+				{
+					T r = g[j], z = g[hidden + j], n = g[2 * hidden + j];
+					T dh_t = dy[state_offset + j] + dh[state_offset + j];
+					T dn = dh_t * (1 - z) * (1 - n * n);
+					T dz = dh_t * (h_prev[state_offset + j] - n) * z * (1 - z);
+					T dr = dn * candidates[state_offset + j] * r * (1 - r);
+					dxg[j] = dhg[j] = dr;
+					dxg[hidden + j] = dhg[hidden + j] = dz;
+					dxg[2 * hidden + j] = dn;
+					dhg[2 * hidden + j] = dn * r;
+					dh[state_offset + j] = dh_t * z;
+				}
+			}
+		}
+
+		// [rows, width] column sums
+		template<typename T>
+		std::shared_ptr<Tensor<T>> column_sums(const T* x, idx_type rows, idx_type width)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(DimVector({ width })));
+			T* y = result->data_ptr();
+			std::fill(y, y + width, T(0));
+			for (idx_type row = 0; row < rows; ++row)
+			{
+				const T* xr = x + static_cast<std::size_t>(row) * width;
+				for (idx_type j = 0; j < width; ++j)
+					y[j] += xr[j];
+			}
+			return result;
+		}
+
+		template<typename T>
+		RnnGrads<T> rnn_backward(RnnMode mode, const Tensor<T>& grad, const Tensor<T>& input,
+			const Tensor<T>& output, const Tensor<T>& w_ih, const Tensor<T>& w_hh, const RnnState<T>& state,
+			const Tensor<T>* grad_h_n, const Tensor<T>* grad_c_n)
+		{
+			RnnShape s = rnn_shape(mode, input, w_ih, w_hh);
+			bool lstm = mode == RnnMode::LSTM;
+			idx_type hidden = s.hidden;
+			idx_type width = s.width();
+			DimVector output_size({ s.steps, s.batch, hidden });
+			if (grad.size() != output_size || output.size() != output_size)
+				rnn_error("The output and its gradient shall be [T, B, H]");
+			if (!state.gates || state.gates->size() != DimVector({ s.steps, s.batch, width }) || !state.h0 ||
+				(lstm && (!state.cells || !state.c0)) || (!lstm && !state.candidates))
+				rnn_error("The state shall come from the forward pass of this layer");
+			DimVector state_dim({ s.batch, hidden });
+			if ((grad_h_n && grad_h_n->size() != state_dim) || (grad_c_n && grad_c_n->size() != state_dim))
+				rnn_error("The gradients of the final states shall be [B, H]");
+			if (grad_c_n && !lstm)
+				rnn_error("Only LSTM layers have a final cell state");
+
+			std::vector<T> input_copy, grad_copy, output_copy;
+			const T* x = contiguous(input, input_copy);
+			const T* dy = contiguous(grad, grad_copy);
+			const T* y = contiguous(output, output_copy);
+			const T* gates = state.gates->data_ptr();
+			const T* w = w_hh.data_ptr() + w_hh.offset();
+			std::size_t state_size = static_cast<std::size_t>(s.batch) * hidden;
+			std::size_t gates_size = state_size * s.gates;
+
+			std::vector<T> dx_gates(static_cast<std::size_t>(s.rows()) * width);
+			std::vector<T> gru_dh_gates(lstm ? 0 : dx_gates.size());
+			T* dh_gates = lstm ? dx_gates.data() : gru_dh_gates.data();
+			// the gradients of h_n and c_n start the carried gradients of the last step
+			std::vector<T> dh(state_size, T(0));
+			std::vector<T> dc(lstm ? state_size : 0, T(0));
+			std::vector<T> state_copy;
+			if (grad_h_n)
+			{
+				const T* g = contiguous(*grad_h_n, state_copy);
+				std::copy(g, g + state_size, dh.begin());
+			}
+			if (grad_c_n)
+			{
+				const T* g = contiguous(*grad_c_n, state_copy);
+				std::copy(g, g + state_size, dc.begin());
+			}
+
+			for (idx_type t = s.steps - 1; t >= 0; --t)
+			{
+				const T* g = gates + t * gates_size;
+				T* dg = dx_gates.data() + t * gates_size;
+				if (lstm)
+				{
+					const T* cells = state.cells->data_ptr();
+					const T* c_prev = t == 0 ? state.c0->data_ptr() : cells + (t - 1) * state_size;
+					lstm_step_backward(s, g, c_prev, cells + t * state_size, dy + t * state_size, dh.data(), dc.data(), dg);
+					gemm(s.batch, hidden, width, dg, width, 1, w, w_hh.stride(0), w_hh.stride(1), T(0), dh.data(), hidden, 1);
+				}
+				else
+				{
+					const T* h_prev = t == 0 ? state.h0->data_ptr() : y + (t - 1) * state_size;
+					T* dhg = dh_gates + t * gates_size;
+					gru_step_backward(s, g, state.candidates->data_ptr() + t * state_size, h_prev, dy + t * state_size, dh.data(), dg, dhg);
+					gemm(s.batch, hidden, width, dhg, width, 1, w, w_hh.stride(0), w_hh.stride(1), T(1), dh.data(), hidden, 1);
+				}
+			}
+
+			RnnGrads<T> grads;
+			grads.input = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.steps, s.batch, s.input })));
+			gemm(s.rows(), s.input, width, dx_gates.data(), width, 1,
+				w_ih.data_ptr() + w_ih.offset(), w_ih.stride(0), w_ih.stride(1), T(0), grads.input->data_ptr(), s.input, 1);
+			grads.w_ih = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ width, s.input })));
+			gemm(width, s.input, s.rows(), dx_gates.data(), 1, width, x, s.input, 1, T(0), grads.w_ih->data_ptr(), s.input, 1);
+
+			// h_{t-1} is h0 for the first step and the output of the step before for the others
+			grads.w_hh = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ width, hidden })));
+			gemm(width, hidden, s.batch, dh_gates, 1, width, state.h0->data_ptr(), hidden, 1, T(0), grads.w_hh->data_ptr(), hidden, 1);
+			if (s.steps > 1)
+				gemm(width, hidden, s.rows() - s.batch, dh_gates + gates_size, 1, width, y, hidden, 1, T(1), grads.w_hh->data_ptr(), hidden, 1);
+
+			grads.b_ih = column_sums(dx_gates.data(), s.rows(), width);
+			grads.b_hh = lstm ? grads.b_ih : column_sums(dh_gates, s.rows(), width);
+			grads.h0 = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.batch, hidden })));
+			std::copy(dh.begin(), dh.end(), grads.h0->data_ptr());
+			if (lstm)
+			{
+				grads.c0 = std::shared_ptr<Tensor<T>>(new Tensor<T>(DimVector({ s.batch, hidden })));
+				std::copy(dc.begin(), dc.end(), grads.c0->data_ptr());
+			}
+			return grads;
+		}
+	}
+
+	idx_type rnn_gates(RnnMode mode)
+	{
+		return mode == RnnMode::LSTM ? 4 : 3;
+	}
+
+	std::shared_ptr<Tensor<f32>> rnn_forward_impl(RnnMode mode, const Tensor<f32>& input,
+		const Tensor<f32>& w_ih, const Tensor<f32>& w_hh, const Tensor<f32>* b_ih, const Tensor<f32>* b_hh,
+		const Tensor<f32>* h0, const Tensor<f32>* c0, RnnState<f32>& state)
+	{
+		return rnn_forward(mode, input, w_ih, w_hh, b_ih, b_hh, h0, c0, state);
+	}
+
+	std::shared_ptr<Tensor<f64>> rnn_forward_impl(RnnMode mode, const Tensor<f64>& input,
+		const Tensor<f64>& w_ih, const Tensor<f64>& w_hh, const Tensor<f64>* b_ih, const Tensor<f64>* b_hh,
+		const Tensor<f64>* h0, const Tensor<f64>* c0, RnnState<f64>& state)
+	{
+		return rnn_forward(mode, input, w_ih, w_hh, b_ih, b_hh, h0, c0, state);
+	}
+
+	RnnGrads<f32> rnn_backward_impl(RnnMode mode, const Tensor<f32>& grad, const Tensor<f32>& input,
+		const Tensor<f32>& output, const Tensor<f32>& w_ih, const Tensor<f32>& w_hh, const RnnState<f32>& state,
+		const Tensor<f32>* grad_h_n, const Tensor<f32>* grad_c_n)
+	{
+		return rnn_backward(mode, grad, input, output, w_ih, w_hh, state, grad_h_n, grad_c_n);
+	}
+
+	RnnGrads<f64> rnn_backward_impl(RnnMode mode, const Tensor<f64>& grad, const Tensor<f64>& input,
+		const Tensor<f64>& output, const Tensor<f64>& w_ih, const Tensor<f64>& w_hh, const RnnState<f64>& state,
+		const Tensor<f64>* grad_h_n, const Tensor<f64>* grad_c_n)
+	{
+		return rnn_backward(mode, grad, input, output, w_ih, w_hh, state, grad_h_n, grad_c_n);
+	}
+}
@@ -0,0 +1,398 @@
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <omp.h>
+
+#include <traph/tensor/tensor.h>
+#include <traph/tensor/scan.h>
+
+namespace traph
+{
+	namespace
+	{
+		// lines shorter than this are scanned by a single thread
+		const idx_type scan_block_threshold = 1 << 14;
+		// number of lanes handled by one task when the scanned dimension is not innermost
+		const idx_type scan_lane_chunk = 256;
+		// do not fork threads for tiny tensors
+		const idx_type scan_parallel_threshold = 1 << 15;
+
+		struct ScanSum
+		{
+			template<typename T>
+			T operator()(T a, T b) const { return a + b; }
+		};
+
+		struct ScanProd
+		{
+			template<typename T>
+			T operator()(T a, T b) const { return a * b; }
+		};
+
+		struct ScanMax
+		{
+			template<typename T>
+			T operator()(T a, T b) const { return b > a ? b : a; }
+		};
+
+		// split a strided tensor into outer x axis x inner, where axis is the scanned dimension
+		struct LineGeometry
+		{
+			idx_type outer;
+			idx_type axis;
+			idx_type inner;
+			idx_type axis_stride;
+			bool inner_packed;
+			std::vector<idx_type> outer_offsets;
+			std::vector<idx_type> inner_offsets;
+
+			LineGeometry(const DimVector& dims, const DimVector& strides, idx_type offset, idx_type dim)
+				:outer(1), axis(dims[dim]), inner(1), axis_stride(strides[dim]), inner_packed(true)
+			{
+				idx_type dim_num = dims.size();
+				for (idx_type i = 0; i < dim; ++i)
+					outer *= dims[i];
+				for (idx_type i = dim + 1; i < dim_num; ++i)
+					inner *= dims[i];
+
+				outer_offsets.resize(outer);
+				for (idx_type o = 0; o < outer; ++o)
+				{
+					idx_type rest = o;
+					idx_type pos = offset;
+					for (idx_type i = dim - 1; i >= 0; --i)
+					{
+						pos += (rest % dims[i]) * strides[i];
+						rest /= dims[i];
+					}
+					outer_offsets[o] = pos;
+				}
+
+				inner_offsets.resize(inner);
+				for (idx_type n = 0; n < inner; ++n)
+				{
+					idx_type rest = n;
+					idx_type pos = 0;
+					for (idx_type i = dim_num - 1; i > dim; --i)
+					{
+						pos += (rest % dims[i]) * strides[i];
+						rest /= dims[i];
+					}
+					inner_offsets[n] = pos;
+					if (pos != n)
+						inner_packed = false;
+				}
+			}
+		};
+
+		idx_type normalize_dim(idx_type dim, idx_type dim_num)
+		{
+			if (dim < 0)
+				dim += dim_num;
+			if (dim < 0 || dim >= dim_num)
+				throw std::runtime_error("scan: dimension out of range");
+			return dim;
+		}
+
+		// sequential inclusive scan of one line, steps may be negative for reverse scans
+		template<typename T, typename Op>
+		void scan_line(const T* src, idx_type src_step, T* dst, idx_type dst_step, idx_type n, Op op)
+		{
+			T acc = *src;
+			*dst = acc;
+			for (idx_type k = 1; k < n; ++k)
+			{
+				src += src_step;
+				dst += dst_step;
+				acc = op(acc, *src);
+				*dst = acc;
+			}
+		}
+
+		// two-pass blocked scan of one long line (inner == 1), dst is contiguous
+		template<typename T, typename Op>
+		void scan_line_blocked(const T* src, idx_type src_step, T* dst, idx_type dst_step, idx_type n, Op op)
+		{
+			int block_num = std::min<int>(omp_get_max_threads(), n / (scan_block_threshold / 4));
+			if (block_num < 2)
+			{
+				scan_line(src, src_step, dst, dst_step, n, op);
+				return;
+			}
+			idx_type block_len = (n + block_num - 1) / block_num;
+			block_num = (n + block_len - 1) / block_len;
+			std::vector<T> carries(block_num);
+
+			// pass 1: local scans, every block keeps its total
+#pragma omp parallel for
+			for (int b = 0; b < block_num; ++b)
+			{
+				idx_type begin = b * block_len;
+				idx_type len = std::min(block_len, n - begin);
+				scan_line(src + begin * src_step, src_step, dst + begin * dst_step, dst_step, len, op);
+				carries[b] = dst[(begin + len - 1) * dst_step];
+			}
+
+			for (int b = 1; b < block_num; ++b)
+				carries[b] = op(carries[b - 1], carries[b]);
+
+			// pass 2: propagate the carry of all previous blocks
+#pragma omp parallel for
+			for (int b = 1; b < block_num; ++b)
+			{
+				idx_type begin = b * block_len;
+				idx_type len = std::min(block_len, n - begin);
+				T carry = carries[b - 1];
+				T* p = dst + begin * dst_step;
+				for (idx_type k = 0; k < len; ++k)
+				{
+					*p = op(carry, *p);
+					p += dst_step;
+				}
+			}
+		}
+
+		template<typename T, typename Op>
+		std::shared_ptr<Tensor<T>> scan_dim(const Tensor<T>& a, idx_type dim, bool reverse, Op op)
+		{
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(a.size()));
+			if (a.ndimension() == 0 || a.size().flat_size() == 0)
+				return result;
+
+			dim = normalize_dim(dim, a.ndimension());
+			LineGeometry geo(a.size(), a.stride(), a.offset(), dim);
+
+			const T* src = a.data_ptr();
+			T* dst = result->data_ptr();
+			idx_type n = geo.axis;
+			idx_type inner = geo.inner;
+
+			// walk the scanned axis backwards by starting at the end with negative steps
+			idx_type src_step = reverse ? -geo.axis_stride : geo.axis_stride;
+			idx_type dst_step = reverse ? -inner : inner;
+			idx_type src_start = reverse ? (n - 1) * geo.axis_stride : 0;
+			idx_type dst_start = reverse ? (n - 1) * inner : 0;
+			bool parallel = a.size().flat_size() >= scan_parallel_threshold;
+
+			if (inner == 1)
+			{
+				int outer = geo.outer;
+				if (n >= scan_block_threshold && outer < omp_get_max_threads())
+				{
+					for (int o = 0; o < outer; ++o)
+						scan_line_blocked(src + geo.outer_offsets[o] + src_start, src_step,
+							dst + o * n + dst_start, dst_step, n, op);
+				}
+				else
+				{
+#pragma omp parallel for if(parallel)
+					for (int o = 0; o < outer; ++o)
+						scan_line(src + geo.outer_offsets[o] + src_start, src_step,
+							dst + o * n + dst_start, dst_step, n, op);
+				}
+				return result;
+			}
+
+			// the scanned axis is not innermost: every row of inner elements is combined with
+			// the previous row, so the inner elements are independent lanes of one vector scan
+			idx_type chunk_num = (inner + scan_lane_chunk - 1) / scan_lane_chunk;
+			int task_num = geo.outer * chunk_num;
+			const idx_type* inner_offsets = geo.inner_offsets.data();
+			bool packed = geo.inner_packed;
+
+#pragma omp parallel for if(parallel)
+			for (int t = 0; t < task_num; ++t)
+			{
+				idx_type o = t / chunk_num;
+				idx_type lane_begin = (t % chunk_num) * scan_lane_chunk;
+				idx_type lane_end = std::min(lane_begin + scan_lane_chunk, inner);
+
+				const T* src_row = src + geo.outer_offsets[o] + src_start;
+				T* dst_row = dst + o * n * inner + dst_start;
+				const T* prev_row = nullptr;
+
+				for (idx_type k = 0; k < n; ++k)
+				{
+					if (packed)
+					{
+						if (prev_row)
+						{
+#pragma omp simd
+							for (idx_type i = lane_begin; i < lane_end; ++i)
+								dst_row[i] = op(prev_row[i], src_row[i]);
+						}
+						else
+						{
+							for (idx_type i = lane_begin; i < lane_end; ++i)
+								dst_row[i] = src_row[i];
+						}
+					}
+					else
+					{
+						for (idx_type i = lane_begin; i < lane_end; ++i)
+							dst_row[i] = prev_row ? op(prev_row[i], src_row[inner_offsets[i]]) : src_row[inner_offsets[i]];
+					}
+					prev_row = dst_row;
+					src_row += src_step;
+					dst_row += dst_step;
+				}
+			}
+
+			return result;
+		}
+
+		// calls kernel(x, x_step, grad, grad_step, out, out_step, len) for every line along dim
+		template<typename T, typename F>
+		std::shared_ptr<Tensor<T>> scan_backward(const Tensor<T>& grad, const Tensor<T>& input, idx_type dim, F kernel)
+		{
+			if (grad.size() != input.size())
+				throw std::runtime_error("scan backward: grad and input shall have the same shape");
+
+			std::shared_ptr<Tensor<T>> result(new Tensor<T>(input.size()));
+			if (input.ndimension() == 0 || input.size().flat_size() == 0)
+				return result;
+
+			dim = normalize_dim(dim, input.ndimension());
+			LineGeometry input_geo(input.size(), input.stride(), input.offset(), dim);
+			LineGeometry grad_geo(grad.size(), grad.stride(), grad.offset(), dim);
+
+			const T* x = input.data_ptr();
+			const T* g = grad.data_ptr();
+			T* out = result->data_ptr();
+			idx_type n = input_geo.axis;
+			idx_type inner = input_geo.inner;
+			int line_num = input_geo.outer * inner;
+			bool parallel = input.size().flat_size() >= scan_parallel_threshold;
+
+#pragma omp parallel for if(parallel)
+			for (int l = 0; l < line_num; ++l)
+			{
+				idx_type o = l / inner;
+				idx_type i = l % inner;
+				kernel(x + input_geo.outer_offsets[o] + input_geo.inner_offsets[i], input_geo.axis_stride,
+					g + grad_geo.outer_offsets[o] + grad_geo.inner_offsets[i], grad_geo.axis_stride,
+					out + o * n * inner + i, inner, n);
+			}
+
+			return result;
+		}
+	}
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cumsum_impl(const Tensor<T>& a, idx_type dim, bool reverse)
+	{
+		return scan_dim(a, dim, reverse, ScanSum());
+	}
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cumprod_impl(const Tensor<T>& a, idx_type dim, bool reverse)
+	{
+		return scan_dim(a, dim, reverse, ScanProd());
+	}
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cummax_impl(const Tensor<T>& a, idx_type dim, bool reverse)
+	{
+		return scan_dim(a, dim, reverse, ScanMax());
+	}
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cumprod_backward_impl(const Tensor<T>& grad, const Tensor<T>& input, idx_type dim)
+	{
+		return scan_backward(grad, input, dim,
+			[](const T* x, idx_type xs, const T* g, idx_type gs, T* out, idx_type os, idx_type n) {
+			// d y_j / d x_i = prod_{k <= j, k != i} x_k
+			// before the first zero z this is y_j / x_i, after it every gradient is zero
+			idx_type z = n;
+			for (idx_type k = 0; k < n; ++k)
+			{
+				if (x[k * xs] == T(0))
+				{
+					z = k;
+					break;
+				}
+			}
+
+			T prod = T(1);
+			for (idx_type k = 0; k < z; ++k)
+			{
+				prod *= x[k * xs];
+				out[k * os] = prod;
+			}
+			T prod_before_zero = z > 0 ? out[(z - 1) * os] : T(1);
+
+			T acc = T(0);
+			for (idx_type k = z - 1; k >= 0; --k)
+			{
+				acc += g[k * gs] * out[k * os];
+				out[k * os] = acc / x[k * xs];
+			}
+
+			if (z < n)
+			{
+				T partial = prod_before_zero;
+				T sum = g[z * gs] * partial;
+				for (idx_type k = z + 1; k < n; ++k)
+				{
+					partial *= x[k * xs];
+					sum += g[k * gs] * partial;
+					out[k * os] = T(0);
+				}
+				out[z * os] = sum;
+			}
+		});
+	}
+
+	template<typename T>
+	std::shared_ptr<Tensor<T>> cummax_backward_impl(const Tensor<T>& grad, const Tensor<T>& input, idx_type dim)
+	{
+		return scan_backward(grad, input, dim,
+			[](const T* x, idx_type xs, const T* g, idx_type gs, T* out, idx_type os, idx_type n) {
+			// every output position routes its gradient to the latest running maximum
+			idx_type arg = 0;
+			T max_value = x[0];
+			for (idx_type k = 0; k < n; ++k)
+				out[k * os] = T(0);
+			for (idx_type k = 0; k < n; ++k)
+			{
+				if (x[k * xs] >= max_value)
+				{
+					max_value = x[k * xs];
+					arg = k;
+				}
+				out[arg * os] += g[k * gs];
+			}
+		});
+	}
+
+	template std::shared_ptr<Tensor<u8>> cumsum_impl(const Tensor<u8>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i8>> cumsum_impl(const Tensor<i8>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i16>> cumsum_impl(const Tensor<i16>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i32>> cumsum_impl(const Tensor<i32>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i64>> cumsum_impl(const Tensor<i64>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<f32>> cumsum_impl(const Tensor<f32>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<f64>> cumsum_impl(const Tensor<f64>& a, idx_type dim, bool reverse);
+
+	template std::shared_ptr<Tensor<u8>> cumprod_impl(const Tensor<u8>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i8>> cumprod_impl(const Tensor<i8>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i16>> cumprod_impl(const Tensor<i16>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i32>> cumprod_impl(const Tensor<i32>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i64>> cumprod_impl(const Tensor<i64>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<f32>> cumprod_impl(const Tensor<f32>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<f64>> cumprod_impl(const Tensor<f64>& a, idx_type dim, bool reverse);
+
+	template std::shared_ptr<Tensor<u8>> cummax_impl(const Tensor<u8>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i8>> cummax_impl(const Tensor<i8>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i16>> cummax_impl(const Tensor<i16>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i32>> cummax_impl(const Tensor<i32>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<i64>> cummax_impl(const Tensor<i64>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<f32>> cummax_impl(const Tensor<f32>& a, idx_type dim, bool reverse);
+	template std::shared_ptr<Tensor<f64>> cummax_impl(const Tensor<f64>& a, idx_type dim, bool reverse);
+
+	template std::shared_ptr<Tensor<f32>> cumprod_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, idx_type dim);
+	template std::shared_ptr<Tensor<f64>> cumprod_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, idx_type dim);
+
+	template std::shared_ptr<Tensor<f32>> cummax_backward_impl(const Tensor<f32>& grad, const Tensor<f32>& input, idx_type dim);
+	template std::shared_ptr<Tensor<f64>> cummax_backward_impl(const Tensor<f64>& grad, const Tensor<f64>& input, idx_type dim);
+}
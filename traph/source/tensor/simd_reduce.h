@@ -0,0 +1,53 @@
+#ifndef TRAPH_SOURCE_TENSOR_SIMD_REDUCE_H_
+#define TRAPH_SOURCE_TENSOR_SIMD_REDUCE_H_
+
+#include <traph/core/cpu.h>
+#include <traph/core/type.h>
+
+#if defined(TRAPH_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+// Sums of the lanes of avx-512 registers, shared by the kernels of this directory. The
+// lanes are summed in halves through memory: _mm512_reduce_add_* and the casts to 256-bit
+// registers start from undefined vectors that gcc 12 warns are used uninitialized.
+
+namespace traph
+{
+#if defined(TRAPH_ARCH_X86)
+	template<typename T, int N>
+	T horizontal_sum_lanes(T* lanes)
+	{
+		for (int w = N / 2; w > 0; w /= 2)
+			for (int i = 0; i < w; ++i)
+				lanes[i] += lanes[i + w];
+		return lanes[0];
+	}
+
+	TRAPH_TARGET_AVX512
+	inline f32 horizontal_sum_avx512(__m512 v)
+	{
+		alignas(64) f32 lanes[16];
+		_mm512_store_ps(lanes, v);
+		return horizontal_sum_lanes<f32, 16>(lanes);
+	}
+
+	TRAPH_TARGET_AVX512
+	inline f64 horizontal_sum_avx512(__m512d v)
+	{
+		alignas(64) f64 lanes[8];
+		_mm512_store_pd(lanes, v);
+		return horizontal_sum_lanes<f64, 8>(lanes);
+	}
+
+	TRAPH_TARGET_AVX512
+	inline i32 horizontal_sum_avx512(__m512i v)
+	{
+		alignas(64) i32 lanes[16];
+		_mm512_store_si512(lanes, v);
+		return horizontal_sum_lanes<i32, 16>(lanes);
+	}
+#endif
+}
+
+#endif
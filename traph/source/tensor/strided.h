@@ -0,0 +1,61 @@
+#ifndef TRAPH_SOURCE_TENSOR_STRIDED_H_
+#define TRAPH_SOURCE_TENSOR_STRIDED_H_
+
+#include <vector>
+
+#include <traph/tensor/tensor.h>
+
+// Walks over tensors of any strides, shared by the kernels of this directory.
+
+namespace traph
+{
+	// f(i, pos) for the elements of the leading dims dimensions of t in row-major order,
+	// pos the offset of element i in the storage of t
+	template<typename T, typename F>
+	void for_each_offset(const Tensor<T>& t, idx_type dims, F f)
+	{
+		DimVector size = t.size();
+		idx_type count = 1;
+		for (idx_type d = 0; d < dims; ++d)
+			count *= size[d];
+		std::vector<idx_type> counter(dims, 0);
+		idx_type pos = t.offset();
+		for (idx_type i = 0; i < count; ++i)
+		{
+			f(i, pos);
+			for (idx_type d = dims - 1; d >= 0; --d)
+			{
+				pos += t.stride(d);
+				if (++counter[d] < size[d])
+					break;
+				pos -= t.stride(d) * size[d];
+				counter[d] = 0;
+			}
+		}
+	}
+
+	// t in row-major order, in place when it already is
+	template<typename T>
+	const T* contiguous(const Tensor<T>& t, std::vector<T>& copy)
+	{
+		DimVector size = t.size();
+		idx_type nd = static_cast<idx_type>(size.size());
+		bool in_place = true;
+		idx_type expected = 1;
+		for (idx_type d = nd - 1; d >= 0; --d)
+		{
+			if (size[d] != 1 && t.stride(d) != expected)
+				in_place = false;
+			expected *= size[d];
+		}
+		if (in_place)
+			return t.data_ptr() + t.offset();
+
+		const T* data = t.data_ptr();
+		copy.resize(size.flat_size());
+		for_each_offset(t, nd, [&](idx_type i, idx_type pos) { copy[i] = data[pos]; });
+		return copy.data();
+	}
+}
+
+#endif
@@ -2,6 +2,17 @@
 
 namespace traph
 {
+	namespace
+	{
+		DataType data_type(u8) { return DataType::BYTE; }
+		DataType data_type(i8) { return DataType::CHAR; }
+		DataType data_type(i16) { return DataType::SHORT; }
+		DataType data_type(i32) { return DataType::INT; }
+		DataType data_type(i64) { return DataType::LONG; }
+		DataType data_type(f32) { return DataType::FLOAT; }
+		DataType data_type(f64) { return DataType::DOUBLE; }
+	}
+
 	// definition
     // private
     template<typename T>
@@ -117,8 +128,8 @@ namespace traph
     void Tensor<T>::add_(TensorInterfacePtr other)
     {
 		// check tensor other type
-        if(other->dtype() != DataType::FLOAT)
-            throw std::runtime_error("expected type float tensor");
+        if(other->dtype() != this->dtype())
+            throw std::runtime_error("expected a tensor of the same type");
 		// check broadcast.shape = this.shape
         auto shape = broadcast_shape(this->size(), other->size());
         if(shape != this->size())
@@ -196,6 +207,14 @@ namespace traph
             apply_impl(0, _offset, f);
     }
 
+    template<typename T>
+	std::shared_ptr<TensorInterface> Tensor<T>::bmm(std::shared_ptr<TensorInterface> mat) const
+	{
+		auto right_matrix = std::dynamic_pointer_cast<Tensor<T>>(mat);
+		bmm_check(*this, *right_matrix);
+		return matmul_impl(*this, *right_matrix);
+	}
+
     template<typename T>
     TensorInterfacePtr Tensor<T>::clone() const
     {
@@ -220,6 +239,24 @@ namespace traph
         return std::shared_ptr<TensorBase<f32>>(new Tensor<f32>(_dimensions));
     }
 
+    template<typename T>
+    std::shared_ptr<TensorInterface> Tensor<T>::cummax(idx_type dim) const
+    {
+        return std::dynamic_pointer_cast<TensorInterface>(cummax_impl(*this, dim));
+    }
+
+    template<typename T>
+    std::shared_ptr<TensorInterface> Tensor<T>::cumprod(idx_type dim) const
+    {
+        return std::dynamic_pointer_cast<TensorInterface>(cumprod_impl(*this, dim));
+    }
+
+    template<typename T>
+    std::shared_ptr<TensorInterface> Tensor<T>::cumsum(idx_type dim) const
+    {
+        return std::dynamic_pointer_cast<TensorInterface>(cumsum_impl(*this, dim));
+    }
+
     template<typename T>
 	T* Tensor<T>::data_ptr()
     {
@@ -238,7 +275,7 @@ namespace traph
     template<typename T>
     DataType Tensor<T>::dtype() const
     {
-        return DataType::FLOAT;
+        return data_type(T());
     }
 
     template<typename T>
@@ -281,9 +318,7 @@ namespace traph
     template<typename T>
 	std::shared_ptr<TensorInterface> Tensor<T>::inverse() const
 	{
-		// FIX ME
-		// return std::dynamic_pointer_cast<TensorInterface>(inverse_impl(*this));
-		return nullptr;
+		return inverse_impl(*this);
 	}
 
     template<typename T>
@@ -335,8 +370,8 @@ namespace traph
     void Tensor<T>::mul_(std::shared_ptr<TensorInterface> other)
     {
         // check tensor other type
-        if(other->dtype() != DataType::FLOAT)
-            throw std::runtime_error("expected type float tensor");
+        if(other->dtype() != this->dtype())
+            throw std::runtime_error("expected a tensor of the same type");
 		// check broadcast.shape = this.shape
         auto shape = broadcast_shape(this->size(), other->size());
         if(shape != this->size())
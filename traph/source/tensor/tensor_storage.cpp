@@ -0,0 +1,25 @@
+#include <traph/tensor/tensor_storage.h>
+
+namespace traph
+{
+    namespace
+    {
+        thread_local std::shared_ptr<StorageArena> current_arena;
+    }
+
+    std::shared_ptr<StorageArena> StorageArena::current()
+    {
+        return current_arena;
+    }
+
+    StorageArenaGuard::StorageArenaGuard(std::shared_ptr<StorageArena> arena)
+        :_previous(current_arena)
+    {
+        current_arena = arena;
+    }
+
+    StorageArenaGuard::~StorageArenaGuard()
+    {
+        current_arena = _previous;
+    }
+}
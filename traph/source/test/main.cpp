@@ -130,6 +130,23 @@
 
 
 #include <traph/test/tensor.h>
+#include <traph/test/scan.h>
+#include <traph/test/gemm.h>
+#include <traph/test/quantization.h>
+#include <traph/test/linalg.h>
+#include <traph/test/einsum.h>
+#include <traph/test/conv.h>
+#include <traph/test/pooling.h>
+#include <traph/test/embedding.h>
+#include <traph/test/rnn.h>
+#include <traph/test/attention.h>
+#include <traph/test/kv_cache.h>
+#include <traph/test/activation.h>
+#include <traph/test/executor.h>
+#include <traph/test/grad_mode.h>
+#include <traph/test/capture.h>
+#include <traph/test/graph_optimizer.h>
+#include <traph/test/memory_plan.h>
 
 int main( int argc, char* argv[] )
 {